@@ -1,6 +1,96 @@
+#include <Core.hpp>
+#include <Movie.hpp>
+#include <Trace.hpp>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
-int main() {
-  std::cout << "Welcome to the EasyNES application" << std::endl;
+namespace {
+
+// Frames per second of the NTSC console
+constexpr double FRAME_RATE = 60.0988;
+
+void PrintUsage() {
+  std::cout << "Usage: EasyApp [options]\n"
+               "  --nestest-log <trace> <log>       Convert a cpu trace to the text log of nestest\n"
+               "  --replay <rom> <movie> <hashes>   Play a movie (.fm2) headless at full speed and write\n"
+               "                                    the hash of every frame, one per line"
+            << std::endl;
+}
+
+int Replay(const char *romPath, const char *moviePath, const char *hashesPath) {
+  using namespace EasyNes;
+
+  auto core = std::make_unique<Core>(CoreMemory::CONSOLE);
+  if (!core->Insert(Rom::Open(romPath))) {
+    std::cerr << "Can't run the rom " << romPath << std::endl;
+    return 2;
+  }
+
+  std::ifstream input(moviePath);
+  Movie         movie;
+  if (!input || !ReadMovie(input, movie)) {
+    std::cerr << "Can't read the movie " << moviePath << std::endl;
+    return 2;
+  }
+
+  // Both keep the timing exact, the hashes are the same without them
+  core->cpu.EnableRecompiler(true);
+  core->cpu.EnableIdleLoopSkip(true);
+  core->cpu.RST();
+
+  std::vector<u32> framebuffer(FRAMEBUFFER_SIZE);
+  auto             start  = std::chrono::steady_clock::now();
+  std::vector<u64> hashes = ReplayMovie(*core, movie, framebuffer.data());
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::ofstream output(hashesPath);
+  for (std::size_t frame = 0; frame < hashes.size(); frame++) {
+    // Up to 20 digits for the frame, the space, 16 for the hash, the newline
+    char line[40];
+    std::snprintf(line, sizeof(line), "%zu %016" PRIx64 "\n", frame, hashes[frame]);
+    output << line;
+  }
+  if (!output) {
+    std::cerr << "Can't write the hashes to " << hashesPath << std::endl;
+    return 2;
+  }
+
+  double fps = seconds > 0 ? hashes.size() / seconds : 0;
+  std::printf("%zu frames in %.3f s, %.1f frames/s (%.1fx real time)\n", hashes.size(), seconds, fps, fps / FRAME_RATE);
   return 0;
 }
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 1) {
+    std::cout << "Welcome to the EasyNES application" << std::endl;
+    return 0;
+  }
+
+  if (argc == 4 && !std::strcmp(argv[1], "--nestest-log")) {
+    std::ifstream trace(argv[2], std::ios::binary);
+    std::ofstream log(argv[3]);
+
+    if (!EasyNes::WriteNestestLog(trace, log)) {
+      std::cerr << "Can't read the trace " << argv[2] << std::endl;
+      return 2;
+    }
+    if (!log) {
+      std::cerr << "Can't write the log to " << argv[3] << std::endl;
+      return 2;
+    }
+    return 0;
+  }
+
+  if (argc == 5 && !std::strcmp(argv[1], "--replay")) {
+    return Replay(argv[2], argv[3], argv[4]);
+  }
+
+  PrintUsage();
+  return 2;
+}
@@ -0,0 +1,127 @@
+#include "Bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+
+namespace EasyNes {
+
+void BenchSuite::Add(std::string name, Workload workload) { m_Benchmarks.push_back({std::move(name), std::move(workload)}); }
+
+std::vector<BenchResult> BenchSuite::Run(const BenchOptions &options, std::ostream &log) const {
+  std::vector<BenchResult> results;
+
+  for (const Benchmark &benchmark : m_Benchmarks) {
+    if (benchmark.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+
+    // Warm up the caches and the lazy state of the emulator
+    benchmark.workload();
+
+    double best = 0;
+    Work   work;
+
+    for (int sample = 0; sample < options.samples; sample++) {
+      auto                                      start   = std::chrono::steady_clock::now();
+      Work                                      current = benchmark.workload();
+      std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+      if (sample == 0 || elapsed.count() < best) {
+        best = elapsed.count();
+        work = current;
+      }
+    }
+
+    BenchResult result;
+    result.name                      = benchmark.name;
+    result.nanosecondsPerInstruction = work.instructions ? best / work.instructions : 0;
+    // Cycles per nanosecond are gigahertz
+    result.megahertz = best > 0 ? work.cycles / best * 1000 : 0;
+
+    log << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(3)
+        << std::setw(10) << result.nanosecondsPerInstruction << " ns/instruction" << std::setw(12)
+        << result.megahertz << " MHz" << std::endl;
+
+    results.push_back(result);
+  }
+
+  return results;
+}
+
+void WriteReport(std::ostream &output, const std::vector<BenchResult> &results) {
+  // One result per line so the reports diff well
+  output << "{\n  \"version\": " << BENCH_REPORT_VERSION << ",\n  \"results\": [\n";
+
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const BenchResult &result = results[i];
+
+    output << "    {\"name\": \"" << result.name << "\", \"nanosecondsPerInstruction\": " << std::setprecision(6)
+           << result.nanosecondsPerInstruction << ", \"megahertz\": " << result.megahertz << "}"
+           << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+
+  output << "  ]\n}\n";
+}
+
+bool ReadReport(std::istream &input, std::vector<BenchResult> &results) {
+  std::string line;
+  bool        versioned = false;
+
+  while (std::getline(input, line)) {
+    int version;
+    if (std::sscanf(line.c_str(), " \"version\": %d", &version) == 1) {
+      if (version != BENCH_REPORT_VERSION) {
+        return false;
+      }
+      versioned = true;
+      continue;
+    }
+
+    char        name[256];
+    BenchResult result;
+    if (std::sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"nanosecondsPerInstruction\": %lf, \"megahertz\": %lf}",
+                    name, &result.nanosecondsPerInstruction, &result.megahertz) == 3) {
+      result.name = name;
+      results.push_back(result);
+    }
+  }
+
+  return versioned;
+}
+
+int CompareReports(std::ostream &output, const std::vector<BenchResult> &baseline,
+                   const std::vector<BenchResult> &results, double threshold) {
+  std::map<std::string, const BenchResult *> previous;
+  for (const BenchResult &result : baseline) {
+    previous[result.name] = &result;
+  }
+
+  int regressions = 0;
+
+  for (const BenchResult &result : results) {
+    auto found = previous.find(result.name);
+    if (found == previous.end() || found->second->megahertz <= 0) {
+      continue;
+    }
+
+    // Positive when the emulator got faster
+    double change = (result.megahertz / found->second->megahertz - 1) * 100;
+    bool   slower = change < -threshold;
+    regressions += slower;
+
+    output << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+           << std::setw(10) << found->second->megahertz << " -> " << std::setw(10) << result.megahertz << " MHz"
+           << std::showpos << std::setw(9) << change << "%" << std::noshowpos << (slower ? "  REGRESSION" : "")
+           << std::endl;
+  }
+
+  return regressions;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,69 @@
+#ifndef EASYNES_BENCH_HPP
+#define EASYNES_BENCH_HPP
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <Types.hpp>
+
+namespace EasyNes {
+
+// Bumped whenever the layout of the reports changes
+constexpr int BENCH_REPORT_VERSION = 1;
+
+// What one call of a workload emulated
+struct Work {
+  u64 cycles       = 0;
+  u64 instructions = 0;
+};
+
+using Workload = std::function<Work()>;
+
+struct BenchResult {
+  std::string name;
+  // Best sample, the host noise only ever makes a run slower
+  double nanosecondsPerInstruction = 0;
+  double megahertz                 = 0;
+};
+
+struct BenchOptions {
+  std::string filter;
+  int         samples = 10;
+};
+
+// Benchmarks are named "suite/name", the workloads keep their state between
+// the calls and are sized to run for about a millisecond
+class BenchSuite {
+ public:
+  void Add(std::string name, Workload workload);
+
+  std::vector<BenchResult> Run(const BenchOptions &options, std::ostream &log) const;
+
+ private:
+  struct Benchmark {
+    std::string name;
+    Workload    workload;
+  };
+
+  std::vector<Benchmark> m_Benchmarks;
+};
+
+void WriteReport(std::ostream &output, const std::vector<BenchResult> &results);
+// Only reads the reports written by WriteReport(), returns false on any other input
+bool ReadReport(std::istream &input, std::vector<BenchResult> &results);
+
+// Print the change of every benchmark found in the baseline, returns the
+// number of benchmarks slower than the threshold in percent
+int CompareReports(std::ostream &output, const std::vector<BenchResult> &baseline,
+                   const std::vector<BenchResult> &results, double threshold);
+
+void AddOpcodeBenchmarks(BenchSuite &suite);
+void AddProgramBenchmarks(BenchSuite &suite);
+// Frames of a game, returns false if the rom cannot be inserted
+bool AddRomBenchmark(BenchSuite &suite, const std::string &path);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_BENCH_HPP
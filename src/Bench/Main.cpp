@@ -0,0 +1,103 @@
+#include <Instrumentation.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "Bench.hpp"
+
+namespace {
+
+// Slowdown in percent reported as a regression
+constexpr double DEFAULT_THRESHOLD = 5.0;
+
+void PrintUsage() {
+  std::cout << "Usage: EasyBench [options]\n"
+               "  --filter <text>           Only run the benchmarks whose name contains the text\n"
+               "  --output <file>           Write the results as json\n"
+               "  --baseline <file>         Compare the results with a previous output\n"
+               "  --threshold <pct>         Slowdown reported as a regression, 5 by default\n"
+               "  --rom <file>              Also run the frames of a game\n"
+               "  --quick                   Take fewer samples\n"
+               "  --instrumentation <file>  Write the cpu counters at exit, needs EASYNES_INSTRUMENTATION\n"
+               "The exit code is 1 when a benchmark regressed against the baseline"
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  EasyNes::BenchOptions options;
+  std::string           output, baseline, rom;
+  double                threshold = DEFAULT_THRESHOLD;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--filter") && hasValue) {
+      options.filter = argv[++i];
+    } else if (!std::strcmp(argv[i], "--output") && hasValue) {
+      output = argv[++i];
+    } else if (!std::strcmp(argv[i], "--baseline") && hasValue) {
+      baseline = argv[++i];
+    } else if (!std::strcmp(argv[i], "--threshold") && hasValue) {
+      threshold = std::atof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--rom") && hasValue) {
+      rom = argv[++i];
+    } else if (!std::strcmp(argv[i], "--instrumentation") && hasValue) {
+      if (!EasyNes::DumpInstrumentationAtExit(argv[++i])) {
+        std::cerr << "The instrumentation is not compiled in" << std::endl;
+        return 2;
+      }
+    } else if (!std::strcmp(argv[i], "--quick")) {
+      options.samples = 3;
+    } else {
+      PrintUsage();
+      return 2;
+    }
+  }
+
+  // Read the baseline first, a typo should not cost a whole run
+  std::vector<EasyNes::BenchResult> previous;
+  if (!baseline.empty()) {
+    std::ifstream file(baseline);
+
+    if (!EasyNes::ReadReport(file, previous)) {
+      std::cerr << "Can't read the baseline " << baseline << std::endl;
+      return 2;
+    }
+  }
+
+  EasyNes::BenchSuite suite;
+  EasyNes::AddOpcodeBenchmarks(suite);
+  EasyNes::AddProgramBenchmarks(suite);
+
+  if (!rom.empty() && !EasyNes::AddRomBenchmark(suite, rom)) {
+    std::cerr << "Can't run the rom " << rom << std::endl;
+    return 2;
+  }
+
+  std::vector<EasyNes::BenchResult> results = suite.Run(options, std::cout);
+
+  if (!output.empty()) {
+    std::ofstream file(output);
+    EasyNes::WriteReport(file, results);
+
+    if (!file) {
+      std::cerr << "Can't write the results to " << output << std::endl;
+      return 2;
+    }
+  }
+
+  if (!baseline.empty()) {
+    std::cout << std::endl << "Compared with " << baseline << std::endl;
+
+    int regressions = EasyNes::CompareReports(std::cout, previous, results, threshold);
+    if (regressions > 0) {
+      std::cout << regressions << " benchmarks regressed by more than " << threshold << "%" << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,170 @@
+#include <Core.hpp>
+#include <Instructions.hpp>
+#include <memory>
+#include <utility>
+
+#include "Bench.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+// Cycles run by one call of a workload
+constexpr u64 BENCH_CYCLES = 100000;
+
+constexpr u16 PROGRAM         = 0x8000;
+constexpr u16 SUBROUTINE      = 0x9000;
+constexpr u16 INTERRUPT       = 0x9100;
+constexpr u8  ZERO_PAGE       = 0x10;
+constexpr u8  POINTER         = 0x20;
+constexpr u8  JUMP_POINTER    = 0x22;
+constexpr u16 ABSOLUTE        = 0x0300;
+// Copies of the instruction under test in one pass of the program
+constexpr int OPCODE_REPEATS = 100;
+// Minimal length in bytes of one pass of the addressing mode programs
+constexpr int MODE_PROGRAM_SIZE = 256;
+
+using Addressing = u16 (CPU::*)(u16);
+using Operation  = void (CPU::*)(u16);
+
+bool IsControlFlow(Operation operation) {
+  return operation == &CPU::JMP || operation == &CPU::JSR || operation == &CPU::RTS || operation == &CPU::RTI ||
+         operation == &CPU::BRK;
+}
+
+// The operand of every mode points to the same few bytes, the indexed modes
+// stay in place as long as X and Y are not loaded
+void EmitInstruction(std::vector<u8> &program, u8 opcode) {
+  Addressing addressing = INSTRUCTION_SET[opcode].addressing;
+  program.push_back(opcode);
+
+  if (addressing == &CPU::IMM) {
+    program.push_back(0x01);
+  } else if (addressing == &CPU::ZER || addressing == &CPU::ZPX || addressing == &CPU::ZPY) {
+    program.push_back(ZERO_PAGE);
+  } else if (addressing == &CPU::IDX || addressing == &CPU::IDY) {
+    program.push_back(POINTER);
+  } else if (addressing == &CPU::REL) {
+    // Taken or not, the branch lands on the next instruction
+    program.push_back(0x00);
+  } else if (addressing == &CPU::IND) {
+    program.push_back(JUMP_POINTER);
+    program.push_back(0x00);
+  } else if (opcode == 0x20) {
+    program.push_back(SUBROUTINE & 0xFF);
+    program.push_back(SUBROUTINE >> 8);
+  } else if (addressing == &CPU::ABS || addressing == &CPU::ABX || addressing == &CPU::ABY) {
+    program.push_back(ABSOLUTE & 0xFF);
+    program.push_back(ABSOLUTE >> 8);
+  } else if (opcode == 0x00) {
+    // Padding byte skipped by the return address
+    program.push_back(0x00);
+  }
+}
+
+std::shared_ptr<Core> MakeCore(const std::vector<u8> &program) {
+  auto core = std::make_shared<Core>();
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core->ram[PROGRAM + i] = program[i];
+  }
+
+  core->ram[SUBROUTINE]       = 0x60;  // RTS
+  core->ram[INTERRUPT]        = 0x40;  // RTI
+  core->ram[POINTER]          = ABSOLUTE & 0xFF;
+  core->ram[POINTER + 1]      = ABSOLUTE >> 8;
+  core->ram[JUMP_POINTER]     = PROGRAM & 0xFF;
+  core->ram[JUMP_POINTER + 1] = PROGRAM >> 8;
+  core->ram[RST_VECTOR]       = PROGRAM & 0xFF;
+  core->ram[RST_VECTOR + 1]   = PROGRAM >> 8;
+  core->ram[IRQ_VECTOR]       = INTERRUPT & 0xFF;
+  core->ram[IRQ_VECTOR + 1]   = INTERRUPT >> 8;
+  core->cpu.RST();
+  return core;
+}
+
+// Loop back to the start of the program once the pass is over
+void EmitLoop(std::vector<u8> &program) {
+  program.insert(program.end(), {0x4C, PROGRAM & 0xFF, PROGRAM >> 8});
+}
+
+Workload RunProgram(const std::vector<u8> &program) {
+  std::shared_ptr<Core> core = MakeCore(program);
+
+  return [core] {
+    u64  start = core->cpu.GetElapsedInstructions();
+    Work work;
+    work.cycles       = core->RunCycles(BENCH_CYCLES);
+    work.instructions = core->cpu.GetElapsedInstructions() - start;
+    return work;
+  };
+}
+
+}  // namespace
+
+void AddOpcodeBenchmarks(BenchSuite &suite) {
+  static const char HEX[] = "0123456789ABCDEF";
+
+  for (int opcode = 0; opcode < 256; opcode++) {
+    const Instruction &instruction = INSTRUCTION_SET[opcode];
+    if (instruction.operation == &CPU::ILL) {
+      continue;
+    }
+
+    // The jumps loop on themselves, the returns are measured with their call
+    std::vector<u8> program;
+    if (instruction.operation != &CPU::JMP) {
+      u8 emitted = instruction.operation == &CPU::RTS ? 0x20 : instruction.operation == &CPU::RTI ? 0x00 : opcode;
+
+      for (int i = 0; i < OPCODE_REPEATS; i++) {
+        EmitInstruction(program, emitted);
+      }
+    }
+
+    if (opcode != 0x6C) {
+      EmitLoop(program);
+    } else {
+      EmitInstruction(program, opcode);
+    }
+
+    std::string name = "opcode/";
+    name += MNEMONIC(opcode);
+    name += "_";
+    name += ADDRESSING_NAME(opcode);
+    name += {'_', HEX[opcode >> 4], HEX[opcode & 0xF]};
+
+    suite.Add(name, RunProgram(program));
+  }
+
+  // Every instruction of a mode one after the other, the loads of the index
+  // registers would move the operands of the indexed modes
+  for (const auto &[addressing, name] : ADDRESSING_NAMES) {
+    std::vector<u8> opcodes;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+      const Instruction &instruction = INSTRUCTION_SET[opcode];
+
+      if (instruction.addressing == addressing && instruction.operation != &CPU::ILL &&
+          !IsControlFlow(instruction.operation) && instruction.operation != &CPU::LDX &&
+          instruction.operation != &CPU::LDY) {
+        opcodes.push_back(opcode);
+      }
+    }
+
+    if (opcodes.empty()) {
+      continue;
+    }
+
+    std::vector<u8> program;
+    while (program.size() < MODE_PROGRAM_SIZE) {
+      for (u8 opcode : opcodes) {
+        EmitInstruction(program, opcode);
+      }
+    }
+    EmitLoop(program);
+
+    suite.Add(std::string("mode/") + name, RunProgram(program));
+  }
+}
+
+}  // namespace EasyNes
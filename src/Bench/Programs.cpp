@@ -0,0 +1,391 @@
+#include <Core.hpp>
+#include <Lockstep.hpp>
+#include <Rewind.hpp>
+#include <Runner.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "Bench.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+// Cycles run by one call of the single core workloads
+constexpr u64 BENCH_CYCLES = 100000;
+constexpr u32 INSTANCES    = 256;
+constexpr u32 FRAMES       = 2;
+
+// Busy loop over a table, a mix of loads, stores and branches
+const std::vector<u8> TABLE_LOOP{
+    0xA2, 0x00,        // X = 0x00
+    0xBD, 0x00, 0x03,  // A = ram[0x0300 + X]
+    0x69, 0x03,        // A += 0x03
+    0x9D, 0x00, 0x03,  // ram[0x0300 + X] = A
+    0xE8,              // X++
+    0xD0, 0xF5,        // if X != 0 goto 0x8002
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+// The table loop with the instructions translated by the recompiler
+const std::vector<u8> XOR_LOOP{
+    0xA2, 0x00,        // X = 0x00
+    0xBD, 0x00, 0x03,  // A = ram[0x0300 + X]
+    0x49, 0x5A,        // A ^= 0x5A
+    0x9D, 0x00, 0x03,  // ram[0x0300 + X] = A
+    0xE8,              // X++
+    0xD0, 0xF5,        // if X != 0 goto 0x8002
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+// Copy a page through indirect pointers
+const std::vector<u8> MEMORY_COPY{
+    0xA9, 0x00,        // A = 0x00
+    0x85, 0x20,        // ram[0x20] = A
+    0x85, 0x22,        // ram[0x22] = A
+    0xA9, 0x03,        // A = 0x03
+    0x85, 0x21,        // ram[0x21] = A
+    0xA9, 0x04,        // A = 0x04
+    0x85, 0x23,        // ram[0x23] = A
+    0xA0, 0x00,        // Y = 0x00
+    0xB1, 0x20,        // A = ram[ram[0x20] + Y]
+    0x91, 0x22,        // ram[ram[0x22] + Y] = A
+    0xC8,              // Y++
+    0xD0, 0xF9,        // if Y != 0 goto 0x8010
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+// Straight line code without any branch, the pattern is repeated over the
+// whole program
+const std::vector<u8> STRAIGHT_LINE{
+    0xA9, 0x10,        // A = 0x10
+    0x85, 0x20,        // ram[0x20] = A
+    0x65, 0x20,        // A += ram[0x20]
+    0xE6, 0x21,        // ram[0x21]++
+    0xA4, 0x21,        // Y = ram[0x21]
+    0xC8,              // Y++
+    0xAA,              // X = A
+    0x29, 0x7F,        // A &= 0x7F
+    0x1D, 0x00, 0x03,  // A |= ram[0x0300 + X]
+    0x55, 0x30,        // A ^= ram[0x30 + X]
+    0xEA,              // NOP
+};
+
+// Arithmetic, shifts and comparisons setting the flags all the time, only the
+// branches read them
+const std::vector<u8> FLAG_LOOP{
+    0xA0, 0x00,        // Y = 0x00
+    0x98,              // A = Y
+    0x69, 0x35,        // A += 0x35
+    0x0A,              // A <<= 1
+    0x49, 0xA5,        // A ^= 0xA5
+    0x6A,              // A = A >> 1 | C << 7
+    0xC9, 0x40,        // compare A with 0x40
+    0xE9, 0x11,        // A -= 0x11
+    0xAA,              // X = A
+    0xE8,              // X++
+    0xC0, 0x80,        // compare Y with 0x80
+    0xC8,              // Y++
+    0xD0, 0xEE,        // if Y != 0 goto 0x8002
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+// The same loop on every instance, each one starts from another table
+const std::vector<u8> LOCKSTEP_LOOP{
+    0xA2, 0x00,        // X = 0x00
+    0xA5, 0x10,        // A = ram[0x10]
+    0x49, 0x5A,        // A ^= 0x5A
+    0x85, 0x10,        // ram[0x10] = A
+    0x29, 0x0F,        // A &= 0x0F
+    0x8D, 0x00, 0x03,  // ram[0x0300] = A
+    0xE8,              // X++
+    0xD0, 0xF2,        // if X != 0 goto 0x8002
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+// Waits for the vertical blank then works a little, most of the frame is spent
+// polling the status
+const std::vector<u8> VBLANK_WAIT{
+    0x2C, 0x02, 0x20,  // test ppu[0x2002]
+    0x10, 0xFB,        // if positive goto 0x8000
+    0xA2, 0x40,        // X = 0x40
+    0xCA,              // X--
+    0xD0, 0xFD,        // if X != 0 goto 0x8007
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+std::unique_ptr<Core> MakeCore(const std::vector<u8> &program, u16 size = 0) {
+  auto core = std::make_unique<Core>();
+
+  for (u32 i = 0; i < std::max<u32>(size, program.size()); i++) {
+    core->ram[0x8000 + i] = program[i % program.size()];
+  }
+
+  core->ram[RST_VECTOR]     = 0x00;
+  core->ram[RST_VECTOR + 1] = 0x80;
+  core->cpu.RST();
+  return core;
+}
+
+Workload RunCore(std::shared_ptr<Core> core) {
+  return [core] {
+    u64  start = core->cpu.GetElapsedInstructions();
+    Work work;
+    work.cycles       = core->RunCycles(BENCH_CYCLES);
+    work.instructions = core->cpu.GetElapsedInstructions() - start;
+    return work;
+  };
+}
+
+// Instructions executed one by one with the policy, without the scheduler
+template <typename Accuracy>
+Workload RunExecute(std::shared_ptr<Core> core) {
+  return [core] {
+    Work work;
+    while (work.cycles < BENCH_CYCLES) {
+      work.cycles += core->cpu.Execute<Accuracy>();
+      work.instructions++;
+    }
+    return work;
+  };
+}
+
+Workload RunStraightLine() {
+  // The pattern runs until the end of the ram, the reset starts it again
+  u16                   size = 0x7000 / STRAIGHT_LINE.size() * STRAIGHT_LINE.size();
+  std::shared_ptr<Core> core = MakeCore(STRAIGHT_LINE, size);
+
+  return [core, size] {
+    Work work;
+    while (work.cycles < BENCH_CYCLES) {
+      core->cpu.RST();
+
+      u64 start = core->cpu.GetElapsedInstructions();
+      work.cycles += core->RunUntil(0x8000 + size);
+      work.instructions += core->cpu.GetElapsedInstructions() - start;
+    }
+    return work;
+  };
+}
+
+Workload RunLockstep() {
+  auto lockstep = std::make_shared<LockstepCPU>(INSTANCES);
+
+  for (u32 instance = 0; instance < INSTANCES; instance++) {
+    for (u32 i = 0; i < LOCKSTEP_LOOP.size(); i++) {
+      lockstep->Write(instance, 0x8000 + i, LOCKSTEP_LOOP[i]);
+    }
+
+    lockstep->Write(instance, 0x10, instance);
+    lockstep->Write(instance, RST_VECTOR, 0x00);
+    lockstep->Write(instance, RST_VECTOR + 1, 0x80);
+  }
+  lockstep->RST();
+
+  return [lockstep] {
+    Work work;
+    for (u32 instance = 0; instance < INSTANCES; instance++) {
+      CPUState state = lockstep->GetState(instance);
+      work.cycles -= state.elapsedCycles;
+      work.instructions -= state.elapsedInstructions;
+    }
+
+    lockstep->RunCycles(BENCH_CYCLES / 10);
+
+    for (u32 instance = 0; instance < INSTANCES; instance++) {
+      CPUState state = lockstep->GetState(instance);
+      work.cycles += state.elapsedCycles;
+      work.instructions += state.elapsedInstructions;
+    }
+    return work;
+  };
+}
+
+// Frames of the table loop with the background and 64 sprites on screen, the
+// pictures are drawn by the render thread of a pipeline or on the cpu thread.
+// The rewind takes a snapshot in front of every frame
+Workload RunRender(bool pipelined, bool rewound) {
+  std::vector<u8> image(INES_HEADER_SIZE + PRG_BANK_SIZE + CHR_BANK_SIZE);
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+  image[5] = 1;
+
+  u8 *prg = image.data() + INES_HEADER_SIZE;
+  std::copy(TABLE_LOOP.begin(), TABLE_LOOP.end(), prg);
+  prg[RST_VECTOR - 0xC000 + 1] = 0x80;
+
+  // Every tile and every row is different
+  for (u32 i = 0; i < CHR_BANK_SIZE; i++) {
+    prg[PRG_BANK_SIZE + i] = i * 0x9D + (i >> 4);
+  }
+
+  auto core = std::make_shared<Core>();
+  auto rom  = Rom::Parse(image.data(), image.size());
+  if (!core->Insert(rom)) {
+    return [] { return Work{}; };
+  }
+
+  auto write = [&](u16 address, u8 value) {
+    core->bus.Write(0x2006, address >> 8);
+    core->bus.Write(0x2006, address & 0xFF);
+    core->bus.Write(0x2007, value);
+  };
+
+  for (u16 i = 0; i < 0x800; i++) {
+    write(0x2000 + i, i * 7);
+  }
+  for (u16 i = 0; i < PALETTE_SIZE; i++) {
+    write(0x3F00 + i, i * 3);
+  }
+
+  // Sprites spread over the screen, up to eight on some scanlines
+  core->bus.Write(0x2003, 0x00);
+  for (u32 sprite = 0; sprite < 64; sprite++) {
+    core->bus.Write(0x2004, sprite * 29 % 224);
+    core->bus.Write(0x2004, sprite);
+    core->bus.Write(0x2004, sprite & 0xE3);
+    core->bus.Write(0x2004, sprite * 53);
+  }
+
+  core->bus.Write(0x2005, 0x03);
+  core->bus.Write(0x2005, 0x00);
+  core->bus.Write(0x2000, 0x08);
+  core->bus.Write(0x2001, 0x1E);
+  core->cpu.RST();
+
+  auto frame = std::make_shared<std::vector<u32>>(FRAMEBUFFER_SIZE);
+  core->ppu.EnablePipeline(pipelined);
+  core->ppu.SetFramebuffer(frame->data());
+
+  // The rewind holds the core, it is destroyed first
+  std::shared_ptr<Rewind> rewind;
+  if (rewound) {
+    rewind = std::shared_ptr<Rewind>(new Rewind(core.get()), [core](Rewind *rewind) { delete rewind; });
+  }
+
+  return [core, frame, rewind] {
+    if (rewind) {
+      rewind->Snapshot();
+    }
+
+    u64  start = core->cpu.GetElapsedInstructions();
+    Work work;
+    work.cycles       = core->RunFrame();
+    work.instructions = core->cpu.GetElapsedInstructions() - start;
+    return work;
+  };
+}
+
+// Frames of the vertical blank wait, through the ppu of a cartridge
+Workload RunVblankWait(bool skip) {
+  std::vector<u8> image(INES_HEADER_SIZE + PRG_BANK_SIZE);
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+
+  u8 *prg = image.data() + INES_HEADER_SIZE;
+  std::copy(VBLANK_WAIT.begin(), VBLANK_WAIT.end(), prg);
+  prg[RST_VECTOR - 0xC000 + 1] = 0x80;
+
+  auto core = std::make_shared<Core>();
+  if (!core->Insert(Rom::Parse(image.data(), image.size()))) {
+    return [] { return Work{}; };
+  }
+  core->cpu.EnableIdleLoopSkip(skip);
+  core->cpu.RST();
+
+  return [core] {
+    u64  start = core->cpu.GetElapsedInstructions();
+    Work work;
+    work.cycles       = core->RunFrame();
+    work.instructions = core->cpu.GetElapsedInstructions() - start;
+    return work;
+  };
+}
+
+// The table loop writing a trace of every instruction, the trace runs for the
+// whole benchmark and the writer thread keeps up with it
+Workload RunTraced() {
+  std::shared_ptr<Core> core = MakeCore(TABLE_LOOP);
+  if (!core->cpu.StartTrace((std::filesystem::temp_directory_path() / "easynes_bench.trace").string())) {
+    return [] { return Work{}; };
+  }
+
+  return RunCore(core);
+}
+
+// Many instances spread over every hardware thread
+Workload RunInstances() {
+  auto runner = std::make_shared<Runner>();
+
+  return [runner] {
+    std::vector<RunJob> jobs(INSTANCES);
+    for (RunJob &job : jobs) {
+      job.factory = [] { return MakeCore(TABLE_LOOP); };
+      job.cycles  = FRAMES * CYCLES_PER_FRAME;
+    }
+
+    Work work;
+    for (const RunResult &result : runner->Run(std::move(jobs))) {
+      work.cycles += result.cycles;
+      work.instructions += result.instructions;
+    }
+    return work;
+  };
+}
+
+}  // namespace
+
+bool AddRomBenchmark(BenchSuite &suite, const std::string &path) {
+  auto core = std::make_shared<Core>(CoreMemory::CONSOLE);
+  if (!core->Insert(Rom::Open(path))) {
+    return false;
+  }
+  core->cpu.RST();
+
+  auto frame = std::make_shared<std::vector<u32>>(FRAMEBUFFER_SIZE);
+  core->ppu.SetFramebuffer(frame->data());
+
+  // One frame of the game per call
+  suite.Add("rom/" + std::filesystem::path(path).filename().string(), [core, frame] {
+    u64  start = core->cpu.GetElapsedInstructions();
+    Work work;
+    work.cycles       = core->RunFrame();
+    work.instructions = core->cpu.GetElapsedInstructions() - start;
+    return work;
+  });
+  return true;
+}
+
+void AddProgramBenchmarks(BenchSuite &suite) {
+  suite.Add("program/straight_line", RunStraightLine());
+  suite.Add("program/table_loop", RunCore(MakeCore(TABLE_LOOP)));
+  suite.Add("program/memory_copy", RunCore(MakeCore(MEMORY_COPY)));
+  suite.Add("program/flag_loop", RunCore(MakeCore(FLAG_LOOP)));
+
+  suite.Add("program/table_loop_instructions", RunExecute<InstructionAccuracy>(MakeCore(TABLE_LOOP)));
+  suite.Add("program/table_loop_cycles", RunExecute<CycleAccuracy>(MakeCore(TABLE_LOOP)));
+
+  suite.Add("program/table_loop_traced", RunTraced());
+
+  std::shared_ptr<Core> profiled = MakeCore(TABLE_LOOP);
+  profiled->cpu.EnableProfiler(true);
+  suite.Add("program/table_loop_profiled", RunCore(profiled));
+
+  suite.Add("program/xor_loop", RunCore(MakeCore(XOR_LOOP)));
+
+  std::shared_ptr<Core> recompiled = MakeCore(XOR_LOOP);
+  recompiled->cpu.EnableRecompiler(true);
+  suite.Add("program/xor_loop_recompiled", RunCore(recompiled));
+
+  suite.Add("program/render", RunRender(false, false));
+  suite.Add("program/render_pipelined", RunRender(true, false));
+  suite.Add("program/render_rewound", RunRender(false, true));
+  suite.Add("program/vblank_wait", RunVblankWait(false));
+  suite.Add("program/vblank_wait_skipped", RunVblankWait(true));
+  suite.Add("program/lockstep", RunLockstep());
+  suite.Add("program/instances", RunInstances());
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,595 @@
+#include "APU.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u8 LENGTHS[32] = {10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+                            12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+constexpr u8 DUTY_CYCLES[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+};
+
+constexpr u8 TRIANGLE_SEQUENCE[32] = {15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+                                      0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15};
+
+// Periods of the noise and of the sample channel, in cpu cycles
+constexpr u16 NOISE_PERIODS[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+constexpr u16 DMC_PERIODS[16]   = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+
+// Cpu cycle of each step of the frame counter in its sequences of four and
+// five steps, and length of the sequences
+constexpr u32 FRAME_STEPS[2][5]      = {{7457, 14913, 22371, 29829, 0}, {7457, 14913, 22371, 29829, 37281}};
+constexpr u32 FRAME_SEQUENCES[2]     = {29830, 37282};
+constexpr u8  FRAME_STEP_COUNTS[2]   = {4, 5};
+
+// Linear approximation of the mixer of the console, per step of the levels
+constexpr float PULSE_SCALE    = 0.00752f;
+constexpr float TRIANGLE_SCALE = 0.00851f;
+constexpr float NOISE_SCALE    = 0.00494f;
+constexpr float DMC_SCALE      = 0.00335f;
+
+enum Channel : u8 { PULSE_1, PULSE_2, TRIANGLE, NOISE, DMC };
+
+// Cycles of a channel timer over the cycles, step(time) is called at each one.
+// timer is the time of the next one, at least 1
+template <typename Step>
+void RunTimer(u32 &timer, u32 period, u32 cycles, Step step) {
+  u32 time = timer;
+
+  for (; time <= cycles; time += period) {
+    step(time);
+  }
+  timer = time - cycles;
+}
+
+}  // namespace
+
+void APU::Envelope::Clock() {
+  if (start) {
+    start   = false;
+    decay   = 15;
+    divider = volume;
+  } else if (divider == 0) {
+    divider = volume;
+    if (decay > 0) {
+      decay--;
+    } else if (loop) {
+      decay = 15;
+    }
+  } else {
+    divider--;
+  }
+}
+
+u16 APU::Pulse::GetTarget() const {
+  u16 change = period >> sweepShift;
+
+  if (!sweepNegate) {
+    return period + change;
+  }
+  return std::max(period - change - first, 0);
+}
+
+bool APU::Pulse::IsMuted() const { return period < 8 || GetTarget() > 0x7FF; }
+
+u8 APU::Pulse::GetLevel() const {
+  return length > 0 && !IsMuted() && DUTY_CYCLES[duty][step] ? envelope.GetVolume() : 0;
+}
+
+void APU::Pulse::ClockSweep() {
+  if (sweepDivider == 0 && sweepEnabled && sweepShift > 0 && !IsMuted()) {
+    period = GetTarget();
+  }
+
+  if (sweepDivider == 0 || sweepReload) {
+    sweepDivider = sweepPeriod;
+    sweepReload  = false;
+  } else {
+    sweepDivider--;
+  }
+}
+
+u8 APU::Triangle::GetLevel() const { return TRIANGLE_SEQUENCE[step]; }
+
+u8 APU::Noise::GetLevel() const { return length > 0 && !(shift & 1) ? envelope.GetVolume() : 0; }
+
+APU::APU(Core *core) : m_Core(core) { Reset(); }
+
+APU::~APU() {}
+
+void APU::Reset() {
+  m_Pulses[0]       = {};
+  m_Pulses[1]       = {};
+  m_Pulses[0].first = true;
+  m_Triangle        = {};
+  m_Noise           = {};
+  m_Dmc             = {};
+
+  for (Pulse &pulse : m_Pulses) {
+    pulse.timer = 2;
+  }
+  m_Triangle.timer = 1;
+  m_Noise.timer    = NOISE_PERIODS[0];
+
+  m_Enabled    = 0;
+  m_FiveSteps  = false;
+  m_IrqInhibit = false;
+  m_FrameIrq   = false;
+  m_DmcIrq     = false;
+  m_IrqLine    = false;
+  m_FrameStep  = 0;
+  m_FrameTimer = FRAME_STEPS[0][0];
+
+  UpdateLevels();
+}
+
+void APU::EnableOutput(bool enabled, u32 sampleRate) {
+  if (!enabled) {
+    m_Output.reset();
+    m_Samples.reset();
+    return;
+  }
+
+  m_Output = std::make_unique<AudioBuffer>(sampleRate);
+  if (!m_Samples) {
+    m_Samples = std::make_unique<AudioRing>();
+  }
+
+  // The levels start from silence in the new buffer
+  m_BatchCycle = 0;
+  std::fill(std::begin(m_Levels), std::end(m_Levels), 0);
+  UpdateLevels();
+}
+
+void APU::Run(u64 cycles) {
+  while (cycles > 0) {
+    u32 step = std::min<u64>(cycles, m_FrameTimer);
+    if (m_Dmc.timer > 0) {
+      step = std::min(step, m_Dmc.timer);
+    }
+    if (m_Output) {
+      step = std::min(step, AUDIO_BATCH_CYCLES - m_BatchCycle);
+      Synthesize(step);
+    }
+
+    cycles -= step;
+    m_FrameTimer -= step;
+    bool sampled = m_Dmc.timer > 0 && (m_Dmc.timer -= step) == 0;
+
+    if (sampled) {
+      ClockDmc();
+    }
+    bool stepped = m_FrameTimer == 0;
+
+    if (stepped) {
+      ClockFrame();
+    }
+    // The steps of the frame counter are a quarter of a frame apart, the
+    // batches only end on their own when they fill up
+    if (m_Output && (stepped || m_BatchCycle == AUDIO_BATCH_CYCLES)) {
+      EndBatch();
+    }
+  }
+}
+
+void APU::EndFrame() {
+  if (m_Output && m_BatchCycle > 0) {
+    EndBatch();
+  }
+}
+
+u64 APU::GetCyclesToEvent() const {
+  u64 cycles = std::numeric_limits<u64>::max();
+
+  // The interrupt comes with the last step of the sequence of four
+  if (!m_FiveSteps && !m_IrqInhibit) {
+    cycles = m_FrameTimer + FRAME_STEPS[0][3] - FRAME_STEPS[0][m_FrameStep];
+  }
+  // The next byte is read once the bits of the current one are out
+  if (m_Dmc.timer > 0 && m_Dmc.remaining > 0) {
+    cycles = std::min<u64>(cycles, m_Dmc.timer + (m_Dmc.bits - 1) * DMC_PERIODS[m_Dmc.rate]);
+  }
+
+  return cycles;
+}
+
+u8 APU::ReadStatus() {
+  u8 status = 0;
+
+  for (u8 i = 0; i < 2; i++) {
+    status |= (m_Pulses[i].length > 0) << i;
+  }
+  status |= (m_Triangle.length > 0) << 2;
+  status |= (m_Noise.length > 0) << 3;
+  status |= (m_Dmc.remaining > 0) << 4;
+  status |= m_FrameIrq << 6;
+  status |= m_DmcIrq << 7;
+
+  m_FrameIrq = false;
+  SetIrq();
+  return status;
+}
+
+void APU::WriteRegister(u16 address, u8 value) {
+  Pulse &pulse = m_Pulses[(address >> 2) & 1];
+
+  switch (address) {
+    case 0x4000:
+    case 0x4004:
+      pulse.duty              = value >> 6;
+      pulse.envelope.loop     = value & 0x20;
+      pulse.envelope.constant = value & 0x10;
+      pulse.envelope.volume   = value & 0x0F;
+      break;
+    case 0x4001:
+    case 0x4005:
+      pulse.sweepEnabled = value & 0x80;
+      pulse.sweepPeriod  = (value >> 4) & 0x07;
+      pulse.sweepNegate  = value & 0x08;
+      pulse.sweepShift   = value & 0x07;
+      pulse.sweepReload  = true;
+      break;
+    case 0x4002:
+    case 0x4006:
+      pulse.period = (pulse.period & 0x700) | value;
+      break;
+    case 0x4003:
+    case 0x4007:
+      pulse.period = (pulse.period & 0xFF) | ((value & 0x07) << 8);
+      if (m_Enabled & (1 << ((address >> 2) & 1))) {
+        pulse.length = LENGTHS[value >> 3];
+      }
+      pulse.step           = 0;
+      pulse.envelope.start = true;
+      break;
+    case 0x4008:
+      m_Triangle.halt         = value & 0x80;
+      m_Triangle.linearPeriod = value & 0x7F;
+      break;
+    case 0x400A:
+      m_Triangle.period = (m_Triangle.period & 0x700) | value;
+      break;
+    case 0x400B:
+      m_Triangle.period = (m_Triangle.period & 0xFF) | ((value & 0x07) << 8);
+      if (m_Enabled & (1 << TRIANGLE)) {
+        m_Triangle.length = LENGTHS[value >> 3];
+      }
+      m_Triangle.linearReload = true;
+      break;
+    case 0x400C:
+      m_Noise.envelope.loop     = value & 0x20;
+      m_Noise.envelope.constant = value & 0x10;
+      m_Noise.envelope.volume   = value & 0x0F;
+      break;
+    case 0x400E:
+      m_Noise.mode = value & 0x80;
+      m_Noise.rate = value & 0x0F;
+      break;
+    case 0x400F:
+      if (m_Enabled & (1 << NOISE)) {
+        m_Noise.length = LENGTHS[value >> 3];
+      }
+      m_Noise.envelope.start = true;
+      break;
+    case 0x4010:
+      m_Dmc.irqEnabled = value & 0x80;
+      m_Dmc.loop       = value & 0x40;
+      m_Dmc.rate       = value & 0x0F;
+      if (!m_Dmc.irqEnabled) {
+        m_DmcIrq = false;
+        SetIrq();
+      }
+      break;
+    case 0x4011:
+      m_Dmc.level = value & 0x7F;
+      break;
+    case 0x4012:
+      m_Dmc.start = 0xC000 + value * 64;
+      break;
+    case 0x4013:
+      m_Dmc.size = value * 16 + 1;
+      break;
+    case APU_STATUS:
+      m_Enabled = value & 0x1F;
+      for (u8 i = 0; i < 2; i++) {
+        if (!(value & (1 << i))) {
+          m_Pulses[i].length = 0;
+        }
+      }
+      if (!(value & (1 << TRIANGLE))) {
+        m_Triangle.length = 0;
+      }
+      if (!(value & (1 << NOISE))) {
+        m_Noise.length = 0;
+      }
+
+      m_DmcIrq = false;
+      SetIrq();
+      if (!(value & (1 << DMC))) {
+        m_Dmc.remaining = 0;
+      } else if (m_Dmc.remaining == 0) {
+        StartSample();
+        FetchSample();
+        if (m_Dmc.timer == 0) {
+          m_Dmc.timer = DMC_PERIODS[m_Dmc.rate];
+        }
+      }
+      break;
+    case APU_FRAME_COUNTER:
+      m_FiveSteps  = value & 0x80;
+      m_IrqInhibit = value & 0x40;
+      if (m_IrqInhibit) {
+        m_FrameIrq = false;
+        SetIrq();
+      }
+
+      // The sequence restarts, the sequence of five clocks everything at once
+      m_FrameStep  = 0;
+      m_FrameTimer = FRAME_STEPS[m_FiveSteps][0];
+      if (m_FiveSteps) {
+        ClockQuarter();
+        ClockHalf();
+      }
+      break;
+  }
+
+  UpdateLevels();
+}
+
+template <typename Visitor>
+void APU::VisitState(Visitor &&visit) {
+  for (Pulse &pulse : m_Pulses) {
+    visit(pulse.envelope.start), visit(pulse.envelope.loop), visit(pulse.envelope.constant);
+    visit(pulse.envelope.volume), visit(pulse.envelope.divider), visit(pulse.envelope.decay);
+    visit(pulse.duty), visit(pulse.length);
+    visit(pulse.sweepEnabled), visit(pulse.sweepNegate), visit(pulse.sweepReload);
+    visit(pulse.sweepPeriod), visit(pulse.sweepShift), visit(pulse.sweepDivider);
+    visit(pulse.period);
+  }
+
+  visit(m_Triangle.halt), visit(m_Triangle.linearReload), visit(m_Triangle.linearPeriod);
+  visit(m_Triangle.linearCounter), visit(m_Triangle.length), visit(m_Triangle.period);
+
+  visit(m_Noise.envelope.start), visit(m_Noise.envelope.loop), visit(m_Noise.envelope.constant);
+  visit(m_Noise.envelope.volume), visit(m_Noise.envelope.divider), visit(m_Noise.envelope.decay);
+  visit(m_Noise.mode), visit(m_Noise.length), visit(m_Noise.rate);
+
+  visit(m_Dmc.irqEnabled), visit(m_Dmc.loop), visit(m_Dmc.rate), visit(m_Dmc.level);
+  visit(m_Dmc.start), visit(m_Dmc.size), visit(m_Dmc.address), visit(m_Dmc.remaining);
+  visit(m_Dmc.buffer), visit(m_Dmc.empty), visit(m_Dmc.shift), visit(m_Dmc.bits), visit(m_Dmc.silent);
+  visit(m_Dmc.timer);
+
+  visit(m_Enabled), visit(m_FiveSteps), visit(m_IrqInhibit), visit(m_FrameIrq), visit(m_DmcIrq);
+  visit(m_IrqLine), visit(m_FrameStep), visit(m_FrameTimer);
+}
+
+std::vector<u8> APU::SaveState() const {
+  std::vector<u8> state;
+
+  // Little endian whatever the host is, the visitor only reads the fields
+  const_cast<APU *>(this)->VisitState([&](auto &field) {
+    for (std::size_t i = 0; i < sizeof(field); i++) {
+      state.push_back(static_cast<u64>(field) >> (8 * i));
+    }
+  });
+
+  return state;
+}
+
+bool APU::LoadState(const std::vector<u8> &state) {
+  std::vector<u8> previous = SaveState();
+  if (state.size() != previous.size()) {
+    return false;
+  }
+
+  auto input = state.begin();
+  VisitState([&](auto &field) {
+    u64 value = 0;
+    for (std::size_t i = 0; i < sizeof(field); i++) {
+      value |= static_cast<u64>(*input++) << (8 * i);
+    }
+    field = static_cast<std::remove_reference_t<decltype(field)>>(value);
+  });
+
+  // The indices into the tables and the timers, the timer of the frame
+  // counter is never 0
+  bool valid = m_FrameStep < FRAME_STEP_COUNTS[m_FiveSteps] && m_FrameTimer > 0 && m_Noise.rate < 16 &&
+               m_Dmc.rate < 16 && m_Dmc.bits > 0 && m_Dmc.bits <= 8;
+  for (const Pulse &pulse : m_Pulses) {
+    valid = valid && pulse.duty < 4;
+  }
+
+  if (!valid) {
+    LoadState(previous);
+    return false;
+  }
+
+  UpdateLevels();
+  return true;
+}
+
+void APU::Synthesize(u32 cycles) {
+  for (u8 i = 0; i < 2; i++) {
+    Pulse &pulse  = m_Pulses[i];
+    u32    period = (pulse.period + 1) * 2;
+
+    // A silent channel only keeps its phase
+    if (pulse.length == 0 || pulse.IsMuted() || pulse.envelope.GetVolume() == 0) {
+      u32 steps   = pulse.timer <= cycles ? (cycles - pulse.timer) / period + 1 : 0;
+      pulse.step  = (pulse.step + steps) % 8;
+      pulse.timer = pulse.timer + steps * period - cycles;
+      continue;
+    }
+
+    RunTimer(pulse.timer, period, cycles, [&](u32 time) {
+      pulse.step = (pulse.step + 1) % 8;
+      Output(m_BatchCycle + time, m_Levels[i], pulse.GetLevel(), PULSE_SCALE);
+    });
+  }
+
+  if (m_Triangle.IsRunning()) {
+    RunTimer(m_Triangle.timer, m_Triangle.period + 1, cycles, [&](u32 time) {
+      m_Triangle.step = (m_Triangle.step + 1) % 32;
+      Output(m_BatchCycle + time, m_Levels[TRIANGLE], m_Triangle.GetLevel(), TRIANGLE_SCALE);
+    });
+  }
+
+  if (m_Noise.length > 0) {
+    RunTimer(m_Noise.timer, NOISE_PERIODS[m_Noise.rate], cycles, [&](u32 time) {
+      u16 feedback  = (m_Noise.shift ^ (m_Noise.shift >> (m_Noise.mode ? 6 : 1))) & 1;
+      m_Noise.shift = (m_Noise.shift >> 1) | (feedback << 14);
+      Output(m_BatchCycle + time, m_Levels[NOISE], m_Noise.GetLevel(), NOISE_SCALE);
+    });
+  }
+
+  m_BatchCycle += cycles;
+}
+
+void APU::Output(u32 cycle, u8 &previous, u8 level, float scale) {
+  if (level != previous) {
+    m_Output->AddStep(cycle, (static_cast<int>(level) - previous) * scale);
+    previous = level;
+  }
+}
+
+void APU::UpdateLevels() {
+  if (!m_Output) {
+    return;
+  }
+
+  Output(m_BatchCycle, m_Levels[PULSE_1], m_Pulses[0].GetLevel(), PULSE_SCALE);
+  Output(m_BatchCycle, m_Levels[PULSE_2], m_Pulses[1].GetLevel(), PULSE_SCALE);
+  Output(m_BatchCycle, m_Levels[TRIANGLE], m_Triangle.GetLevel(), TRIANGLE_SCALE);
+  Output(m_BatchCycle, m_Levels[NOISE], m_Noise.GetLevel(), NOISE_SCALE);
+  Output(m_BatchCycle, m_Levels[DMC], m_Dmc.level, DMC_SCALE);
+}
+
+void APU::EndBatch() {
+  m_Dropped += m_Output->EndBatch(m_BatchCycle, *m_Samples);
+  m_BatchCycle = 0;
+}
+
+void APU::ClockFrame() {
+  u8 step  = m_FrameStep;
+  u8 count = FRAME_STEP_COUNTS[m_FiveSteps];
+
+  // The fourth step of the sequence of five does nothing
+  if (!(m_FiveSteps && step == 3)) {
+    ClockQuarter();
+  }
+  if (step == 1 || step == count - 1) {
+    ClockHalf();
+  }
+  if (!m_FiveSteps && step == 3 && !m_IrqInhibit) {
+    m_FrameIrq = true;
+    SetIrq();
+  }
+
+  const u32 *steps = FRAME_STEPS[m_FiveSteps];
+  m_FrameStep      = (step + 1) % count;
+  m_FrameTimer     = m_FrameStep > 0 ? steps[m_FrameStep] - steps[step]
+                                     : FRAME_SEQUENCES[m_FiveSteps] - steps[step] + steps[0];
+  UpdateLevels();
+}
+
+void APU::ClockQuarter() {
+  m_Pulses[0].envelope.Clock();
+  m_Pulses[1].envelope.Clock();
+  m_Noise.envelope.Clock();
+
+  if (m_Triangle.linearReload) {
+    m_Triangle.linearCounter = m_Triangle.linearPeriod;
+  } else if (m_Triangle.linearCounter > 0) {
+    m_Triangle.linearCounter--;
+  }
+  if (!m_Triangle.halt) {
+    m_Triangle.linearReload = false;
+  }
+}
+
+void APU::ClockHalf() {
+  for (Pulse &pulse : m_Pulses) {
+    if (!pulse.envelope.loop && pulse.length > 0) {
+      pulse.length--;
+    }
+    pulse.ClockSweep();
+  }
+
+  if (!m_Triangle.halt && m_Triangle.length > 0) {
+    m_Triangle.length--;
+  }
+  if (!m_Noise.envelope.loop && m_Noise.length > 0) {
+    m_Noise.length--;
+  }
+}
+
+void APU::ClockDmc() {
+  if (!m_Dmc.silent) {
+    if (m_Dmc.shift & 1) {
+      m_Dmc.level += m_Dmc.level <= 125 ? 2 : 0;
+    } else {
+      m_Dmc.level -= m_Dmc.level >= 2 ? 2 : 0;
+    }
+  }
+  m_Dmc.shift >>= 1;
+
+  if (--m_Dmc.bits == 0) {
+    m_Dmc.bits   = 8;
+    m_Dmc.silent = m_Dmc.empty;
+    if (!m_Dmc.empty) {
+      m_Dmc.shift = m_Dmc.buffer;
+      m_Dmc.empty = true;
+      FetchSample();
+    }
+  }
+
+  m_Dmc.timer = m_Dmc.IsIdle() ? 0 : DMC_PERIODS[m_Dmc.rate];
+  UpdateLevels();
+}
+
+void APU::FetchSample() {
+  if (!m_Dmc.empty || m_Dmc.remaining == 0) {
+    return;
+  }
+
+  m_Dmc.buffer  = m_Core->bus.Read(m_Dmc.address);
+  m_Dmc.empty   = false;
+  m_Dmc.address = m_Dmc.address == 0xFFFF ? 0x8000 : m_Dmc.address + 1;
+  m_Core->cpu.Stall(DMC_FETCH_CYCLES);
+
+  if (--m_Dmc.remaining == 0) {
+    if (m_Dmc.loop) {
+      StartSample();
+    } else if (m_Dmc.irqEnabled) {
+      m_DmcIrq = true;
+      SetIrq();
+    }
+  }
+}
+
+void APU::StartSample() {
+  m_Dmc.address   = m_Dmc.start;
+  m_Dmc.remaining = m_Dmc.size;
+}
+
+void APU::SetIrq() {
+  // Like the mappers, the line stays asserted until both flags are
+  // acknowledged and the cpu takes the interrupt once it clears its mask
+  m_IrqLine = m_FrameIrq || m_DmcIrq;
+  if (m_IrqLine) {
+    m_Core->cpu.PollIrq();
+  }
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,206 @@
+#ifndef EASYNES_APU_HPP
+#define EASYNES_APU_HPP
+
+#include <memory>
+#include <vector>
+
+#include "Audio.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+// Registers of the channels, the status and the frame counter, which shares
+// its address with the second controller
+constexpr u16 APU_FIRST_REGISTER = 0x4000;
+constexpr u16 APU_LAST_REGISTER  = 0x4013;
+constexpr u16 APU_STATUS         = 0x4015;
+constexpr u16 APU_FRAME_COUNTER  = 0x4017;
+// The cpu waits while the sample channel reads a byte
+constexpr u32 DMC_FETCH_CYCLES = 4;
+
+// The sound of the console: two pulse channels, a triangle, a noise and the
+// delta modulation channel playing samples from memory, sequenced by the frame
+// counter. The apu runs behind the cpu like the ppu, the scheduler brings it
+// up to date on its events and before its registers are accessed.
+//
+// The channels are only clocked one by one while the output is enabled. Their
+// level changes are band-limited steps in an audio buffer turned into samples
+// once per batch, on every step of the frame counter and at the end of the
+// frames, the catch ups in between only extend the batch. Without
+// the output only the frame counter and the sample channel run, from one of
+// their steps to the next, since they raise interrupts, stall the cpu and
+// show in the status
+class APU {
+ public:
+  explicit APU(Core *core);
+  ~APU();
+
+  APU(const APU &)            = delete;
+  APU &operator=(const APU &) = delete;
+
+  // Power on state, the channels are silent
+  void Reset();
+
+  // Synthesize the samples at the rate into a ring read by a single consumer,
+  // on any thread. Disabled by default, headless runs pay nothing for the sound
+  void        EnableOutput(bool enabled, u32 sampleRate = DEFAULT_SAMPLE_RATE);
+  inline bool IsOutputEnabled() const { return m_Output != nullptr; }
+  // nullptr while the output is disabled
+  inline AudioRing *GetSamples() { return m_Samples.get(); }
+  // Samples lost while the ring was full
+  inline u64 GetDroppedSamples() const { return m_Dropped; }
+
+  // Advance by the cpu cycles, the interrupts are raised on their cycle
+  void Run(u64 cycles);
+  // End the batch at the end of a frame of the ppu, the samples of the frame
+  // are all in the ring
+  void EndFrame();
+  // Cpu cycles until the next interrupt or read of the sample channel
+  u64 GetCyclesToEvent() const;
+  // The frame counter or the sample channel holds the irq line
+  inline bool IsIrqAsserted() const { return m_IrqLine; }
+
+  u8   ReadStatus();
+  void WriteRegister(u16 address, u8 value);
+
+  // The registers and the counters of the channels. The phases of the
+  // waveforms only advance with the output and are not saved, a state is the
+  // same with or without the sound. Loading fails and leaves the apu untouched
+  // if the state is not valid
+  std::vector<u8> SaveState() const;
+  bool            LoadState(const std::vector<u8> &state);
+
+ private:
+  struct Envelope {
+    bool start   = false;
+    bool loop    = false;
+    bool constant = false;
+    u8   volume  = 0;
+    u8   divider = 0;
+    u8   decay   = 0;
+
+    void Clock();
+    inline u8 GetVolume() const { return constant ? volume : decay; }
+  };
+
+  struct Pulse {
+    Envelope envelope;
+    u8       duty          = 0;
+    u8       step          = 0;
+    u8       length        = 0;
+    bool     sweepEnabled  = false;
+    bool     sweepNegate   = false;
+    bool     sweepReload   = false;
+    u8       sweepPeriod   = 0;
+    u8       sweepShift    = 0;
+    u8       sweepDivider  = 0;
+    u16      period        = 0;
+    // Cpu cycles until the next step of the sequence
+    u32 timer = 0;
+    // The first channel negates with the one's complement
+    bool first = false;
+
+    u16  GetTarget() const;
+    bool IsMuted() const;
+    u8   GetLevel() const;
+    void ClockSweep();
+  };
+
+  struct Triangle {
+    bool halt          = false;
+    bool linearReload  = false;
+    u8   linearPeriod  = 0;
+    u8   linearCounter = 0;
+    u8   length        = 0;
+    u8   step          = 0;
+    u16  period        = 0;
+    u32  timer         = 0;
+
+    // The ultrasonic periods are held, the console would play a constant
+    inline bool IsRunning() const { return length > 0 && linearCounter > 0 && period >= 2; }
+    u8          GetLevel() const;
+  };
+
+  struct Noise {
+    Envelope envelope;
+    bool     mode   = false;
+    u8       length = 0;
+    u8       rate   = 0;
+    u16      shift  = 1;
+    u32      timer  = 0;
+
+    u8 GetLevel() const;
+  };
+
+  struct Dmc {
+    bool irqEnabled = false;
+    bool loop       = false;
+    u8   rate       = 0;
+    u8   level      = 0;
+    u16  start      = 0;
+    u16  size       = 0;
+    u16  address    = 0;
+    u16  remaining  = 0;
+    u8   buffer     = 0;
+    bool empty      = true;
+    u8   shift      = 0;
+    u8   bits       = 8;
+    bool silent     = true;
+    // Cpu cycles until the next output clock, 0 while the channel is idle
+    u32 timer = 0;
+
+    inline bool IsIdle() const { return remaining == 0 && empty && silent; }
+  };
+
+  // Clock the channels and the levels between the steps of the frame counter
+  // and of the sample channel, from the cycle of the batch
+  void Synthesize(u32 cycles);
+  // Step the output of a channel at the cycle of the batch
+  void Output(u32 cycle, u8 &previous, u8 level, float scale);
+  // The levels after a register, a step or a sample changed them
+  void UpdateLevels();
+  void EndBatch();
+
+  template <typename Visitor>
+  void VisitState(Visitor &&visit);
+
+  void ClockFrame();
+  void ClockQuarter();
+  void ClockHalf();
+  void ClockDmc();
+  void FetchSample();
+  void StartSample();
+  void SetIrq();
+
+  Core *m_Core;
+
+  Pulse    m_Pulses[2];
+  Triangle m_Triangle;
+  Noise    m_Noise;
+  Dmc      m_Dmc;
+
+  // One bit per channel, the length counters only load while it is set
+  u8   m_Enabled    = 0;
+  bool m_FiveSteps  = false;
+  bool m_IrqInhibit = false;
+  bool m_FrameIrq   = false;
+  bool m_DmcIrq     = false;
+  bool m_IrqLine    = false;
+  // Step of the frame counter and cpu cycles until it is clocked
+  u8  m_FrameStep  = 0;
+  u32 m_FrameTimer = 0;
+
+  // Synthesis, only while the output is enabled
+  std::unique_ptr<AudioBuffer> m_Output;
+  std::unique_ptr<AudioRing>   m_Samples;
+  u64                          m_Dropped = 0;
+  // Cycle in the batch and last level of each channel
+  u32 m_BatchCycle = 0;
+  u8  m_Levels[5]  = {};
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_APU_HPP
@@ -0,0 +1,159 @@
+#include "Audio.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+
+namespace EasyNes {
+
+namespace {
+
+// Taps of a step and phases of a step between two samples
+constexpr u32 STEP_TAPS   = 16;
+constexpr u32 PHASE_BITS  = 5;
+constexpr u32 STEP_PHASES = 1 << PHASE_BITS;
+// Of the output rate, the steps keep a margin below the nyquist frequency
+constexpr double STEP_CUTOFF = 0.45;
+// The first high-pass filter of the console output
+constexpr double HIGH_PASS_FREQUENCY = 90;
+
+// Samples of the longest batch, the fraction of the first one included
+constexpr u32 MAX_BATCH_SAMPLES = static_cast<u64>(AUDIO_BATCH_CYCLES) * MAX_SAMPLE_RATE / CPU_CLOCK_RATE + 2;
+
+using StepKernel = std::array<std::array<float, STEP_TAPS>, STEP_PHASES>;
+
+// Blackman windowed sinc centered between the two middle taps, one row per
+// phase. Each row adds up to one, a step reaches its whole height
+const StepKernel &STEP_KERNEL() {
+  static const StepKernel kernel = [] {
+    StepKernel rows;
+    double     half = STEP_TAPS / 2;
+
+    for (u32 phase = 0; phase < STEP_PHASES; phase++) {
+      double center = half - 1 + static_cast<double>(phase) / STEP_PHASES;
+      double sum    = 0;
+      double taps[STEP_TAPS];
+
+      for (u32 tap = 0; tap < STEP_TAPS; tap++) {
+        double t    = tap - center;
+        double sinc = t == 0 ? 2 * STEP_CUTOFF : std::sin(2 * std::numbers::pi * STEP_CUTOFF * t) / (std::numbers::pi * t);
+        double x    = (t + half) / (2 * half);
+        double window =
+            0.42 - 0.5 * std::cos(2 * std::numbers::pi * x) + 0.08 * std::cos(4 * std::numbers::pi * x);
+
+        taps[tap] = sinc * window;
+        sum += taps[tap];
+      }
+
+      for (u32 tap = 0; tap < STEP_TAPS; tap++) {
+        rows[phase][tap] = static_cast<float>(taps[tap] / sum);
+      }
+    }
+    return rows;
+  }();
+
+  return kernel;
+}
+
+}  // namespace
+
+u32 AudioRing::Push(const s16 *samples, u32 count) {
+  u64 head = m_Head.load(std::memory_order_relaxed);
+
+  if (AUDIO_RING_SIZE - (head - m_CachedTail) < count) {
+    m_CachedTail = m_Tail.load(std::memory_order_acquire);
+  }
+
+  u32 pushed = std::min<u64>(count, AUDIO_RING_SIZE - (head - m_CachedTail));
+  u32 index  = head % AUDIO_RING_SIZE;
+  u32 first  = std::min(pushed, AUDIO_RING_SIZE - index);
+
+  std::memcpy(m_Samples.data() + index, samples, first * sizeof(s16));
+  std::memcpy(m_Samples.data(), samples + first, (pushed - first) * sizeof(s16));
+  m_Head.store(head + pushed, std::memory_order_release);
+  return pushed;
+}
+
+u32 AudioRing::Read(s16 *samples, u32 count) {
+  u64 tail = m_Tail.load(std::memory_order_relaxed);
+
+  if (m_CachedHead - tail < count) {
+    m_CachedHead = m_Head.load(std::memory_order_acquire);
+  }
+
+  u32 read  = std::min<u64>(count, m_CachedHead - tail);
+  u32 index = tail % AUDIO_RING_SIZE;
+  u32 first = std::min(read, AUDIO_RING_SIZE - index);
+
+  std::memcpy(samples, m_Samples.data() + index, first * sizeof(s16));
+  std::memcpy(samples + first, m_Samples.data(), (read - first) * sizeof(s16));
+  m_Tail.store(tail + read, std::memory_order_release);
+  return read;
+}
+
+AudioBuffer::AudioBuffer(u32 sampleRate)
+    : m_SampleRate(std::clamp<u32>(sampleRate, 1, MAX_SAMPLE_RATE)),
+      m_Step((static_cast<u64>(m_SampleRate) << 32) / CPU_CLOCK_RATE),
+      // Room for the taps of the last step and for whole vectors of samples
+      m_Deltas(MAX_BATCH_SAMPLES + STEP_TAPS + 4),
+      m_Samples(MAX_BATCH_SAMPLES + 4),
+      m_Pole(static_cast<float>(std::exp(-2 * std::numbers::pi * HIGH_PASS_FREQUENCY / m_SampleRate))) {}
+
+void AudioBuffer::AddStep(u32 cycle, float delta) {
+  u64          position = m_Offset + cycle * m_Step;
+  float       *deltas   = m_Deltas.data() + (position >> 32);
+  const float *taps     = STEP_KERNEL()[(position >> (32 - PHASE_BITS)) % STEP_PHASES].data();
+
+#if defined(__SSE2__)
+  __m128 scale = _mm_set1_ps(delta);
+  for (u32 i = 0; i < STEP_TAPS; i += 4) {
+    __m128 sum = _mm_add_ps(_mm_loadu_ps(deltas + i), _mm_mul_ps(_mm_loadu_ps(taps + i), scale));
+    _mm_storeu_ps(deltas + i, sum);
+  }
+#else
+  for (u32 i = 0; i < STEP_TAPS; i++) {
+    deltas[i] += taps[i] * delta;
+  }
+#endif
+}
+
+u32 AudioBuffer::EndBatch(u32 cycles, AudioRing &ring) {
+  u64 end   = m_Offset + cycles * m_Step;
+  u32 count = end >> 32;
+
+  // The integration and the filter carry from one sample to the next
+  for (u32 i = 0; i < count; i++) {
+    m_Sum += m_Deltas[i];
+    m_Filtered = m_Pole * (m_Filtered + m_Sum - m_Previous);
+    m_Previous = m_Sum;
+    m_Deltas[i] = m_Filtered;
+  }
+
+#if defined(__SSE2__)
+  __m128 scale = _mm_set1_ps(32767.0f);
+  for (u32 i = 0; i < count; i += 4) {
+    __m128i words  = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(m_Deltas.data() + i), scale));
+    __m128i packed = _mm_packs_epi32(words, words);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(m_Samples.data() + i), packed);
+  }
+#else
+  for (u32 i = 0; i < count; i++) {
+    m_Samples[i] = static_cast<s16>(std::clamp(std::lround(m_Deltas[i] * 32767.0f), -32768L, 32767L));
+  }
+#endif
+
+  u32 dropped = count - ring.Push(m_Samples.data(), count);
+
+  // The taps of the steps past the batch move to the front
+  std::memmove(m_Deltas.data(), m_Deltas.data() + count, STEP_TAPS * sizeof(float));
+  std::fill_n(m_Deltas.data() + STEP_TAPS, count, 0.0f);
+  m_Offset = end - (static_cast<u64>(count) << 32);
+  return dropped;
+}
+
+}  // namespace EasyNes
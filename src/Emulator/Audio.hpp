@@ -0,0 +1,79 @@
+#ifndef EASYNES_AUDIO_HPP
+#define EASYNES_AUDIO_HPP
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Cpu cycles per second of the NTSC console, the clock of the apu
+constexpr u32 CPU_CLOCK_RATE      = 1789773;
+constexpr u32 DEFAULT_SAMPLE_RATE = 48000;
+constexpr u32 MAX_SAMPLE_RATE     = 96000;
+// Samples buffered for the consumer, about a third of a second at 48 kHz
+constexpr u32 AUDIO_RING_SIZE = 1 << 14;
+// Longest batch of cycles turned into samples at once
+constexpr u32 AUDIO_BATCH_CYCLES = 1 << 15;
+
+// Ring of samples with a single producer, the core, and a single consumer,
+// the audio thread. Each index is only written by its side, the other side
+// keeps a stale copy and only reloads it when the ring looks full or empty
+class AudioRing {
+ public:
+  AudioRing() : m_Samples(AUDIO_RING_SIZE) {}
+
+  // Returns the samples pushed, the others are dropped when the ring is full
+  u32 Push(const s16 *samples, u32 count);
+  // Returns the samples read, up to count
+  u32 Read(s16 *samples, u32 count);
+
+ private:
+  std::vector<s16> m_Samples;
+
+  // On their own cache lines, the two threads write them all the time
+  alignas(64) std::atomic<u64> m_Head = 0;
+  u64 m_CachedTail                     = 0;
+  alignas(64) std::atomic<u64> m_Tail = 0;
+  u64 m_CachedHead                     = 0;
+};
+
+// Band-limited synthesis of the steps of a signal straight at the output rate.
+// A step adds a windowed sinc impulse to the differences of the samples, at
+// the phase of its cycle between two samples, so the filtering and the
+// resampling are a single multiply-add of 16 taps. The samples whose taps are
+// complete are integrated, cleared of their dc offset and pushed to the ring
+// once per batch
+class AudioBuffer {
+ public:
+  explicit AudioBuffer(u32 sampleRate);
+
+  // The signal changes by delta at the cycle, counted from the start of the
+  // batch and below AUDIO_BATCH_CYCLES
+  void AddStep(u32 cycle, float delta);
+  // The batch ends after the cycles, the next one starts there. Returns the
+  // samples that did not fit in the ring
+  u32 EndBatch(u32 cycles, AudioRing &ring);
+
+  inline u32 GetSampleRate() const { return m_SampleRate; }
+
+ private:
+  u32 m_SampleRate;
+  // Output samples per cycle and position of the start of the batch, in
+  // samples with 32 fractional bits
+  u64 m_Step;
+  u64 m_Offset = 0;
+
+  std::vector<float> m_Deltas;
+  std::vector<s16>   m_Samples;
+  float              m_Sum      = 0;
+  float              m_Previous = 0;
+  float              m_Filtered = 0;
+  float              m_Pole;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_AUDIO_HPP
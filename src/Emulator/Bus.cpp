@@ -0,0 +1,187 @@
+#include "Bus.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+void SET_TRAP(u8 &traps, u8 slot, bool trapped) {
+  // The traps of NO_TRAP_SLOT are ignored
+  if (slot >= TRAP_SLOTS) {
+    return;
+  }
+  if (trapped) {
+    traps |= 1 << slot;
+  } else {
+    traps &= ~(1 << slot);
+  }
+}
+
+}  // namespace
+
+Bus::Bus() { Unmap(0x00, 0xFF); }
+
+void Bus::MapMemory(u8 first, u8 last, u8 *data, std::size_t size, bool writable) {
+  for (std::size_t page = first; page <= last; page++) {
+    Map(page, data + ((page - first) * PAGE_SIZE) % size, writable, nullptr, nullptr, nullptr);
+  }
+}
+
+bool Bus::MapRom(u8 first, u8 last, const u8 *data, std::size_t size, void *context, WriteHandler write) {
+  // The page is never written through since it is not writable
+  u8 *memory = const_cast<u8 *>(data);
+
+  // The pages share the handlers, only the first one can fail
+  for (std::size_t page = first; page <= last; page++) {
+    if (!Map(page, memory + ((page - first) * PAGE_SIZE) % size, false, context, nullptr, write)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Bus::MapHandlers(u8 first, u8 last, void *context, ReadHandler read, WriteHandler write) {
+  for (std::size_t page = first; page <= last; page++) {
+    if (!Map(page, nullptr, false, context, read, write)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Bus::Unmap(u8 first, u8 last) { MapHandlers(first, last, nullptr, nullptr, nullptr); }
+
+u8 Bus::AddTrap(void *context, ReadTrap read, WriteTrap write, FetchTrap fetch) {
+  u8 slot = 0;
+  while (slot < TRAP_SLOTS && (m_Traps[slot].read || m_Traps[slot].write || m_Traps[slot].fetch)) {
+    slot++;
+  }
+
+  if (slot < TRAP_SLOTS) {
+    m_Traps[slot] = {context, read, write, fetch};
+  }
+  return slot;
+}
+
+void Bus::RemoveTrap(u8 slot) {
+  if (slot >= TRAP_SLOTS) {
+    return;
+  }
+
+  for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+    m_Pages[page].readTraps &= ~(1 << slot);
+    m_Pages[page].writeTraps &= ~(1 << slot);
+    m_Pages[page].fetchTraps &= ~(1 << slot);
+    UpdateFastPath(page);
+  }
+  m_Traps[slot] = {};
+}
+
+void Bus::TrapReads(u8 slot, u8 page, bool trapped) {
+  SET_TRAP(m_Pages[page].readTraps, slot, trapped);
+  UpdateFastPath(page);
+}
+
+void Bus::TrapWrites(u8 slot, u8 page, bool trapped) {
+  SET_TRAP(m_Pages[page].writeTraps, slot, trapped);
+  UpdateFastPath(page);
+}
+
+void Bus::TrapFetches(u8 slot, u8 page, bool trapped) {
+  SET_TRAP(m_Pages[page].fetchTraps, slot, trapped);
+  UpdateFastPath(page);
+}
+
+void Bus::UpdateFastPath(u8 page) {
+  const Page &info = m_Pages[page];
+
+  // The fetches are not reads of the data, but they share the table
+  m_ReadPages[page]  = !info.readTraps && !info.fetchTraps ? info.memory : nullptr;
+  m_WritePages[page] = info.writable && !info.writeTraps ? info.memory : nullptr;
+}
+
+bool Bus::Map(u8 page, u8 *memory, bool writable, void *context, ReadHandler read, WriteHandler write) {
+  Handlers handlers = {context, read, write};
+  Page    &info     = m_Pages[page];
+
+  // The slot of the same handlers, or else the first free one. The page is
+  // left untouched when every slot is taken
+  u8 slot = 0;
+  if (handlers != Handlers{}) {
+    u8 free = 0;
+    for (slot = 1; slot < HANDLER_SLOTS && m_Handlers[slot] != handlers; slot++) {
+      if (!free && m_HandlerPages[slot] == 0) {
+        free = slot;
+      }
+    }
+    if (slot == HANDLER_SLOTS) {
+      if (!free) {
+        return false;
+      }
+      slot = free;
+    }
+  }
+
+  m_HandlerPages[info.handlers]--;
+  m_HandlerPages[slot]++;
+  if (slot != 0) {
+    m_Handlers[slot] = handlers;
+  }
+
+  info.memory   = memory;
+  info.handlers = slot;
+  info.writable = writable;
+  UpdateFastPath(page);
+  return true;
+}
+
+u8 Bus::ReadHandled(u16 address) {
+  const Page &page = m_Pages[PAGE_OF(address)];
+
+  for (u8 traps = page.readTraps, slot = 0; traps; traps >>= 1, slot++) {
+    if (traps & 1) {
+      m_Traps[slot].read(m_Traps[slot].context, address);
+    }
+  }
+
+  if (page.memory) {
+    return page.memory[address % PAGE_SIZE];
+  } else if (const Handlers &handlers = m_Handlers[page.handlers]; handlers.read) {
+    return handlers.read(handlers.context, address);
+  }
+
+  // Nothing drives the data lines, they keep the high byte of the address
+  // that was just put on the bus
+  return PAGE_OF(address);
+}
+
+void Bus::WriteHandled(u16 address, u8 value) {
+  const Page &page = m_Pages[PAGE_OF(address)];
+
+  for (u8 traps = page.writeTraps, slot = 0; traps; traps >>= 1, slot++) {
+    if (traps & 1) {
+      m_Traps[slot].write(m_Traps[slot].context, address, value);
+    }
+  }
+
+  // Writes to read only memory or to an unmapped page are lost
+  if (page.writable) {
+    page.memory[address % PAGE_SIZE] = value;
+  } else if (const Handlers &handlers = m_Handlers[page.handlers]; handlers.write) {
+    handlers.write(handlers.context, address, value);
+  }
+}
+
+bool Bus::FetchHandled(u16 address, u8 &opcode) {
+  const Page &page = m_Pages[PAGE_OF(address)];
+
+  for (u8 traps = page.fetchTraps, slot = 0; traps; traps >>= 1, slot++) {
+    if ((traps & 1) && m_Traps[slot].fetch(m_Traps[slot].context, address)) {
+      return false;
+    }
+  }
+
+  opcode = page.memory ? page.memory[address % PAGE_SIZE] : ReadHandled(address);
+  return true;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,145 @@
+#ifndef EASYNES_BUS_HPP
+#define EASYNES_BUS_HPP
+
+#include <array>
+#include <cstddef>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+constexpr u16         PAGE_SIZE  = 256;
+constexpr std::size_t PAGE_COUNT = 256;
+constexpr std::size_t TRAP_SLOTS = 8;
+// Returned by AddTrap when every slot is taken, the traps of this slot are ignored
+constexpr u8 NO_TRAP_SLOT = TRAP_SLOTS;
+// Different handlers mapped at once, the pages hold the index of theirs
+constexpr std::size_t HANDLER_SLOTS = 16;
+
+constexpr u8 PAGE_OF(u16 address) { return address >> 8; }
+
+using ReadHandler  = u8 (*)(void *context, u16 address);
+using WriteHandler = void (*)(void *context, u16 address, u8 value);
+// Called before a trapped read reaches the page
+using ReadTrap = void (*)(void *context, u16 address);
+// Called before a trapped write reaches the page
+using WriteTrap = void (*)(void *context, u16 address, u8 value);
+// Called before the cpu fetches an opcode from a trapped page, true stops the
+// cpu before the instruction
+using FetchTrap = bool (*)(void *context, u16 address);
+
+// The cpu address space split in 256 pages of 256 bytes. A page either points
+// directly to host memory, which costs a single indexed load, or forwards the
+// accesses to handlers for memory mapped I/O
+class Bus {
+ public:
+  Bus();
+
+  // Map the memory to the pages [first, last], the memory is mirrored when it
+  // is smaller than the range. The size must be a multiple of the page size
+  void MapMemory(u8 first, u8 last, u8 *data, std::size_t size, bool writable = true);
+  // Map read only memory whose writes are forwarded to the handler, the way
+  // cartridges decode their registers over their rom
+  bool MapRom(u8 first, u8 last, const u8 *data, std::size_t size, void *context, WriteHandler write);
+  // Forward the accesses of the pages [first, last] to the handlers, a null
+  // handler ignores the writes or reads the open bus. At most HANDLER_SLOTS - 1
+  // different handlers are mapped at once, mapping more fails and leaves the
+  // pages as they were
+  bool MapHandlers(u8 first, u8 last, void *context, ReadHandler read, WriteHandler write);
+  void Unmap(u8 first, u8 last);
+
+  // Host memory behind the page, nullptr when the page is handled. Peeking
+  // through it never calls the traps
+  inline const u8 *GetPageMemory(u8 page) const { return m_Pages[page].memory; }
+  inline bool      IsPageWritable(u8 page) const { return m_Pages[page].writable; }
+  inline bool      IsFetchTrapped(u8 page) const { return m_Pages[page].fetchTraps; }
+  inline bool      IsPageHandled(u8 page) const { return m_Pages[page].handlers != 0; }
+
+  // Direct pointers of every page, nullptr when the access is not on the fast
+  // path. The opcode fetches go through the read table, the pages whose reads
+  // or fetches are trapped leave it
+  inline u8 *const *GetReadTable() const { return m_ReadPages.data(); }
+  inline u8 *const *GetWriteTable() const { return m_WritePages.data(); }
+
+  // Traps move the accesses of the trapped pages off the fast path, every
+  // other page keeps its direct pointer. At most TRAP_SLOTS can be registered,
+  // NO_TRAP_SLOT is returned past them
+  u8   AddTrap(void *context, ReadTrap read, WriteTrap write, FetchTrap fetch);
+  void RemoveTrap(u8 slot);
+  void TrapReads(u8 slot, u8 page, bool trapped = true);
+  void TrapWrites(u8 slot, u8 page, bool trapped = true);
+  void TrapFetches(u8 slot, u8 page, bool trapped = true);
+
+  inline u8 AddWriteTrap(void *context, WriteTrap trap) { return AddTrap(context, nullptr, trap, nullptr); }
+
+  inline u8 Read(u16 address) {
+    u8 *page = m_ReadPages[PAGE_OF(address)];
+    return page ? page[address % PAGE_SIZE] : ReadHandled(address);
+  }
+
+  inline void Write(u16 address, u8 value) {
+    u8 *page = m_WritePages[PAGE_OF(address)];
+    if (page) {
+      page[address % PAGE_SIZE] = value;
+    } else {
+      WriteHandled(address, value);
+    }
+  }
+
+  // Opcode fetch of the cpu, false when a trap stopped it before the instruction
+  inline bool Fetch(u16 address, u8 &opcode) {
+    u8 *page = m_ReadPages[PAGE_OF(address)];
+    if (page) {
+      opcode = page[address % PAGE_SIZE];
+      return true;
+    }
+    return FetchHandled(address, opcode);
+  }
+
+ private:
+  u8   ReadHandled(u16 address);
+  void WriteHandled(u16 address, u8 value);
+  bool FetchHandled(u16 address, u8 &opcode);
+  void UpdateFastPath(u8 page);
+  bool Map(u8 page, u8 *memory, bool writable, void *context, ReadHandler read, WriteHandler write);
+
+  struct Handlers {
+    void        *context = nullptr;
+    ReadHandler  read    = nullptr;
+    WriteHandler write   = nullptr;
+
+    bool operator==(const Handlers &) const = default;
+  };
+
+  // The handlers are shared by their pages
+  struct Page {
+    u8  *memory = nullptr;
+    // Slot of the handlers, the slot 0 has none
+    u8   handlers = 0;
+    bool writable = false;
+    // One bit per trap slot
+    u8 readTraps  = 0;
+    u8 writeTraps = 0;
+    u8 fetchTraps = 0;
+  };
+  static_assert(sizeof(Page) == 16);
+
+  struct Trap {
+    void     *context = nullptr;
+    ReadTrap  read    = nullptr;
+    WriteTrap write   = nullptr;
+    FetchTrap fetch   = nullptr;
+  };
+
+  std::array<u8 *, PAGE_COUNT>        m_ReadPages;
+  std::array<u8 *, PAGE_COUNT>        m_WritePages;
+  std::array<Page, PAGE_COUNT>        m_Pages;
+  std::array<Handlers, HANDLER_SLOTS> m_Handlers;
+  // Pages mapped to each slot of handlers, the slots without pages are free
+  std::array<u16, HANDLER_SLOTS> m_HandlerPages = {PAGE_COUNT};
+  std::array<Trap, TRAP_SLOTS>   m_Traps;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_BUS_HPP
@@ -1,5 +1,6 @@
 #include "CPU.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <utility>
 
@@ -10,40 +11,212 @@ namespace EasyNes {
 
 constexpr u16 BATCH_BYTES(u8 lo, u8 hi) { return (hi << 8) | lo; }
 
-constexpr std::pair<u8, u8> DECOMPOSE_WORD(u16 value) { return {(value >> 8), value | 0x00FF}; }
+constexpr std::pair<u8, u8> DECOMPOSE_WORD(u16 value) { return {(value >> 8), value & 0x00FF}; }
 
 constexpr bool IS_NEGATIVE(u8 value) { return value & NEGATIVE_BIT; }
 
-constexpr bool HAS_OVERFLOWED(u8 a, u8 b, u16 result) { return ~(a ^ b) & IS_NEGATIVE(a ^ result); }
+// The operands have the same sign and the result has the other one
+constexpr bool HAS_OVERFLOWED(u8 a, u8 b, u16 result) { return ~(a ^ b) & (a ^ result) & NEGATIVE_BIT; }
 
-CPU::CPU(Core *core) : m_Core(core) {}
+CPU::CPU(Core *core) : m_Core(core), m_Bus(&core->bus) {}
 
 bool CPU::Step() {
   // If the cpu don't have to wait more cycles we can perform the next instruction
-  if (m_WaitingCycles-- == 0) {
-    u8          opcode      = *FetchByte(m_PC++);
-    Instruction instruction = INSTRUCTION_SET[opcode];
-
-    // Execute the instruction
-    u8 *data = (this->*instruction.addressing)();
-    (this->*instruction.operation)(data);
+  if (m_WaitingCycles == 0) {
+    u32 cycles = Execute();
+    // Stopped in front of the instruction, the clock is left to it
+    if (cycles == 0 && m_Stopped) {
+      return false;
+    }
 
-    m_WaitingCycles += instruction.cycles;
-    m_ElapsedInstructions++;
+    // The current clock is part of the instruction, the elapsed cycles follow
+    // the clocks one at a time
+    m_WaitingCycles = cycles - 1;
+    m_ElapsedCycles -= m_WaitingCycles;
     return true;
   }
+
+  m_WaitingCycles--;
+  m_ElapsedCycles++;
   return false;
 }
 
-u8 *CPU::FetchByte(u16 address) { return &m_Core->ram[address]; }
+template <typename Accuracy>
+u32 CPU::Execute() {
+  // The fetch comes before any change, a trap can still stop the cpu in front
+  // of the instruction
+  u8 opcode;
+  if (!m_Bus->Fetch(m_PC, opcode)) {
+    Stop();
+    return 0;
+  }
+
+  // Cycles left by a reset or an interrupt are paid along with the
+  // instruction, they come first so the elapsed cycles are the time of the
+  // instruction while it executes
+  u32 waited      = m_WaitingCycles > 0 ? m_WaitingCycles : 0;
+  u32 cycles      = waited;
+  m_WaitingCycles = 0;
+  m_ElapsedCycles += waited;
+  u64 start = m_ElapsedCycles;
+
+  if (m_Trace) {
+    RecordTrace();
+  }
+
+  // Only read by the instrumentation and the profiler
+  [[maybe_unused]] u16 address = m_PC;
+
+  // Execute the instruction, the addressing modes and the branches add their
+  // penalties to the waiting cycles
+  if constexpr (Accuracy::PER_CYCLE) {
+    // The fetch took the first cycle
+    m_PC++;
+    m_ElapsedCycles++;
+    cycles += CYCLE_TABLE[opcode](*this);
+  } else {
+    m_PC++;
+    cycles += DISPATCH_TABLE[opcode](*this);
+  }
+  cycles += m_WaitingCycles;
+  m_WaitingCycles = 0;
+
+  if constexpr (INSTRUMENTATION_ENABLED) {
+    m_Instrumentation.OnInstruction(address, opcode, cycles - waited);
+  }
 
-u8 *CPU::PushByte(u8 value) {
-  u8 *data = FetchByte(STACK_BASE + m_SP--);
-  *data    = value;
-  return data;
+  if (m_Profiler) {
+    m_Profiler->OnCycles(address, cycles);
+  }
+
+  // The cycle policy moved them along its accesses
+  m_ElapsedCycles = start + cycles - waited;
+  m_ElapsedInstructions++;
+  return cycles;
 }
 
-u8 *CPU::PullByte() { return FetchByte(STACK_BASE + ++m_SP); }
+template u32 CPU::Execute<InstructionAccuracy>();
+template u32 CPU::Execute<CycleAccuracy>();
+
+u64 CPU::Run(u64 cycles, u64 instructions) {
+  u64  elapsed   = 0;
+  auto remaining = [&] { return m_InstructionLimit - m_ElapsedInstructions; };
+
+  m_Stopped          = false;
+  m_InstructionLimit = m_ElapsedInstructions + std::min(instructions, ~m_ElapsedInstructions);
+
+  while (elapsed < cycles && m_ElapsedInstructions < m_InstructionLimit) {
+    u16 address  = m_PC;
+    u32 compiled = 0;
+
+    // The pending cycles of an interrupt are paid by the interpreter, the
+    // debugger sees every instruction
+    if (m_Recompiler && m_WaitingCycles == 0 && !m_Trace && !m_Core->debugger) {
+      compiled = m_Recompiler->Execute(*this, cycles - elapsed, remaining());
+    }
+
+    if (compiled > 0) {
+      elapsed += compiled;
+      if (m_Profiler) {
+        m_Profiler->OnCycles(address, compiled);
+      }
+    } else {
+      elapsed += Execute();
+    }
+
+    // A jump back may close an idle loop
+    if (m_IdleLoops && m_PC <= address && elapsed < cycles && !m_Trace && !m_Core->debugger && !m_Stopped) {
+      u64 skipped = m_IdleLoops->OnJumpBack(*this, cycles - elapsed, remaining());
+      if (skipped > 0 && m_Profiler) {
+        m_Profiler->OnCycles(m_PC, skipped);
+      }
+      elapsed += skipped;
+    }
+  }
+
+  return elapsed;
+}
+
+void CPU::Stop() {
+  m_Stopped          = true;
+  m_InstructionLimit = 0;
+}
+
+void CPU::EnableRecompiler(bool enabled, u8 threshold) {
+  if (!enabled) {
+    m_Recompiler.reset();
+  } else if (!m_Recompiler) {
+    m_Recompiler = std::make_unique<Recompiler>(m_Bus, threshold);
+  }
+}
+
+void CPU::FlushRecompiler() {
+  if (m_Recompiler) {
+    m_Recompiler->Clear();
+  }
+}
+
+void CPU::EnableIdleLoopSkip(bool enabled) {
+  if (!enabled) {
+    m_IdleLoops.reset();
+  } else if (!m_IdleLoops) {
+    m_IdleLoops = std::make_unique<IdleLoopDetector>();
+  }
+}
+
+bool CPU::StartTrace(const std::string &path) {
+  // The previous trace is complete before the file is reopened
+  m_Trace.reset();
+  m_Trace = Trace::Open(path, m_ElapsedCycles);
+  return m_Trace != nullptr;
+}
+
+void CPU::StopTrace() { m_Trace.reset(); }
+
+void CPU::EnableProfiler(bool enabled, u32 period) {
+  if (!enabled) {
+    m_Profiler.reset();
+  } else if (!m_Profiler || m_Profiler->GetPeriod() != period) {
+    m_Profiler = std::make_unique<Profiler>(period);
+  }
+}
+
+void CPU::RecordTrace() {
+  TraceRecord record = {u16(m_ElapsedCycles), m_PC, {}, m_A, m_X, m_Y, m_SP, GetStatus()};
+
+  // The code is peeked without the side effects of the handlers
+  for (u8 i = 0; i < 3; i++) {
+    u16       address = m_PC + i;
+    const u8 *memory  = m_Bus->GetPageMemory(PAGE_OF(address));
+    record.bytes[i]   = memory ? memory[address % PAGE_SIZE] : 0;
+  }
+
+  m_Trace->Record(record);
+}
+
+CPUState CPU::GetState() const {
+  return {m_PC, m_SP, m_A, m_X, m_Y, GetStatus(), m_WaitingCycles, m_ElapsedCycles, m_ElapsedInstructions};
+}
+
+void CPU::SetState(const CPUState &state) {
+  m_PC                  = state.pc;
+  m_SP                  = state.sp;
+  m_A                   = state.a;
+  m_X                   = state.x;
+  m_Y                   = state.y;
+  SetStatus(state.status);
+  m_WaitingCycles       = state.waitingCycles;
+  m_ElapsedCycles       = state.elapsedCycles;
+  m_ElapsedInstructions = state.elapsedInstructions;
+
+  if (m_IdleLoops) {
+    m_IdleLoops->Reset();
+  }
+}
+
+void CPU::PushByte(u8 value) { Write(STACK_BASE + m_SP--, value); }
+
+u8 CPU::PullByte() { return Read(STACK_BASE + ++m_SP); }
 
 u16 CPU::PushWord(u16 value) {
   auto decomposed = DECOMPOSE_WORD(value);
@@ -52,121 +225,158 @@ u16 CPU::PushWord(u16 value) {
   return value;
 }
 
-u16 CPU::PullWord() { return BATCH_BYTES(*PullByte(), *PullByte()); }
+u16 CPU::PullWord() {
+  // The low byte was pushed last
+  u8 lo = PullByte();
+  u8 hi = PullByte();
+  return BATCH_BYTES(lo, hi);
+}
 
 void CPU::Interrupt(u16 vector, u8 cycles) {
-  m_Status.B = 0;
-  PushByte(m_Status.value);
+  u8  sp     = m_SP;
+  u16 resume = m_PC;
+
   PushWord(m_PC);
+  // PushByte the status onto the stack with the break bit cleared
+  m_Status.B = 0;
+  PushByte(GetStatus());
   m_Status.I = 1;
 
-  u8 lo = *FetchByte(vector);
-  u8 hi = *FetchByte(vector + 1);
+  u8 lo = Read(vector);
+  u8 hi = Read(vector + 1);
 
   m_PC = BATCH_BYTES(lo, hi);
 
-  m_WaitingCycles = cycles;
+  if (m_Profiler) {
+    m_Profiler->OnCall(m_PC, sp);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnCall(resume, sp);
+  }
+
+  // Raised in the middle of an instruction, the interrupt follows it
+  m_WaitingCycles += cycles;
+}
+
+void CPU::PollIrq() {
+  if (!m_Status.I && m_Core->IsIrqAsserted()) {
+    Interrupt(IRQ_VECTOR, 7);
+  }
 }
+
 void CPU::RST() {
-  u8 lo = *FetchByte(RST_VECTOR);
-  u8 hi = *FetchByte(RST_VECTOR + 1);
+  u8 lo = Read(RST_VECTOR);
+  u8 hi = Read(RST_VECTOR + 1);
 
   m_PC = BATCH_BYTES(lo, hi);
 
   m_A = m_X = m_Y = 0x00;
   m_SP            = 0xFD;
-  m_Status.value  = 0;
-  m_Status.U      = 1;
+  // The interrupts are masked until the program clears the flag
+  SetStatus(0);
+  m_Status.I = 1;
+  m_Status.U = 1;
+
+  if (m_Profiler) {
+    m_Profiler->OnReset(m_PC);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnReset();
+  }
 
   m_WaitingCycles = 8;
 }
 
-u8 *CPU::IMM() { return FetchByte(m_PC++); }
-
-u8 *CPU::REL() {
-  u16 offset = *FetchByte(m_PC++);
-
+u16 CPU::REL(u16 offset) {
   if (IS_NEGATIVE(offset)) {
     offset |= 0xFF00;
   }
 
-  return FetchByte(m_PC + offset);
+  // The offset is relative to the next instruction
+  return m_PC + offset;
 }
 
-u16 CPU::ZeroPageAddressing(u8 offset) {
-  u8 address = *FetchByte(m_PC++);
+u16 CPU::ZeroPageAddressing(u8 address, u8 offset) {
   // Add the offset and wrap the address around the first page
   return (address + offset) % PAGE_SIZE;
 }
 
-u16 CPU::AbsoluteAddressing(u8 offset) {
-  u8 lo = *FetchByte(m_PC++);
-  u8 hi = *FetchByte(m_PC++);
-
-  u16 address = BATCH_BYTES(lo, hi) + offset;
+u16 CPU::AbsoluteAddressing(u16 address, u8 offset) {
+  u16 result = address + offset;
 
   // Additional cycle if the page is crossed
-  if ((hi << 8) != (address & 0xFF00)) {
+  if ((address & 0xFF00) != (result & 0xFF00)) {
     m_WaitingCycles++;
+
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      m_Instrumentation.OnPenalty(Penalty::PAGE_CROSS);
+    }
   }
 
-  return address;
+  return result;
 }
 
-u8 *CPU::IND() {
-  u8  pointerLo = *FetchByte(m_PC++);
-  u8  pointerHi = *FetchByte(m_PC++);
-  u16 pointer   = BATCH_BYTES(*FetchByte(pointerLo), *FetchByte(pointerHi));
+u16 CPU::IND(u16 pointer) {
+  u8 lo = Read(pointer);
+  // The high byte is not read from the next page when the pointer sits at the
+  // end of a page, it wraps around the pointer page instead
+  u8 hi = Read((pointer & 0xFF00) | ((pointer + 1) & 0x00FF));
 
-  u8 lo = *FetchByte(pointer);
-  u8 hi = 0;
-
-  // Page boundary crossed
-  if ((pointer & 0x00FF) == 0xFF) {
-    hi = (*FetchByte(pointer & 0xFF00) << 8);
-  } else {
-    hi = (*FetchByte(pointer + 1) << 8);
-  }
+  return BATCH_BYTES(lo, hi);
+}
 
-  return FetchByte(BATCH_BYTES(lo, hi));
+u16 CPU::IDX(u16 pointer) {
+  // The pointer wraps around the first page
+  u8 address = pointer + m_X;
+  u8 lo      = Read(address);
+  u8 hi      = Read((address + 1) % PAGE_SIZE);
+  return BATCH_BYTES(lo, hi);
 }
 
-u8 *CPU::IDX() {
-  u8 lo = (*FetchByte(m_PC++) + m_X) % PAGE_SIZE;
-  u8 hi = (lo + 1) % PAGE_SIZE;
-  return FetchByte(BATCH_BYTES(lo, hi));
+u16 CPU::IDY(u16 pointer) {
+  u8 lo = Read(pointer % PAGE_SIZE);
+  u8 hi = Read((pointer + 1) % PAGE_SIZE);
+
+  return AbsoluteAddressing(BATCH_BYTES(lo, hi), m_Y);
 }
 
-u8 *CPU::IDY() {
-  u8 lo = *FetchByte(m_PC++);
-  u8 hi = (lo + 1) % PAGE_SIZE;
-  return FetchByte(BATCH_BYTES(lo, hi));
+u16 CPU::IDY_W(u16 pointer) {
+  u8 lo = Read(pointer % PAGE_SIZE);
+  u8 hi = Read((pointer + 1) % PAGE_SIZE);
+
+  return BATCH_BYTES(lo, hi) + m_Y;
 }
 
 u8 CPU::AddOperation(u8 operand) {
   u16 result = m_A + operand + m_Status.C;
 
-  m_Status.C = result >= 0xFF;
-  m_Status.Z = result == 0;
-  m_Status.N = IS_NEGATIVE(result);
+  m_Status.C = result > 0xFF;
   m_Status.V = HAS_OVERFLOWED(m_A, operand, result);
+  SetResult(result);
 
   return result;
 }
 
 void CPU::BitwiseOperation(u8 operand, u8 (*operation)(u8, u8)) {
-  m_A        = (*operation)(m_A, operand);
-  m_Status.Z = m_A == 0;
-  m_Status.N = IS_NEGATIVE(m_A);
+  m_A = (*operation)(m_A, operand);
+  SetResult(m_A);
 }
 
-void CPU::BranchOperation(bool condition, u8 destination) {
+void CPU::BranchOperation(bool condition, u16 destination) {
   if (condition) {
     m_WaitingCycles++;
 
     // Additional cycle if page crossed
     if ((m_PC & 0xFF00) != (destination & 0xFF00)) {
       m_WaitingCycles++;
+
+      if constexpr (INSTRUMENTATION_ENABLED) {
+        m_Instrumentation.OnPenalty(Penalty::BRANCH_PAGE_CROSS);
+      }
+    }
+
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      m_Instrumentation.OnPenalty(Penalty::BRANCH_TAKEN);
     }
 
     m_PC = destination;
@@ -176,103 +386,136 @@ void CPU::BranchOperation(bool condition, u8 destination) {
 void CPU::CompareOperation(u8 reg, u8 operand) {
   u8 difference = reg - operand;
 
-  m_Status.N = IS_NEGATIVE(difference);
-  m_Status.Z = difference == 0;
-  m_Status.C = difference >= 0;
+  SetResult(difference);
+  m_Status.C = reg >= operand;
 }
 
-void CPU::IncrementOperation(u8 *a) {
-  *a         = (*a + 1) % 256;
-  m_Status.Z = *a == 0;
-  m_Status.N = IS_NEGATIVE(*a);
+u8 CPU::IncrementOperation(u8 value) {
+  u8 result = (value + 1) % 256;
+  SetResult(result);
+  return result;
 }
 
-void CPU::DecrementOperation(u8 *a) {
-  *a         = (*a - 1) % 256;
-  m_Status.Z = *a == 0;
-  m_Status.N = IS_NEGATIVE(*a);
+u8 CPU::DecrementOperation(u8 value) {
+  u8 result = (value - 1) % 256;
+  SetResult(result);
+  return result;
 }
 
 void CPU::LoadOperation(u8 &reg, u8 value) {
-  reg        = value;
-  m_Status.Z = reg == 0;
-  m_Status.N = IS_NEGATIVE(reg);
-}
-
-void CPU::ReturnOperation(u16 offset) {
-  m_Status.value = *PullByte();
-  m_PC           = PullWord() + offset;
+  reg = value;
+  SetResult(reg);
 }
 
 void CPU::TransferOperation(u8 &source, u8 &destination) {
   destination = source;
-  m_Status.N  = IS_NEGATIVE(source);
-  m_Status.Z  = source == 0;
+  SetResult(source);
+}
+
+u8 CPU::ShiftLeftOperation(u8 value) {
+  u8 result = value << 1;
+
+  m_Status.C = value & 0b10000000;
+  SetResult(result);
+
+  return result;
 }
 
-void CPU::ASL(u8 *operand) {
-  u8 result = *operand << 1;
+u8 CPU::ShiftRightOperation(u8 value) {
+  u8 result = (value >> 1);
 
-  m_Status.C = *operand & 0b10000000;
-  m_Status.N = IS_NEGATIVE(result);
-  m_Status.Z = result == 0;
+  m_Status.C = value & 0x01;
+  SetResult(result);
 
-  *operand = result;
+  return result;
 }
 
-void CPU::BIT(u8 *operand) {
-  u8 result = *operand & m_A;
+u8 CPU::RotateLeftOperation(u8 value) {
+  u16 result = (value << 1) | m_Status.C;
+
+  m_Status.C = result > 0xFF;
+  SetResult(result);
 
-  m_Status.C = result == 0;
-  m_Status.N = IS_NEGATIVE(result);
-  m_Status.V = *operand & 0b1000000;
+  return result;
 }
 
-void CPU::BRK(u8 *) {
-  PushWord(++m_PC);
+u8 CPU::RotateRightOperation(u8 value) {
+  u8 result = (value >> 1) | (m_Status.C << 7);
 
-  // PushByte the status onto the stack with the break bit active
-  PushByte(m_Status.value | 0b10000);
-  m_Status.I = 1;
+  m_Status.C = value & 0x01;
+  SetResult(result);
 
-  u8 lo = *FetchByte(IRQ_VECTOR);
-  u8 hi = *FetchByte(IRQ_VECTOR + 1);
-  m_PC  = BATCH_BYTES(lo, hi);
+  return result;
 }
 
-void CPU::JSR(u8 *destination) {
-  PushWord(--m_PC);
-  m_PC = *destination;
+void CPU::BIT(u16 address) {
+  u8 operand = Read(address);
+
+  // The flags other than zero come from the operand alone
+  m_ZeroSource     = operand & m_A;
+  m_NegativeSource = operand;
+  m_Status.V       = operand & 0b1000000;
 }
 
-void CPU::LSR(u8 *operand) {
-  u8 result = (*operand >> 1);
+void CPU::BRK(u16) {
+  u8  sp     = m_SP;
+  // The byte following BRK is skipped by the return address
+  u16 resume = m_PC + 1;
 
-  m_Status.C = *operand & 0x01;
-  m_Status.N = result == 0;
-  m_Status.Z = IS_NEGATIVE(result);
+  PushWord(resume);
 
-  *operand = result;
-}
+  // PushByte the status onto the stack with the break bit active
+  PushByte(GetStatus() | BREAK_BITS);
+  m_Status.I = 1;
 
-void CPU::ROL(u8 *operand) {
-  u16 result = (*operand << 1) | m_Status.C;
+  u8 lo = Read(IRQ_VECTOR);
+  u8 hi = Read(IRQ_VECTOR + 1);
+  m_PC  = BATCH_BYTES(lo, hi);
 
-  m_Status.C = result > 0xFF;
-  m_Status.N = IS_NEGATIVE(result);
-  m_Status.Z = result == 0;
+  if (m_Profiler) {
+    m_Profiler->OnCall(m_PC, sp);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnCall(resume, sp);
+  }
+}
 
-  *operand = result;
+void CPU::JSR(u16 destination) {
+  if (m_Profiler) {
+    m_Profiler->OnCall(destination, m_SP);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnCall(m_PC, m_SP);
+  }
+
+  // The return address points to the last byte of the instruction
+  PushWord(m_PC - 1);
+  m_PC = destination;
 }
 
-void CPU::ROR(u8 *operand) {
-  u8 result = (*operand >> 1) | (m_Status.C << 7);
+void CPU::RTI(u16) {
+  SetStatus(PulledStatus(PullByte()));
+  m_PC = PullWord();
 
-  m_Status.C = *operand & 0x01;
-  m_Status.N = IS_NEGATIVE(result);
-  m_Status.Z = result == 0;
+  if (m_Profiler) {
+    m_Profiler->OnReturn(m_SP);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnReturn(m_SP);
+  }
+  // The line is still asserted if the handler did not acknowledge the source
+  PollIrq();
+}
 
-  *operand = result;
+void CPU::RTS(u16) {
+  m_PC = PullWord() + 1;
+
+  if (m_Profiler) {
+    m_Profiler->OnReturn(m_SP);
+  }
+  if (m_Core->debugger) {
+    m_Core->debugger->OnReturn(m_SP);
+  }
 }
 
 }  // namespace EasyNes
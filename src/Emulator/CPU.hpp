@@ -1,51 +1,180 @@
 #ifndef EASYNES_CPU_HPP
 #define EASYNES_CPU_HPP
+#include <memory>
+#include <string>
 #include <utility>
 
+#include "Bus.hpp"
+#include "IdleLoop.hpp"
+#include "Instrumentation.hpp"
+#include "Profiler.hpp"
+#include "Recompiler.hpp"
+#include "Trace.hpp"
 #include "Types.hpp"
 
 namespace EasyNes {
 
 class Core;
   
-constexpr u8  NEGATIVE_BIT = 0b10000000;
-constexpr u16 STACK_BASE   = 0x0100;
-constexpr u16 IRQ_VECTOR   = 0xFFFE;
-constexpr u16 RST_VECTOR   = 0xFFFC;
-constexpr u16 NMI_VECTOR   = 0xFFFA;
-constexpr u16 PAGE_SIZE    = 256;
-  
+constexpr u8  CARRY_BIT     = 0b00000001;
+constexpr u8  ZERO_BIT      = 0b00000010;
+constexpr u8  INTERRUPT_BIT = 0b00000100;
+constexpr u8  DECIMAL_BIT   = 0b00001000;
+constexpr u8  BREAK_BIT     = 0b00010000;
+constexpr u8  UNUSED_BIT    = 0b00100000;
+constexpr u8  OVERFLOW_BIT  = 0b01000000;
+constexpr u8  NEGATIVE_BIT  = 0b10000000;
+// Only exist in the copies of the status pushed on the stack, set by PHP and BRK
+constexpr u8  BREAK_BITS    = BREAK_BIT | UNUSED_BIT;
+constexpr u16 STACK_BASE    = 0x0100;
+constexpr u16 IRQ_VECTOR    = 0xFFFE;
+constexpr u16 RST_VECTOR    = 0xFFFC;
+constexpr u16 NMI_VECTOR    = 0xFFFA;
+
+// Accuracy policies of the interpreter, both are generated from the same
+// instruction set. The instruction policy executes an instruction at once, its
+// bus accesses all happen on its first cycle. The cycle policy spends the bus
+// cycles one at a time, with the dummy reads and writes of the console, a
+// device brought up to date by an access sees the cpu on its exact cycle
+struct InstructionAccuracy {
+  static constexpr bool PER_CYCLE = false;
+};
+
+struct CycleAccuracy {
+  static constexpr bool PER_CYCLE = true;
+};
+
+// Set by the EASYNES_CYCLE_ACCURATE build option, the policy of Step() and Run()
+#ifdef EASYNES_CYCLE_ACCURATE
+using DefaultAccuracy = CycleAccuracy;
+#else
+using DefaultAccuracy = InstructionAccuracy;
+#endif
+
+// Everything needed to resume the cpu where it stopped
+struct CPUState {
+  u16 pc;
+  u8  sp;
+  u8  a;
+  u8  x;
+  u8  y;
+  u8  status;
+  s32 waitingCycles;
+  u64 elapsedCycles;
+  u64 elapsedInstructions;
+};
+
 class CPU {
   friend class Instruction;
+  friend class Recompiler;
+  friend class IdleLoopDetector;
+  friend struct MicroOps;
 
  public:
   CPU(Core *core);
   // Perform one cpu clock, returns if the clock fetch a new instruction
   bool Step();
+  // Execute the next instruction, returns the cycles it took. Instantiated for
+  // both policies. A trap stopping the opcode fetch executes nothing and
+  // returns 0
+  template <typename Accuracy = DefaultAccuracy>
+  u32 Execute();
+  // Execute instructions until one of the budgets is spent, through the
+  // recompiled blocks when possible, returns the elapsed cycles. The recompiled
+  // blocks and the skipped idle loops keep the timing of the instruction policy
+  u64 Run(u64 cycles, u64 instructions);
+  // End the run in progress after the current instruction, the scheduler
+  // returns along with it. The next run clears the stop
+  void        Stop();
+  inline void Resume() { m_Stopped = false; }
+  inline bool IsStopped() const { return m_Stopped; }
   
   void Interrupt(u16 vector, u8 cycles);
-  void IRQ() { if(!m_Status.I) Interrupt(IRQ_VECTOR, 7); }
+  // Take the interrupt if the irq line of the core is asserted and the
+  // interrupts are not masked. Polled when a source asserts the line and when
+  // an instruction clears the mask, the only times the outcome can change
+  void PollIrq();
   void NMI() { Interrupt(NMI_VECTOR, 8); }
   void RST();
+  // Cycles the cpu is held by a device, like a dma, paid along with the
+  // current instruction
+  inline void Stall(u32 cycles) { m_WaitingCycles += cycles; }
+
+  // The recompiler translates the code executed more than threshold times,
+  // only Run() goes through it. Writes bypassing the bus require a flush
+  void        EnableRecompiler(bool enabled, u8 threshold = DEFAULT_HOT_THRESHOLD);
+  inline bool IsRecompilerEnabled() const { return m_Recompiler != nullptr; }
+  void        FlushRecompiler();
+  inline const Recompiler *GetRecompiler() const { return m_Recompiler.get(); }
+
+  // Fast-forward the loops polling memory until something they read can
+  // change, only Run() skips them
+  void        EnableIdleLoopSkip(bool enabled);
+  inline bool IsIdleLoopSkipEnabled() const { return m_IdleLoops != nullptr; }
+  inline const IdleLoopDetector *GetIdleLoopDetector() const { return m_IdleLoops.get(); }
+
+  // Record every executed instruction to the file, the recompiled blocks and
+  // the idle loop skips are off while tracing. Returns false if the file
+  // cannot be created
+  bool               StartTrace(const std::string &path);
+  void               StopTrace();
+  inline bool        IsTracing() const { return m_Trace != nullptr; }
+  inline const Trace *GetTrace() const { return m_Trace.get(); }
+
+  // Sample the program counter and the call stack every period cycles, the
+  // recompiled blocks and the skipped idle loops are sampled at their start
+  void                   EnableProfiler(bool enabled, u32 period = DEFAULT_SAMPLE_PERIOD);
+  inline bool            IsProfilerEnabled() const { return m_Profiler != nullptr; }
+  inline Profiler       *GetProfiler() { return m_Profiler.get(); }
+  inline const Profiler *GetProfiler() const { return m_Profiler.get(); }
 
   inline bool IsCompleted() const { return m_WaitingCycles == 0; }
+  // Cycles the cpu is held before its next instruction
+  inline u32 GetWaitingCycles() const { return m_WaitingCycles > 0 ? m_WaitingCycles : 0; }
+
+  CPUState GetState() const;
+  void     SetState(const CPUState &state);
 
   inline u8  GetRegisterA() const { return m_A; }
   inline u8  GetRegisterX() const { return m_X; }
   inline u8  GetRegisterY() const { return m_Y; }
   inline u8  GetRegisterSP() const { return m_SP; }
   inline u16 GetRegisterPC() const { return m_PC; }
-  inline u8  GetRegisterStatus() const { return m_Status.value; }
-  inline u32 GetElapsedInstructions() const { return m_ElapsedInstructions; }
+  inline u8  GetRegisterStatus() const { return GetStatus(); }
+  inline u64 GetElapsedInstructions() const { return m_ElapsedInstructions; }
+  // The cycle of the access in progress during an instruction of the cycle
+  // policy, of its first cycle with the instruction policy
+  inline u64 GetElapsedCycles() const { return m_ElapsedCycles; }
+
+  // Empty unless the build enables the instrumentation
+  inline const Instrumentation &GetInstrumentation() const { return m_Instrumentation; }
+  inline Instrumentation       &GetInstrumentation() { return m_Instrumentation; }
 
  private:
   Core *m_Core;
-  u32   m_ElapsedInstructions;
+  Bus  *m_Bus;
+  u64   m_ElapsedInstructions = 0;
+  u64   m_ElapsedCycles       = 0;
+  // Cut by Stop() to end the loop of Run()
+  u64  m_InstructionLimit = 0;
+  bool m_Stopped          = false;
+
+  std::unique_ptr<Recompiler> m_Recompiler;
+
+  std::unique_ptr<IdleLoopDetector> m_IdleLoops;
+
+  std::unique_ptr<Trace> m_Trace;
+  void                   RecordTrace();
+
+  std::unique_ptr<Profiler> m_Profiler;
+
+  [[no_unique_address]] Instrumentation m_Instrumentation;
 
   // R/W Memory
-  u8 *FetchByte(u16 address);
-  u8 *PushByte(u8 value);
-  u8 *PullByte();
+  inline u8   Read(u16 address) { return m_Bus->Read(address); }
+  inline void Write(u16 address, u8 value) { m_Bus->Write(address, value); }
+  void        PushByte(u8 value);
+  u8          PullByte();
 
   u16 PushWord(u16 value);
   u16 PullWord();
@@ -71,101 +200,158 @@ class CPU {
     };
   } m_Status;
 
-  s32 m_WaitingCycles;
+  // The zero and negative flags are only built into the status when it is
+  // read, the operations keep the values they come from instead. Z is set when
+  // m_ZeroSource is 0, N is bit 7 of m_NegativeSource. The Z and N bits of
+  // m_Status are left stale
+  u8 m_ZeroSource     = 1;
+  u8 m_NegativeSource = 0;
+
+  inline void SetResult(u8 result) { m_ZeroSource = m_NegativeSource = result; }
+
+  inline u8 GetStatus() const {
+    return (m_Status.value & ~(ZERO_BIT | NEGATIVE_BIT)) | (m_ZeroSource == 0 ? ZERO_BIT : 0) |
+           (m_NegativeSource & NEGATIVE_BIT);
+  }
+
+  // The break bit of a pulled status is dropped, the unused bit always reads 1
+  static constexpr u8 PulledStatus(u8 value) { return (value & ~BREAK_BIT) | UNUSED_BIT; }
+  inline void SetStatus(u8 value) {
+    m_Status.value   = value;
+    m_ZeroSource     = ~value & ZERO_BIT;
+    m_NegativeSource = value;
+  }
+
+  s32 m_WaitingCycles = 0;
 
   constexpr u16 ZERO_PAGE(u8 address, u16 offset) { return (address + offset) % 256; }
 
  private:
-  u16 ZeroPageAddressing(u8 offset = 0);
-  u16 AbsoluteAddressing(u8 offset = 0);
+  u16 ZeroPageAddressing(u8 address, u8 offset = 0);
+  u16 AbsoluteAddressing(u16 address, u8 offset = 0);
 
  public:
-  inline u8 *ACC() { return &m_A; }
-  inline u8 *IMP() { return nullptr; }
-  u8 *       IMM();
-  u8 *       REL();
-  inline u8 *ZER() { return FetchByte(ZeroPageAddressing()); }
-  inline u8 *ZPX() { return FetchByte(ZeroPageAddressing(m_X)); }
-  inline u8 *ZPY() { return FetchByte(ZeroPageAddressing(m_Y)); }
-  inline u8 *ABS() { return FetchByte(AbsoluteAddressing()); }
-  inline u8 *ABX() { return FetchByte(AbsoluteAddressing(m_X)); }
-  inline u8 *ABY() { return FetchByte(AbsoluteAddressing(m_Y)); }
-  u8 *       IND();
-  u8 *       IDX();
-  u8 *       IDY();
+  // Fetch the operand bytes following the opcode
+  template <u8 SIZE>
+  inline u16 FetchOperand() {
+    u16 operand = 0;
+    if constexpr (SIZE >= 1) {
+      operand = Read(m_PC);
+    }
+    if constexpr (SIZE >= 2) {
+      operand |= Read(m_PC + 1) << 8;
+    }
+    m_PC += SIZE;
+    return operand;
+  }
+
+  // The addressing modes return the effective address from the operand bytes,
+  // the program counter already points to the next instruction. The
+  // accumulator and implied modes have no operand
+  inline u16 ACC(u16) { return 0; }
+  inline u16 IMP(u16) { return 0; }
+  inline u16 IMM(u16) { return m_PC - 1; }
+  u16        REL(u16 offset);
+  inline u16 ZER(u16 address) { return ZeroPageAddressing(address); }
+  inline u16 ZPX(u16 address) { return ZeroPageAddressing(address, m_X); }
+  inline u16 ZPY(u16 address) { return ZeroPageAddressing(address, m_Y); }
+  inline u16 ABS(u16 address) { return AbsoluteAddressing(address); }
+  inline u16 ABX(u16 address) { return AbsoluteAddressing(address, m_X); }
+  inline u16 ABY(u16 address) { return AbsoluteAddressing(address, m_Y); }
+  u16        IND(u16 pointer);
+  u16        IDX(u16 pointer);
+  u16        IDY(u16 pointer);
+  // Indexed modes of the stores and the read-modify-write instructions, they
+  // always spend the cycle of the page cross and it is in their base cycles
+  inline u16 ABX_W(u16 address) { return address + m_X; }
+  inline u16 ABY_W(u16 address) { return address + m_Y; }
+  u16        IDY_W(u16 pointer);
 
  private:
   u8   AddOperation(u8 operand);
   void BitwiseOperation(u8 operand, u8 (*operation)(u8, u8));
-  void BranchOperation(bool condition, u8 destination);
+  void BranchOperation(bool condition, u16 destination);
   void CompareOperation(u8 reg, u8 operand);
-  void IncrementOperation(u8 *a);
-  void DecrementOperation(u8 *a);
+  u8   IncrementOperation(u8 value);
+  u8   DecrementOperation(u8 value);
   void LoadOperation(u8 &reg, u8 value);
-  void ReturnOperation(u16 offset = 0);
   void TransferOperation(u8 &source, u8 &destination);
+  u8   ShiftLeftOperation(u8 value);
+  u8   ShiftRightOperation(u8 value);
+  u8   RotateLeftOperation(u8 value);
+  u8   RotateRightOperation(u8 value);
 
  public:
   // to keep all inlined and simple to read we momentarily disable clang format
   // clang-format off
 
-  inline void ADC(u8 *operand) { m_A = AddOperation(*operand); }
-  inline void AND(u8 *operand) { BitwiseOperation(*operand, [](u8 a, u8 b) -> u8 { return a & b; }); }
-  void        ASL(u8 *operand);
-  inline void BCC(u8 *destination) { BranchOperation(!m_Status.C, *destination); }
-  inline void BCS(u8 *destination) { BranchOperation(m_Status.C, *destination); }
-  inline void BEQ(u8 *destination) { BranchOperation(!m_Status.Z, *destination); }
-  void        BIT(u8 *operand);
-  inline void BMI(u8 *destination) { BranchOperation(m_Status.N, *destination); }
-  inline void BNE(u8 *destination) { BranchOperation(m_Status.Z, *destination); }
-  inline void BPL(u8 *destination) { BranchOperation(!m_Status.N, *destination); }
-  void        BRK(u8 *);
-  inline void BVC(u8 *destination) { BranchOperation(!m_Status.V, *destination); }
-  inline void BVS(u8 *destination) { BranchOperation(m_Status.V, *destination); }
-  inline void CLC(u8 *) { m_Status.C = false; }
-  inline void CLD(u8 *) { m_Status.D = false; }
-  inline void CLI(u8 *) { m_Status.I = false; }
-  inline void CLV(u8 *) { m_Status.V = false; }
-  void        CMP(u8 *operand) { CompareOperation(m_A, *operand); }
-  void        CPX(u8 *operand) { CompareOperation(m_X, *operand); }
-  void        CPY(u8 *operand) { CompareOperation(m_Y, *operand); }
-  inline void DEC(u8 *operand) { DecrementOperation(operand); }
-  inline void DEX(u8 *) { DecrementOperation(&m_X); }
-  inline void DEY(u8 *) { DecrementOperation(&m_Y); }
-  inline void EOR(u8 *operand) { BitwiseOperation(*operand, [](u8 a, u8 b) -> u8 { return a ^ b; }); }
-  void        INC(u8 *operand) { IncrementOperation(operand); }
-  void        INX(u8 *) { IncrementOperation(&m_X); }
-  void        INY(u8 *) { IncrementOperation(&m_Y); }
-  inline void JMP(u8 *destination) { m_PC = *destination; }
-  void        JSR(u8 *destination);
-  inline void LDA(u8 *value) { LoadOperation(m_A, *value); }
-  inline void LDX(u8 *value) { LoadOperation(m_X, *value); }
-  inline void LDY(u8 *value) { LoadOperation(m_Y, *value); }
-  void        LSR(u8 *operand);
-  inline void NOP(u8 *) {}
-  inline void ORA(u8 *operand) { BitwiseOperation(*operand, [](u8 a, u8 b) -> u8 { return a | b; }); }
-  inline void PHA(u8 *) { PushByte(m_A); }
-  inline void PHP(u8 *) { PushByte(m_Status.value); }
-  inline void PLA(u8 *) { m_A = *PullByte(); }
-  inline void PLP(u8 *) { m_Status.value = *PullByte(); }
-  void        ROL(u8 *operand);
-  void        ROR(u8 *operand);
-  inline void RTI(u8 *) { ReturnOperation(); }
-  inline void RTS(u8 *) { ReturnOperation(1); }
-  inline void SBC(u8 *operand) { m_A = AddOperation(~(*operand)); }
-  inline void SEC(u8 *) { m_Status.C = 1; }
-  inline void SED(u8 *) { m_Status.D = 1; }
-  inline void SEI(u8 *) { m_Status.I = 1; }
-  inline void STA(u8 *data) { *data = m_A; }
-  inline void STX(u8 *data) { *data = m_X; }
-  inline void STY(u8 *data) { *data = m_Y; }
-  inline void TAX(u8 *) { TransferOperation(m_A, m_X); }
-  inline void TAY(u8 *) { TransferOperation(m_A, m_Y); }
-  inline void TSX(u8 *) { TransferOperation(m_SP, m_X); }
-  inline void TXA(u8 *) { TransferOperation(m_X, m_A); }
-  inline void TXS(u8 *) { TransferOperation(m_X, m_SP); }
-  inline void TYA(u8 *) { TransferOperation(m_Y, m_A); }
-  inline void ILL(u8 *) {}
+  inline void ADC(u16 address) { m_A = AddOperation(Read(address)); }
+  inline void AND(u16 address) { BitwiseOperation(Read(address), [](u8 a, u8 b) -> u8 { return a & b; }); }
+  inline void ASL(u16 address) { Write(address, ShiftLeftOperation(Read(address))); }
+  inline void ASL_A(u16) { m_A = ShiftLeftOperation(m_A); }
+  inline void BCC(u16 destination) { BranchOperation(!m_Status.C, destination); }
+  inline void BCS(u16 destination) { BranchOperation(m_Status.C, destination); }
+  inline void BEQ(u16 destination) { BranchOperation(m_ZeroSource == 0, destination); }
+  void        BIT(u16 address);
+  inline void BMI(u16 destination) { BranchOperation(m_NegativeSource & NEGATIVE_BIT, destination); }
+  inline void BNE(u16 destination) { BranchOperation(m_ZeroSource != 0, destination); }
+  inline void BPL(u16 destination) { BranchOperation(!(m_NegativeSource & NEGATIVE_BIT), destination); }
+  void        BRK(u16);
+  inline void BVC(u16 destination) { BranchOperation(!m_Status.V, destination); }
+  inline void BVS(u16 destination) { BranchOperation(m_Status.V, destination); }
+  inline void CLC(u16) { m_Status.C = false; }
+  inline void CLD(u16) { m_Status.D = false; }
+  inline void CLI(u16) {
+    m_Status.I = false;
+    PollIrq();
+  }
+  inline void CLV(u16) { m_Status.V = false; }
+  void        CMP(u16 address) { CompareOperation(m_A, Read(address)); }
+  void        CPX(u16 address) { CompareOperation(m_X, Read(address)); }
+  void        CPY(u16 address) { CompareOperation(m_Y, Read(address)); }
+  inline void DEC(u16 address) { Write(address, DecrementOperation(Read(address))); }
+  inline void DEX(u16) { m_X = DecrementOperation(m_X); }
+  inline void DEY(u16) { m_Y = DecrementOperation(m_Y); }
+  inline void EOR(u16 address) { BitwiseOperation(Read(address), [](u8 a, u8 b) -> u8 { return a ^ b; }); }
+  void        INC(u16 address) { Write(address, IncrementOperation(Read(address))); }
+  void        INX(u16) { m_X = IncrementOperation(m_X); }
+  void        INY(u16) { m_Y = IncrementOperation(m_Y); }
+  inline void JMP(u16 destination) { m_PC = destination; }
+  void        JSR(u16 destination);
+  inline void LDA(u16 address) { LoadOperation(m_A, Read(address)); }
+  inline void LDX(u16 address) { LoadOperation(m_X, Read(address)); }
+  inline void LDY(u16 address) { LoadOperation(m_Y, Read(address)); }
+  inline void LSR(u16 address) { Write(address, ShiftRightOperation(Read(address))); }
+  inline void LSR_A(u16) { m_A = ShiftRightOperation(m_A); }
+  inline void NOP(u16) {}
+  inline void ORA(u16 address) { BitwiseOperation(Read(address), [](u8 a, u8 b) -> u8 { return a | b; }); }
+  inline void PHA(u16) { PushByte(m_A); }
+  inline void PHP(u16) { PushByte(GetStatus() | BREAK_BITS); }
+  inline void PLA(u16) { LoadOperation(m_A, PullByte()); }
+  inline void PLP(u16) {
+    SetStatus(PulledStatus(PullByte()));
+    PollIrq();
+  }
+  inline void ROL(u16 address) { Write(address, RotateLeftOperation(Read(address))); }
+  inline void ROL_A(u16) { m_A = RotateLeftOperation(m_A); }
+  inline void ROR(u16 address) { Write(address, RotateRightOperation(Read(address))); }
+  inline void ROR_A(u16) { m_A = RotateRightOperation(m_A); }
+  void        RTI(u16);
+  void        RTS(u16);
+  inline void SBC(u16 address) { m_A = AddOperation(~Read(address)); }
+  inline void SEC(u16) { m_Status.C = 1; }
+  inline void SED(u16) { m_Status.D = 1; }
+  inline void SEI(u16) { m_Status.I = 1; }
+  inline void STA(u16 address) { Write(address, m_A); }
+  inline void STX(u16 address) { Write(address, m_X); }
+  inline void STY(u16 address) { Write(address, m_Y); }
+  inline void TAX(u16) { TransferOperation(m_A, m_X); }
+  inline void TAY(u16) { TransferOperation(m_A, m_Y); }
+  inline void TSX(u16) { TransferOperation(m_SP, m_X); }
+  inline void TXA(u16) { TransferOperation(m_X, m_A); }
+  inline void TXS(u16) { m_SP = m_X; }
+  inline void TYA(u16) { TransferOperation(m_Y, m_A); }
+  inline void ILL(u16) {}
 
   // clang-format on
 };
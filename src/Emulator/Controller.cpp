@@ -0,0 +1,31 @@
+#include "Controller.hpp"
+
+namespace EasyNes {
+
+void Controllers::Write(u8 value) {
+  m_Strobe = value & 1;
+  if (m_Strobe) {
+    m_Shifts = m_Buttons;
+  }
+}
+
+void Controllers::SetState(const ControllerState &state) {
+  m_Shifts = state.shifts;
+  m_Strobe = state.strobe;
+}
+
+u8 Controllers::Read(u8 port) {
+  u8 &shift = m_Shifts[port & 1];
+
+  if (m_Strobe) {
+    shift = m_Buttons[port & 1];
+  }
+
+  u8 button = shift & 1;
+  if (!m_Strobe) {
+    shift = (shift >> 1) | 0x80;
+  }
+  return 0x40 | button;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,54 @@
+#ifndef EASYNES_CONTROLLER_HPP
+#define EASYNES_CONTROLLER_HPP
+
+#include <array>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Controller registers, a write to the first one strobes both ports
+constexpr u16 CONTROLLER_PORT_1 = 0x4016;
+constexpr u16 CONTROLLER_PORT_2 = 0x4017;
+
+// Buttons of a standard controller, in the order they are shifted out
+constexpr u8 BUTTON_A      = 0x01;
+constexpr u8 BUTTON_B      = 0x02;
+constexpr u8 BUTTON_SELECT = 0x04;
+constexpr u8 BUTTON_START  = 0x08;
+constexpr u8 BUTTON_UP     = 0x10;
+constexpr u8 BUTTON_DOWN   = 0x20;
+constexpr u8 BUTTON_LEFT   = 0x40;
+constexpr u8 BUTTON_RIGHT  = 0x80;
+
+// Registers of the controllers kept by the saved states, the held buttons come
+// from the host and are not part of them
+struct ControllerState {
+  std::array<u8, 2> shifts = {};
+  bool              strobe = false;
+};
+
+// The two standard controllers. While the strobe is high the shift registers
+// are reloaded with the held buttons, once it is low each read shifts out one
+// button, A first, then ones like the official controllers
+class Controllers {
+ public:
+  inline void SetButtons(u8 port, u8 buttons) { m_Buttons[port & 1] = buttons; }
+  inline u8   GetButtons(u8 port) const { return m_Buttons[port & 1]; }
+
+  inline ControllerState GetState() const { return {m_Shifts, m_Strobe}; }
+  void                   SetState(const ControllerState &state);
+
+  void Write(u8 value);
+  // The upper bits are the open bus, the high byte of the register address
+  u8 Read(u8 port);
+
+ private:
+  std::array<u8, 2> m_Buttons = {};
+  std::array<u8, 2> m_Shifts  = {};
+  bool              m_Strobe  = false;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_CONTROLLER_HPP
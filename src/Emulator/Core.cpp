@@ -3,3 +3,282 @@
 //
 
 #include "Core.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace EasyNes {
+
+constexpr std::array<u8, 4> STATE_MAGIC = {'E', 'N', 'E', 'S'};
+
+// Ppu registers, position in the frame and memories
+constexpr std::size_t PPU_STATE_SIZE = 6 + 2 + 2 + 2 + 2 + 4 + 8 + VRAM_SIZE + OAM_SIZE + PALETTE_SIZE;
+
+// Magic, version, cpu registers and counters, size of the ram, ppu and the
+// cycle it reached, controllers, sizes of the apu and of the mapper states. The
+// ram follows its size, the states of the apu and of the mapper come last
+constexpr std::size_t STATE_SIZE = 4 + 2 + 2 + 5 + 4 + 8 + 8 + 4 + PPU_STATE_SIZE + 8 + 3 + 4 + 4;
+
+namespace {
+
+// The states are little endian whatever the host is
+template <typename T>
+void Serialize(u8 *&output, T value) {
+  for (std::size_t i = 0; i < sizeof(T); i++) {
+    *output++ = static_cast<u64>(value) >> (8 * i);
+  }
+}
+
+template <typename T>
+T Deserialize(const u8 *&input) {
+  u64 value = 0;
+  for (std::size_t i = 0; i < sizeof(T); i++) {
+    value |= static_cast<u64>(*input++) << (8 * i);
+  }
+  return static_cast<T>(value);
+}
+
+// Registers of the $4000 page, the apu, the controllers and the sprite dma
+u8 ReadIo(void *context, u16 address) {
+  Core *core = static_cast<Core *>(context);
+
+  if (address == APU_STATUS) {
+    core->scheduler.CatchUp();
+    return core->apu.ReadStatus();
+  }
+  if (address == CONTROLLER_PORT_1 || address == CONTROLLER_PORT_2) {
+    return core->controllers.Read(address - CONTROLLER_PORT_1);
+  }
+  return PAGE_OF(address);
+}
+
+void WriteIo(void *context, u16 address, u8 value) {
+  Core *core = static_cast<Core *>(context);
+
+  if (address <= APU_LAST_REGISTER || address == APU_STATUS || address == APU_FRAME_COUNTER) {
+    // The write can move the interrupts of the apu
+    core->scheduler.CatchUp();
+    core->apu.WriteRegister(address, value);
+    core->scheduler.Schedule();
+  } else if (address == CONTROLLER_PORT_1) {
+    core->controllers.Write(value);
+  } else if (address == OAM_DMA) {
+    core->scheduler.CatchUp();
+
+    std::array<u8, OAM_SIZE> page;
+    for (u32 i = 0; i < OAM_SIZE; i++) {
+      page[i] = core->bus.Read((value << 8) | i);
+    }
+
+    core->ppu.WriteOam(page.data());
+    core->cpu.Stall(OAM_DMA_CYCLES);
+  }
+}
+
+}  // namespace
+
+Core::Core(CoreMemory memory) : ram(memory == CoreMemory::FLAT ? RAM_SIZE : WORK_RAM_SIZE) {
+  bus.MapMemory(0x00, memory == CoreMemory::FLAT ? 0xFF : 0x1F, ram.Data(), ram.GetSize());
+}
+
+bool Core::Insert(std::shared_ptr<const Rom> cartridge) {
+  std::unique_ptr<Mapper> inserted = cartridge ? MAKE_MAPPER(this, *cartridge) : nullptr;
+  if (!inserted) {
+    return false;
+  }
+
+  mapper = std::move(inserted);
+  rom    = std::move(cartridge);
+
+  if (ram.GetSize() != WORK_RAM_SIZE) {
+    ram.Resize(WORK_RAM_SIZE);
+  }
+  bus.MapMemory(0x00, 0x1F, ram.Data(), WORK_RAM_SIZE);
+  // The slot of the handlers of the previous cartridge is free again
+  bus.Unmap(0x41, 0xFF);
+  if (!mapper->GetPrgRam().empty()) {
+    bus.MapMemory(0x60, 0x7F, mapper->GetPrgRam().data(), mapper->GetPrgRam().size());
+  }
+
+  mapper->Reset();
+  ppu.Reset();
+  apu.Reset();
+  scheduler.Sync(cpu.GetElapsedCycles());
+
+  // The eight registers of the ppu are mirrored up to $3FFF. The cartridge is
+  // taken out when the bus has no slot left for the handlers
+  if (!bus.MapHandlers(0x20, 0x3F, &ppu, &PPU::OnRead, &PPU::OnWrite) ||
+      !bus.MapHandlers(0x40, 0x40, this, &ReadIo, &WriteIo) || !bus.IsPageHandled(0x80)) {
+    mapper.reset();
+    rom.reset();
+    bus.Unmap(0x20, 0xFF);
+    return false;
+  }
+
+  cpu.FlushRecompiler();
+  return true;
+}
+
+bool Core::IsIrqAsserted() const { return mapper && (mapper->IsIrqPending() || apu.IsIrqAsserted()); }
+
+void Core::EnableDebugger(bool enabled) {
+  if (!enabled) {
+    debugger.reset();
+  } else if (!debugger) {
+    debugger = std::make_unique<Debugger>(this);
+  }
+}
+
+u64 Core::RunCycles(u64 cycles) { return scheduler.Run(cycles, UNLIMITED_CYCLES); }
+
+u64 Core::RunInstructions(u64 count) { return scheduler.Run(UNLIMITED_CYCLES, count); }
+
+u64 Core::RunUntil(u16 address, u64 cycles) {
+  return RunUntil([address](const CPU &cpu) { return cpu.GetRegisterPC() == address; }, cycles);
+}
+
+u64 Core::RunFrame() { return scheduler.RunFrame(); }
+
+std::vector<u8> Core::SaveState() const {
+  std::vector<u8> registers = mapper ? mapper->SaveState() : std::vector<u8>();
+  std::vector<u8> sound     = apu.SaveState();
+  std::vector<u8> state(STATE_SIZE + ram.GetSize() + sound.size() + registers.size());
+  u8             *output = state.data();
+  CPUState        saved  = cpu.GetState();
+  PPUState        video  = ppu.GetState();
+  ControllerState ports  = controllers.GetState();
+
+  output = std::copy(STATE_MAGIC.begin(), STATE_MAGIC.end(), output);
+  Serialize(output, STATE_VERSION);
+  Serialize(output, saved.pc);
+  Serialize(output, saved.sp);
+  Serialize(output, saved.a);
+  Serialize(output, saved.x);
+  Serialize(output, saved.y);
+  Serialize(output, saved.status);
+  Serialize(output, saved.waitingCycles);
+  Serialize(output, saved.elapsedCycles);
+  Serialize(output, saved.elapsedInstructions);
+  Serialize(output, static_cast<u32>(ram.GetSize()));
+  output = std::copy(ram.Data(), ram.Data() + ram.GetSize(), output);
+  Serialize(output, video.control);
+  Serialize(output, video.mask);
+  Serialize(output, video.status);
+  Serialize(output, video.oamAddress);
+  Serialize(output, video.latch);
+  Serialize(output, video.readBuffer);
+  Serialize(output, video.v);
+  Serialize(output, video.t);
+  Serialize(output, video.x);
+  Serialize(output, video.w);
+  Serialize(output, video.scanline);
+  Serialize(output, video.dots);
+  Serialize(output, video.frame);
+  output = std::copy(video.vram.begin(), video.vram.end(), output);
+  output = std::copy(video.oam.begin(), video.oam.end(), output);
+  output = std::copy(video.palette.begin(), video.palette.end(), output);
+  Serialize(output, scheduler.GetCycle());
+  Serialize(output, ports.shifts[0]);
+  Serialize(output, ports.shifts[1]);
+  Serialize(output, static_cast<u8>(ports.strobe));
+  Serialize(output, static_cast<u32>(sound.size()));
+  Serialize(output, static_cast<u32>(registers.size()));
+  output = std::copy(sound.begin(), sound.end(), output);
+  std::copy(registers.begin(), registers.end(), output);
+
+  return state;
+}
+
+bool Core::LoadState(const std::vector<u8> &state) {
+  const u8 *input = state.data();
+
+  if (state.size() < STATE_SIZE || !std::equal(STATE_MAGIC.begin(), STATE_MAGIC.end(), input)) {
+    return false;
+  }
+
+  input += STATE_MAGIC.size();
+  if (Deserialize<u16>(input) != STATE_VERSION) {
+    return false;
+  }
+
+  CPUState loaded;
+  loaded.pc                  = Deserialize<u16>(input);
+  loaded.sp                  = Deserialize<u8>(input);
+  loaded.a                   = Deserialize<u8>(input);
+  loaded.x                   = Deserialize<u8>(input);
+  loaded.y                   = Deserialize<u8>(input);
+  loaded.status              = Deserialize<u8>(input);
+  loaded.waitingCycles       = Deserialize<s32>(input);
+  loaded.elapsedCycles       = Deserialize<u64>(input);
+  loaded.elapsedInstructions = Deserialize<u64>(input);
+
+  // A state only loads into a core with the same memory
+  if (Deserialize<u32>(input) != ram.GetSize() || state.size() < STATE_SIZE + ram.GetSize()) {
+    return false;
+  }
+  const u8 *memory = input;
+  input += ram.GetSize();
+
+  PPUState video;
+  video.control    = Deserialize<u8>(input);
+  video.mask       = Deserialize<u8>(input);
+  video.status     = Deserialize<u8>(input);
+  video.oamAddress = Deserialize<u8>(input);
+  video.latch      = Deserialize<u8>(input);
+  video.readBuffer = Deserialize<u8>(input);
+  video.v          = Deserialize<u16>(input);
+  video.t          = Deserialize<u16>(input);
+  video.x          = Deserialize<u8>(input);
+  video.w          = Deserialize<u8>(input);
+  video.scanline   = Deserialize<u16>(input);
+  video.dots       = Deserialize<u32>(input);
+  video.frame      = Deserialize<u64>(input);
+  std::copy_n(input, VRAM_SIZE, video.vram.begin());
+  input += VRAM_SIZE;
+  std::copy_n(input, OAM_SIZE, video.oam.begin());
+  input += OAM_SIZE;
+  std::copy_n(input, PALETTE_SIZE, video.palette.begin());
+  input += PALETTE_SIZE;
+  u64 cycle = Deserialize<u64>(input);
+
+  ControllerState ports;
+  ports.shifts[0] = Deserialize<u8>(input);
+  ports.shifts[1] = Deserialize<u8>(input);
+  ports.strobe    = Deserialize<u8>(input) != 0;
+
+  if (video.scanline >= SCANLINES_PER_FRAME || video.dots >= DOTS_PER_SCANLINE) {
+    return false;
+  }
+
+  u32 soundSize     = Deserialize<u32>(input);
+  u32 registersSize = Deserialize<u32>(input);
+  if (static_cast<u64>(soundSize) + registersSize != state.size() - STATE_SIZE - ram.GetSize()) {
+    return false;
+  }
+
+  // The apu and the mapper are loaded last, they are the only parts that can
+  // still fail. The apu is loaded back if the mapper does
+  std::vector<u8> sound(input, input + soundSize);
+  std::vector<u8> saved(input + soundSize, state.data() + state.size());
+  std::vector<u8> previous = apu.SaveState();
+  if (!apu.LoadState(sound)) {
+    return false;
+  }
+  if (mapper ? !mapper->LoadState(saved) : !saved.empty()) {
+    apu.LoadState(previous);
+    return false;
+  }
+
+  cpu.SetState(loaded);
+  ppu.SetState(video);
+  controllers.SetState(ports);
+  scheduler.Sync(cycle);
+  std::memcpy(ram.Data(), memory, ram.GetSize());
+
+  // The ram was written behind the back of the bus
+  cpu.FlushRecompiler();
+  return true;
+}
+
+}  // namespace EasyNes
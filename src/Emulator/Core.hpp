@@ -5,16 +5,112 @@
 #ifndef EASYNES_CORE_HPP
 #define EASYNES_CORE_HPP
 
+#include <concepts>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "APU.hpp"
+#include "Bus.hpp"
 #include "CPU.hpp"
+#include "Controller.hpp"
+#include "Debugger.hpp"
+#include "Mapper.hpp"
+#include "PPU.hpp"
 #include "RAM.hpp"
+#include "Rom.hpp"
+#include "Scheduler.hpp"
 
 namespace EasyNes {
 
+constexpr u64 UNLIMITED_CYCLES = std::numeric_limits<u64>::max();
+// Cpu cycles in one frame of the NTSC console
+constexpr u64 CYCLES_PER_FRAME = 29781;
+// Bumped whenever the layout of the saved states changes
+constexpr u16 STATE_VERSION = 7;
+// Sprite dma register, the cpu waits while the page is copied
+constexpr u16 OAM_DMA        = 0x4014;
+constexpr u32 OAM_DMA_CYCLES = 513;
+
+// Memory of a core before a cartridge is inserted
+enum class CoreMemory : u8 {
+  // 64 KiB of ram over the whole address space, to run programs on a bare cpu
+  FLAT,
+  // Only the work ram of the console, nothing is allocated
+  CONSOLE,
+};
+
 struct Core {
+  Bus bus;
   CPU cpu{this};
   RAM ram;
+  PPU ppu{this};
+  APU apu{this};
+  // Image of the inserted cartridge, shared with the other cores
+  std::shared_ptr<const Rom> rom;
+  std::unique_ptr<Mapper>    mapper;
+  Scheduler                  scheduler{this};
+  Controllers                controllers;
+  // Nullptr until it is enabled, the core pays nothing for it before
+  std::unique_ptr<Debugger> debugger;
+
+  // The ram is mapped from $0000, over the whole address space when it is
+  // flat, and up to $1FFF otherwise
+  explicit Core(CoreMemory memory = CoreMemory::FLAT);
+
+  // The components point to each other, a core stays at its address. It owns
+  // all of its state and can be handed over to another thread
+  Core(const Core &)            = delete;
+  Core &operator=(const Core &) = delete;
+
+  // Map the banks of the cartridge over the upper half of the address space
+  // through its mapper, and the registers of the ppu, of the dma and of the
+  // controllers. Returns false if the mapper is not supported, or if the bus
+  // has no slot left for the handlers and the cartridge was taken out again
+  bool Insert(std::shared_ptr<const Rom> cartridge);
+
+  // The sources share the irq line, it stays asserted until each of them is
+  // acknowledged
+  bool IsIrqAsserted() const;
+
+  // Disabling the debugger drops its breakpoints and its watchpoints
+  void EnableDebugger(bool enabled);
+
+  // The run functions execute whole instructions back to back through the
+  // scheduler and return the number of elapsed cycles, the last instruction
+  // may overshoot the budget
+
+  u64 RunCycles(u64 cycles);
+  u64 RunInstructions(u64 count);
+  // Run until the program counter reaches the address or the budget is spent
+  u64 RunUntil(u16 address, u64 cycles = UNLIMITED_CYCLES);
+  // Run until predicate(cpu) is true or the budget is spent
+  template <std::predicate<const CPU &> Predicate>
+  u64 RunUntil(Predicate predicate, u64 cycles = UNLIMITED_CYCLES);
+  // Run until the picture of the frame is complete. The ppu can stay behind
+  // the cpu after the other run functions, it is up to date after this one
+  u64 RunFrame();
+
+  // The state holds the cpu, the ram, the ppu, the apu and the registers of
+  // the mapper, the mapping of the bus follows the mapper. The cartridge is not
+  // saved, a state loads into a core with the same cartridge. Loading fails
+  // and leaves the core untouched if the state is not valid
+  std::vector<u8> SaveState() const;
+  bool            LoadState(const std::vector<u8> &state);
 };
 
+template <std::predicate<const CPU &> Predicate>
+u64 Core::RunUntil(Predicate predicate, u64 cycles) {
+  u64 elapsed = 0;
+
+  while (elapsed < cycles && !predicate(std::as_const(cpu))) {
+    elapsed += scheduler.RunInstruction(cycles - elapsed);
+  }
+
+  return elapsed;
+}
+
 }  // namespace EasyNes
 
 #endif  // EASYNES_CORE_HPP
@@ -0,0 +1,212 @@
+#include "Debugger.hpp"
+
+#include <bitset>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u8 JSR_OPCODE = 0x20;
+constexpr u8 JSR_SIZE   = 3;
+
+// A stack full of return addresses
+constexpr std::size_t MAX_CALLS = 128;
+
+}  // namespace
+
+Debugger::Debugger(Core *core) : m_Core(core) {
+  m_TrapSlot = m_Core->bus.AddTrap(this, &Debugger::OnRead, &Debugger::OnWrite, &Debugger::OnFetch);
+  m_Calls.reserve(MAX_CALLS);
+}
+
+Debugger::~Debugger() { m_Core->bus.RemoveTrap(m_TrapSlot); }
+
+u32 Debugger::AddBreakpoint(u16 address, DebugCondition condition) {
+  if (m_TrapSlot == NO_TRAP_SLOT) {
+    return 0;
+  }
+
+  m_Breakpoints.push_back({m_NextId, address, std::move(condition)});
+  UpdateTraps();
+  return m_NextId++;
+}
+
+u32 Debugger::AddWatchpoint(u16 first, u16 last, bool read, bool write, DebugCondition condition) {
+  if (m_TrapSlot == NO_TRAP_SLOT) {
+    return 0;
+  }
+
+  m_Watchpoints.push_back({m_NextId, first, last, read, write, std::move(condition)});
+  UpdateTraps();
+  return m_NextId++;
+}
+
+void Debugger::Remove(u32 id) {
+  std::erase_if(m_Breakpoints, [id](const Breakpoint &breakpoint) { return breakpoint.id == id; });
+  std::erase_if(m_Watchpoints, [id](const Watchpoint &watchpoint) { return watchpoint.id == id; });
+  UpdateTraps();
+}
+
+void Debugger::Clear() {
+  m_Breakpoints.clear();
+  m_Watchpoints.clear();
+  UpdateTraps();
+}
+
+DebugEvent Debugger::Run(u64 cycles) { return Execute(cycles, UNLIMITED_CYCLES); }
+
+DebugEvent Debugger::Step() {
+  DebugEvent event = Execute(UNLIMITED_CYCLES, 1);
+
+  if (event.reason == DebugReason::NONE) {
+    event = {DebugReason::STEP, 0, m_Core->cpu.GetRegisterPC()};
+  }
+  return event;
+}
+
+DebugEvent Debugger::StepOver(u64 cycles) {
+  u16       pc     = m_Core->cpu.GetRegisterPC();
+  const u8 *memory = m_Core->bus.GetPageMemory(PAGE_OF(pc));
+
+  // The subroutine returns to the instruction behind the JSR, with the stack
+  // pointer it had before the call
+  if (memory && memory[pc % PAGE_SIZE] == JSR_OPCODE) {
+    return RunTo(pc + JSR_SIZE, m_Core->cpu.GetRegisterSP(), cycles);
+  }
+  return Step();
+}
+
+DebugEvent Debugger::StepOut(u64 cycles) {
+  if (!m_Calls.empty()) {
+    return RunTo(m_Calls.back().address, m_Calls.back().sp, cycles);
+  }
+
+  u8        sp    = m_Core->cpu.GetRegisterSP();
+  const u8 *stack = m_Core->bus.GetPageMemory(PAGE_OF(STACK_BASE));
+
+  if (!stack) {
+    return Step();
+  }
+
+  // The JSR pushed the address of its last byte, the return pulls it back
+  u16 address = stack[u8(sp + 1)] | (stack[u8(sp + 2)] << 8);
+  return RunTo(address + 1, sp + 2, cycles);
+}
+
+DebugEvent Debugger::Execute(u64 cycles, u64 instructions) {
+  CPU &cpu = m_Core->cpu;
+
+  m_Event             = {};
+  m_Running           = true;
+  m_ResumeAddress     = cpu.GetRegisterPC();
+  m_ResumeInstruction = cpu.GetElapsedInstructions();
+
+  m_Core->scheduler.Run(cycles, instructions);
+
+  m_Running = false;
+  return m_Event;
+}
+
+DebugEvent Debugger::RunTo(u16 address, u8 sp, u64 cycles) {
+  // The breakpoint could never stop the run
+  if (m_TrapSlot == NO_TRAP_SLOT) {
+    return Step();
+  }
+
+  m_Breakpoints.push_back({0, address, [sp](const Core &core) { return core.cpu.GetRegisterSP() == sp; }});
+  UpdateTraps();
+
+  DebugEvent event = Execute(cycles, UNLIMITED_CYCLES);
+
+  Remove(0);
+  return event;
+}
+
+bool Debugger::Hit(const DebugEvent &event, const DebugCondition &condition) {
+  if (condition && !condition(*m_Core)) {
+    return false;
+  }
+  // The steps end on their own breakpoint, it is not reported
+  if (event.id != 0 && m_Callback && !m_Callback(event)) {
+    return false;
+  }
+
+  m_Event = event;
+  return true;
+}
+
+void Debugger::Watch(DebugReason reason, u16 address, u8 value) {
+  // The first hit of the instruction is the one reported
+  if (!m_Running || m_Event.reason != DebugReason::NONE) {
+    return;
+  }
+
+  for (const Watchpoint &watchpoint : m_Watchpoints) {
+    bool watched = reason == DebugReason::READ ? watchpoint.read : watchpoint.write;
+
+    if (watched && address >= watchpoint.first && address <= watchpoint.last &&
+        Hit({reason, watchpoint.id, address, value}, watchpoint.condition)) {
+      // The instruction making the access completes first
+      m_Core->cpu.Stop();
+      return;
+    }
+  }
+}
+
+void Debugger::UpdateTraps() {
+  std::bitset<PAGE_COUNT> reads;
+  std::bitset<PAGE_COUNT> writes;
+  std::bitset<PAGE_COUNT> fetches;
+
+  for (const Breakpoint &breakpoint : m_Breakpoints) {
+    fetches[PAGE_OF(breakpoint.address)] = true;
+  }
+  for (const Watchpoint &watchpoint : m_Watchpoints) {
+    for (u32 page = PAGE_OF(watchpoint.first); page <= PAGE_OF(watchpoint.last); page++) {
+      reads[page]  = reads[page] || watchpoint.read;
+      writes[page] = writes[page] || watchpoint.write;
+    }
+  }
+
+  Bus &bus = m_Core->bus;
+  for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+    bus.TrapReads(m_TrapSlot, page, reads[page]);
+    bus.TrapWrites(m_TrapSlot, page, writes[page]);
+    bus.TrapFetches(m_TrapSlot, page, fetches[page]);
+  }
+}
+
+void Debugger::OnRead(void *context, u16 address) {
+  Debugger *debugger = static_cast<Debugger *>(context);
+  const u8 *memory   = debugger->m_Core->bus.GetPageMemory(PAGE_OF(address));
+
+  // The handlers may have side effects, their value is not peeked
+  debugger->Watch(DebugReason::READ, address, memory ? memory[address % PAGE_SIZE] : 0);
+}
+
+void Debugger::OnWrite(void *context, u16 address, u8 value) {
+  static_cast<Debugger *>(context)->Watch(DebugReason::WRITE, address, value);
+}
+
+bool Debugger::OnFetch(void *context, u16 address) {
+  Debugger  *debugger = static_cast<Debugger *>(context);
+  const CPU &cpu      = debugger->m_Core->cpu;
+
+  if (!debugger->m_Running ||
+      (address == debugger->m_ResumeAddress && cpu.GetElapsedInstructions() == debugger->m_ResumeInstruction)) {
+    return false;
+  }
+
+  for (const Breakpoint &breakpoint : debugger->m_Breakpoints) {
+    DebugReason reason = breakpoint.id != 0 ? DebugReason::BREAKPOINT : DebugReason::STEP;
+
+    if (breakpoint.address == address && debugger->Hit({reason, breakpoint.id, address}, breakpoint.condition)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,147 @@
+#ifndef EASYNES_DEBUGGER_HPP
+#define EASYNES_DEBUGGER_HPP
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+enum class DebugReason : u8 {
+  // The budget of the run is spent
+  NONE,
+  BREAKPOINT,
+  READ,
+  WRITE,
+  // A step is complete
+  STEP,
+};
+
+// What ended a run of the debugger
+struct DebugEvent {
+  DebugReason reason = DebugReason::NONE;
+  // Breakpoint or watchpoint hit, 0 for the steps
+  u32 id      = 0;
+  u16 address = 0;
+  // Value written, or the value of the memory for the reads of memory pages
+  u8 value = 0;
+};
+
+// Checked on every hit, the hit is ignored when it is false
+using DebugCondition = std::function<bool(const Core &core)>;
+// Called on the hits whose condition holds, false keeps the run going
+using DebugCallback = std::function<bool(const DebugEvent &event)>;
+
+// Breakpoints and watchpoints through the traps of the bus, only the pages
+// holding them leave the fast path and the rest of the address space runs at
+// full speed. A breakpoint stops in front of its instruction, a watchpoint
+// after the instruction making the access. They only act during the runs of
+// the debugger, the other runs of the core go through them. The recompiled
+// blocks and the idle loop skips are off while the debugger is enabled. When
+// the bus has no trap slot left for the debugger, nothing can be added and
+// the steps over and out execute a single instruction
+class Debugger {
+ public:
+  explicit Debugger(Core *core);
+  ~Debugger();
+
+  Debugger(const Debugger &)            = delete;
+  Debugger &operator=(const Debugger &) = delete;
+
+  // The ids are never 0, 0 is returned when the bus had no trap slot left for
+  // the debugger
+  u32 AddBreakpoint(u16 address, DebugCondition condition = {});
+  // Watch the accesses to [first, last], the operands of the instructions are
+  // read through the bus but their opcodes are not
+  u32  AddWatchpoint(u16 first, u16 last, bool read, bool write, DebugCondition condition = {});
+  void Remove(u32 id);
+  void Clear();
+
+  inline void SetCallback(DebugCallback callback) { m_Callback = std::move(callback); }
+
+  // Run until a hit or until the budget is spent, a run never stops in front
+  // of its first instruction
+  DebugEvent Run(u64 cycles);
+  // Execute one instruction, into the subroutines and the interrupts
+  DebugEvent Step();
+  // Execute the whole subroutine called by a JSR, or a single instruction
+  DebugEvent StepOver(u64 cycles);
+  // Run until the innermost subroutine or interrupt returns. The calls are
+  // followed like the shadow stack of the profiler, so the values the routine
+  // pushed do not matter. For the calls made before the debugger was enabled,
+  // the return address is read from the top of the stack
+  DebugEvent StepOut(u64 cycles);
+
+  // Called by the cpu, address is where the call returns and sp the stack
+  // pointer before the return address is pushed. The calls at or below it
+  // lost their return address already
+  inline void OnCall(u16 address, u8 sp) {
+    OnReturn(sp);
+    m_Calls.push_back({address, sp});
+  }
+
+  // sp is the stack pointer once the return address is pulled
+  inline void OnReturn(u8 sp) {
+    while (!m_Calls.empty() && m_Calls.back().sp <= sp) {
+      m_Calls.pop_back();
+    }
+  }
+
+  inline void OnReset() { m_Calls.clear(); }
+
+ private:
+  struct Call {
+    u16 address;
+    u8  sp;
+  };
+
+  struct Breakpoint {
+    u32            id;
+    u16            address;
+    DebugCondition condition;
+  };
+
+  struct Watchpoint {
+    u32            id;
+    u16            first;
+    u16            last;
+    bool           read;
+    bool           write;
+    DebugCondition condition;
+  };
+
+  DebugEvent Execute(u64 cycles, u64 instructions);
+  // Run until the stack pointer is back to sp at the address, through a
+  // breakpoint with the id 0
+  DebugEvent RunTo(u16 address, u8 sp, u64 cycles);
+  bool       Hit(const DebugEvent &event, const DebugCondition &condition);
+  void       Watch(DebugReason reason, u16 address, u8 value);
+  void       UpdateTraps();
+
+  static void OnRead(void *context, u16 address);
+  static void OnWrite(void *context, u16 address, u8 value);
+  static bool OnFetch(void *context, u16 address);
+
+  Core                   *m_Core;
+  u8                      m_TrapSlot;
+  u32                     m_NextId = 1;
+  std::vector<Call>       m_Calls;
+  std::vector<Breakpoint> m_Breakpoints;
+  std::vector<Watchpoint> m_Watchpoints;
+  DebugCallback           m_Callback;
+
+  // Set during the runs of the debugger
+  bool       m_Running = false;
+  DebugEvent m_Event;
+  // First instruction of the run, it goes through its breakpoint
+  u16 m_ResumeAddress     = 0;
+  u64 m_ResumeInstruction = 0;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_DEBUGGER_HPP
@@ -0,0 +1,189 @@
+#include "IdleLoop.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "Core.hpp"
+#include "Instructions.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+enum class Kind : u8 {
+  // Writes, the stack, the interrupt mask and the indirect jumps end the analysis
+  OTHER,
+  // Reads its operand, a register or the status follows the value
+  READ,
+  // Only works on the registers
+  REGISTER,
+  BRANCH,
+  JUMP,
+};
+
+Kind Classify(const Instruction &instruction) {
+  auto op = instruction.operation;
+
+  // clang-format off
+  if (op == &CPU::ADC || op == &CPU::AND || op == &CPU::BIT || op == &CPU::CMP || op == &CPU::CPX ||
+      op == &CPU::CPY || op == &CPU::EOR || op == &CPU::LDA || op == &CPU::LDX || op == &CPU::LDY ||
+      op == &CPU::ORA || op == &CPU::SBC) return Kind::READ;
+  if (op == &CPU::ASL_A || op == &CPU::LSR_A || op == &CPU::ROL_A || op == &CPU::ROR_A || op == &CPU::CLC ||
+      op == &CPU::CLD || op == &CPU::CLV || op == &CPU::SEC || op == &CPU::SED || op == &CPU::DEX ||
+      op == &CPU::DEY || op == &CPU::INX || op == &CPU::INY || op == &CPU::TAX || op == &CPU::TAY ||
+      op == &CPU::TSX || op == &CPU::TXA || op == &CPU::TXS || op == &CPU::TYA || op == &CPU::NOP) return Kind::REGISTER;
+  if (op == &CPU::BCC || op == &CPU::BCS || op == &CPU::BEQ || op == &CPU::BMI || op == &CPU::BNE ||
+      op == &CPU::BPL || op == &CPU::BVC || op == &CPU::BVS) return Kind::BRANCH;
+  if (op == &CPU::JMP && instruction.addressing == &CPU::ABS) return Kind::JUMP;
+  // clang-format on
+
+  return Kind::OTHER;
+}
+
+// Reading the memory has no side effect, reading the ppu status again has none
+// once the vertical blank is acknowledged. The other registers are not polled
+bool IsIdleRead(const Bus &bus, const Instruction &instruction, u16 operand, bool &ppu) {
+  auto mode = instruction.addressing;
+
+  if (mode == &CPU::IMM) {
+    return true;
+  }
+  if (mode == &CPU::ZER || mode == &CPU::ZPX || mode == &CPU::ZPY) {
+    return bus.GetPageMemory(0x00);
+  }
+  if (mode == &CPU::ABS) {
+    if (bus.GetPageMemory(PAGE_OF(operand))) {
+      return true;
+    }
+    if ((operand & 0xE007) == PPU_STATUS) {
+      ppu = true;
+      return true;
+    }
+    return false;
+  }
+  if (mode == &CPU::ABX || mode == &CPU::ABY) {
+    // The index can reach the next page
+    return bus.GetPageMemory(PAGE_OF(operand)) && bus.GetPageMemory(PAGE_OF(operand + 0xFF));
+  }
+
+  return false;
+}
+
+}  // namespace
+
+u64 IdleLoopDetector::OnJumpBack(CPU &cpu, u64 cycles, u64 instructions) {
+  Visit visit = {cpu.m_PC,
+                 cpu.m_A,
+                 cpu.m_X,
+                 cpu.m_Y,
+                 cpu.m_SP,
+                 cpu.GetStatus(),
+                 cpu.m_ElapsedCycles,
+                 cpu.m_ElapsedInstructions,
+                 cpu.m_Core->ppu.GetStatusChanges()};
+  Visit last  = std::exchange(m_Last, visit);
+
+  if (visit.pc != last.pc) {
+    return 0;
+  }
+
+  u64  length = visit.instruction - last.instruction;
+  bool same   = visit.a == last.a && visit.x == last.x && visit.y == last.y && visit.sp == last.sp &&
+                visit.status == last.status;
+
+  // An interrupt in the middle of the iteration adds its instructions
+  bool ppu = false;
+  if (!same || cpu.m_WaitingCycles != 0 || !Analyze(cpu, visit.pc, length, ppu)) {
+    return 0;
+  }
+
+  // Reading the status while the vertical blank is set clears it, the next
+  // read would not see the same value
+  if (ppu && visit.statusChanges != last.statusChanges) {
+    return 0;
+  }
+
+  u64 period  = visit.cycle - last.cycle;
+  u64 horizon = cpu.m_Core->scheduler.GetNextChange(ppu);
+  if (horizon <= visit.cycle) {
+    return 0;
+  }
+
+  // Every read of the skipped iterations comes before the change
+  u64 iterations = std::min({(horizon - visit.cycle) / period, cycles / period, instructions / length});
+  if (iterations == 0) {
+    return 0;
+  }
+
+  u64 skipped = iterations * period;
+  cpu.m_ElapsedCycles += skipped;
+  cpu.m_ElapsedInstructions += iterations * length;
+  m_Last.cycle += skipped;
+  m_Last.instruction += iterations * length;
+
+  m_Stats.skips++;
+  m_Stats.skippedCycles += skipped;
+  m_Stats.skippedInstructions += iterations * length;
+  return skipped;
+}
+
+void IdleLoopDetector::Reset() { m_Last = {}; }
+
+bool IdleLoopDetector::Analyze(const CPU &cpu, u16 address, u64 length, bool &ppu) const {
+  const Bus &bus = *cpu.m_Bus;
+  u16        pc  = address;
+
+  // The code read from a handler could change, the loop must be in memory
+  auto peek = [&](u16 at, u8 &byte) {
+    const u8 *memory = bus.GetPageMemory(PAGE_OF(at));
+    if (memory) {
+      byte = memory[at % PAGE_SIZE];
+    }
+    return memory != nullptr;
+  };
+
+  for (u64 i = 0; i < length; i++) {
+    u8 opcode;
+    if (!peek(pc, opcode)) {
+      return false;
+    }
+
+    u8  size    = 1 + OPERAND_SIZES[opcode];
+    u16 operand = 0;
+    for (u8 j = 1; j < size; j++) {
+      u8 byte;
+      if (!peek(pc + j, byte)) {
+        return false;
+      }
+      operand |= byte << (8 * (j - 1));
+    }
+
+    const Instruction &instruction = INSTRUCTION_SET[opcode];
+    bool               end         = i + 1 == length;
+    pc += size;
+
+    switch (Classify(instruction)) {
+      case Kind::READ:
+        if (end || !IsIdleRead(bus, instruction, operand, ppu)) {
+          return false;
+        }
+        break;
+      case Kind::REGISTER:
+        if (end) {
+          return false;
+        }
+        break;
+      case Kind::BRANCH:
+        // Only the last instruction of the block jumps
+        return end && u16(pc + static_cast<s8>(operand)) == address;
+      case Kind::JUMP:
+        return end && operand == address;
+      case Kind::OTHER:
+        return false;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace EasyNes
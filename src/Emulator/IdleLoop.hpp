@@ -0,0 +1,60 @@
+#ifndef EASYNES_IDLE_LOOP_HPP
+#define EASYNES_IDLE_LOOP_HPP
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+class CPU;
+
+struct IdleLoopStats {
+  // Times a loop was fast-forwarded
+  u64 skips;
+  u64 skippedCycles;
+  u64 skippedInstructions;
+};
+
+// Recognize the loops polling memory without changing anything, like a
+// BIT $2002 / BPL or a JMP to itself, and fast-forward them. The loop is a
+// basic block of reads and register operations ending with a jump back to its
+// start. Once a whole iteration leaves the registers as they were, and the
+// ppu status it reads did not change meanwhile, every following iteration is
+// the same until the memory it reads can change: the next event of the
+// scheduler, or the next scanline changing the status for the loops reading
+// it. The whole iterations before that are skipped and their cycles and
+// instructions credited at once, the timing stays exact
+class IdleLoopDetector {
+ public:
+  // Called when the cpu jumped back, to the start of the instruction or before.
+  // Returns the skipped cycles, within the budgets of the caller
+  u64 OnJumpBack(CPU &cpu, u64 cycles, u64 instructions);
+  // Forget the loop in progress, after the cpu state was replaced
+  void Reset();
+
+  inline const IdleLoopStats &GetStats() const { return m_Stats; }
+
+ private:
+  // The loop is a basic block of length instructions at the address, the
+  // loop reads the ppu status if ppu is set
+  bool Analyze(const CPU &cpu, u16 address, u64 length, bool &ppu) const;
+
+  struct Visit {
+    u16 pc;
+    u8  a;
+    u8  x;
+    u8  y;
+    u8  sp;
+    u8  status;
+    u64 cycle;
+    u64 instruction;
+    u64 statusChanges;
+  };
+
+  Visit m_Last = {};
+
+  IdleLoopStats m_Stats = {};
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_IDLE_LOOP_HPP
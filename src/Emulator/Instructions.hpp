@@ -2,15 +2,17 @@
 #define EASYNES_INSTRUCTIONS_HPP
 
 #include <array>
+#include <utility>
 
 #include "CPU.hpp"
+#include "Core.hpp"
 
 namespace EasyNes {
   
 struct Instruction {
   u8 cycles = 0;
-  u8* (CPU::*addressing)(void) = &CPU::IMP;
-  void (CPU::*operation)(u8*) = &CPU::ILL;
+  u16 (CPU::*addressing)(u16) = &CPU::IMP;
+  void (CPU::*operation)(u16) = &CPU::ILL;
 };
   
 // clang-format off
@@ -33,7 +35,7 @@ constexpr Instruction INSTRUCTION_SET[256] = {
     [0x3D] = {4, &CPU::ABX, &CPU::AND}, [0x39] = {4, &CPU::ABY, &CPU::AND},
     [0x21] = {6, &CPU::IDX, &CPU::AND}, [0x31] = {5, &CPU::IDY, &CPU::AND},
 
-    [0x0A] = {2, &CPU::IMP, &CPU::ASL}, [0x06] = {5, &CPU::ZER, &CPU::ASL},
+    [0x0A] = {2, &CPU::ACC, &CPU::ASL_A}, [0x06] = {5, &CPU::ZER, &CPU::ASL},
     [0x16] = {6, &CPU::ZPX, &CPU::ASL}, [0x0E] = {6, &CPU::ABS, &CPU::ASL},
     [0x1E] = {7, &CPU::ABX, &CPU::ASL},
 
@@ -42,7 +44,8 @@ constexpr Instruction INSTRUCTION_SET[256] = {
 
     [0x24] = {3, &CPU::ZER, &CPU::BIT}, [0x2C] = {4, &CPU::ABS, &CPU::BIT},
 
-    [0xD0] = {2, &CPU::REL, &CPU::BNE}, [0x10] = {2, &CPU::REL, &CPU::BPL},
+    [0x30] = {2, &CPU::REL, &CPU::BMI}, [0xD0] = {2, &CPU::REL, &CPU::BNE},
+    [0x10] = {2, &CPU::REL, &CPU::BPL},
 
     [0x00] = {7, &CPU::IMP, &CPU::BRK},
 
@@ -94,7 +97,7 @@ constexpr Instruction INSTRUCTION_SET[256] = {
     [0xB4] = {4, &CPU::ZPX, &CPU::LDY}, [0xAC] = {4, &CPU::ABS, &CPU::LDY},
     [0xBC] = {4, &CPU::ABX, &CPU::LDY},
 
-    [0x4A] = {2, &CPU::IMM, &CPU::LSR}, [0x46] = {5, &CPU::ZER, &CPU::LSR},
+    [0x4A] = {2, &CPU::ACC, &CPU::LSR_A}, [0x46] = {5, &CPU::ZER, &CPU::LSR},
     [0x56] = {6, &CPU::ZPX, &CPU::LSR}, [0x4E] = {6, &CPU::ABS, &CPU::LSR},
     [0x5E] = {7, &CPU::ABX, &CPU::LSR},
 
@@ -109,11 +112,11 @@ constexpr Instruction INSTRUCTION_SET[256] = {
 
     [0x68] = {4, &CPU::IMP, &CPU::PLA}, [0x28] = {4, &CPU::IMP, &CPU::PLP},
 
-    [0X2A] = {2, &CPU::IMM, &CPU::ROL}, [0x26] = {5, &CPU::ZER, &CPU::ROL},
+    [0X2A] = {2, &CPU::ACC, &CPU::ROL_A}, [0x26] = {5, &CPU::ZER, &CPU::ROL},
     [0x36] = {6, &CPU::ZPX, &CPU::ROL}, [0x2E] = {6, &CPU::ABS, &CPU::ROL},
     [0x3E] = {7, &CPU::ABX, &CPU::ROL},
 
-    [0X6A] = {2, &CPU::IMM, &CPU::ROR}, [0x66] = {5, &CPU::ZER, &CPU::ROR},
+    [0X6A] = {2, &CPU::ACC, &CPU::ROR_A}, [0x66] = {5, &CPU::ZER, &CPU::ROR},
     [0x76] = {6, &CPU::ZPX, &CPU::ROR}, [0x6E] = {6, &CPU::ABS, &CPU::ROR},
     [0x7E] = {7, &CPU::ABX, &CPU::ROR},
 
@@ -146,9 +149,315 @@ constexpr Instruction INSTRUCTION_SET[256] = {
   #pragma GCC diagnostic pop
 #endif
 
-  
-}  // namespace EasyNes
+// clang-format on
+
+// Number of operand bytes following the opcode
+constexpr u8 OPERAND_SIZE(u16 (CPU::*addressing)(u16)) {
+  if (addressing == &CPU::ACC || addressing == &CPU::IMP) {
+    return 0;
+  }
+  if (addressing == &CPU::ABS || addressing == &CPU::ABX || addressing == &CPU::ABY || addressing == &CPU::IND) {
+    return 2;
+  }
+  return 1;
+}
+
+template <typename Member>
+struct MemberName {
+  Member      member;
+  const char *name;
+};
+
+// clang-format off
+
+constexpr MemberName<u16 (CPU::*)(u16)> ADDRESSING_NAMES[] = {
+    {&CPU::IMP, "IMP"}, {&CPU::ACC, "ACC"}, {&CPU::IMM, "IMM"}, {&CPU::ZER, "ZER"}, {&CPU::ZPX, "ZPX"},
+    {&CPU::ZPY, "ZPY"}, {&CPU::ABS, "ABS"}, {&CPU::ABX, "ABX"}, {&CPU::ABY, "ABY"}, {&CPU::IND, "IND"},
+    {&CPU::IDX, "IDX"}, {&CPU::IDY, "IDY"}, {&CPU::REL, "REL"}};
+
+constexpr MemberName<void (CPU::*)(u16)> OPERATION_NAMES[] = {
+    {&CPU::ADC, "ADC"}, {&CPU::AND, "AND"}, {&CPU::ASL, "ASL"}, {&CPU::ASL_A, "ASL"}, {&CPU::BCC, "BCC"},
+    {&CPU::BCS, "BCS"}, {&CPU::BEQ, "BEQ"}, {&CPU::BIT, "BIT"}, {&CPU::BMI, "BMI"}, {&CPU::BNE, "BNE"},
+    {&CPU::BPL, "BPL"}, {&CPU::BRK, "BRK"}, {&CPU::BVC, "BVC"}, {&CPU::BVS, "BVS"}, {&CPU::CLC, "CLC"},
+    {&CPU::CLD, "CLD"}, {&CPU::CLI, "CLI"}, {&CPU::CLV, "CLV"}, {&CPU::CMP, "CMP"}, {&CPU::CPX, "CPX"},
+    {&CPU::CPY, "CPY"}, {&CPU::DEC, "DEC"}, {&CPU::DEX, "DEX"}, {&CPU::DEY, "DEY"}, {&CPU::EOR, "EOR"},
+    {&CPU::INC, "INC"}, {&CPU::INX, "INX"}, {&CPU::INY, "INY"}, {&CPU::JMP, "JMP"}, {&CPU::JSR, "JSR"},
+    {&CPU::LDA, "LDA"}, {&CPU::LDX, "LDX"}, {&CPU::LDY, "LDY"}, {&CPU::LSR, "LSR"}, {&CPU::LSR_A, "LSR"},
+    {&CPU::NOP, "NOP"}, {&CPU::ORA, "ORA"}, {&CPU::PHA, "PHA"}, {&CPU::PHP, "PHP"}, {&CPU::PLA, "PLA"},
+    {&CPU::PLP, "PLP"}, {&CPU::ROL, "ROL"}, {&CPU::ROL_A, "ROL"}, {&CPU::ROR, "ROR"}, {&CPU::ROR_A, "ROR"},
+    {&CPU::RTI, "RTI"}, {&CPU::RTS, "RTS"}, {&CPU::SBC, "SBC"}, {&CPU::SEC, "SEC"}, {&CPU::SED, "SED"},
+    {&CPU::SEI, "SEI"}, {&CPU::STA, "STA"}, {&CPU::STX, "STX"}, {&CPU::STY, "STY"}, {&CPU::TAX, "TAX"},
+    {&CPU::TAY, "TAY"}, {&CPU::TSX, "TSX"}, {&CPU::TXA, "TXA"}, {&CPU::TXS, "TXS"}, {&CPU::TYA, "TYA"}};
 
 // clang-format on
 
+// Names of the operation and the addressing mode of an opcode, the opcodes
+// missing from the instruction set are named "???"
+constexpr const char *MNEMONIC(u8 opcode) {
+  for (const auto &[operation, name] : OPERATION_NAMES) {
+    if (operation == INSTRUCTION_SET[opcode].operation) {
+      return name;
+    }
+  }
+  return "???";
+}
+
+constexpr const char *ADDRESSING_NAME(u8 opcode) {
+  for (const auto &[addressing, name] : ADDRESSING_NAMES) {
+    if (addressing == INSTRUCTION_SET[opcode].addressing) {
+      return name;
+    }
+  }
+  return "???";
+}
+
+// What an operation does with its effective address
+enum class OperandAccess : u8 {
+  NONE,
+  READ,
+  WRITE,
+  // Read, then written back modified
+  MODIFY,
+};
+
+constexpr OperandAccess OPERAND_ACCESS(const Instruction &instruction) {
+  auto op   = instruction.operation;
+  auto mode = instruction.addressing;
+
+  if (mode == &CPU::ACC || mode == &CPU::IMP || mode == &CPU::REL || op == &CPU::JMP || op == &CPU::JSR ||
+      op == &CPU::ILL) {
+    return OperandAccess::NONE;
+  }
+  if (op == &CPU::STA || op == &CPU::STX || op == &CPU::STY) {
+    return OperandAccess::WRITE;
+  }
+  if (op == &CPU::ASL || op == &CPU::LSR || op == &CPU::ROL || op == &CPU::ROR || op == &CPU::INC ||
+      op == &CPU::DEC) {
+    return OperandAccess::MODIFY;
+  }
+  return OperandAccess::READ;
+}
+
+// The stores and the read-modify-write instructions always spend the cycle of
+// the page cross, their indexed modes have no penalty
+constexpr u16 (CPU::*EXECUTED_ADDRESSING(const Instruction &instruction))(u16) {
+  OperandAccess access = OPERAND_ACCESS(instruction);
+
+  if (access == OperandAccess::WRITE || access == OperandAccess::MODIFY) {
+    if (instruction.addressing == &CPU::ABX) {
+      return &CPU::ABX_W;
+    }
+    if (instruction.addressing == &CPU::ABY) {
+      return &CPU::ABY_W;
+    }
+    if (instruction.addressing == &CPU::IDY) {
+      return &CPU::IDY_W;
+    }
+  }
+  return instruction.addressing;
+}
+
+// Handler of a single opcode, the addressing and the operation are read from
+// the instruction set at compile time so both are inlined into one function
+template <u8 OPCODE>
+u8 ExecuteOpcode(CPU &cpu) {
+  constexpr Instruction instruction = INSTRUCTION_SET[OPCODE];
+  constexpr auto        addressing  = EXECUTED_ADDRESSING(instruction);
+  constexpr u8          SIZE        = OPERAND_SIZE(instruction.addressing);
+
+  u16 address = (cpu.*addressing)(cpu.FetchOperand<SIZE>());
+  (cpu.*instruction.operation)(address);
+
+  return instruction.cycles;
+}
+
+using OpcodeHandler = u8 (*)(CPU &);
+
+template <std::size_t... OPCODES>
+constexpr std::array<OpcodeHandler, 256> MAKE_DISPATCH_TABLE(std::index_sequence<OPCODES...>) {
+  return {&ExecuteOpcode<OPCODES>...};
+}
+
+template <std::size_t... OPCODES>
+constexpr std::array<u8, 256> MAKE_OPERAND_SIZES(std::index_sequence<OPCODES...>) {
+  return {OPERAND_SIZE(INSTRUCTION_SET[OPCODES].addressing)...};
+}
+
+// Bus cycles of the cycle policy. Every cycle of an instruction reads or
+// writes the bus, the elapsed cycles of the cpu move past each access once it
+// is done. The operations make the last access themselves, the accesses of the
+// stack and of the vectors, which never reach a device, share its cycle. JSR
+// pushes before its last read, its pushes have their own cycles
+struct MicroOps {
+  static inline u8 Read(CPU &cpu, u16 address) {
+    u8 value = cpu.Read(address);
+    cpu.m_ElapsedCycles++;
+    return value;
+  }
+
+  static inline void Write(CPU &cpu, u16 address, u8 value) {
+    cpu.Write(address, value);
+    cpu.m_ElapsedCycles++;
+  }
+
+  static inline u16 FetchWord(CPU &cpu) {
+    u8 lo = Read(cpu, cpu.m_PC++);
+    u8 hi = Read(cpu, cpu.m_PC++);
+    return (hi << 8) | lo;
+  }
+
+  // The low byte of the index is added first, the address read before the
+  // carry reaches the high byte is dropped. The reads skip it without a carry
+  template <OperandAccess ACCESS>
+  static inline u16 Index(CPU &cpu, u16 base, u8 index) {
+    u16 unfixed = (base & 0xFF00) | ((base + index) & 0x00FF);
+    u16 address = ACCESS == OperandAccess::READ ? cpu.AbsoluteAddressing(base, index) : u16(base + index);
+
+    if (ACCESS != OperandAccess::READ || address != unfixed) {
+      Read(cpu, unfixed);
+    }
+    return address;
+  }
+
+  // Fetch the operand and compute the effective address with the dummy reads
+  // of the mode, the cpu is left on the cycle of the access
+  template <u16 (CPU::*MODE)(u16), OperandAccess ACCESS>
+  static inline u16 Address(CPU &cpu) {
+    if constexpr (MODE == &CPU::ACC || MODE == &CPU::IMP) {
+      // The next byte is read and dropped
+      Read(cpu, cpu.m_PC);
+      return 0;
+    } else if constexpr (MODE == &CPU::IMM) {
+      // Read by the operation
+      return cpu.m_PC++;
+    } else if constexpr (MODE == &CPU::REL) {
+      u8 offset = Read(cpu, cpu.m_PC++);
+      return cpu.REL(offset);
+    } else if constexpr (MODE == &CPU::ZER) {
+      return Read(cpu, cpu.m_PC++);
+    } else if constexpr (MODE == &CPU::ZPX || MODE == &CPU::ZPY) {
+      // The base is read while the index is added
+      u8 base = Read(cpu, cpu.m_PC++);
+      Read(cpu, base);
+      return (cpu.*MODE)(base);
+    } else if constexpr (MODE == &CPU::ABS) {
+      return FetchWord(cpu);
+    } else if constexpr (MODE == &CPU::ABX || MODE == &CPU::ABY) {
+      u16 base = FetchWord(cpu);
+      return Index<ACCESS>(cpu, base, MODE == &CPU::ABX ? cpu.m_X : cpu.m_Y);
+    } else if constexpr (MODE == &CPU::IND) {
+      // JMP makes no access of its own, the high byte is the last one. It
+      // wraps around the page of the pointer like IND()
+      u16 pointer = FetchWord(cpu);
+      u8  lo      = Read(cpu, pointer);
+      u8  hi      = cpu.Read((pointer & 0xFF00) | ((pointer + 1) & 0x00FF));
+      return (hi << 8) | lo;
+    } else if constexpr (MODE == &CPU::IDX) {
+      u8 pointer = Read(cpu, cpu.m_PC++);
+      Read(cpu, pointer);
+      pointer += cpu.m_X;
+      u8 lo = Read(cpu, pointer);
+      u8 hi = Read(cpu, u8(pointer + 1));
+      return (hi << 8) | lo;
+    } else {
+      static_assert(MODE == &CPU::IDY);
+      u8 pointer = Read(cpu, cpu.m_PC++);
+      u8 lo      = Read(cpu, pointer);
+      u8 hi      = Read(cpu, u8(pointer + 1));
+      return Index<ACCESS>(cpu, (hi << 8) | lo, cpu.m_Y);
+    }
+  }
+
+  // The computation of the read-modify-write operations, without their accesses
+  static constexpr u8 (CPU::*MODIFICATION(void (CPU::*operation)(u16)))(u8) {
+    if (operation == &CPU::ASL) return &CPU::ShiftLeftOperation;
+    if (operation == &CPU::LSR) return &CPU::ShiftRightOperation;
+    if (operation == &CPU::ROL) return &CPU::RotateLeftOperation;
+    if (operation == &CPU::ROR) return &CPU::RotateRightOperation;
+    if (operation == &CPU::INC) return &CPU::IncrementOperation;
+    return &CPU::DecrementOperation;
+  }
+
+  // Handler of a single opcode after its opcode fetch, the same instruction as
+  // ExecuteOpcode() spread over its bus cycles
+  template <u8 OPCODE>
+  static u8 Execute(CPU &cpu) {
+    constexpr Instruction   instruction = INSTRUCTION_SET[OPCODE];
+    constexpr auto          operation   = instruction.operation;
+    constexpr OperandAccess access      = OPERAND_ACCESS(instruction);
+
+    // Nothing happens on the unknown opcodes, like with the instruction policy
+    if constexpr (operation == &CPU::ILL) {
+      return instruction.cycles;
+    }
+
+    // The return address is pushed between the two bytes of the destination
+    if constexpr (operation == &CPU::JSR) {
+      u8 lo = Read(cpu, cpu.m_PC++);
+      u8 sp = cpu.m_SP;
+      Read(cpu, STACK_BASE + cpu.m_SP);
+      Write(cpu, STACK_BASE + cpu.m_SP--, cpu.m_PC >> 8);
+      Write(cpu, STACK_BASE + cpu.m_SP--, cpu.m_PC & 0xFF);
+      u16 destination = (cpu.Read(cpu.m_PC) << 8) | lo;
+
+      if (cpu.m_Profiler) {
+        cpu.m_Profiler->OnCall(destination, sp);
+      }
+      // The return lands behind the high byte of the destination
+      if (cpu.m_Core->debugger) {
+        cpu.m_Core->debugger->OnCall(cpu.m_PC + 1, sp);
+      }
+      cpu.m_PC = destination;
+      return instruction.cycles;
+    }
+
+    u16 address = Address<instruction.addressing, access>(cpu);
+
+    if constexpr (access == OperandAccess::MODIFY) {
+      // The unmodified value is written back while the operation runs
+      u8 value = Read(cpu, address);
+      Write(cpu, address, value);
+      cpu.Write(address, (cpu.*MODIFICATION(operation))(value));
+    } else if constexpr (instruction.addressing == &CPU::REL) {
+      u16 next    = cpu.m_PC;
+      s32 waiting = cpu.m_WaitingCycles;
+      (cpu.*operation)(address);
+
+      // A taken branch reads the next opcode, then the destination before the
+      // carry reaches the high byte when it is on another page
+      if (cpu.m_WaitingCycles != waiting) {
+        Read(cpu, next);
+      }
+      if (cpu.m_WaitingCycles - waiting > 1) {
+        Read(cpu, (next & 0xFF00) | (cpu.m_PC & 0x00FF));
+      }
+    } else {
+      // The stack is read before the pointer moves
+      if constexpr (operation == &CPU::PLA || operation == &CPU::PLP || operation == &CPU::RTI ||
+                    operation == &CPU::RTS) {
+        Read(cpu, STACK_BASE + cpu.m_SP);
+      }
+      (cpu.*operation)(address);
+      // The return address is read before it is incremented
+      if constexpr (operation == &CPU::RTS) {
+        cpu.Read(cpu.m_PC - 1);
+      }
+    }
+
+    return instruction.cycles;
+  }
+};
+
+template <std::size_t... OPCODES>
+constexpr std::array<OpcodeHandler, 256> MAKE_CYCLE_TABLE(std::index_sequence<OPCODES...>) {
+  return {&MicroOps::Execute<OPCODES>...};
+}
+
+constexpr std::array<OpcodeHandler, 256> DISPATCH_TABLE = MAKE_DISPATCH_TABLE(std::make_index_sequence<256>());
+constexpr std::array<u8, 256>            OPERAND_SIZES  = MAKE_OPERAND_SIZES(std::make_index_sequence<256>());
+// Handlers of the cycle policy, called after the opcode fetch
+constexpr std::array<OpcodeHandler, 256> CYCLE_TABLE = MAKE_CYCLE_TABLE(std::make_index_sequence<256>());
+
+}  // namespace EasyNes
+
 #endif  // EASYNES_INSTRUCTIONS_HPP
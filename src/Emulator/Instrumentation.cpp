@@ -0,0 +1,131 @@
+#include "Instrumentation.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+
+#include "Instructions.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr const char *PENALTY_NAMES[] = {"page_cross", "branch_taken", "branch_page_cross"};
+
+struct Totals {
+  std::mutex          mutex;
+  InstrumentationData data;
+  std::string         path;
+};
+
+Totals &GetTotals() {
+  static Totals totals;
+  return totals;
+}
+
+void DumpTotals() {
+  Totals         &totals = GetTotals();
+  std::lock_guard lock(totals.mutex);
+
+  std::ofstream file(totals.path);
+  totals.data.Write(file);
+}
+
+}  // namespace
+
+void InstrumentationData::Merge(const InstrumentationData &data) {
+  for (std::size_t i = 0; i < opcodeCounts.size(); i++) {
+    opcodeCounts[i] += data.opcodeCounts[i];
+    opcodeCycles[i] += data.opcodeCycles[i];
+  }
+  for (std::size_t i = 0; i < penalties.size(); i++) {
+    penalties[i] += data.penalties[i];
+  }
+  for (std::size_t i = 0; i < heatmap.size(); i++) {
+    heatmap[i] += data.heatmap[i];
+  }
+}
+
+void InstrumentationData::Clear() {
+  opcodeCounts.fill(0);
+  opcodeCycles.fill(0);
+  penalties.fill(0);
+  std::fill(heatmap.begin(), heatmap.end(), 0);
+}
+
+void InstrumentationData::Write(std::ostream &output) const {
+  u64 instructions = 0, cycles = 0;
+  for (int opcode = 0; opcode < 256; opcode++) {
+    instructions += opcodeCounts[opcode];
+    cycles += opcodeCycles[opcode];
+  }
+
+  output << "instructions " << instructions << "\ncycles " << cycles << "\n";
+
+  output << "\n[opcodes]\n" << std::hex << std::uppercase << std::setfill('0');
+  for (int opcode = 0; opcode < 256; opcode++) {
+    if (opcodeCounts[opcode] > 0) {
+      output << std::setw(2) << opcode << " " << MNEMONIC(opcode) << " " << ADDRESSING_NAME(opcode) << " " << std::dec
+             << opcodeCounts[opcode] << " " << opcodeCycles[opcode] << std::hex << "\n";
+    }
+  }
+
+  // Mode, instructions, cycles
+  output << std::dec << "\n[modes]\n";
+  for (const auto &[addressing, name] : ADDRESSING_NAMES) {
+    u64 modeInstructions = 0, modeCycles = 0;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+      if (INSTRUCTION_SET[opcode].addressing == addressing) {
+        modeInstructions += opcodeCounts[opcode];
+        modeCycles += opcodeCycles[opcode];
+      }
+    }
+
+    if (modeInstructions > 0) {
+      output << name << " " << modeInstructions << " " << modeCycles << "\n";
+    }
+  }
+
+  output << "\n[penalties]\n";
+  for (std::size_t i = 0; i < penalties.size(); i++) {
+    output << PENALTY_NAMES[i] << " " << penalties[i] << "\n";
+  }
+
+  // Only the addresses executed at least once
+  output << "\n[heatmap]\n" << std::hex;
+  for (std::size_t address = 0; address < heatmap.size(); address++) {
+    if (heatmap[address] > 0) {
+      output << std::setw(4) << address << " " << std::dec << heatmap[address] << std::hex << "\n";
+    }
+  }
+  output << std::dec << std::setfill(' ');
+}
+
+InstrumentationPolicy<true>::~InstrumentationPolicy() {
+  Totals         &totals = GetTotals();
+  std::lock_guard lock(totals.mutex);
+  totals.data.Merge(m_Data);
+}
+
+bool DumpInstrumentationAtExit(const std::string &path) {
+  if constexpr (!INSTRUMENTATION_ENABLED) {
+    return false;
+  }
+
+  // The totals are built before the handler is registered so they are
+  // destroyed after it runs
+  Totals         &totals = GetTotals();
+  std::lock_guard lock(totals.mutex);
+
+  // Only the last path is written
+  bool registered = !totals.path.empty();
+  totals.path     = path;
+
+  return registered || std::atexit(DumpTotals) == 0;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,81 @@
+#ifndef EASYNES_INSTRUMENTATION_HPP
+#define EASYNES_INSTRUMENTATION_HPP
+
+#include <array>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Set by the EASYNES_INSTRUMENTATION build option, the cpu compiles its
+// counters out of the interpreter otherwise
+#ifdef EASYNES_INSTRUMENTATION
+constexpr bool INSTRUMENTATION_ENABLED = true;
+#else
+constexpr bool INSTRUMENTATION_ENABLED = false;
+#endif
+
+// Extra cycles added to an instruction
+enum class Penalty : u8 {
+  PAGE_CROSS,         // Indexed address on another page than its base
+  BRANCH_TAKEN,       // Any taken branch
+  BRANCH_PAGE_CROSS,  // Taken branch landing on another page
+  COUNT,
+};
+
+struct InstrumentationData {
+  std::array<u64, 256>                                      opcodeCounts{};
+  std::array<u64, 256>                                      opcodeCycles{};
+  std::array<u64, static_cast<std::size_t>(Penalty::COUNT)> penalties{};
+  // Instructions executed at each address
+  std::vector<u64> heatmap = std::vector<u64>(0x10000);
+
+  void Merge(const InstrumentationData &data);
+  void Clear();
+  // Text report, the cycles by addressing mode are summed from the opcodes
+  void Write(std::ostream &output) const;
+};
+
+// Counters of the interpreter, the recompiled blocks and the lockstep kernels
+// are not instrumented. Nothing is left of it when instrumentation is off
+template <bool ENABLED>
+class InstrumentationPolicy {
+ public:
+  inline void OnInstruction(u16, u8, u32) {}
+  inline void OnPenalty(Penalty) {}
+};
+
+template <>
+class InstrumentationPolicy<true> {
+ public:
+  InstrumentationPolicy() = default;
+  // The counters are added to the totals of the process
+  ~InstrumentationPolicy();
+
+  inline void OnInstruction(u16 address, u8 opcode, u32 cycles) {
+    m_Data.opcodeCounts[opcode]++;
+    m_Data.opcodeCycles[opcode] += cycles;
+    m_Data.heatmap[address]++;
+  }
+
+  inline void OnPenalty(Penalty penalty) { m_Data.penalties[static_cast<std::size_t>(penalty)]++; }
+
+  inline const InstrumentationData &GetData() const { return m_Data; }
+  inline void                       Clear() { m_Data.Clear(); }
+
+ private:
+  InstrumentationData m_Data;
+};
+
+using Instrumentation = InstrumentationPolicy<INSTRUMENTATION_ENABLED>;
+
+// Write the counters of every destroyed cpu to the file when the process
+// exits, returns false if the instrumentation is compiled out
+bool DumpInstrumentationAtExit(const std::string &path);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_INSTRUMENTATION_HPP
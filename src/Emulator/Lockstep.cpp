@@ -0,0 +1,470 @@
+#include "Lockstep.hpp"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include "Instructions.hpp"
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+namespace EasyNes {
+
+namespace {
+
+// One byte of LOCKSTEP_LANES instances, masks hold 0xFF in the selected lanes
+#if defined(__AVX2__)
+
+using Vector = __m256i;
+
+inline Vector Load(const u8 *data) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data)); }
+inline void   Store(u8 *data, Vector value) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(data), value); }
+inline Vector Splat(u8 value) { return _mm256_set1_epi8(value); }
+inline Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+inline Vector AndNot(Vector a, Vector b) { return _mm256_andnot_si256(b, a); }
+inline Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+inline Vector Xor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+inline Vector Add(Vector a, Vector b) { return _mm256_add_epi8(a, b); }
+inline Vector Equal(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vector Select(Vector mask, Vector a, Vector b) { return _mm256_blendv_epi8(b, a, mask); }
+inline bool   IsEmpty(Vector mask) { return _mm256_testz_si256(mask, mask); }
+
+#else
+
+// Portable lanes, the loops are simple enough for the compiler to vectorize
+struct Vector {
+  std::array<u8, LOCKSTEP_LANES> lanes;
+};
+
+template <typename Operation>
+inline Vector Map(Vector a, Vector b, Operation operation) {
+  Vector result;
+  for (u32 i = 0; i < LOCKSTEP_LANES; i++) {
+    result.lanes[i] = operation(a.lanes[i], b.lanes[i]);
+  }
+  return result;
+}
+
+inline Vector Load(const u8 *data) {
+  Vector result;
+  std::copy(data, data + LOCKSTEP_LANES, result.lanes.begin());
+  return result;
+}
+
+inline void Store(u8 *data, Vector value) { std::copy(value.lanes.begin(), value.lanes.end(), data); }
+
+inline Vector Splat(u8 value) {
+  Vector result;
+  result.lanes.fill(value);
+  return result;
+}
+
+inline Vector And(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x & y; }); }
+inline Vector AndNot(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x & ~y; }); }
+inline Vector Or(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x | y; }); }
+inline Vector Xor(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x ^ y; }); }
+inline Vector Add(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x + y; }); }
+inline Vector Equal(Vector a, Vector b) { return Map(a, b, [](u8 x, u8 y) -> u8 { return x == y ? 0xFF : 0x00; }); }
+inline Vector Select(Vector mask, Vector a, Vector b) { return Or(And(mask, a), AndNot(b, mask)); }
+inline bool   IsEmpty(Vector mask) { return std::all_of(mask.lanes.begin(), mask.lanes.end(), [](u8 lane) { return !lane; }); }
+
+#endif
+
+// Status with the negative and zero flags of the value
+inline Vector UpdateNZ(Vector status, Vector value) {
+  Vector negative = And(value, Splat(NEGATIVE_BIT));
+  Vector zero     = And(Equal(value, Splat(0)), Splat(ZERO_BIT));
+  return Or(And(status, Splat(static_cast<u8>(~(NEGATIVE_BIT | ZERO_BIT)))), Or(negative, zero));
+}
+
+}  // namespace
+
+struct LockstepKernels {
+  // The instruction shared by a group
+  struct Group {
+    const u8 *mask;
+    u16       pc;
+    u16       operand;
+  };
+
+  using Registers = std::vector<u8> LockstepCPU::*;
+  using Kernel    = void (*)(LockstepCPU &cpu, const Group &group);
+
+  // Call the function with the offset and the mask of the vectors holding a
+  // lane of the group
+  template <typename Function>
+  static void ForEachVector(LockstepCPU &cpu, const Group &group, Function function) {
+    for (u32 offset = 0; offset < cpu.m_Lanes; offset += LOCKSTEP_LANES) {
+      Vector mask = Load(group.mask + offset);
+
+      if (!IsEmpty(mask)) {
+        function(offset, mask);
+      }
+    }
+  }
+
+  // Count the instruction and its cycles in the pending counters
+  static void Count(LockstepCPU &cpu, u32 offset, Vector mask, Vector cycles) {
+    Store(&cpu.m_PendingCycles[offset], Add(Load(&cpu.m_PendingCycles[offset]), cycles));
+    Store(&cpu.m_PendingInstructions[offset], Add(Load(&cpu.m_PendingInstructions[offset]), And(mask, Splat(1))));
+  }
+
+  static void Retire(LockstepCPU &cpu, const Group &group, u16 next, u8 cycles) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Store(&cpu.m_PCL[offset], Select(mask, Splat(next & 0xFF), Load(&cpu.m_PCL[offset])));
+      Store(&cpu.m_PCH[offset], Select(mask, Splat(next >> 8), Load(&cpu.m_PCH[offset])));
+      Count(cpu, offset, mask, And(mask, Splat(cycles)));
+    });
+  }
+
+  // Operand of the instruction, the memory operands are at the same address
+  // for every instance so they are read as a row
+  template <u16 (CPU::*ADDRESSING)(u16)>
+  static Vector Operand(LockstepCPU &cpu, const Group &group, u32 offset) {
+    if constexpr (ADDRESSING == &CPU::IMM) {
+      return Splat(group.operand);
+    } else {
+      return Load(&cpu.m_Memory[group.operand * cpu.m_Lanes + offset]);
+    }
+  }
+
+  template <u16 (CPU::*ADDRESSING)(u16), Registers REGISTER>
+  static void Load_(LockstepCPU &cpu, const Group &group) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector value = Operand<ADDRESSING>(cpu, group, offset);
+      Store(&(cpu.*REGISTER)[offset], Select(mask, value, Load(&(cpu.*REGISTER)[offset])));
+      Store(&cpu.m_Status[offset], Select(mask, UpdateNZ(Load(&cpu.m_Status[offset]), value), Load(&cpu.m_Status[offset])));
+    });
+  }
+
+  template <Registers REGISTER>
+  static void Store_(LockstepCPU &cpu, const Group &group) {
+    u8 *row = &cpu.m_Memory[group.operand * cpu.m_Lanes];
+
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Store(row + offset, Select(mask, Load(&(cpu.*REGISTER)[offset]), Load(row + offset)));
+    });
+  }
+
+  template <u16 (CPU::*ADDRESSING)(u16), Vector (*OPERATION)(Vector, Vector)>
+  static void Bitwise(LockstepCPU &cpu, const Group &group) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector value = OPERATION(Load(&cpu.m_A[offset]), Operand<ADDRESSING>(cpu, group, offset));
+      Store(&cpu.m_A[offset], Select(mask, value, Load(&cpu.m_A[offset])));
+      Store(&cpu.m_Status[offset], Select(mask, UpdateNZ(Load(&cpu.m_Status[offset]), value), Load(&cpu.m_Status[offset])));
+    });
+  }
+
+  template <Registers REGISTER, u8 DELTA>
+  static void Increment(LockstepCPU &cpu, const Group &group) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector value = Add(Load(&(cpu.*REGISTER)[offset]), Splat(DELTA));
+      Store(&(cpu.*REGISTER)[offset], Select(mask, value, Load(&(cpu.*REGISTER)[offset])));
+      Store(&cpu.m_Status[offset], Select(mask, UpdateNZ(Load(&cpu.m_Status[offset]), value), Load(&cpu.m_Status[offset])));
+    });
+  }
+
+  template <Registers SOURCE, Registers DESTINATION>
+  static void Transfer(LockstepCPU &cpu, const Group &group) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector value = Load(&(cpu.*SOURCE)[offset]);
+      Store(&(cpu.*DESTINATION)[offset], Select(mask, value, Load(&(cpu.*DESTINATION)[offset])));
+      Store(&cpu.m_Status[offset], Select(mask, UpdateNZ(Load(&cpu.m_Status[offset]), value), Load(&cpu.m_Status[offset])));
+    });
+  }
+
+  template <u8 BIT, bool VALUE>
+  static void Flag(LockstepCPU &cpu, const Group &group) {
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector status = Load(&cpu.m_Status[offset]);
+      Vector value  = VALUE ? Or(status, Splat(BIT)) : And(status, Splat(static_cast<u8>(~BIT)));
+      Store(&cpu.m_Status[offset], Select(mask, value, status));
+    });
+  }
+
+  // Branches split the group between the taken and the not taken instances
+  template <u8 BIT, bool VALUE, u8 CYCLES>
+  static void Branch(LockstepCPU &cpu, const Group &group) {
+    u16 next        = group.pc + 2;
+    u16 destination = next + static_cast<s8>(group.operand);
+    // Additional cycle if taken, and another one if the page is crossed
+    u8 penalty = 1 + ((next & 0xFF00) != (destination & 0xFF00));
+
+    ForEachVector(cpu, group, [&](u32 offset, Vector mask) {
+      Vector flag  = And(Load(&cpu.m_Status[offset]), Splat(BIT));
+      Vector taken = And(mask, Equal(flag, Splat(VALUE ? BIT : 0)));
+
+      Vector pcl = Select(mask, Splat(next & 0xFF), Load(&cpu.m_PCL[offset]));
+      Vector pch = Select(mask, Splat(next >> 8), Load(&cpu.m_PCH[offset]));
+      Store(&cpu.m_PCL[offset], Select(taken, Splat(destination & 0xFF), pcl));
+      Store(&cpu.m_PCH[offset], Select(taken, Splat(destination >> 8), pch));
+      Count(cpu, offset, mask, Add(And(mask, Splat(CYCLES)), And(taken, Splat(penalty))));
+    });
+  }
+
+  template <u8 OPCODE>
+  static void Execute(LockstepCPU &cpu, const Group &group) {
+    constexpr Instruction instruction = INSTRUCTION_SET[OPCODE];
+    constexpr auto        mode        = instruction.addressing;
+    constexpr auto        op          = instruction.operation;
+    constexpr u16         next        = 1 + OPERAND_SIZE(mode);
+
+    // Operands at the same address for every instance
+    constexpr bool ROW  = mode == &CPU::ZER || mode == &CPU::ABS;
+    constexpr bool READ = ROW || mode == &CPU::IMM;
+
+    // clang-format off
+    if constexpr (op == &CPU::LDA && READ) Load_<mode, &LockstepCPU::m_A>(cpu, group);
+    else if constexpr (op == &CPU::LDX && READ) Load_<mode, &LockstepCPU::m_X>(cpu, group);
+    else if constexpr (op == &CPU::LDY && READ) Load_<mode, &LockstepCPU::m_Y>(cpu, group);
+    else if constexpr (op == &CPU::STA && ROW) Store_<&LockstepCPU::m_A>(cpu, group);
+    else if constexpr (op == &CPU::STX && ROW) Store_<&LockstepCPU::m_X>(cpu, group);
+    else if constexpr (op == &CPU::STY && ROW) Store_<&LockstepCPU::m_Y>(cpu, group);
+    else if constexpr (op == &CPU::AND && READ) Bitwise<mode, And>(cpu, group);
+    else if constexpr (op == &CPU::ORA && READ) Bitwise<mode, Or>(cpu, group);
+    else if constexpr (op == &CPU::EOR && READ) Bitwise<mode, Xor>(cpu, group);
+    else if constexpr (op == &CPU::INX) Increment<&LockstepCPU::m_X, 0x01>(cpu, group);
+    else if constexpr (op == &CPU::INY) Increment<&LockstepCPU::m_Y, 0x01>(cpu, group);
+    else if constexpr (op == &CPU::DEX) Increment<&LockstepCPU::m_X, 0xFF>(cpu, group);
+    else if constexpr (op == &CPU::DEY) Increment<&LockstepCPU::m_Y, 0xFF>(cpu, group);
+    else if constexpr (op == &CPU::TAX) Transfer<&LockstepCPU::m_A, &LockstepCPU::m_X>(cpu, group);
+    else if constexpr (op == &CPU::TAY) Transfer<&LockstepCPU::m_A, &LockstepCPU::m_Y>(cpu, group);
+    else if constexpr (op == &CPU::TXA) Transfer<&LockstepCPU::m_X, &LockstepCPU::m_A>(cpu, group);
+    else if constexpr (op == &CPU::TYA) Transfer<&LockstepCPU::m_Y, &LockstepCPU::m_A>(cpu, group);
+    else if constexpr (op == &CPU::CLC) Flag<CARRY_BIT, false>(cpu, group);
+    else if constexpr (op == &CPU::SEC) Flag<CARRY_BIT, true>(cpu, group);
+    else if constexpr (op == &CPU::CLI) Flag<INTERRUPT_BIT, false>(cpu, group);
+    else if constexpr (op == &CPU::SEI) Flag<INTERRUPT_BIT, true>(cpu, group);
+    else if constexpr (op == &CPU::CLD) Flag<DECIMAL_BIT, false>(cpu, group);
+    else if constexpr (op == &CPU::SED) Flag<DECIMAL_BIT, true>(cpu, group);
+    else if constexpr (op == &CPU::CLV) Flag<OVERFLOW_BIT, false>(cpu, group);
+    else if constexpr (op == &CPU::NOP) {}
+    else if constexpr (op == &CPU::BCC) return Branch<CARRY_BIT, false, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BCS) return Branch<CARRY_BIT, true, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BNE) return Branch<ZERO_BIT, false, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BEQ) return Branch<ZERO_BIT, true, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BPL) return Branch<NEGATIVE_BIT, false, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BMI) return Branch<NEGATIVE_BIT, true, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BVC) return Branch<OVERFLOW_BIT, false, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::BVS) return Branch<OVERFLOW_BIT, true, instruction.cycles>(cpu, group);
+    else if constexpr (op == &CPU::JMP && mode == &CPU::ABS) return Retire(cpu, group, group.operand, instruction.cycles);
+    else return cpu.ExecuteScalar(group.mask);
+    // clang-format on
+
+    Retire(cpu, group, group.pc + next, instruction.cycles);
+  }
+
+  template <std::size_t... OPCODES>
+  static constexpr std::array<Kernel, 256> MAKE_KERNELS(std::index_sequence<OPCODES...>) {
+    return {&Execute<OPCODES>...};
+  }
+};
+
+constexpr std::array<LockstepKernels::Kernel, 256> LOCKSTEP_KERNELS =
+    LockstepKernels::MAKE_KERNELS(std::make_index_sequence<256>());
+
+LockstepCPU::LockstepCPU(u32 instances)
+    : m_Instances(instances), m_Lanes((instances + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES * LOCKSTEP_LANES) {
+  m_Memory.resize(RAM_SIZE * m_Lanes);
+
+  for (std::vector<u8> *lanes : {&m_A, &m_X, &m_Y, &m_SP, &m_Status, &m_PCL, &m_PCH, &m_Remaining, &m_Group, &m_Enabled}) {
+    lanes->resize(m_Lanes);
+  }
+
+  for (std::vector<u8> *counters : {&m_PendingCycles, &m_PendingInstructions, &m_Waiting}) {
+    counters->resize(m_Lanes);
+  }
+
+  m_Cycles.resize(m_Lanes);
+  m_Instructions.resize(m_Lanes);
+  std::fill_n(m_Enabled.begin(), m_Instances, 0xFF);
+
+  m_Scalar.bus.MapHandlers(0x00, 0xFF, this, &LockstepCPU::ReadLane, &LockstepCPU::WriteLane);
+}
+
+void LockstepCPU::RST() {
+  for (u32 instance = 0; instance < m_Instances; instance++) {
+    m_ScalarLane = instance;
+    m_Scalar.cpu.RST();
+
+    // Only the registers of the scalar cpu are meaningful
+    CPUState state            = m_Scalar.cpu.GetState();
+    CPUState previous         = GetState(instance);
+    state.elapsedCycles       = previous.elapsedCycles;
+    state.elapsedInstructions = previous.elapsedInstructions;
+    SetState(instance, state);
+  }
+}
+
+u32 LockstepCPU::Step() {
+  m_Remaining = m_Enabled;
+  return Step(m_Remaining);
+}
+
+void LockstepCPU::RunInstructions(u64 count) {
+  for (; count > 0; count--) {
+    Step();
+  }
+}
+
+void LockstepCPU::RunCycles(u64 cycles) {
+  Flush();
+
+  // The waiting cycles are part of the budget like in Core::RunCycles()
+  std::vector<u64> targets(m_Lanes);
+  for (u32 lane = 0; lane < m_Lanes; lane++) {
+    targets[lane] = m_Cycles[lane] + cycles;
+  }
+
+  while (true) {
+    Flush();
+
+    // No instance can reach its budget before the closest one has run that
+    // many instructions, the budgets are only checked between the rounds
+    std::vector<u8> running(m_Lanes);
+    u64             closest = UNLIMITED_CYCLES;
+
+    for (u32 lane = 0; lane < m_Lanes; lane++) {
+      u64 spent     = m_Cycles[lane] + m_Waiting[lane];
+      running[lane] = spent < targets[lane] ? m_Enabled[lane] : 0;
+
+      if (running[lane]) {
+        closest = std::min(closest, targets[lane] - spent);
+      }
+    }
+
+    if (closest == UNLIMITED_CYCLES) {
+      return;
+    }
+
+    u64 steps = std::max<u64>(1, closest / MAX_INSTRUCTION_CYCLES);
+    for (; steps > 0; steps--) {
+      m_Remaining = running;
+      Step(m_Remaining);
+    }
+  }
+}
+
+u32 LockstepCPU::Step(std::vector<u8> &remaining) {
+  u32 groups = 0;
+  u32 first  = 0;
+
+  // The cycles left by a reset are paid along with the next instruction
+  if (m_HasWaiting) {
+    for (u32 lane = 0; lane < m_Lanes; lane++) {
+      if (remaining[lane]) {
+        m_Cycles[lane] += m_Waiting[lane];
+        m_Waiting[lane] = 0;
+      }
+    }
+    m_HasWaiting = std::any_of(m_Waiting.begin(), m_Waiting.end(), [](u8 cycles) { return cycles; });
+  }
+
+  // The pending counters are flushed before they can overflow
+  if (++m_PendingSteps == MAX_PENDING_STEPS) {
+    Flush();
+  }
+
+  while (true) {
+    // The first remaining instance leads the next group
+    while (first < m_Lanes && !remaining[first]) {
+      first++;
+    }
+
+    if (first == m_Lanes) {
+      return groups;
+    }
+
+    u16 pc     = m_PCL[first] | (m_PCH[first] << 8);
+    u8  opcode = Read(first, pc);
+    u8  size   = OPERAND_SIZES[opcode];
+
+    std::array<u8, 3> bytes = {opcode, Read(first, pc + 1), Read(first, pc + 2)};
+
+    // The group is made of the remaining instances at the same program counter
+    // with the same instruction bytes, the memory may differ between them
+    for (u32 offset = 0; offset < m_Lanes; offset += LOCKSTEP_LANES) {
+      Vector mask = Load(&remaining[offset]);
+      mask        = And(mask, Equal(Load(&m_PCL[offset]), Splat(pc & 0xFF)));
+      mask        = And(mask, Equal(Load(&m_PCH[offset]), Splat(pc >> 8)));
+
+      for (u8 i = 0; i <= size; i++) {
+        u16 address = pc + i;
+        mask        = And(mask, Equal(Load(&m_Memory[address * m_Lanes + offset]), Splat(bytes[i])));
+      }
+
+      Store(&m_Group[offset], mask);
+      Store(&remaining[offset], AndNot(Load(&remaining[offset]), mask));
+    }
+
+    u16 operand = size == 0 ? 0 : size == 1 ? bytes[1] : bytes[1] | (bytes[2] << 8);
+    LOCKSTEP_KERNELS[opcode](*this, {m_Group.data(), pc, operand});
+    groups++;
+  }
+}
+
+void LockstepCPU::ExecuteScalar(const u8 *mask) {
+  for (u32 lane = 0; lane < m_Lanes; lane++) {
+    if (mask[lane]) {
+      m_ScalarLane = lane;
+      m_Scalar.cpu.SetState(GetState(lane));
+      m_Scalar.cpu.Execute();
+      SetState(lane, m_Scalar.cpu.GetState());
+    }
+  }
+}
+
+void LockstepCPU::Flush() {
+  for (u32 lane = 0; lane < m_Lanes; lane++) {
+    m_Cycles[lane] += m_PendingCycles[lane];
+    m_Instructions[lane] += m_PendingInstructions[lane];
+  }
+
+  std::fill(m_PendingCycles.begin(), m_PendingCycles.end(), 0);
+  std::fill(m_PendingInstructions.begin(), m_PendingInstructions.end(), 0);
+  m_PendingSteps = 0;
+}
+
+CPUState LockstepCPU::GetState(u32 instance) const {
+  u16 pc = m_PCL[instance] | (m_PCH[instance] << 8);
+  return {pc,
+          m_SP[instance],
+          m_A[instance],
+          m_X[instance],
+          m_Y[instance],
+          m_Status[instance],
+          m_Waiting[instance],
+          m_Cycles[instance] + m_PendingCycles[instance],
+          m_Instructions[instance] + m_PendingInstructions[instance]};
+}
+
+void LockstepCPU::SetState(u32 instance, const CPUState &state) {
+  m_PCL[instance]          = state.pc & 0xFF;
+  m_PCH[instance]          = state.pc >> 8;
+  m_SP[instance]           = state.sp;
+  m_A[instance]            = state.a;
+  m_X[instance]            = state.x;
+  m_Y[instance]            = state.y;
+  m_Status[instance]       = state.status;
+  m_Waiting[instance]      = std::max(state.waitingCycles, 0);
+  m_Cycles[instance]       = state.elapsedCycles;
+  m_Instructions[instance] = state.elapsedInstructions;
+
+  m_PendingCycles[instance]       = 0;
+  m_PendingInstructions[instance] = 0;
+  m_HasWaiting |= m_Waiting[instance] > 0;
+}
+
+u8 LockstepCPU::ReadLane(void *context, u16 address) {
+  auto *cpu = static_cast<LockstepCPU *>(context);
+  return cpu->Read(cpu->m_ScalarLane, address);
+}
+
+void LockstepCPU::WriteLane(void *context, u16 address, u8 value) {
+  auto *cpu = static_cast<LockstepCPU *>(context);
+  cpu->Write(cpu->m_ScalarLane, address, value);
+}
+
+}  // namespace EasyNes
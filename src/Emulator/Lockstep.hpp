@@ -0,0 +1,100 @@
+#ifndef EASYNES_LOCKSTEP_HPP
+#define EASYNES_LOCKSTEP_HPP
+
+#include <vector>
+
+#include "CPU.hpp"
+#include "Core.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Instances processed by one vector operation
+constexpr u32 LOCKSTEP_LANES = 32;
+// Longest instruction with its penalties
+constexpr u32 MAX_INSTRUCTION_CYCLES = 9;
+// Steps counted in the byte counters before they are flushed
+constexpr u32 MAX_PENDING_STEPS = 255 / MAX_INSTRUCTION_CYCLES;
+
+// Many cpus, each with a flat 64 KiB memory, running the same program in
+// lockstep. The registers and the memory are stored as structures of arrays,
+// the byte of every instance at one address is contiguous. The instances
+// sharing a program counter and an instruction form a group that executes
+// through vector kernels, a group splits off as soon as its instances diverge.
+// The kernels are picked from the instruction set at compile time, the
+// instructions without a kernel run on a scalar CPU for every instance of the
+// group so the behaviour always matches the interpreter
+class LockstepCPU {
+  friend struct LockstepKernels;
+
+ public:
+  explicit LockstepCPU(u32 instances);
+
+  LockstepCPU(const LockstepCPU &)            = delete;
+  LockstepCPU &operator=(const LockstepCPU &) = delete;
+
+  // Reset every instance through its reset vector
+  void RST();
+
+  // Execute one instruction on every instance, returns the number of groups
+  u32 Step();
+  // Each instance executes the instructions or runs until it spent the
+  // cycles, the last instruction may overshoot the budget
+  void RunInstructions(u64 count);
+  void RunCycles(u64 cycles);
+
+  inline u32 GetInstanceCount() const { return m_Instances; }
+
+  inline u8   Read(u32 instance, u16 address) const { return m_Memory[address * m_Lanes + instance]; }
+  inline void Write(u32 instance, u16 address, u8 value) { m_Memory[address * m_Lanes + instance] = value; }
+
+  CPUState GetState(u32 instance) const;
+  void     SetState(u32 instance, const CPUState &state);
+
+ private:
+  // Run the instances of the mask for one instruction
+  u32  Step(std::vector<u8> &remaining);
+  void ExecuteScalar(const u8 *mask);
+  // Add the pending counters to the elapsed ones
+  void Flush();
+
+  static u8   ReadLane(void *context, u16 address);
+  static void WriteLane(void *context, u16 address, u8 value);
+
+  u32 m_Instances;
+  // Rounded up to a whole number of vectors
+  u32 m_Lanes;
+
+  std::vector<u8> m_Memory;
+  std::vector<u8> m_A;
+  std::vector<u8> m_X;
+  std::vector<u8> m_Y;
+  std::vector<u8> m_SP;
+  std::vector<u8> m_Status;
+  std::vector<u8> m_PCL;
+  std::vector<u8> m_PCH;
+
+  std::vector<u64> m_Cycles;
+  std::vector<u64> m_Instructions;
+  // The kernels count in bytes, flushed every few steps
+  std::vector<u8> m_PendingCycles;
+  std::vector<u8> m_PendingInstructions;
+  u32             m_PendingSteps = 0;
+  // Cycles left by a reset
+  std::vector<u8> m_Waiting;
+  bool            m_HasWaiting = false;
+
+  // 0xFF for the instances taking part, the padding lanes are never set
+  std::vector<u8> m_Enabled;
+  std::vector<u8> m_Remaining;
+  std::vector<u8> m_Group;
+
+  // Interpreter of the instructions without a kernel, its bus reads and
+  // writes the memory of the current lane, it needs no ram of its own
+  Core m_Scalar{CoreMemory::CONSOLE};
+  u32  m_ScalarLane = 0;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_LOCKSTEP_HPP
@@ -0,0 +1,360 @@
+#include "Mapper.hpp"
+
+#include <algorithm>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+// Bank to the index of a bank of the given size, negative banks count from
+// the end and every bank wraps around the memory
+u32 BANK_OFFSET(s32 bank, u32 size, u32 total) {
+  s32 count = std::max<u32>(total / size, 1);
+  return ((bank % count + count) % count) * size;
+}
+
+class NROM final : public Mapper {
+ public:
+  using Mapper::Mapper;
+
+  void Reset() override { Update(); }
+
+ protected:
+  void Write(u16, u8) override {}
+
+  void Update() override {
+    // The 16 KiB boards are mirrored by the bus
+    MapPrg(0, 0, 0x8000);
+    MapChr(0, 0, 0x2000);
+  }
+};
+
+// Five serial writes load one of the four internal registers
+class MMC1 final : public Mapper {
+ public:
+  MMC1(Core *core, const Rom &rom) : Mapper(core, rom) { m_Registers.resize(COUNT); }
+
+  void Reset() override {
+    std::fill(m_Registers.begin(), m_Registers.end(), 0);
+    // The last bank is fixed at $C000 on power on
+    m_Registers[CONTROL] = 0x0C;
+    m_Registers[SHIFT]   = SHIFT_EMPTY;
+    Update();
+  }
+
+ protected:
+  enum : u8 { SHIFT, CONTROL, CHR0, CHR1, PRG, COUNT };
+
+  // The shift register is full when this bit reaches the first position
+  static constexpr u8 SHIFT_EMPTY = 0x10;
+
+  void Write(u16 address, u8 value) override {
+    if (value & 0x80) {
+      m_Registers[SHIFT] = SHIFT_EMPTY;
+      m_Registers[CONTROL] |= 0x0C;
+      Update();
+      return;
+    }
+
+    bool full          = m_Registers[SHIFT] & 1;
+    m_Registers[SHIFT] = (m_Registers[SHIFT] >> 1) | ((value & 1) << 4);
+
+    if (full) {
+      // Bits 13 and 14 of the address select the register
+      m_Registers[CONTROL + ((address >> 13) & 0x03)] = m_Registers[SHIFT];
+      m_Registers[SHIFT]                              = SHIFT_EMPTY;
+      Update();
+    }
+  }
+
+  void Update() override {
+    constexpr Mirroring MIRRORINGS[] = {Mirroring::SINGLE_LOWER, Mirroring::SINGLE_UPPER, Mirroring::VERTICAL,
+                                        Mirroring::HORIZONTAL};
+
+    u8 control  = m_Registers[CONTROL];
+    u8 prg      = m_Registers[PRG] & 0x0F;
+    m_Mirroring = MIRRORINGS[control & 0x03];
+
+    switch ((control >> 2) & 0x03) {
+      case 0:
+      case 1:
+        MapPrg(0, prg >> 1, 0x8000);
+        break;
+      case 2:
+        MapPrg(0, 0, 0x4000);
+        MapPrg(2, prg, 0x4000);
+        break;
+      case 3:
+        MapPrg(0, prg, 0x4000);
+        MapPrg(2, -1, 0x4000);
+        break;
+    }
+
+    if (control & 0x10) {
+      MapChr(0, m_Registers[CHR0], 0x1000);
+      MapChr(4, m_Registers[CHR1], 0x1000);
+    } else {
+      MapChr(0, m_Registers[CHR0] >> 1, 0x2000);
+    }
+  }
+};
+
+// A single register switching the 16 KiB bank at $8000
+class UxROM final : public Mapper {
+ public:
+  UxROM(Core *core, const Rom &rom) : Mapper(core, rom) { m_Registers.resize(1); }
+
+  void Reset() override {
+    m_Registers[0] = 0;
+    Update();
+  }
+
+ protected:
+  void Write(u16, u8 value) override {
+    m_Registers[0] = value;
+    Update();
+  }
+
+  void Update() override {
+    MapPrg(0, m_Registers[0], 0x4000);
+    MapPrg(2, -1, 0x4000);
+    MapChr(0, 0, 0x2000);
+  }
+};
+
+// A single register switching the 8 KiB of graphics
+class CNROM final : public Mapper {
+ public:
+  CNROM(Core *core, const Rom &rom) : Mapper(core, rom) { m_Registers.resize(1); }
+
+  void Reset() override {
+    m_Registers[0] = 0;
+    Update();
+  }
+
+ protected:
+  void Write(u16, u8 value) override {
+    m_Registers[0] = value;
+    Update();
+  }
+
+  void Update() override {
+    MapPrg(0, 0, 0x8000);
+    MapChr(0, m_Registers[0], 0x2000);
+  }
+};
+
+// Eight bank registers behind a select register, and a scanline counter
+// raising an interrupt when it reaches zero
+class MMC3 final : public Mapper {
+ public:
+  MMC3(Core *core, const Rom &rom) : Mapper(core, rom) { m_Registers.resize(COUNT); }
+
+  void Reset() override {
+    std::fill(m_Registers.begin(), m_Registers.end(), 0);
+    m_Registers[MIRRORING] = m_Rom.GetInfo().mirroring == Mirroring::HORIZONTAL;
+    SetIrq(false);
+    Update();
+  }
+
+  bool CountsScanlines() const override { return true; }
+
+  void OnScanline() override {
+    if (m_Registers[COUNTER] == 0 || m_Registers[RELOAD]) {
+      m_Registers[COUNTER] = m_Registers[LATCH];
+      m_Registers[RELOAD]  = false;
+    } else {
+      m_Registers[COUNTER]--;
+    }
+
+    if (m_Registers[COUNTER] == 0 && m_Registers[IRQ_ENABLED]) {
+      SetIrq(true);
+    }
+  }
+
+ protected:
+  enum : u8 { SELECT, R0, R1, R2, R3, R4, R5, R6, R7, MIRRORING, LATCH, COUNTER, RELOAD, IRQ_ENABLED, COUNT };
+
+  void Write(u16 address, u8 value) override {
+    // Each pair of registers is selected by the range and the parity, only
+    // the bank registers map the banks again
+    bool odd = address & 1;
+
+    switch (address & 0xE000) {
+      case 0x8000:
+        if (odd) {
+          m_Registers[R0 + (m_Registers[SELECT] & 0x07)] = value;
+        } else {
+          m_Registers[SELECT] = value;
+        }
+        Update();
+        break;
+      case 0xA000:
+        // The program ram protection is not emulated
+        if (!odd) {
+          m_Registers[MIRRORING] = value & 1;
+          Update();
+        }
+        break;
+      case 0xC000:
+        if (odd) {
+          m_Registers[RELOAD] = true;
+        } else {
+          m_Registers[LATCH] = value;
+        }
+        break;
+      case 0xE000:
+        m_Registers[IRQ_ENABLED] = odd;
+        // Disabling acknowledges the pending interrupt
+        if (!odd) {
+          SetIrq(false);
+        }
+        break;
+    }
+  }
+
+  void Update() override {
+    const u8 *r       = m_Registers.data();
+    bool      swapPrg = r[SELECT] & 0x40;
+    u8        chr     = r[SELECT] & 0x80 ? 4 : 0;
+
+    if (m_Rom.GetInfo().mirroring != Mirroring::FOUR_SCREEN) {
+      m_Mirroring = r[MIRRORING] ? Mirroring::HORIZONTAL : Mirroring::VERTICAL;
+    }
+
+    MapPrg(swapPrg ? 2 : 0, r[R6]);
+    MapPrg(1, r[R7]);
+    MapPrg(swapPrg ? 0 : 2, -2);
+    MapPrg(3, -1);
+
+    // Two 2 KiB banks and four 1 KiB banks, the halves swap on inversion
+    MapChr(chr + 0, r[R0] >> 1, 0x800);
+    MapChr(chr + 2, r[R1] >> 1, 0x800);
+    MapChr(chr ^ 4, r[R2]);
+    MapChr((chr ^ 4) + 1, r[R3]);
+    MapChr((chr ^ 4) + 2, r[R4]);
+    MapChr((chr ^ 4) + 3, r[R5]);
+  }
+};
+
+}  // namespace
+
+Mapper::Mapper(Core *core, const Rom &rom) : m_Core(core), m_Rom(rom), m_Mirroring(rom.GetInfo().mirroring) {
+  // Boards without graphics rom carry ram instead
+  if (rom.GetInfo().chrSize == 0) {
+    m_ChrRam.resize(std::max<u32>(rom.GetInfo().chrRamSize, 0x2000));
+  }
+  // A single slot of program ram, in whole pages of the bus
+  if (rom.GetInfo().prgRamSize > 0) {
+    m_PrgRam.resize(std::clamp<u32>(rom.GetInfo().prgRamSize, PAGE_SIZE, PRG_SLOT_SIZE));
+  }
+}
+
+std::vector<u8> Mapper::SaveState() const {
+  std::vector<u8> state = SaveRegisters();
+  state.insert(state.end(), m_ChrRam.begin(), m_ChrRam.end());
+  state.insert(state.end(), m_PrgRam.begin(), m_PrgRam.end());
+  return state;
+}
+
+bool Mapper::LoadState(const std::vector<u8> &state) {
+  std::size_t size = m_Registers.size() + 1;
+
+  if (state.size() != size + m_ChrRam.size() + m_PrgRam.size()) {
+    return false;
+  }
+
+  auto input = state.begin() + size;
+  std::copy_n(input, m_ChrRam.size(), m_ChrRam.begin());
+  input += m_ChrRam.size();
+  std::copy(input, state.end(), m_PrgRam.begin());
+
+  return LoadRegisters({state.begin(), state.begin() + size});
+}
+
+std::vector<u8> Mapper::SaveRegisters() const {
+  std::vector<u8> registers = m_Registers;
+  registers.push_back(m_IrqPending);
+  return registers;
+}
+
+bool Mapper::LoadRegisters(const std::vector<u8> &registers) {
+  if (registers.size() != m_Registers.size() + 1) {
+    return false;
+  }
+
+  std::copy_n(registers.begin(), m_Registers.size(), m_Registers.begin());
+  m_IrqPending = registers.back();
+
+  Update();
+  return true;
+}
+
+void Mapper::MapPrg(u8 slot, s32 bank, u32 size) {
+  const RomInfo &info  = m_Rom.GetInfo();
+  u8             first = 0x80 + slot * (PRG_SLOT_SIZE / PAGE_SIZE);
+  u8             last  = first + size / PAGE_SIZE - 1;
+
+  // A bank larger than the rom mirrors the whole rom
+  u32 mapped = std::min(size, info.prgSize);
+  m_Core->bus.MapRom(first, last, m_Rom.GetPrg() + BANK_OFFSET(bank, mapped, info.prgSize), mapped, this,
+                     &Mapper::OnWrite);
+}
+
+void Mapper::MapChr(u8 slot, s32 bank, u32 size) {
+  u8 *memory;
+  u32 total;
+
+  if (m_ChrRam.empty()) {
+    // The ppu never writes through the banks of the rom
+    memory = const_cast<u8 *>(m_Rom.GetChr());
+    total  = m_Rom.GetInfo().chrSize;
+  } else {
+    memory = m_ChrRam.data();
+    total  = m_ChrRam.size();
+  }
+
+  u32 offset = BANK_OFFSET(bank, size, total);
+  for (u32 i = 0; i < size / CHR_SLOT_SIZE; i++) {
+    m_ChrBanks[slot + i] = memory + (offset + i * CHR_SLOT_SIZE) % total;
+  }
+}
+
+void Mapper::SetIrq(bool pending) {
+  // The line stays asserted until the mapper acknowledges it, the cpu takes
+  // the interrupt now or once it clears its mask
+  m_IrqPending = pending;
+  if (pending) {
+    m_Core->cpu.PollIrq();
+  }
+}
+
+void Mapper::OnWrite(void *context, u16 address, u8 value) {
+  Mapper *mapper = static_cast<Mapper *>(context);
+
+  // The scanlines before the write are drawn with the previous banks
+  mapper->m_Core->scheduler.CatchUp();
+  mapper->Write(address, value);
+  mapper->m_Core->ppu.OnBankSwitch();
+}
+
+std::unique_ptr<Mapper> MAKE_MAPPER(Core *core, const Rom &rom) {
+  switch (rom.GetInfo().mapper) {
+    case 0:
+      return std::make_unique<NROM>(core, rom);
+    case 1:
+      return std::make_unique<MMC1>(core, rom);
+    case 2:
+      return std::make_unique<UxROM>(core, rom);
+    case 3:
+      return std::make_unique<CNROM>(core, rom);
+    case 4:
+      return std::make_unique<MMC3>(core, rom);
+    default:
+      return nullptr;
+  }
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,96 @@
+#ifndef EASYNES_MAPPER_HPP
+#define EASYNES_MAPPER_HPP
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "Bus.hpp"
+#include "Rom.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+constexpr u32 PRG_SLOT_SIZE = 8 * 1024;
+constexpr u32 CHR_SLOT_SIZE = 1024;
+constexpr u8  CHR_SLOTS     = 8;
+
+// The banks of the cartridge are mapped straight into the pages of the bus,
+// the reads of the program stay a single indexed load whatever the mapper.
+// The registers are written through the bus handler of the rom pages, a bank
+// switch rewrites the page pointers of the switched slots and nothing else.
+// The graphics banks are a table of 1 KiB pointers for the ppu
+class Mapper {
+ public:
+  Mapper(Core *core, const Rom &rom);
+  virtual ~Mapper() = default;
+
+  Mapper(const Mapper &)            = delete;
+  Mapper &operator=(const Mapper &) = delete;
+
+  // Map the banks of the power on state
+  virtual void Reset() = 0;
+  // Rising edge of the ppu address line A12, once per rendered scanline
+  virtual void OnScanline() {}
+  // The scheduler stops the cpu at every scanline for the mappers counting
+  // them, the others only see the vertical blank
+  virtual bool CountsScanlines() const { return false; }
+
+  inline bool      IsIrqPending() const { return m_IrqPending; }
+  inline Mirroring GetMirroring() const { return m_Mirroring; }
+
+  inline const u8 *GetChrBank(u8 slot) const { return m_ChrBanks[slot]; }
+  // Only the graphics ram can be written
+  inline u8 *GetWritableChrBank(u8 slot) { return m_ChrRam.empty() ? nullptr : m_ChrBanks[slot]; }
+  // Graphics ram of the board, empty when it has a graphics rom
+  inline const std::vector<u8> &GetChrRam() const { return m_ChrRam; }
+  inline std::vector<u8>       &GetChrRam() { return m_ChrRam; }
+  // Ram of the board mapped at $6000, empty when there is none
+  inline std::vector<u8> &GetPrgRam() { return m_PrgRam; }
+
+  // The registers of the mapper and its rams, the banks are mapped again on
+  // load. Loading fails and leaves the mapper untouched if the state is not
+  // valid
+  std::vector<u8> SaveState() const;
+  bool            LoadState(const std::vector<u8> &state);
+  // The registers alone, the rewind keeps the pages of the rams on its own
+  std::vector<u8> SaveRegisters() const;
+  bool            LoadRegisters(const std::vector<u8> &registers);
+
+ protected:
+  virtual void Write(u16 address, u8 value) = 0;
+  // Map the banks from the registers
+  virtual void Update() = 0;
+
+  // Map the program bank of the given size to $8000 + slot * 8 KiB, and the
+  // graphics bank to slot * 1 KiB. Negative banks count from the last one,
+  // the bank numbers wrap around the size of the rom
+  void MapPrg(u8 slot, s32 bank, u32 size = PRG_SLOT_SIZE);
+  void MapChr(u8 slot, s32 bank, u32 size = CHR_SLOT_SIZE);
+
+  void SetIrq(bool pending);
+
+  Core      *m_Core;
+  const Rom &m_Rom;
+  Mirroring  m_Mirroring;
+  bool       m_IrqPending = false;
+  // Saved and loaded by the base class
+  std::vector<u8> m_Registers;
+
+ private:
+  static void OnWrite(void *context, u16 address, u8 value);
+
+  std::array<u8 *, CHR_SLOTS> m_ChrBanks = {};
+  std::vector<u8>             m_ChrRam;
+  std::vector<u8>             m_PrgRam;
+};
+
+// Supported mappers: NROM (0), MMC1 (1), UxROM (2), CNROM (3) and MMC3 (4).
+// Returns nullptr for the other ones
+std::unique_ptr<Mapper> MAKE_MAPPER(Core *core, const Rom &rom);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_MAPPER_HPP
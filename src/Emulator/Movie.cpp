@@ -0,0 +1,185 @@
+#include "Movie.hpp"
+
+#include <bit>
+#include <cstdlib>
+#include <istream>
+#include <string>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+// Commands of the movies, on the frame they are in
+constexpr u8 MOVIE_SOFT_RESET = 0x01;
+constexpr u8 MOVIE_HARD_RESET = 0x02;
+
+constexpr u64 PRIME_1 = 0x9E3779B185EBCA87;
+constexpr u64 PRIME_2 = 0xC2B2AE3D27D4EB4F;
+constexpr u64 PRIME_3 = 0x165667B19E3779F9;
+constexpr u64 PRIME_4 = 0x85EBCA77C2B2AE63;
+constexpr u64 PRIME_5 = 0x27D4EB2F165667C5;
+
+// The words are little endian whatever the host is, the compilers turn this
+// into a single load
+template <typename T>
+T Load(const u8 *data) {
+  T value = 0;
+  for (std::size_t i = 0; i < sizeof(T); i++) {
+    value |= static_cast<T>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+u64 Round(u64 accumulator, u64 input) {
+  accumulator += input * PRIME_2;
+  return std::rotl(accumulator, 31) * PRIME_1;
+}
+
+u64 Merge(u64 hash, u64 accumulator) {
+  hash ^= Round(0, accumulator);
+  return hash * PRIME_1 + PRIME_4;
+}
+
+bool ParseButtons(const std::string &field, u8 &buttons) {
+  if (field.empty()) {
+    buttons = 0;
+    return true;
+  }
+  if (field.size() != 8) {
+    return false;
+  }
+
+  // The letters go from the right button, the highest bit, to A
+  buttons = 0;
+  for (std::size_t i = 0; i < 8; i++) {
+    if (field[i] != '.' && field[i] != ' ') {
+      buttons |= 0x80 >> i;
+    }
+  }
+  return true;
+}
+
+bool ParseFrame(const std::string &line, MovieFrame &frame) {
+  // The fields between the bars, the commands and the two first ports
+  std::vector<std::string> fields;
+  std::size_t              start = 1;
+
+  for (std::size_t bar; (bar = line.find('|', start)) != std::string::npos; start = bar + 1) {
+    fields.push_back(line.substr(start, bar - start));
+  }
+  if (fields.size() < 3) {
+    return false;
+  }
+
+  char *end;
+  long  commands = std::strtol(fields[0].c_str(), &end, 10);
+  if (fields[0].empty() || *end != '\0') {
+    return false;
+  }
+
+  frame.reset = commands & (MOVIE_SOFT_RESET | MOVIE_HARD_RESET);
+  return ParseButtons(fields[1], frame.buttons[0]) && ParseButtons(fields[2], frame.buttons[1]);
+}
+
+}  // namespace
+
+bool ReadMovie(std::istream &input, Movie &movie) {
+  std::string line;
+
+  while (std::getline(input, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    if (line.empty() || line[0] != '|') {
+      // The input of the binary movies follows the header
+      if (line == "binary 1") {
+        return false;
+      }
+      continue;
+    }
+
+    MovieFrame frame;
+    if (!ParseFrame(line, frame)) {
+      return false;
+    }
+    movie.frames.push_back(frame);
+  }
+
+  return true;
+}
+
+u64 XXHASH64(const void *data, std::size_t size, u64 seed) {
+  const u8 *input = static_cast<const u8 *>(data);
+  const u8 *end   = input + size;
+  u64       hash;
+
+  if (size >= 32) {
+    u64 lanes[4] = {seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1};
+
+    // Four independent lanes of 8 bytes, the rounds do not wait on each other
+    for (; input + 32 <= end; input += 32) {
+      for (u32 i = 0; i < 4; i++) {
+        lanes[i] = Round(lanes[i], Load<u64>(input + 8 * i));
+      }
+    }
+
+    hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+    for (u64 lane : lanes) {
+      hash = Merge(hash, lane);
+    }
+  } else {
+    hash = seed + PRIME_5;
+  }
+
+  hash += size;
+
+  for (; input + 8 <= end; input += 8) {
+    hash ^= Round(0, Load<u64>(input));
+    hash = std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+  }
+  if (input + 4 <= end) {
+    hash ^= Load<u32>(input) * PRIME_1;
+    hash = std::rotl(hash, 23) * PRIME_2 + PRIME_3;
+    input += 4;
+  }
+  for (; input < end; input++) {
+    hash ^= *input * PRIME_5;
+    hash = std::rotl(hash, 11) * PRIME_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME_2;
+  hash ^= hash >> 29;
+  hash *= PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+u64 FRAME_HASH(const Core &core, const u32 *framebuffer) {
+  u64 hash = XXHASH64(core.ram.Data(), WORK_RAM_SIZE);
+  return XXHASH64(framebuffer, FRAMEBUFFER_SIZE * sizeof(u32), hash);
+}
+
+std::vector<u64> ReplayMovie(Core &core, const Movie &movie, u32 *framebuffer) {
+  std::vector<u64> hashes;
+  hashes.reserve(movie.frames.size());
+  core.ppu.SetFramebuffer(framebuffer);
+
+  for (const MovieFrame &frame : movie.frames) {
+    if (frame.reset) {
+      core.cpu.RST();
+    }
+    core.controllers.SetButtons(0, frame.buttons[0]);
+    core.controllers.SetButtons(1, frame.buttons[1]);
+
+    core.RunFrame();
+    hashes.push_back(FRAME_HASH(core, framebuffer));
+  }
+
+  return hashes;
+}
+
+}  // namespace EasyNes
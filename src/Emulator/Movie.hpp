@@ -0,0 +1,44 @@
+#ifndef EASYNES_MOVIE_HPP
+#define EASYNES_MOVIE_HPP
+
+#include <array>
+#include <iosfwd>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+// Input of one frame, set before the frame runs
+struct MovieFrame {
+  std::array<u8, 2> buttons = {};
+  // The reset button is pressed before the frame
+  bool reset = false;
+};
+
+struct Movie {
+  std::vector<MovieFrame> frames;
+};
+
+// Read the input log of a text movie of FCEUX (.fm2), the header lines are
+// skipped and each "|commands|RLDUTSBA|RLDUTSBA|..." line is a frame. A button
+// is held unless its letter is a '.' or a space, both resets are a reset of the
+// cpu. Returns false on a line it does not understand or a binary movie
+bool ReadMovie(std::istream &input, Movie &movie);
+
+// xxHash64 of the data, the same as the reference implementation
+u64 XXHASH64(const void *data, std::size_t size, u64 seed = 0);
+
+// Hash of the state a frame leaves behind, the work ram then the picture
+u64 FRAME_HASH(const Core &core, const u32 *framebuffer);
+
+// Run one frame per entry of the movie as fast as possible from the current
+// state of the core, returns the hash of every frame. The framebuffer is given
+// to the ppu and holds FRAMEBUFFER_SIZE pixels
+std::vector<u64> ReplayMovie(Core &core, const Movie &movie, u32 *framebuffer);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_MOVIE_HPP
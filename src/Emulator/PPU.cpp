@@ -0,0 +1,704 @@
+#include "PPU.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "Core.hpp"
+#include "Pipeline.hpp"
+
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u16 VBLANK_SCANLINE     = 241;
+constexpr u16 PRE_RENDER_SCANLINE = 261;
+constexpr u16 HORIZONTAL_BITS     = 0x041F;
+constexpr u16 VERTICAL_BITS       = 0x7BE0;
+
+// Flags of the sprite pixels above the palette index
+constexpr u8 SPRITE_BEHIND = 0x40;
+constexpr u8 SPRITE_ZERO   = 0x80;
+
+// Tiles under a scanline, one more than the screen for the fine scroll
+constexpr u32 LINE_TILES = SCREEN_WIDTH / 8 + 1;
+
+// Spread the bits of a plane to one byte per pixel, the leftmost pixel in the
+// first byte. The two planes of a row are merged with a shift and an or, a
+// table of every pair of planes would be 512 KiB and miss the cache instead
+constexpr std::array<u64, 256> MAKE_SPREAD(bool flipped) {
+  std::array<u64, 256> table{};
+
+  for (u32 plane = 0; plane < 256; plane++) {
+    std::array<u8, 8> pixels{};
+    for (u32 x = 0; x < 8; x++) {
+      pixels[x] = (plane >> (flipped ? x : 7 - x)) & 1;
+    }
+    table[plane] = std::bit_cast<u64>(pixels);
+  }
+  return table;
+}
+
+constexpr std::array<u64, 256> SPREAD         = MAKE_SPREAD(false);
+constexpr std::array<u64, 256> SPREAD_FLIPPED = MAKE_SPREAD(true);
+
+// Nametables of each quarter of the ppu address space
+constexpr u8 NAMETABLES[][4] = {
+    {0, 0, 1, 1},  // Horizontal
+    {0, 1, 0, 1},  // Vertical
+    {0, 1, 2, 3},  // Four screen
+    {0, 0, 0, 0},  // Single lower
+    {1, 1, 1, 1},  // Single upper
+};
+
+// Graphics read without a cartridge
+constexpr std::array<u8, CHR_SLOT_SIZE> NO_CHR = {};
+
+// The backdrop entries of the sprite palettes mirror the background ones
+constexpr u8 PALETTE_INDEX(u16 address) {
+  u8 index = address % PALETTE_SIZE;
+  return (index & 0x13) == 0x10 ? index & 0x0F : index;
+}
+
+}  // namespace
+
+PPU::PPU(Core *core) : m_Core(core) {
+  // Blank until the banks of a ppu without a core are given
+  m_ChrBanks.fill(NO_CHR.data());
+  MapNametables(Mirroring::HORIZONTAL);
+  Reset();
+}
+
+PPU::~PPU() {}
+
+void PPU::SetFramebuffer(u32 *framebuffer) {
+  if (m_Pipeline) {
+    m_Pipeline->SetFramebuffer(framebuffer);
+  } else {
+    m_Framebuffer = framebuffer;
+  }
+}
+
+void PPU::EnablePipeline(bool enabled) {
+  if (enabled == IsPipelined()) {
+    return;
+  }
+
+  // The render thread takes the framebuffer, this ppu only keeps the flags
+  if (enabled) {
+    m_Pipeline = std::make_unique<PPUPipeline>(m_Core);
+    m_Pipeline->SetFramebuffer(m_Framebuffer);
+    m_Framebuffer = nullptr;
+  } else {
+    m_Framebuffer = m_Pipeline->GetFramebuffer();
+    m_Pipeline.reset();
+  }
+}
+
+void PPU::OnBankSwitch() {
+  if (m_Pipeline) {
+    m_Pipeline->RecordBanks();
+  }
+}
+
+void PPU::SyncPipeline() {
+  if (m_Pipeline) {
+    m_Pipeline->Restart();
+  }
+}
+
+void PPU::SetBanks(const std::array<u8 *, 8> &banks, bool writable, Mirroring mirroring) {
+  for (u8 slot = 0; slot < CHR_SLOTS; slot++) {
+    m_ChrBanks[slot]      = banks[slot];
+    m_WritableBanks[slot] = writable ? banks[slot] : nullptr;
+  }
+  MapNametables(mirroring);
+}
+
+void PPU::Reset() {
+  m_V = m_T = 0;
+  m_X = m_W = 0;
+
+  m_Control = m_Mask = m_Status = m_OamAddress = 0;
+  m_Latch = m_ReadBuffer = 0;
+
+  m_Scanline = 0;
+  m_Dots     = 0;
+  m_Frame    = 0;
+
+  m_Vram.fill(0);
+  m_Oam.fill(0);
+  m_Palette.fill(0);
+  UpdateColors();
+}
+
+u32 PPU::GetCyclesToEvent(bool everyScanline) const {
+  // The vertical blank starts when the scanline before it ends
+  u32 scanlines = 1;
+  if (!everyScanline) {
+    scanlines += (VBLANK_SCANLINE - 1 - m_Scanline + SCANLINES_PER_FRAME) % SCANLINES_PER_FRAME;
+  }
+
+  return GetCyclesToEnd(scanlines);
+}
+
+u32 PPU::GetCyclesToStatusChange() const {
+  u32 scanlines = 1;
+
+  // The sprite flags are set by the visible scanlines, the vertical blank flag
+  // by the end of the last one and every flag is cleared by the pre-render
+  // scanline
+  if (m_Scanline < SCREEN_HEIGHT && (IsRendering() || m_Framebuffer)) {
+    scanlines = 1;
+  } else if (m_Scanline < VBLANK_SCANLINE) {
+    scanlines = VBLANK_SCANLINE - m_Scanline;
+  } else if (m_Scanline < PRE_RENDER_SCANLINE) {
+    scanlines = PRE_RENDER_SCANLINE - m_Scanline;
+  }
+
+  return GetCyclesToEnd(scanlines);
+}
+
+u32 PPU::GetCyclesToEnd(u32 scanlines) const {
+  u32 dots = scanlines * DOTS_PER_SCANLINE - m_Dots;
+  return (dots + DOTS_PER_CYCLE - 1) / DOTS_PER_CYCLE;
+}
+
+void PPU::Run(u64 cycles) {
+  u64 dots  = m_Dots + cycles * DOTS_PER_CYCLE;
+  u64 frame = m_Frame;
+
+  while (dots >= DOTS_PER_SCANLINE) {
+    dots -= DOTS_PER_SCANLINE;
+    EndScanline();
+  }
+
+  m_Dots = dots;
+
+  if (m_Pipeline) {
+    m_Pipeline->Advance(cycles);
+    if (m_Frame != frame) {
+      m_Pipeline->Present(m_Frame);
+    }
+  }
+}
+
+u8 PPU::ReadRegister(u16 address) {
+  if (m_Pipeline) {
+    m_Pipeline->RecordRead(address);
+  }
+
+  switch (address % 8) {
+    case 2:
+      // Reading the status acknowledges the vertical blank
+      m_Latch = (m_Status & 0xE0) | (m_Latch & 0x1F);
+      m_StatusChanges += (m_Status & STATUS_VBLANK_BIT) != 0;
+      m_Status &= ~STATUS_VBLANK_BIT;
+      m_W = 0;
+      break;
+    case 4:
+      m_Latch = m_Oam[m_OamAddress];
+      break;
+    case 7:
+      // The reads are delayed by a buffer, except the palette which still
+      // fills the buffer with the nametable underneath
+      if ((m_V & 0x3FFF) >= 0x3F00) {
+        m_Latch      = (ReadMemory(m_V) & 0x3F) | (m_Latch & 0xC0);
+        m_ReadBuffer = ReadMemory(m_V - 0x1000);
+      } else {
+        m_Latch      = m_ReadBuffer;
+        m_ReadBuffer = ReadMemory(m_V);
+      }
+      m_V = (m_V + (m_Control & 0x04 ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+
+  // The write only registers read the last value on the bus
+  return m_Latch;
+}
+
+void PPU::WriteRegister(u16 address, u8 value) {
+  if (m_Pipeline) {
+    m_Pipeline->RecordWrite(address, value);
+  }
+  m_Latch = value;
+
+  switch (address % 8) {
+    case 0: {
+      // Enabling the nmi during the vertical blank raises it at once
+      bool raised = !(m_Control & CONTROL_NMI_BIT) && (value & CONTROL_NMI_BIT) && (m_Status & STATUS_VBLANK_BIT);
+      m_Control   = value;
+      m_T         = (m_T & 0xF3FF) | ((value & 0x03) << 10);
+      if (raised && m_Core) {
+        m_Core->cpu.NMI();
+      }
+      break;
+    }
+    case 1:
+      m_Mask = value;
+      UpdateColors();
+      break;
+    case 3:
+      m_OamAddress = value;
+      break;
+    case 4:
+      if (m_WriteTrap) {
+        m_WriteTrap(m_TrapContext, &m_Oam[m_OamAddress]);
+      }
+      m_Oam[m_OamAddress++] = value;
+      break;
+    case 5:
+      if (m_W == 0) {
+        m_T = (m_T & 0xFFE0) | (value >> 3);
+        m_X = value & 0x07;
+      } else {
+        m_T = (m_T & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+      }
+      m_W ^= 1;
+      break;
+    case 6:
+      if (m_W == 0) {
+        m_T = (m_T & 0x00FF) | ((value & 0x3F) << 8);
+      } else {
+        m_T = (m_T & 0xFF00) | value;
+        m_V = m_T;
+      }
+      m_W ^= 1;
+      break;
+    case 7:
+      WriteMemory(m_V, value);
+      m_V = (m_V + (m_Control & 0x04 ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+}
+
+void PPU::WriteOam(const u8 *page) {
+  if (m_Pipeline) {
+    m_Pipeline->RecordOam(page);
+  }
+  // A single trap for the copy, the sprites fit in a page of memory
+  if (m_WriteTrap) {
+    m_WriteTrap(m_TrapContext, m_Oam.data());
+  }
+
+  for (u32 i = 0; i < OAM_SIZE; i++) {
+    m_Oam[(m_OamAddress + i) % OAM_SIZE] = page[i];
+  }
+}
+
+u8 PPU::ReadMemory(u16 address) {
+  address &= 0x3FFF;
+  UpdateBanks();
+
+  if (address < 0x2000) {
+    return m_ChrBanks[address / CHR_SLOT_SIZE][address % CHR_SLOT_SIZE];
+  }
+  if (address < 0x3F00) {
+    return m_Nametables[(address >> 10) & 0x03][address % 0x400];
+  }
+  return m_Palette[PALETTE_INDEX(address)];
+}
+
+void PPU::WriteMemory(u16 address, u8 value) {
+  address &= 0x3FFF;
+  UpdateBanks();
+
+  if (address < 0x2000) {
+    // The writes to the graphics rom are lost
+    u8 *bank = !m_Core          ? m_WritableBanks[address / CHR_SLOT_SIZE]
+               : m_Core->mapper ? m_Core->mapper->GetWritableChrBank(address / CHR_SLOT_SIZE)
+                                : nullptr;
+    if (bank) {
+      if (m_WriteTrap) {
+        m_WriteTrap(m_TrapContext, &bank[address % CHR_SLOT_SIZE]);
+      }
+      bank[address % CHR_SLOT_SIZE] = value;
+    }
+  } else if (address < 0x3F00) {
+    u8 *memory = &m_Nametables[(address >> 10) & 0x03][address % 0x400];
+    if (m_WriteTrap) {
+      m_WriteTrap(m_TrapContext, memory);
+    }
+    *memory = value;
+  } else {
+    if (m_WriteTrap) {
+      m_WriteTrap(m_TrapContext, &m_Palette[PALETTE_INDEX(address)]);
+    }
+    m_Palette[PALETTE_INDEX(address)] = value & 0x3F;
+    UpdateColors();
+  }
+}
+
+PPUState PPU::GetState() const { return {GetRegisters(), m_Vram, m_Oam, m_Palette}; }
+
+void PPU::SetState(const PPUState &state) {
+  m_Vram    = state.vram;
+  m_Oam     = state.oam;
+  m_Palette = state.palette;
+  SetRegisters(state);
+}
+
+PPURegisters PPU::GetRegisters() const {
+  return {m_Control, m_Mask, m_Status, m_OamAddress, m_Latch, m_ReadBuffer, m_V,
+          m_T,       m_X,    m_W,      m_Scanline,   m_Dots,  m_Frame};
+}
+
+void PPU::SetRegisters(const PPURegisters &registers) {
+  m_Control    = registers.control;
+  m_Mask       = registers.mask;
+  m_Status     = registers.status;
+  m_OamAddress = registers.oamAddress;
+  m_Latch      = registers.latch;
+  m_ReadBuffer = registers.readBuffer;
+  m_V          = registers.v;
+  m_T          = registers.t;
+  m_X          = registers.x;
+  m_W          = registers.w;
+  m_Scanline   = registers.scanline;
+  m_Dots       = registers.dots;
+  m_Frame      = registers.frame;
+  UpdateColors();
+}
+
+void PPU::SetWriteTrap(void *context, MemoryTrap trap) {
+  m_TrapContext = context;
+  m_WriteTrap   = trap;
+}
+
+u8 PPU::OnRead(void *context, u16 address) {
+  PPU *ppu = static_cast<PPU *>(context);
+  ppu->m_Core->scheduler.CatchUp();
+  return ppu->ReadRegister(address);
+}
+
+void PPU::OnWrite(void *context, u16 address, u8 value) {
+  PPU *ppu = static_cast<PPU *>(context);
+  ppu->m_Core->scheduler.CatchUp();
+  ppu->WriteRegister(address, value);
+}
+
+void PPU::EndScanline() {
+  bool visible = m_Scanline < SCREEN_HEIGHT;
+  u8   status  = m_Status;
+
+  if (visible && m_Framebuffer) {
+    RenderScanline();
+  } else if (visible && IsRendering()) {
+    EvaluateFlags();
+  }
+
+  if (IsRendering() && (visible || m_Scanline == PRE_RENDER_SCANLINE)) {
+    // The next row, back to the left of the screen, and back to the top for
+    // the pre-render scanline
+    IncrementY();
+    m_V = (m_V & ~HORIZONTAL_BITS) | (m_T & HORIZONTAL_BITS);
+    if (!visible) {
+      m_V = (m_V & ~VERTICAL_BITS) | (m_T & VERTICAL_BITS);
+    }
+
+    if (m_Core && m_Core->mapper) {
+      m_Core->mapper->OnScanline();
+    }
+  }
+
+  m_Scanline++;
+
+  if (m_Scanline == VBLANK_SCANLINE) {
+    m_Status |= STATUS_VBLANK_BIT;
+    m_Frame++;
+    if ((m_Control & CONTROL_NMI_BIT) && m_Core) {
+      m_Core->cpu.NMI();
+    }
+  } else if (m_Scanline == PRE_RENDER_SCANLINE) {
+    m_Status &= ~(STATUS_VBLANK_BIT | STATUS_SPRITE_ZERO_BIT | STATUS_OVERFLOW_BIT);
+  } else if (m_Scanline == SCANLINES_PER_FRAME) {
+    m_Scanline = 0;
+  }
+
+  m_StatusChanges += m_Status != status;
+}
+
+void PPU::RenderScanline() {
+  alignas(16) std::array<u8, LINE_TILES * 8> background;
+  alignas(16) std::array<u8, SCREEN_WIDTH + 8> sprites;
+  alignas(16) std::array<u8, SCREEN_WIDTH> indices;
+
+  UpdateBanks();
+
+  if (m_Mask & MASK_BACKGROUND_BIT) {
+    FetchBackground(background.data());
+    if (!(m_Mask & MASK_BACKGROUND_LEFT_BIT)) {
+      std::fill_n(background.data() + m_X, 8, 0);
+    }
+  } else {
+    background.fill(0);
+  }
+
+  sprites.fill(0);
+  if (m_Mask & MASK_SPRITES_BIT) {
+    EvaluateSprites(sprites.data());
+    if (!(m_Mask & MASK_SPRITES_LEFT_BIT)) {
+      std::fill_n(sprites.data(), 8, 0);
+    }
+  }
+
+  if (Compose(background.data() + m_X, sprites.data(), indices.data())) {
+    m_Status |= STATUS_SPRITE_ZERO_BIT;
+  }
+
+  u32 *row = m_Framebuffer + m_Scanline * SCREEN_WIDTH;
+
+#if defined(__AVX2__)
+  for (u32 x = 0; x < SCREEN_WIDTH; x += 8) {
+    __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(indices.data() + x));
+    __m256i colors = _mm256_i32gather_epi32(reinterpret_cast<const int *>(m_Colors.data()),
+                                            _mm256_cvtepu8_epi32(packed), sizeof(u32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + x), colors);
+  }
+#else
+  for (u32 x = 0; x < SCREEN_WIDTH; x++) {
+    row[x] = m_Colors[indices[x]];
+  }
+#endif
+}
+
+void PPU::FetchBackground(u8 *line) {
+  u16 v     = m_V;
+  u16 table = m_Control & 0x10 ? 0x1000 : 0x0000;
+
+  for (u32 tile = 0; tile < LINE_TILES; tile++) {
+    const u8 *nametable = m_Nametables[(v >> 10) & 0x03];
+
+    // Each byte of the attribute table covers 4x4 tiles, 2 bits per 2x2
+    u8  index     = nametable[v & 0x03FF];
+    u8  attribute = nametable[0x03C0 | ((v >> 4) & 0x38) | ((v >> 2) & 0x07)];
+    u8  palette   = (attribute >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03;
+    u16 pattern   = table | (index << 4) | (v >> 12);
+
+    const u8 *bank = m_ChrBanks[pattern / CHR_SLOT_SIZE];
+    u8        lo   = bank[pattern % CHR_SLOT_SIZE];
+    u8        hi   = bank[pattern % CHR_SLOT_SIZE + 8];
+
+    // The palette lands above the two bits of the pixel in every byte
+    u64 pixels = SPREAD[lo] | (SPREAD[hi] << 1) | (palette * 0x0404040404040404);
+    std::memcpy(line + tile * 8, &pixels, sizeof(pixels));
+
+    // Coarse X wraps to the next horizontal nametable
+    if ((v & 0x001F) == 31) {
+      v = (v & ~0x001F) ^ 0x0400;
+    } else {
+      v++;
+    }
+  }
+}
+
+void PPU::EvaluateSprites(u8 *line) {
+  s32 height = m_Control & 0x20 ? 16 : 8;
+  u32 found  = 0;
+
+  for (u32 sprite = 0; sprite < 64; sprite++) {
+    const u8 *entry = &m_Oam[sprite * 4];
+    // The sprites show one scanline below their coordinate
+    s32 row = static_cast<s32>(m_Scanline) - 1 - entry[0];
+
+    if (row < 0 || row >= height) {
+      continue;
+    }
+    if (++found > 8) {
+      m_Status |= STATUS_OVERFLOW_BIT;
+      break;
+    }
+
+    u64 pixels = FetchSprite(sprite, row, height);
+    if (!pixels) {
+      continue;
+    }
+
+    u8 attributes = entry[2];
+    u8 flags = 0x10 | ((attributes & 0x03) << 2) | (attributes & 0x20 ? SPRITE_BEHIND : 0) |
+               (sprite == 0 ? SPRITE_ZERO : 0);
+
+    // A pixel only goes over the transparent pixels of the previous sprites
+    u8 *destination = line + entry[3];
+    for (u32 x = 0; x < 8; x++, pixels >>= 8) {
+      if ((pixels & 0x03) && !(destination[x] & 0x03)) {
+        destination[x] = (pixels & 0x03) | flags;
+      }
+    }
+  }
+}
+
+u64 PPU::FetchSprite(u32 sprite, s32 row, s32 height) const {
+  const u8 *entry      = &m_Oam[sprite * 4];
+  u8        tile       = entry[1];
+  u8        attributes = entry[2];
+  if (attributes & 0x80) {
+    row = height - 1 - row;
+  }
+
+  u16 pattern;
+  if (height == 16) {
+    // The first bit of the tile selects the table of the two tiles
+    pattern = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) | (row >= 8 ? 16 : 0) | (row % 8);
+  } else {
+    pattern = (m_Control & 0x08 ? 0x1000 : 0x0000) | (tile << 4) | row;
+  }
+
+  const u8 *bank = m_ChrBanks[pattern / CHR_SLOT_SIZE];
+  u8        lo   = bank[pattern % CHR_SLOT_SIZE];
+  u8        hi   = bank[pattern % CHR_SLOT_SIZE + 8];
+
+  const std::array<u64, 256> &spread = attributes & 0x40 ? SPREAD_FLIPPED : SPREAD;
+  return spread[lo] | (spread[hi] << 1);
+}
+
+void PPU::EvaluateFlags() {
+  s32 height = m_Control & 0x20 ? 16 : 8;
+  s32 first  = static_cast<s32>(m_Scanline) - 1 - m_Oam[0];
+
+  if (m_Mask & MASK_SPRITES_BIT) {
+    u32 found = 0;
+    for (u32 sprite = 0; sprite < 64 && found <= 8; sprite++) {
+      s32 row = static_cast<s32>(m_Scanline) - 1 - m_Oam[sprite * 4];
+      found += row >= 0 && row < height;
+    }
+    if (found > 8) {
+      m_Status |= STATUS_OVERFLOW_BIT;
+    }
+  }
+
+  // Sprite zero can only hit the background while both layers are shown
+  constexpr u8 LAYERS = MASK_BACKGROUND_BIT | MASK_SPRITES_BIT;
+  if ((m_Status & STATUS_SPRITE_ZERO_BIT) || (m_Mask & LAYERS) != LAYERS || first < 0 || first >= height) {
+    return;
+  }
+
+  UpdateBanks();
+  u64 pixels = FetchSprite(0, first, height);
+  if (!pixels) {
+    return;
+  }
+
+  alignas(16) std::array<u8, LINE_TILES * 8> background;
+  FetchBackground(background.data());
+
+  // The same clipping as the composition, and no hit on the last pixel
+  u32 left = m_Oam[3];
+  for (u32 x = 0; x < 8 && left + x + 1 < SCREEN_WIDTH; x++, pixels >>= 8) {
+    u32 column = left + x;
+    if (column < 8 && (m_Mask & (MASK_BACKGROUND_LEFT_BIT | MASK_SPRITES_LEFT_BIT)) !=
+                          (MASK_BACKGROUND_LEFT_BIT | MASK_SPRITES_LEFT_BIT)) {
+      continue;
+    }
+    if ((pixels & 0x03) && (background[m_X + column] & 0x03)) {
+      m_Status |= STATUS_SPRITE_ZERO_BIT;
+      return;
+    }
+  }
+}
+
+bool PPU::Compose(const u8 *background, const u8 *sprites, u8 *output) {
+  // A hit on the last pixel of the scanline is never reported
+  constexpr u32 LAST_PIXEL = 1u << 15;
+  bool          hit        = false;
+
+#if defined(__SSE2__)
+  const __m128i pixelBits = _mm_set1_epi8(0x03);
+  const __m128i colorBits = _mm_set1_epi8(0x1F);
+  const __m128i behindBit = _mm_set1_epi8(SPRITE_BEHIND);
+  const __m128i zeroBit   = _mm_set1_epi8(static_cast<char>(SPRITE_ZERO));
+  const __m128i zero      = _mm_setzero_si128();
+
+  for (u32 x = 0; x < SCREEN_WIDTH; x += 16) {
+    __m128i back   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(background + x));
+    __m128i sprite = _mm_load_si128(reinterpret_cast<const __m128i *>(sprites + x));
+
+    __m128i backClear   = _mm_cmpeq_epi8(_mm_and_si128(back, pixelBits), zero);
+    __m128i spriteClear = _mm_cmpeq_epi8(_mm_and_si128(sprite, pixelBits), zero);
+    __m128i behind      = _mm_cmpeq_epi8(_mm_and_si128(sprite, behindBit), behindBit);
+    __m128i first       = _mm_cmpeq_epi8(_mm_and_si128(sprite, zeroBit), zeroBit);
+
+    // The sprite is hidden when transparent or behind an opaque background
+    __m128i hidden  = _mm_or_si128(spriteClear, _mm_andnot_si128(backClear, behind));
+    __m128i visible = _mm_andnot_si128(backClear, back);
+    __m128i color   = _mm_or_si128(_mm_and_si128(hidden, visible), _mm_andnot_si128(hidden, _mm_and_si128(sprite, colorBits)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + x), color);
+
+    u32 hits = _mm_movemask_epi8(_mm_andnot_si128(_mm_or_si128(backClear, spriteClear), first));
+    if (x + 16 == SCREEN_WIDTH) {
+      hits &= ~LAST_PIXEL;
+    }
+    hit |= hits != 0;
+  }
+#else
+  for (u32 x = 0; x < SCREEN_WIDTH; x++) {
+    u8   back        = background[x];
+    u8   sprite      = sprites[x];
+    bool backOpaque  = back & 0x03;
+    bool spriteShown = (sprite & 0x03) && !(backOpaque && (sprite & SPRITE_BEHIND));
+
+    output[x] = spriteShown ? sprite & 0x1F : (backOpaque ? back : 0);
+    hit |= backOpaque && (sprite & 0x03) && (sprite & SPRITE_ZERO) && x + 1 < SCREEN_WIDTH;
+  }
+#endif
+
+  return hit;
+}
+
+void PPU::UpdateBanks() {
+  // The banks of a ppu without a core only change with SetBanks
+  if (!m_Core) {
+    return;
+  }
+
+  const Mapper *mapper = m_Core->mapper.get();
+
+  for (u8 slot = 0; slot < CHR_SLOTS; slot++) {
+    m_ChrBanks[slot] = mapper ? mapper->GetChrBank(slot) : NO_CHR.data();
+  }
+
+  MapNametables(mapper ? mapper->GetMirroring() : Mirroring::HORIZONTAL);
+}
+
+void PPU::MapNametables(Mirroring mirroring) {
+  for (u8 quarter = 0; quarter < 4; quarter++) {
+    m_Nametables[quarter] = m_Vram.data() + NAMETABLES[static_cast<u8>(mirroring)][quarter] * 0x400;
+  }
+}
+
+void PPU::UpdateColors() {
+  u8 greyscale = m_Mask & MASK_GREYSCALE_BIT ? 0x30 : 0x3F;
+
+  for (u8 i = 0; i < PALETTE_SIZE; i++) {
+    m_Colors[i] = SYSTEM_PALETTE[m_Palette[PALETTE_INDEX(i)] & greyscale];
+  }
+}
+
+void PPU::IncrementY() {
+  if ((m_V & 0x7000) != 0x7000) {
+    m_V += 0x1000;
+    return;
+  }
+
+  // Fine Y overflows into coarse Y, which wraps to the next vertical
+  // nametable after the 30 rows of tiles
+  u16 y = (m_V & 0x03E0) >> 5;
+  m_V &= ~0x7000;
+
+  if (y == 29) {
+    y = 0;
+    m_V ^= 0x0800;
+  } else if (y == 31) {
+    y = 0;
+  } else {
+    y++;
+  }
+
+  m_V = (m_V & ~0x03E0) | (y << 5);
+}
+
+}  // namespace EasyNes
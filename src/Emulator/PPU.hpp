@@ -0,0 +1,227 @@
+#ifndef EASYNES_PPU_HPP
+#define EASYNES_PPU_HPP
+
+#include <array>
+#include <memory>
+
+#include "Rom.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+class PPUPipeline;
+
+constexpr u32 SCREEN_WIDTH        = 256;
+constexpr u32 SCREEN_HEIGHT       = 240;
+constexpr u32 FRAMEBUFFER_SIZE    = SCREEN_WIDTH * SCREEN_HEIGHT;
+constexpr u32 DOTS_PER_SCANLINE   = 341;
+constexpr u32 SCANLINES_PER_FRAME = 262;
+// Three ppu dots per cpu cycle on the NTSC console
+constexpr u32 DOTS_PER_CYCLE = 3;
+
+constexpr u16 VRAM_SIZE    = 4 * 1024;
+constexpr u16 OAM_SIZE     = 256;
+constexpr u8  PALETTE_SIZE = 32;
+
+// Called in front of a write of the ppu with the byte about to change
+using MemoryTrap = void (*)(void *context, const u8 *memory);
+
+// Status register, mirrored every 8 bytes up to $3FFF
+constexpr u16 PPU_STATUS = 0x2002;
+
+constexpr u8 CONTROL_NMI_BIT          = 0b10000000;
+constexpr u8 STATUS_VBLANK_BIT        = 0b10000000;
+constexpr u8 STATUS_SPRITE_ZERO_BIT   = 0b01000000;
+constexpr u8 STATUS_OVERFLOW_BIT      = 0b00100000;
+constexpr u8 MASK_GREYSCALE_BIT       = 0b00000001;
+constexpr u8 MASK_BACKGROUND_LEFT_BIT = 0b00000010;
+constexpr u8 MASK_SPRITES_LEFT_BIT    = 0b00000100;
+constexpr u8 MASK_BACKGROUND_BIT      = 0b00001000;
+constexpr u8 MASK_SPRITES_BIT         = 0b00010000;
+
+// Colors of the 64 palette entries as 0xAARRGGBB, the emphasis bits of the
+// mask are not emulated
+constexpr std::array<u32, 64> SYSTEM_PALETTE = {
+    0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
+    0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08, 0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+    0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF, 0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
+    0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
+    0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC, 0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000,
+};
+
+// Registers and counters of the ppu, without its memories
+struct PPURegisters {
+  u8  control;
+  u8  mask;
+  u8  status;
+  u8  oamAddress;
+  u8  latch;
+  u8  readBuffer;
+  u16 v;
+  u16 t;
+  u8  x;
+  u8  w;
+  u16 scanline;
+  u32 dots;
+  u64 frame;
+};
+
+// Everything needed to resume the ppu where it stopped
+struct PPUState : PPURegisters {
+  std::array<u8, VRAM_SIZE>    vram;
+  std::array<u8, OAM_SIZE>     oam;
+  std::array<u8, PALETTE_SIZE> palette;
+};
+
+// The picture is drawn a whole scanline at a time, when the scanline ends.
+// The rows of the tiles are decoded through tables and the background and
+// the sprites of a scanline are merged 16 pixels at a time. The frame is
+// written to the framebuffer of the caller, nothing is allocated while running.
+// Without a framebuffer only the flags of the sprites are evaluated, the
+// background is fetched for the scanlines of sprite zero until it hits
+class PPU {
+ public:
+  // A ppu without a core raises no interrupt and draws from the banks it is
+  // given, the render thread of a pipeline replays one
+  explicit PPU(Core *core);
+  ~PPU();
+
+  PPU(const PPU &)            = delete;
+  PPU &operator=(const PPU &) = delete;
+
+  // Power on state, the first scanline is about to start
+  void Reset();
+
+  // The frame is drawn to the FRAMEBUFFER_SIZE pixels, nullptr only keeps the
+  // side effects of the rendering like the sprite zero hit
+  void SetFramebuffer(u32 *framebuffer);
+
+  // Draw the pictures on a thread of their own, see Pipeline.hpp. The
+  // framebuffer receives the picture of the previous frame when a frame ends
+  void        EnablePipeline(bool enabled);
+  inline bool IsPipelined() const { return m_Pipeline != nullptr; }
+  // The mapper switched its graphics banks or its mirroring
+  void OnBankSwitch();
+  // The state was set behind the back of the pipeline, it starts over
+  void SyncPipeline();
+  // Banks and mirroring of a ppu without a core, the banks are written
+  // through when they are writable
+  void SetBanks(const std::array<u8 *, 8> &banks, bool writable, Mirroring mirroring);
+
+  // Advance by the cpu cycles, every completed scanline is drawn and its
+  // events raised: the vertical blank and its nmi, the scanline counter of the
+  // mapper
+  void Run(u64 cycles);
+  // Cpu cycles until the end of the next scanline raising an event, the
+  // vertical blank or any scanline for the counter of the mapper
+  u32 GetCyclesToEvent(bool everyScanline) const;
+  // Cpu cycles until the end of the next scanline which may change the status
+  u32 GetCyclesToStatusChange() const;
+
+  // Registers $2000-$2007, mirrored every 8 bytes
+  u8   ReadRegister(u16 address);
+  void WriteRegister(u16 address, u8 value);
+  // Copy of a page of cpu memory to the sprites, the cpu is stalled by the caller
+  void WriteOam(const u8 *page);
+
+  inline u16 GetScanline() const { return m_Scanline; }
+  // Frames whose picture is complete
+  inline u64 GetFrame() const { return m_Frame; }
+  // Changes of the status so far, by the scanlines or by reading it. Not part
+  // of the state, only compared over a short time
+  inline u64 GetStatusChanges() const { return m_StatusChanges; }
+
+  // Ppu address space, $0000-$1FFF through the graphics banks of the mapper
+  u8   ReadMemory(u16 address);
+  void WriteMemory(u16 address, u8 value);
+
+  PPUState GetState() const;
+  void     SetState(const PPUState &state);
+  // The memories are left alone, they are written through the accessors
+  PPURegisters GetRegisters() const;
+  void         SetRegisters(const PPURegisters &registers);
+
+  // The colors follow the palette on the next SetRegisters
+  inline std::array<u8, VRAM_SIZE>    &GetVram() { return m_Vram; }
+  inline std::array<u8, OAM_SIZE>     &GetOam() { return m_Oam; }
+  inline std::array<u8, PALETTE_SIZE> &GetPalette() { return m_Palette; }
+
+  // Trap the writes to the memories of the ppu and to the graphics ram of
+  // the mapper, nullptr removes it
+  void SetWriteTrap(void *context, MemoryTrap trap);
+
+  static u8   OnRead(void *context, u16 address);
+  static void OnWrite(void *context, u16 address, u8 value);
+
+ private:
+  // Cpu cycles until the end of the scanlines, the current one included
+  u32  GetCyclesToEnd(u32 scanlines) const;
+  void EndScanline();
+  void RenderScanline();
+  // Only the flags of the sprites, as RenderScanline sets them
+  void EvaluateFlags();
+  // Decode the 33 tiles under the scanline, the fine scroll picks 256 pixels
+  void FetchBackground(u8 *line);
+  // The sprites of the scanline, the first ones in memory over the others
+  void EvaluateSprites(u8 *line);
+  // Pixels of the row of a sprite on the scanline, one byte each from the left
+  u64 FetchSprite(u32 sprite, s32 row, s32 height) const;
+  // Merge the layers to palette indices, returns true on a sprite zero hit
+  bool Compose(const u8 *background, const u8 *sprites, u8 *output);
+
+  // Pointers of the banks, taken again before every access since the mapper
+  // can switch them at any time
+  void UpdateBanks();
+  void MapNametables(Mirroring mirroring);
+  void UpdateColors();
+  void IncrementY();
+
+  inline bool IsRendering() const { return m_Mask & (MASK_BACKGROUND_BIT | MASK_SPRITES_BIT); }
+
+  Core *m_Core;
+  u32  *m_Framebuffer = nullptr;
+  // The cycles run and the writes are logged for the render thread
+  std::unique_ptr<PPUPipeline> m_Pipeline;
+  void                        *m_TrapContext = nullptr;
+  MemoryTrap                   m_WriteTrap   = nullptr;
+
+  // Loopy's registers: the current and the temporary vram address, the fine
+  // horizontal scroll and the write toggle of $2005 and $2006
+  u16 m_V = 0;
+  u16 m_T = 0;
+  u8  m_X = 0;
+  u8  m_W = 0;
+
+  u8 m_Control    = 0;
+  u8 m_Mask       = 0;
+  u8 m_Status     = 0;
+  u8 m_OamAddress = 0;
+  // Last value written to a register, read back from the unused bits
+  u8 m_Latch      = 0;
+  u8 m_ReadBuffer = 0;
+
+  u16 m_Scanline = 0;
+  u32 m_Dots     = 0;
+  u64 m_Frame    = 0;
+
+  u64 m_StatusChanges = 0;
+
+  std::array<u8, VRAM_SIZE>    m_Vram;
+  std::array<u8, OAM_SIZE>     m_Oam;
+  std::array<u8, PALETTE_SIZE> m_Palette;
+  // Host colors of the palette entries, with the greyscale applied
+  std::array<u32, PALETTE_SIZE> m_Colors;
+
+  std::array<const u8 *, 8> m_ChrBanks;
+  std::array<u8 *, 4>       m_Nametables;
+  // Only set without a core, for the graphics ram
+  std::array<u8 *, 8> m_WritableBanks = {};
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_PPU_HPP
@@ -0,0 +1,207 @@
+#include "Pipeline.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+PPUPipeline::PPUPipeline(Core *core) : m_Core(core), m_Events(PIPELINE_RING_SIZE) {
+  for (std::vector<u32> &buffer : m_Buffers) {
+    buffer.resize(FRAMEBUFFER_SIZE);
+  }
+
+  Restart();
+  m_Thread = std::thread(&PPUPipeline::Work, this);
+}
+
+PPUPipeline::~PPUPipeline() {
+  Push(PPUEventKind::STOP);
+  m_Head.notify_one();
+  m_Thread.join();
+}
+
+void PPUPipeline::RecordRead(u16 address) {
+  // The other reads have no effect on the picture
+  if (address % 8 == 2 || address % 8 == 7) {
+    Push(PPUEventKind::READ, address);
+  }
+}
+
+void PPUPipeline::RecordWrite(u16 address, u8 value) { Push(PPUEventKind::WRITE, address, value); }
+
+void PPUPipeline::RecordOam(const u8 *page) {
+  for (u32 i = 0; i < OAM_SIZE; i++) {
+    Push(PPUEventKind::OAM, i, page[i]);
+  }
+}
+
+void PPUPipeline::RecordBanks() {
+  const Mapper *mapper = m_Core->mapper.get();
+  const u8     *memory = mapper->GetChrRam().empty() ? m_Core->rom->GetChr() : mapper->GetChrRam().data();
+
+  for (u8 slot = 0; slot < CHR_SLOTS; slot++) {
+    Push(PPUEventKind::BANK, slot, 0, mapper->GetChrBank(slot) - memory);
+  }
+  Push(PPUEventKind::MIRRORING, 0, static_cast<u8>(mapper->GetMirroring()));
+}
+
+void PPUPipeline::Present(u64 frame) {
+  Push(PPUEventKind::SYNC);
+  m_Head.notify_one();
+
+  if (frame < 2 || !m_Framebuffer) {
+    return;
+  }
+
+  // The picture of the frame before the last one, the render thread draws the
+  // last one in the other buffer meanwhile
+  u64 drawn = m_Drawn.load(std::memory_order_acquire);
+  if (drawn < frame - 1) {
+    m_Stalls++;
+  }
+  while (drawn < frame - 1) {
+    m_Drawn.wait(drawn, std::memory_order_acquire);
+    drawn = m_Drawn.load(std::memory_order_acquire);
+  }
+
+  std::memcpy(m_Framebuffer, m_Buffers[frame % 2].data(), FRAMEBUFFER_SIZE * sizeof(u32));
+}
+
+void PPUPipeline::Restart() {
+  Drain();
+
+  // The render thread waits for the next event, its ppu can be set from here
+  const Mapper *mapper = m_Core->mapper.get();
+  m_Rom                = m_Core->rom;
+
+  if (mapper && mapper->GetChrRam().empty()) {
+    // The ppu never writes through the banks of the rom
+    m_Chr      = const_cast<u8 *>(m_Rom->GetChr());
+    m_Writable = false;
+  } else {
+    m_ChrRam   = mapper ? mapper->GetChrRam() : std::vector<u8>(CHR_SLOTS * CHR_SLOT_SIZE);
+    m_Chr      = m_ChrRam.data();
+    m_Writable = mapper != nullptr;
+  }
+
+  const u8 *memory = mapper ? mapper->GetChrRam().empty() ? m_Rom->GetChr() : mapper->GetChrRam().data() : nullptr;
+  for (u8 slot = 0; slot < CHR_SLOTS; slot++) {
+    m_Offsets[slot] = mapper ? mapper->GetChrBank(slot) - memory : slot * CHR_SLOT_SIZE;
+  }
+
+  m_Ppu.SetState(m_Core->ppu.GetState());
+  MapBanks(mapper ? mapper->GetMirroring() : Mirroring::HORIZONTAL);
+  m_Ppu.SetFramebuffer(m_Buffers[m_Ppu.GetFrame() % 2].data());
+  m_Pending = 0;
+  m_Drawn.store(m_Ppu.GetFrame(), std::memory_order_release);
+}
+
+void PPUPipeline::Push(PPUEventKind kind, u16 address, u8 value, u32 offset) {
+  u64 head = m_Head.load(std::memory_order_relaxed);
+
+  if (head - m_CachedTail == PIPELINE_RING_SIZE) {
+    m_CachedTail = m_Tail.load(std::memory_order_acquire);
+
+    // Full, the render thread may be sleeping on a frame that is not over
+    if (head - m_CachedTail == PIPELINE_RING_SIZE) {
+      m_Stalls++;
+      m_Head.notify_one();
+    }
+    while (head - m_CachedTail == PIPELINE_RING_SIZE) {
+      std::this_thread::yield();
+      m_CachedTail = m_Tail.load(std::memory_order_acquire);
+    }
+  }
+
+  m_Events[head % PIPELINE_RING_SIZE] = {m_Pending, offset, address, kind, value};
+  m_Pending                           = 0;
+  m_Head.store(head + 1, std::memory_order_release);
+}
+
+void PPUPipeline::Drain() {
+  u64 head = m_Head.load(std::memory_order_relaxed);
+
+  m_Head.notify_one();
+  while (m_Tail.load(std::memory_order_acquire) != head) {
+    std::this_thread::yield();
+  }
+  m_CachedTail = head;
+}
+
+void PPUPipeline::Work() {
+  u64 tail = m_Tail.load(std::memory_order_relaxed);
+
+  for (;;) {
+    u64 head = m_Head.load(std::memory_order_acquire);
+    if (head == tail) {
+      m_Head.wait(head, std::memory_order_acquire);
+      continue;
+    }
+
+    for (; tail != head; tail++) {
+      const PPUEvent &event = m_Events[tail % PIPELINE_RING_SIZE];
+      if (event.kind == PPUEventKind::STOP) {
+        return;
+      }
+      Replay(event);
+    }
+    m_Tail.store(tail, std::memory_order_release);
+  }
+}
+
+void PPUPipeline::Replay(const PPUEvent &event) {
+  Run(event.cycles);
+
+  switch (event.kind) {
+    case PPUEventKind::READ:
+      m_Ppu.ReadRegister(event.address);
+      break;
+    case PPUEventKind::WRITE:
+      m_Ppu.WriteRegister(event.address, event.value);
+      break;
+    case PPUEventKind::OAM:
+      m_Oam[event.address] = event.value;
+      if (event.address == OAM_SIZE - 1) {
+        m_Ppu.WriteOam(m_Oam.data());
+      }
+      break;
+    case PPUEventKind::BANK:
+      m_Offsets[event.address] = event.offset;
+      break;
+    case PPUEventKind::MIRRORING:
+      MapBanks(static_cast<Mirroring>(event.value));
+      break;
+    default:
+      break;
+  }
+}
+
+void PPUPipeline::Run(u64 cycles) {
+  while (cycles > 0) {
+    u64 step  = std::min<u64>(cycles, m_Ppu.GetCyclesToEvent(false));
+    u64 frame = m_Ppu.GetFrame();
+
+    m_Ppu.Run(step);
+    cycles -= step;
+
+    // The picture is complete at the vertical blank, the next one is drawn in
+    // the other buffer
+    if (m_Ppu.GetFrame() != frame) {
+      m_Ppu.SetFramebuffer(m_Buffers[m_Ppu.GetFrame() % 2].data());
+      m_Drawn.store(m_Ppu.GetFrame(), std::memory_order_release);
+      m_Drawn.notify_one();
+    }
+  }
+}
+
+void PPUPipeline::MapBanks(Mirroring mirroring) {
+  std::array<u8 *, CHR_SLOTS> banks;
+  for (u8 slot = 0; slot < CHR_SLOTS; slot++) {
+    banks[slot] = m_Chr + m_Offsets[slot];
+  }
+  m_Ppu.SetBanks(banks, m_Writable, mirroring);
+}
+
+}  // namespace EasyNes
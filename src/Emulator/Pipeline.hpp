@@ -0,0 +1,129 @@
+#ifndef EASYNES_PIPELINE_HPP
+#define EASYNES_PIPELINE_HPP
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "PPU.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Events buffered between the cpu and the render thread, 256 KiB per pipeline
+constexpr u32 PIPELINE_RING_SIZE = 1 << 14;
+
+enum class PPUEventKind : u8 {
+  // Reads of the status and of the data register move the toggle and the
+  // address, the writes of the registers
+  READ,
+  WRITE,
+  // One byte of a sprite dma, the last one copies the page
+  OAM,
+  // Offset of a graphics bank in the graphics memory, the mirroring comes
+  // after the banks and maps them all
+  BANK,
+  MIRRORING,
+  // Only runs the ppu, the end of a frame
+  SYNC,
+  STOP,
+};
+
+// What the ppu of the cpu thread did, after it ran for the cycles
+struct PPUEvent {
+  u64          cycles;
+  u32          offset;
+  u16          address;
+  PPUEventKind kind;
+  u8           value;
+};
+
+static_assert(sizeof(PPUEvent) == 16);
+
+// The drawing of the frames on a thread of their own. The ppu of the core
+// keeps the timing, the status and the memory, but only evaluates the flags
+// of the sprites. Its register accesses, sprite dma and bank switches are
+// logged with the cycles it ran in between, a second ppu without a core
+// replays them on the render thread and draws the pictures while the cpu runs
+// on. Every read of the cpu is answered by the ppu of the core, the only sync
+// points are the ends of the frames and the loaded states.
+//
+// The picture of a frame is delivered when the next one ends, the cpu waits
+// for the render thread only if it is a whole frame behind.
+//
+// The pipeline is off unless PPU::EnablePipeline() is called. It only pays off
+// when the render thread has a core of its own, on a single core both threads
+// share it and the frames take longer than with the plain ppu
+class PPUPipeline {
+ public:
+  explicit PPUPipeline(Core *core);
+  // Stops the render thread, the pictures in progress are lost
+  ~PPUPipeline();
+
+  PPUPipeline(const PPUPipeline &)            = delete;
+  PPUPipeline &operator=(const PPUPipeline &) = delete;
+
+  inline void SetFramebuffer(u32 *framebuffer) { m_Framebuffer = framebuffer; }
+  inline u32 *GetFramebuffer() const { return m_Framebuffer; }
+
+  // Called by the ppu of the core on the cpu thread
+  inline void Advance(u64 cycles) { m_Pending += cycles; }
+  void        RecordRead(u16 address);
+  void        RecordWrite(u16 address, u8 value);
+  void        RecordOam(const u8 *page);
+  void        RecordBanks();
+  // The ppu completed the frames, the picture of the one before the last is
+  // copied to the framebuffer
+  void Present(u64 frame);
+  // Wait for the render thread, then start over from the state of the ppu of
+  // the core and the banks of its mapper
+  void Restart();
+
+  // Times the cpu waited for the render thread
+  inline u64 GetStalls() const { return m_Stalls; }
+
+ private:
+  void Push(PPUEventKind kind, u16 address = 0, u8 value = 0, u32 offset = 0);
+  // Wait until the render thread replayed every event
+  void Drain();
+
+  // Render thread
+  void Work();
+  void Replay(const PPUEvent &event);
+  // Run the replayed ppu, switching the buffers at every vertical blank
+  void Run(u64 cycles);
+  void MapBanks(Mirroring mirroring);
+
+  Core *m_Core;
+  u32  *m_Framebuffer = nullptr;
+  u64   m_Pending     = 0;
+  u64   m_Stalls      = 0;
+
+  std::vector<PPUEvent> m_Events;
+  // On their own cache lines, the two threads write them all the time
+  alignas(64) std::atomic<u64> m_Head = 0;
+  u64 m_CachedTail                     = 0;
+  alignas(64) std::atomic<u64> m_Tail = 0;
+  // Pictures completed by the render thread
+  alignas(64) std::atomic<u64> m_Drawn = 0;
+
+  // Owned by the render thread between the restarts
+  PPU                             m_Ppu{nullptr};
+  std::array<std::vector<u32>, 2> m_Buffers;
+  // The graphics rom is shared, the graphics ram is a copy written by the
+  // replayed ppu
+  std::shared_ptr<const Rom> m_Rom;
+  std::vector<u8>            m_ChrRam;
+  u8                        *m_Chr      = nullptr;
+  bool                       m_Writable = false;
+  std::array<u32, 8>         m_Offsets  = {};
+  std::array<u8, OAM_SIZE>   m_Oam;
+
+  std::thread m_Thread;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_PIPELINE_HPP
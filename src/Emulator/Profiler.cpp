@@ -0,0 +1,142 @@
+#include "Profiler.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+namespace EasyNes {
+
+namespace {
+
+bool ParseAddress(std::string text, u16 &address) {
+  if (!text.empty() && text.front() == '$') {
+    text.erase(0, 1);
+  }
+  if (!text.empty() && text.back() == ':') {
+    text.pop_back();
+  }
+
+  u32  value;
+  auto result = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+  if (text.empty() || result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+    return false;
+  }
+
+  // The bank of the banked addresses is dropped
+  address = value;
+  return true;
+}
+
+}  // namespace
+
+Profiler::Profiler(u32 period) : m_Period(period), m_Countdown(period) { m_Stack.reserve(MAX_CALL_DEPTH); }
+
+bool Profiler::LoadSymbols(std::istream &input) {
+  std::string line;
+
+  while (std::getline(input, line)) {
+    std::istringstream words(line);
+    std::string        first, address, name;
+
+    if (!(words >> first) || first[0] == '#' || first[0] == ';') {
+      continue;
+    }
+
+    if (first == "al") {
+      words >> address >> name;
+      if (!name.empty() && name.front() == '.') {
+        name.erase(0, 1);
+      }
+    } else {
+      address = first;
+      words >> name;
+    }
+
+    u16 value;
+    if (name.empty() || !ParseAddress(address, value)) {
+      return false;
+    }
+    m_Symbols[value] = name;
+  }
+
+  return true;
+}
+
+void Profiler::WriteFoldedStacks(std::ostream &output) const {
+  // Stacks sampled at different addresses of the same routine are merged
+  std::map<std::string, u64> folded;
+
+  for (const auto &[key, count] : m_Samples) {
+    std::string stack;
+    for (std::size_t i = 0; i + 1 < key.size(); i++) {
+      stack += (i > 0 ? ";" : "") + Name(key[i]);
+    }
+
+    // Without labels the routines are only known from their calls
+    u16 routine = Routine(key.back());
+    if (key.size() == 1 || (!m_Symbols.empty() && routine != key[key.size() - 2])) {
+      stack += (key.size() > 1 ? ";" : "") + Name(routine);
+    }
+
+    folded[stack] += count;
+  }
+
+  for (const auto &[stack, count] : folded) {
+    output << stack << ' ' << count << '\n';
+  }
+}
+
+void Profiler::Clear() {
+  m_Samples.clear();
+  m_SampleCount = 0;
+  m_Countdown   = m_Period;
+}
+
+void Profiler::OnReset(u16 address) {
+  // Above any stack pointer, the root is never returned from
+  m_Stack.clear();
+  m_Stack.push_back({address, 0x100});
+}
+
+std::size_t Profiler::StackHash::operator()(const std::vector<u16> &stack) const {
+  std::size_t hash = stack.size();
+  for (u16 entry : stack) {
+    hash = hash * 0x100000001B3 ^ entry;
+  }
+  return hash;
+}
+
+void Profiler::Sample(u16 address) {
+  // A long stall or a skipped idle loop can span several periods
+  u64 count = 1 + static_cast<u64>(-m_Countdown) / m_Period;
+  m_Countdown += count * m_Period;
+  m_SampleCount += count;
+
+  m_Key.clear();
+  for (const Frame &frame : m_Stack) {
+    m_Key.push_back(frame.entry);
+  }
+  m_Key.push_back(address);
+
+  m_Samples[m_Key] += count;
+}
+
+std::string Profiler::Name(u16 address) const {
+  auto symbol = m_Symbols.find(address);
+  if (symbol != m_Symbols.end()) {
+    return symbol->second;
+  }
+
+  char name[8];
+  std::snprintf(name, sizeof(name), "$%04X", address);
+  return name;
+}
+
+u16 Profiler::Routine(u16 address) const {
+  auto next = m_Symbols.upper_bound(address);
+  return next == m_Symbols.begin() ? address : std::prev(next)->first;
+}
+
+}  // namespace EasyNes
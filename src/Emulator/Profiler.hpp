@@ -0,0 +1,99 @@
+#ifndef EASYNES_PROFILER_HPP
+#define EASYNES_PROFILER_HPP
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Cycles between two samples by default, about 30 samples per frame
+constexpr u32 DEFAULT_SAMPLE_PERIOD = 1000;
+// Deeper calls are sampled in the deepest frame
+constexpr u32 MAX_CALL_DEPTH = 64;
+
+// Samples the guest program counter and a shadow call stack every period
+// cycles. The stack follows JSR, RTS, the interrupts and RTI: a frame is left
+// once the stack pointer is back above the return address it pushed, so the
+// routines dropping their return address or returning through a pushed
+// address leave no stale frame past the next call or return
+class Profiler {
+ public:
+  explicit Profiler(u32 period = DEFAULT_SAMPLE_PERIOD);
+
+  // Name the routines, the labels are read as "address name" lines, in hex
+  // with an optional '$', or from the label files of ld65 ("al 00C000 .name").
+  // Returns false on a line it does not understand, the labels read before it
+  // are kept
+  bool LoadSymbols(std::istream &input);
+
+  // One "caller;callee;... count" line per sampled stack, the input of the
+  // flamegraph tools. The frames are the entries of the routines, the last
+  // one is the label holding the sampled address when it is another one
+  void WriteFoldedStacks(std::ostream &output) const;
+
+  inline u64 GetSamples() const { return m_SampleCount; }
+  inline u32 GetPeriod() const { return m_Period; }
+  // Drop the samples, the shadow stack and the labels are kept
+  void Clear();
+
+  // Called by the cpu, sp is the stack pointer before the return address is
+  // pushed. The frames at or below it lost their return address already
+  inline void OnCall(u16 destination, u8 sp) {
+    OnReturn(sp);
+    if (m_Stack.size() < MAX_CALL_DEPTH) {
+      m_Stack.push_back({destination, sp});
+    }
+  }
+
+  // sp is the stack pointer once the return address is pulled
+  inline void OnReturn(u8 sp) {
+    while (!m_Stack.empty() && m_Stack.back().sp <= sp) {
+      m_Stack.pop_back();
+    }
+  }
+
+  // The whole stack is dropped, the routine at the address is the new root
+  void OnReset(u16 address);
+
+  inline void OnCycles(u16 address, u64 cycles) {
+    m_Countdown -= static_cast<s64>(cycles);
+    if (m_Countdown <= 0) {
+      Sample(address);
+    }
+  }
+
+ private:
+  struct Frame {
+    u16 entry;
+    u16 sp;
+  };
+
+  struct StackHash {
+    std::size_t operator()(const std::vector<u16> &stack) const;
+  };
+
+  void        Sample(u16 address);
+  std::string Name(u16 address) const;
+  // Entry of the label holding the address, the address when there is none
+  u16 Routine(u16 address) const;
+
+  u32                m_Period;
+  s64                m_Countdown;
+  u64                m_SampleCount = 0;
+  std::vector<Frame> m_Stack;
+
+  // The entries of the stack then the sampled address
+  std::unordered_map<std::vector<u16>, u64, StackHash> m_Samples;
+  std::vector<u16>                                     m_Key;
+
+  std::map<u16, std::string> m_Symbols;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_PROFILER_HPP
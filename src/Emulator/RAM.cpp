@@ -1,21 +1,22 @@
 #include "RAM.hpp"
 
+#include <cstring>
+
 namespace EasyNes {
 
-RAM::RAM() { Wipe(); }
+RAM::RAM(std::size_t size) { Resize(size); }
 
 RAM::~RAM() {}
 
-void RAM::Wipe() {
-  for (u8 &data : m_Data) {
-    data = 0;
+void RAM::Resize(std::size_t size) {
+  // The new memory comes cleared, the work ram is only cleared when it is used
+  m_Large = size > WORK_RAM_SIZE ? std::make_unique<u8[]>(size) : nullptr;
+  m_Size  = size;
+  if (!m_Large) {
+    Wipe();
   }
 }
 
-u8 &RAM::operator[](u16 address) {
-  // We don't check the address to be within the memory boundaries because we
-  // cannot represent an out of range address with only 16 bits
-  return m_Data[address];
-}
+void RAM::Wipe() { std::memset(Data(), 0, m_Size); }
 
 }  // namespace EasyNes
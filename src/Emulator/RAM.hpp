@@ -2,24 +2,41 @@
 #define EASYNES_RAM_HPP
 
 #include <array>
+#include <memory>
 
 #include "Types.hpp"
 
 namespace EasyNes {
 
+// Work ram of the console, mirrored up to $1FFF
+constexpr std::size_t WORK_RAM_SIZE = 2 * 1024;
+// Ram over the whole address space, to run programs on a bare cpu
 constexpr std::size_t RAM_SIZE = 256 * 256;
 
+// The work ram lives in the object, only a larger memory is allocated. The
+// size is a power of two and the addresses wrap around it like the mirrors
 class RAM {
  public:
-  RAM();
+  explicit RAM(std::size_t size = WORK_RAM_SIZE);
   ~RAM();
 
+  RAM(const RAM &)            = delete;
+  RAM &operator=(const RAM &) = delete;
+
+  // The memory moves and is cleared
+  void Resize(std::size_t size);
   void Wipe();
 
-  u8 &operator[](u16 address);
+  inline u8 &operator[](u16 address) { return Data()[address & (m_Size - 1)]; }
+
+  inline u8          *Data() { return m_Large ? m_Large.get() : m_Work.data(); }
+  inline const u8    *Data() const { return m_Large ? m_Large.get() : m_Work.data(); }
+  inline std::size_t GetSize() const { return m_Size; }
 
  private:
-  std::array<u8, RAM_SIZE> m_Data;
+  std::array<u8, WORK_RAM_SIZE> m_Work;
+  std::unique_ptr<u8[]>         m_Large;
+  std::size_t                   m_Size = WORK_RAM_SIZE;
 };
 
 }  // namespace EasyNes
@@ -0,0 +1,850 @@
+#include "Recompiler.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "CPU.hpp"
+#include "Instructions.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+  #define EASYNES_RECOMPILER_X64 1
+  #include <sys/mman.h>
+#else
+  #define EASYNES_RECOMPILER_X64 0
+#endif
+
+namespace EasyNes {
+
+constexpr std::size_t CODE_SIZE              = 4 * 1024 * 1024;
+constexpr std::size_t MAX_BLOCK_CODE         = 16 * 1024;
+constexpr u8          MAX_BLOCK_INSTRUCTIONS = 64;
+// Longest run of a native loop, leaves room for the counters
+constexpr u64 MAX_LOOP_CYCLES = 0x40000000;
+
+constexpr std::array<u8, 256> MAKE_NZ_FLAGS() {
+  std::array<u8, 256> flags{};
+  for (int value = 0; value < 256; value++) {
+    flags[value] = (value & NEGATIVE_BIT) | (value == 0 ? ZERO_BIT : 0);
+  }
+  return flags;
+}
+
+// Negative and zero flags of every result, indexed by the generated code
+constexpr std::array<u8, 256> NZ_FLAGS = MAKE_NZ_FLAGS();
+
+namespace {
+
+enum Register : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+enum Condition : u8 { ZERO = 0x4, NOT_ZERO = 0x5, ABOVE = 0x7 };
+
+enum Alu : u8 { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6 };
+
+// Host registers of the guest state during a block
+constexpr Register STATE      = RDI;
+constexpr Register FLAGS      = RSI;
+constexpr Register READ_PAGES  = RBX;
+constexpr Register WRITE_PAGES = RBP;
+constexpr Register REG_A      = R8;
+constexpr Register REG_X      = R9;
+constexpr Register REG_Y      = R10;
+constexpr Register REG_P      = R11;
+// Page crossing and branch penalties paid in the current iteration
+constexpr Register PENALTIES = R13;
+// Cycles and instructions of the iterations of a loop already run
+constexpr Register LOOP_CYCLES       = R12;
+constexpr Register LOOP_INSTRUCTIONS = R14;
+
+// Minimal x86-64 encoder, every memory operand uses a 32 bits displacement
+class Assembler {
+ public:
+  Assembler(u8 *code, std::size_t capacity) : m_Code(code), m_Capacity(capacity) {}
+
+  inline std::size_t GetSize() const { return m_Size; }
+  inline bool        HasOverflowed() const { return m_Size > m_Capacity; }
+
+  void Byte(u8 value) {
+    if (m_Size < m_Capacity) {
+      m_Code[m_Size] = value;
+    }
+    m_Size++;
+  }
+
+  void Word(u16 value) {
+    Byte(value);
+    Byte(value >> 8);
+  }
+
+  void Dword(u32 value) {
+    Word(value);
+    Word(value >> 16);
+  }
+
+  void Qword(u64 value) {
+    Dword(value);
+    Dword(value >> 32);
+  }
+
+  // A REX prefix is forced for the byte registers, without it sil and dil
+  // would be read as dh and bh
+  void Rex(bool wide, u8 reg, u8 index, u8 base, bool force = false) {
+    u8 rex = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+    if (rex != 0x40 || force) {
+      Byte(rex);
+    }
+  }
+
+  void Direct(u8 reg, u8 rm) { Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+  // [base + displacement]
+  void Memory(u8 reg, u8 base, s32 displacement) {
+    Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+      Byte(0x24);
+    }
+    Dword(displacement);
+  }
+
+  // [base + index * 2^scale + displacement]
+  void Memory(u8 reg, u8 base, u8 index, u8 scale, s32 displacement) {
+    Byte(0x84 | ((reg & 7) << 3));
+    Byte((scale << 6) | ((index & 7) << 3) | (base & 7));
+    Dword(displacement);
+  }
+
+  void Push(u8 reg) {
+    Rex(false, 0, 0, reg);
+    Byte(0x50 + (reg & 7));
+  }
+
+  void Pop(u8 reg) {
+    Rex(false, 0, 0, reg);
+    Byte(0x58 + (reg & 7));
+  }
+
+  void Ret() { Byte(0xC3); }
+
+  void MovImm(u8 reg, u32 value) {
+    Rex(false, 0, 0, reg);
+    Byte(0xB8 + (reg & 7));
+    Dword(value);
+  }
+
+  void MovImm64(u8 reg, u64 value) {
+    Rex(true, 0, 0, reg);
+    Byte(0xB8 + (reg & 7));
+    Qword(value);
+  }
+
+  void Mov(u8 destination, u8 source) {
+    Rex(false, destination, 0, source);
+    Byte(0x8B);
+    Direct(destination, source);
+  }
+
+  // Zero extend the low byte of a register
+  void MovzxByte(u8 destination, u8 source) {
+    Rex(false, destination, 0, source, true);
+    Byte(0x0F);
+    Byte(0xB6);
+    Direct(destination, source);
+  }
+
+  void MovzxWord(u8 destination, u8 source) {
+    Rex(false, destination, 0, source);
+    Byte(0x0F);
+    Byte(0xB7);
+    Direct(destination, source);
+  }
+
+  void LoadQword(u8 destination, u8 base, s32 displacement) {
+    Rex(true, destination, 0, base);
+    Byte(0x8B);
+    Memory(destination, base, displacement);
+  }
+
+  void LoadQword(u8 destination, u8 base, u8 index, u8 scale, s32 displacement) {
+    Rex(true, destination, index, base);
+    Byte(0x8B);
+    Memory(destination, base, index, scale, displacement);
+  }
+
+  void LoadByte(u8 destination, u8 base, s32 displacement) {
+    Rex(false, destination, 0, base);
+    Byte(0x0F);
+    Byte(0xB6);
+    Memory(destination, base, displacement);
+  }
+
+  void LoadByte(u8 destination, u8 base, u8 index, s32 displacement) {
+    Rex(false, destination, index, base);
+    Byte(0x0F);
+    Byte(0xB6);
+    Memory(destination, base, index, 0, displacement);
+  }
+
+  void StoreByte(u8 base, s32 displacement, u8 source) {
+    Rex(false, source, 0, base, true);
+    Byte(0x88);
+    Memory(source, base, displacement);
+  }
+
+  void StoreByte(u8 base, u8 index, s32 displacement, u8 source) {
+    Rex(false, source, index, base, true);
+    Byte(0x88);
+    Memory(source, base, index, 0, displacement);
+  }
+
+  void StoreWordImm(u8 base, s32 displacement, u16 value) {
+    Byte(0x66);
+    Rex(false, 0, 0, base);
+    Byte(0xC7);
+    Memory(0, base, displacement);
+    Word(value);
+  }
+
+  void StoreDword(u8 base, s32 displacement, u8 source) {
+    Rex(false, source, 0, base);
+    Byte(0x89);
+    Memory(source, base, displacement);
+  }
+
+  void StoreDwordImm(u8 base, s32 displacement, u32 value) {
+    Rex(false, 0, 0, base);
+    Byte(0xC7);
+    Memory(0, base, displacement);
+    Dword(value);
+  }
+
+  void Lea(u8 destination, u8 base, s32 displacement) {
+    Rex(false, destination, 0, base);
+    Byte(0x8D);
+    Memory(destination, base, displacement);
+  }
+
+  void ArithmeticImm(Alu operation, u8 reg, u32 value) {
+    Rex(false, 0, 0, reg);
+    Byte(0x81);
+    Direct(operation, reg);
+    Dword(value);
+  }
+
+  // destination = destination (operation) source
+  void Arithmetic(Alu operation, u8 destination, u8 source) {
+    Rex(false, source, 0, destination);
+    Byte(operation * 8 + 1);
+    Direct(source, destination);
+  }
+
+  void ShrImm(u8 reg, u8 count) {
+    Rex(false, 0, 0, reg);
+    Byte(0xC1);
+    Direct(5, reg);
+    Byte(count);
+  }
+
+  // Unsigned comparison of the register with [base + displacement]
+  void Compare(u8 reg, u8 base, s32 displacement) {
+    Rex(false, reg, 0, base);
+    Byte(0x3B);
+    Memory(reg, base, displacement);
+  }
+
+  void TestImm(u8 reg, u32 value) {
+    Rex(false, 0, 0, reg);
+    Byte(0xF7);
+    Direct(0, reg);
+    Dword(value);
+  }
+
+  void TestQword(u8 reg) {
+    Rex(true, reg, 0, reg);
+    Byte(0x85);
+    Direct(reg, reg);
+  }
+
+  // Conditional and unconditional jumps return the position of their
+  // displacement to patch once the target is known
+  std::size_t Jump(Condition condition) {
+    Byte(0x0F);
+    Byte(0x80 + condition);
+    Dword(0);
+    return m_Size - 4;
+  }
+
+  std::size_t Jump() {
+    Byte(0xE9);
+    Dword(0);
+    return m_Size - 4;
+  }
+
+  void Patch(std::size_t position, std::size_t target) {
+    s32 displacement = target - (position + 4);
+    for (int i = 0; i < 4; i++) {
+      if (position + i < m_Capacity) {
+        m_Code[position + i] = displacement >> (8 * i);
+      }
+    }
+  }
+
+ private:
+  u8         *m_Code;
+  std::size_t m_Capacity;
+  std::size_t m_Size = 0;
+};
+
+// Where a block stops: the guest state is synced back and the interpreter
+// continues at the program counter
+struct Exit {
+  u16 pc;
+  u8  instructions;
+  u16 cycles;
+};
+
+struct PendingExit {
+  std::size_t position;
+  Exit        exit;
+};
+
+// Effective address of a memory operand, the host pointer of its page lands
+// in rax and the offset in the page is either constant or in rcx
+struct HostAddress {
+  bool indexed;
+  u8   offset;
+};
+
+// The operations translated by the recompiler, anything else ends the block
+enum class Operation { UNSUPPORTED, LOAD, STORE, LOGIC, INCREMENT, TRANSFER, FLAG, NOP, BRANCH, JUMP };
+
+struct Translation {
+  Operation operation = Operation::UNSUPPORTED;
+  Register  reg       = RAX;
+  Register  source    = RAX;
+  // Logic operation, increment direction, flag value
+  u8 detail = 0;
+  // Status bit of the flag operations and the branches
+  u8   mask      = 0;
+  bool condition = false;
+};
+
+Translation Translate(const Instruction &instruction) {
+  auto op = instruction.operation;
+
+  // clang-format off
+  if (op == &CPU::LDA) return {Operation::LOAD, REG_A};
+  if (op == &CPU::LDX) return {Operation::LOAD, REG_X};
+  if (op == &CPU::LDY) return {Operation::LOAD, REG_Y};
+  if (op == &CPU::STA) return {Operation::STORE, REG_A};
+  if (op == &CPU::STX) return {Operation::STORE, REG_X};
+  if (op == &CPU::STY) return {Operation::STORE, REG_Y};
+  if (op == &CPU::AND) return {Operation::LOGIC, REG_A, RAX, AND};
+  if (op == &CPU::ORA) return {Operation::LOGIC, REG_A, RAX, OR};
+  if (op == &CPU::EOR) return {Operation::LOGIC, REG_A, RAX, XOR};
+  if (op == &CPU::INC) return {Operation::INCREMENT, RAX, RAX, ADD};
+  if (op == &CPU::DEC) return {Operation::INCREMENT, RAX, RAX, SUB};
+  if (op == &CPU::INX) return {Operation::INCREMENT, REG_X, RAX, ADD};
+  if (op == &CPU::INY) return {Operation::INCREMENT, REG_Y, RAX, ADD};
+  if (op == &CPU::DEX) return {Operation::INCREMENT, REG_X, RAX, SUB};
+  if (op == &CPU::DEY) return {Operation::INCREMENT, REG_Y, RAX, SUB};
+  if (op == &CPU::TAX) return {Operation::TRANSFER, REG_X, REG_A};
+  if (op == &CPU::TAY) return {Operation::TRANSFER, REG_Y, REG_A};
+  if (op == &CPU::TXA) return {Operation::TRANSFER, REG_A, REG_X};
+  if (op == &CPU::TYA) return {Operation::TRANSFER, REG_A, REG_Y};
+  if (op == &CPU::CLC) return {Operation::FLAG, RAX, RAX, 0, CARRY_BIT};
+  if (op == &CPU::SEC) return {Operation::FLAG, RAX, RAX, 1, CARRY_BIT};
+  // CLI is left to the interpreter, it polls the irq line
+  if (op == &CPU::SEI) return {Operation::FLAG, RAX, RAX, 1, INTERRUPT_BIT};
+  if (op == &CPU::CLD) return {Operation::FLAG, RAX, RAX, 0, DECIMAL_BIT};
+  if (op == &CPU::SED) return {Operation::FLAG, RAX, RAX, 1, DECIMAL_BIT};
+  if (op == &CPU::CLV) return {Operation::FLAG, RAX, RAX, 0, OVERFLOW_BIT};
+  if (op == &CPU::NOP) return {Operation::NOP};
+  if (op == &CPU::BCC) return {Operation::BRANCH, RAX, RAX, 0, CARRY_BIT, false};
+  if (op == &CPU::BCS) return {Operation::BRANCH, RAX, RAX, 0, CARRY_BIT, true};
+  if (op == &CPU::BNE) return {Operation::BRANCH, RAX, RAX, 0, ZERO_BIT, false};
+  if (op == &CPU::BEQ) return {Operation::BRANCH, RAX, RAX, 0, ZERO_BIT, true};
+  if (op == &CPU::BPL) return {Operation::BRANCH, RAX, RAX, 0, NEGATIVE_BIT, false};
+  if (op == &CPU::BMI) return {Operation::BRANCH, RAX, RAX, 0, NEGATIVE_BIT, true};
+  if (op == &CPU::BVC) return {Operation::BRANCH, RAX, RAX, 0, OVERFLOW_BIT, false};
+  if (op == &CPU::BVS) return {Operation::BRANCH, RAX, RAX, 0, OVERFLOW_BIT, true};
+  if (op == &CPU::JMP && instruction.addressing == &CPU::ABS) return {Operation::JUMP};
+  // clang-format on
+
+  return {};
+}
+
+bool IsTranslatable(const Instruction &instruction) {
+  auto mode = instruction.addressing;
+
+  switch (Translate(instruction).operation) {
+    case Operation::UNSUPPORTED:
+      return false;
+    case Operation::LOAD:
+    case Operation::LOGIC:
+      return mode == &CPU::IMM || mode == &CPU::ZER || mode == &CPU::ZPX || mode == &CPU::ZPY || mode == &CPU::ABS || mode == &CPU::ABX || mode == &CPU::ABY;
+    case Operation::STORE:
+    case Operation::INCREMENT:
+      return mode == &CPU::IMP || mode == &CPU::ZER || mode == &CPU::ZPX || mode == &CPU::ZPY || mode == &CPU::ABS || mode == &CPU::ABX || mode == &CPU::ABY;
+    default:
+      return true;
+  }
+}
+
+// Worst case penalties of an instruction
+u8 MaxPenalties(const Instruction &instruction) {
+  auto      mode      = instruction.addressing;
+  Operation operation = Translate(instruction).operation;
+
+  // The writes always spend the cycle of the page cross, it is in their cycles
+  if ((mode == &CPU::ABX || mode == &CPU::ABY) && operation != Operation::STORE &&
+      operation != Operation::INCREMENT) {
+    return 1;
+  }
+  if (operation == Operation::BRANCH) {
+    return 2;
+  }
+  return 0;
+}
+
+class BlockEmitter {
+ public:
+  BlockEmitter(Assembler &as, u16 start) : m_As(as), m_Start(start) {}
+
+  void Prologue() {
+    m_As.Push(RBX);
+    m_As.Push(RBP);
+    m_As.Push(R12);
+    m_As.Push(R13);
+    m_As.Push(R14);
+
+    m_As.LoadQword(READ_PAGES, STATE, offsetof(RecompilerState, readPages));
+    m_As.LoadQword(WRITE_PAGES, STATE, offsetof(RecompilerState, writePages));
+    m_As.MovImm64(FLAGS, reinterpret_cast<u64>(NZ_FLAGS.data()));
+    m_As.LoadByte(REG_A, STATE, offsetof(RecompilerState, a));
+    m_As.LoadByte(REG_X, STATE, offsetof(RecompilerState, x));
+    m_As.LoadByte(REG_Y, STATE, offsetof(RecompilerState, y));
+    m_As.LoadByte(REG_P, STATE, offsetof(RecompilerState, status));
+    m_As.MovImm(PENALTIES, 0);
+    m_As.MovImm(LOOP_CYCLES, 0);
+    m_As.MovImm(LOOP_INSTRUCTIONS, 0);
+    m_Top = m_As.GetSize();
+  }
+
+  // Leave the block when the page of the operand is not plain memory, nothing
+  // of the instruction has run yet
+  HostAddress Address(const Instruction &instruction, u16 operand, bool write, const Exit &bail) {
+    auto     mode  = instruction.addressing;
+    Register table = write ? WRITE_PAGES : READ_PAGES;
+
+    if (mode == &CPU::ZER || mode == &CPU::ABS) {
+      m_As.LoadQword(RAX, table, PAGE_OF(operand) * sizeof(u8 *));
+      m_As.TestQword(RAX);
+      ExitIf(ZERO, bail);
+      return {false, static_cast<u8>(operand % PAGE_SIZE)};
+    }
+
+    Register index = (mode == &CPU::ZPY || mode == &CPU::ABY) ? REG_Y : REG_X;
+
+    if (mode == &CPU::ZPX || mode == &CPU::ZPY) {
+      // The address wraps around the first page
+      m_As.Lea(RCX, index, operand % PAGE_SIZE);
+      m_As.MovzxByte(RCX, RCX);
+      m_As.LoadQword(RAX, table, 0);
+      m_As.TestQword(RAX);
+      ExitIf(ZERO, bail);
+      return {true, 0};
+    }
+
+    // Absolute indexed, the address wraps around the address space
+    m_As.Lea(RCX, index, operand);
+    m_As.MovzxWord(RCX, RCX);
+    m_As.Mov(RDX, RCX);
+    m_As.ShrImm(RDX, 8);
+    m_As.LoadQword(RAX, table, RDX, 3, 0);
+    m_As.TestQword(RAX);
+    ExitIf(ZERO, bail);
+
+    // Additional cycle if a read crosses the page
+    if (!write) {
+      m_As.Lea(RDX, index, operand % PAGE_SIZE);
+      m_As.ShrImm(RDX, 8);
+      m_As.Arithmetic(ADD, PENALTIES, RDX);
+    }
+    m_As.MovzxByte(RCX, RCX);
+    return {true, 0};
+  }
+
+  void Load(u8 destination, HostAddress address) {
+    if (address.indexed) {
+      m_As.LoadByte(destination, RAX, RCX, 0);
+    } else {
+      m_As.LoadByte(destination, RAX, address.offset);
+    }
+  }
+
+  void Store(HostAddress address, u8 source) {
+    if (address.indexed) {
+      m_As.StoreByte(RAX, RCX, 0, source);
+    } else {
+      m_As.StoreByte(RAX, address.offset, source);
+    }
+  }
+
+  // Operand value in edx
+  void Operand(const Instruction &instruction, u16 operand, const Exit &bail) {
+    if (instruction.addressing == &CPU::IMM) {
+      m_As.MovImm(RDX, operand);
+    } else {
+      Load(RDX, Address(instruction, operand, false, bail));
+    }
+  }
+
+  void UpdateNZ(u8 reg) {
+    m_As.ArithmeticImm(AND, REG_P, static_cast<u8>(~(NEGATIVE_BIT | ZERO_BIT)));
+    m_As.LoadByte(RAX, FLAGS, reg, 0);
+    m_As.Arithmetic(OR, REG_P, RAX);
+  }
+
+  void ExitIf(Condition condition, const Exit &exit) { m_Exits.push_back({m_As.Jump(condition), exit}); }
+
+  void ExitNow(const Exit &exit) { m_Exits.push_back({m_As.Jump(), exit}); }
+
+  // Continue at the block itself, the loop runs natively while another
+  // iteration fits the budgets
+  void Continue(const Exit &exit) {
+    if (exit.pc != m_Start) {
+      ExitNow(exit);
+      return;
+    }
+
+    m_As.Lea(RAX, PENALTIES, exit.cycles);
+    m_As.Arithmetic(ADD, LOOP_CYCLES, RAX);
+    m_As.ArithmeticImm(ADD, LOOP_INSTRUCTIONS, exit.instructions);
+    m_As.MovImm(PENALTIES, 0);
+
+    m_As.Compare(LOOP_CYCLES, STATE, offsetof(RecompilerState, cycleLimit));
+    ExitIf(ABOVE, {m_Start, 0, 0});
+    m_As.Compare(LOOP_INSTRUCTIONS, STATE, offsetof(RecompilerState, instructionLimit));
+    ExitIf(ABOVE, {m_Start, 0, 0});
+    m_As.Patch(m_As.Jump(), m_Top);
+  }
+
+  // The exit stubs are emitted after the body so the taken path stays linear
+  void Epilogue() {
+    std::vector<std::size_t> returns;
+
+    for (const PendingExit &pending : m_Exits) {
+      m_As.Patch(pending.position, m_As.GetSize());
+      m_As.StoreWordImm(STATE, offsetof(RecompilerState, pc), pending.exit.pc);
+      m_As.Lea(RAX, LOOP_INSTRUCTIONS, pending.exit.instructions);
+      m_As.StoreDword(STATE, offsetof(RecompilerState, instructions), RAX);
+      m_As.Lea(RAX, PENALTIES, pending.exit.cycles);
+      m_As.Arithmetic(ADD, RAX, LOOP_CYCLES);
+      m_As.StoreDword(STATE, offsetof(RecompilerState, cycles), RAX);
+      returns.push_back(m_As.Jump());
+    }
+
+    for (std::size_t position : returns) {
+      m_As.Patch(position, m_As.GetSize());
+    }
+
+    m_As.StoreByte(STATE, offsetof(RecompilerState, a), REG_A);
+    m_As.StoreByte(STATE, offsetof(RecompilerState, x), REG_X);
+    m_As.StoreByte(STATE, offsetof(RecompilerState, y), REG_Y);
+    m_As.StoreByte(STATE, offsetof(RecompilerState, status), REG_P);
+
+    m_As.Pop(R14);
+    m_As.Pop(R13);
+    m_As.Pop(R12);
+    m_As.Pop(RBP);
+    m_As.Pop(RBX);
+    m_As.Ret();
+  }
+
+  // Emit the body of the instruction, returns false if it ends the block
+  bool Emit(const Instruction &instruction, u16 address, u8 size, u16 operand, const Exit &bail) {
+    Translation translation = Translate(instruction);
+    u16         next        = address + size;
+    Exit        done        = {next, static_cast<u8>(bail.instructions + 1), static_cast<u16>(bail.cycles + instruction.cycles)};
+
+    switch (translation.operation) {
+      case Operation::LOAD:
+        Operand(instruction, operand, bail);
+        m_As.Mov(translation.reg, RDX);
+        UpdateNZ(translation.reg);
+        return true;
+
+      case Operation::STORE:
+        Store(Address(instruction, operand, true, bail), translation.reg);
+        return true;
+
+      case Operation::LOGIC:
+        Operand(instruction, operand, bail);
+        m_As.Arithmetic(static_cast<Alu>(translation.detail), REG_A, RDX);
+        UpdateNZ(REG_A);
+        return true;
+
+      case Operation::INCREMENT:
+        if (instruction.addressing == &CPU::IMP) {
+          m_As.ArithmeticImm(static_cast<Alu>(translation.detail), translation.reg, 1);
+          m_As.MovzxByte(translation.reg, translation.reg);
+          UpdateNZ(translation.reg);
+        } else {
+          // Read and written through the write pointer, a writable page is
+          // backed by the same memory for both
+          HostAddress host = Address(instruction, operand, true, bail);
+          Load(RDX, host);
+          m_As.ArithmeticImm(static_cast<Alu>(translation.detail), RDX, 1);
+          m_As.MovzxByte(RDX, RDX);
+          Store(host, RDX);
+          UpdateNZ(RDX);
+        }
+        return true;
+
+      case Operation::TRANSFER:
+        m_As.Mov(translation.reg, translation.source);
+        UpdateNZ(translation.source);
+        return true;
+
+      case Operation::FLAG:
+        if (translation.detail) {
+          m_As.ArithmeticImm(OR, REG_P, translation.mask);
+        } else {
+          m_As.ArithmeticImm(AND, REG_P, static_cast<u8>(~translation.mask));
+        }
+        return true;
+
+      case Operation::NOP:
+        return true;
+
+      case Operation::BRANCH: {
+        u16 destination = next + static_cast<s8>(operand);
+        // Additional cycle if taken, and another one if the page is crossed
+        u16  penalty = 1 + ((next & 0xFF00) != (destination & 0xFF00));
+        Exit taken   = {destination, done.instructions, static_cast<u16>(done.cycles + penalty)};
+
+        m_As.TestImm(REG_P, translation.mask);
+        ExitIf(translation.condition ? ZERO : NOT_ZERO, done);
+        Continue(taken);
+        return false;
+      }
+
+      case Operation::JUMP:
+        Continue({operand, done.instructions, done.cycles});
+        return false;
+
+      default:
+        ExitNow(bail);
+        return false;
+    }
+  }
+
+ private:
+  Assembler               &m_As;
+  u16                      m_Start;
+  std::size_t              m_Top = 0;
+  std::vector<PendingExit> m_Exits;
+};
+
+}  // namespace
+
+Recompiler::Recompiler(Bus *bus, u8 threshold) : m_Bus(bus), m_Threshold(threshold) {
+  m_TrapSlot = m_Bus->AddWriteTrap(this, &Recompiler::OnWrite);
+
+#if EASYNES_RECOMPILER_X64
+  // Without a trap slot the writes to the code go unseen, the interpreter is kept
+  if (m_TrapSlot == NO_TRAP_SLOT) {
+    return;
+  }
+
+  void *code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  // Hosts forbidding writable and executable memory keep the interpreter
+  m_Code = code != MAP_FAILED ? static_cast<u8 *>(code) : nullptr;
+#endif
+}
+
+Recompiler::~Recompiler() {
+  m_Bus->RemoveTrap(m_TrapSlot);
+
+#if EASYNES_RECOMPILER_X64
+  if (m_Code) {
+    munmap(m_Code, CODE_SIZE);
+  }
+#endif
+}
+
+bool Recompiler::IsSupported() { return EASYNES_RECOMPILER_X64; }
+
+u32 Recompiler::Execute(CPU &cpu, u64 cycles, u64 instructions) {
+  u16       address = cpu.m_PC;
+  const u8 *memory  = m_Bus->GetPageMemory(PAGE_OF(address));
+
+  // Code running from handlers is always interpreted
+  if (!memory || !m_Code) {
+    return 0;
+  }
+
+  Page *page = m_Pages[PAGE_OF(address)].get();
+
+  if (!page || page->memory != memory) {
+    page = Refresh(PAGE_OF(address));
+  }
+
+  Block &block = page->blocks[address % PAGE_SIZE];
+
+  if (!block.entry) {
+    if (block.rejected || ++block.heat < m_Threshold) {
+      return 0;
+    }
+
+    if (CODE_SIZE - m_CodeUsed < MAX_BLOCK_CODE) {
+      // The arena is full, every block is compiled again when it gets hot
+      Clear();
+      return 0;
+    }
+
+    if (!Compile(address, memory, block)) {
+      block.rejected = true;
+      return 0;
+    }
+  }
+
+  if (block.maxCycles > cycles || block.instructions > instructions) {
+    return 0;
+  }
+
+  // A loop starts another iteration only if the longest one fits the budgets
+  u32 cycleLimit       = std::min<u64>(cycles, MAX_LOOP_CYCLES) - block.maxCycles;
+  u32 instructionLimit = std::min<u64>(instructions, MAX_LOOP_CYCLES) - block.instructions;
+
+  RecompilerState state = {cpu.m_A,    cpu.m_X,          cpu.m_Y, cpu.GetStatus(), address, 0, 0,
+                           cycleLimit, instructionLimit, m_Bus->GetReadTable(), m_Bus->GetWriteTable()};
+  block.entry(&state);
+
+  cpu.m_A  = state.a;
+  cpu.m_X  = state.x;
+  cpu.m_Y  = state.y;
+  cpu.m_PC = state.pc;
+  cpu.SetStatus(state.status);
+
+  cpu.m_ElapsedCycles += state.cycles;
+  cpu.m_ElapsedInstructions += state.instructions;
+  return state.cycles;
+}
+
+void Recompiler::Clear() {
+  for (std::unique_ptr<Page> &page : m_Pages) {
+    page.reset();
+  }
+
+  for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+    m_Bus->TrapWrites(m_TrapSlot, page, false);
+  }
+
+  m_CodeUsed   = 0;
+  m_BlockCount = 0;
+}
+
+Recompiler::Page *Recompiler::Refresh(u8 page) {
+  const u8 *memory = m_Bus->GetPageMemory(page);
+
+  std::unique_ptr<Page> &blocks = m_Pages[page];
+
+  if (!blocks) {
+    blocks = std::make_unique<Page>();
+  }
+
+  blocks->memory = memory;
+  blocks->blocks = {};
+
+  // Trap every page writing to the same memory, including the mirrors
+  for (std::size_t alias = 0; alias < PAGE_COUNT; alias++) {
+    if (m_Bus->GetPageMemory(alias) == memory && m_Bus->IsPageWritable(alias)) {
+      m_Bus->TrapWrites(m_TrapSlot, alias);
+    }
+  }
+
+  return blocks.get();
+}
+
+bool Recompiler::Compile(u16 address, const u8 *memory, Block &block) {
+  Assembler    as(m_Code + m_CodeUsed, MAX_BLOCK_CODE);
+  BlockEmitter emitter(as, address);
+
+  emitter.Prologue();
+
+  u16  pc         = address;
+  u8   count      = 0;
+  u16  cycles     = 0;
+  u16  maxCycles  = 0;
+  bool terminated = false;
+
+  while (count < MAX_BLOCK_INSTRUCTIONS) {
+    u8                 offset      = pc % PAGE_SIZE;
+    u8                 opcode      = memory[offset];
+    const Instruction &instruction = INSTRUCTION_SET[opcode];
+    u8                 size        = 1 + OPERAND_SIZES[opcode];
+
+    // Blocks never leave their page, a write to the next page would not
+    // invalidate them
+    if (PAGE_OF(pc) != PAGE_OF(address) || offset + size > PAGE_SIZE || !IsTranslatable(instruction)) {
+      break;
+    }
+
+    u16 operand = 0;
+    for (u8 i = 1; i < size; i++) {
+      operand |= memory[offset + i] << (8 * (i - 1));
+    }
+
+    Exit bail = {pc, count, cycles};
+    count++;
+    cycles += instruction.cycles;
+    maxCycles += instruction.cycles + MaxPenalties(instruction);
+
+    if (!emitter.Emit(instruction, pc, size, operand, bail)) {
+      terminated = true;
+      break;
+    }
+
+    pc += size;
+  }
+
+  if (count == 0) {
+    return false;
+  }
+
+  if (!terminated) {
+    emitter.ExitNow({pc, count, cycles});
+  }
+
+  emitter.Epilogue();
+
+  if (as.HasOverflowed()) {
+    return false;
+  }
+
+  block.entry        = reinterpret_cast<Entry>(m_Code + m_CodeUsed);
+  block.instructions = count;
+  block.maxCycles    = maxCycles;
+
+  // Keep the next block aligned on a cache line
+  m_CodeUsed += (as.GetSize() + 63) & ~std::size_t(63);
+  m_BlockCount++;
+  return true;
+}
+
+void Recompiler::Invalidate(u16 address) {
+  const u8 *memory = m_Bus->GetPageMemory(PAGE_OF(address));
+
+  // The page may be a mirror of several compiled pages, their blocks are
+  // dropped and the code stays in the arena until it is cleared
+  for (std::unique_ptr<Page> &page : m_Pages) {
+    if (page && page->memory == memory) {
+      page->blocks = {};
+    }
+  }
+}
+
+void Recompiler::OnWrite(void *context, u16 address, u8) { static_cast<Recompiler *>(context)->Invalidate(address); }
+
+}  // namespace EasyNes
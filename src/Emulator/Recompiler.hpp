@@ -0,0 +1,92 @@
+#ifndef EASYNES_RECOMPILER_HPP
+#define EASYNES_RECOMPILER_HPP
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "Bus.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+class CPU;
+
+constexpr u8 DEFAULT_HOT_THRESHOLD = 16;
+
+// Registers handed to the compiled blocks, the blocks report where and after
+// how many cycles and instructions they stopped. A block looping on itself
+// keeps running while its counters stay under the limits
+struct RecompilerState {
+  u8         a;
+  u8         x;
+  u8         y;
+  u8         status;
+  u16        pc;
+  u32        cycles;
+  u32        instructions;
+  u32        cycleLimit;
+  u32        instructionLimit;
+  u8 *const *readPages;
+  u8 *const *writePages;
+};
+
+// Translate the hot basic blocks of the guest code to native x86-64. The 6502
+// registers stay in host registers for the whole block, which ends on a branch,
+// a jump, the end of its page or an instruction the recompiler does not
+// support, a block branching back to its start loops without leaving. A block
+// leaves to the interpreter before touching a page that is not plain memory, so
+// I/O and the writes to trapped pages always run through the bus. Writes to the
+// memory behind compiled code drop its blocks
+class Recompiler {
+ public:
+  Recompiler(Bus *bus, u8 threshold = DEFAULT_HOT_THRESHOLD);
+  ~Recompiler();
+
+  // False when the host cannot run the generated code, nothing gets compiled.
+  // Nothing gets compiled either when the bus has no trap slot left
+  static bool IsSupported();
+
+  // Run the block at the program counter if it is compiled and fits the
+  // budgets, returns the elapsed cycles or 0 if the interpreter must run
+  u32 Execute(CPU &cpu, u64 cycles, u64 instructions);
+
+  void Clear();
+
+  inline u32 GetBlockCount() const { return m_BlockCount; }
+
+ private:
+  using Entry = void (*)(RecompilerState *state);
+
+  struct Block {
+    Entry entry        = nullptr;
+    bool  rejected     = false;
+    u8    heat         = 0;
+    u8    instructions = 0;
+    u16   maxCycles    = 0;
+  };
+
+  struct Page {
+    const u8                    *memory = nullptr;
+    std::array<Block, PAGE_SIZE> blocks;
+  };
+
+  Page       *Refresh(u8 page);
+  bool        Compile(u16 address, const u8 *memory, Block &block);
+  void        Invalidate(u16 address);
+  static void OnWrite(void *context, u16 address, u8 value);
+
+  Bus                                          *m_Bus;
+  u8                                            m_Threshold;
+  u8                                            m_TrapSlot;
+  std::array<std::unique_ptr<Page>, PAGE_COUNT> m_Pages;
+  u32                                           m_BlockCount = 0;
+
+  // Executable memory the blocks are emitted to, reset when full
+  u8         *m_Code     = nullptr;
+  std::size_t m_CodeUsed = 0;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_RECOMPILER_HPP
@@ -0,0 +1,220 @@
+#include "Rewind.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr std::size_t NO_PAGE = ~std::size_t(0);
+
+constexpr std::size_t PAGES_OF(std::size_t size) { return (size + PAGE_SIZE - 1) / PAGE_SIZE; }
+
+}  // namespace
+
+Rewind::Rewind(Core *core, std::size_t budget) : m_Core(core), m_Budget(budget) {
+  m_TrapSlot = m_Core->bus.AddWriteTrap(this, &Rewind::OnWrite);
+  m_Core->ppu.SetWriteTrap(this, &Rewind::OnVideoWrite);
+}
+
+Rewind::~Rewind() {
+  m_Core->ppu.SetWriteTrap(nullptr, nullptr);
+  m_Core->bus.RemoveTrap(m_TrapSlot);
+}
+
+bool Rewind::Snapshot() {
+  if (m_TrapSlot == NO_TRAP_SLOT) {
+    return false;
+  }
+
+  while (!m_Frames.empty() && m_MemoryUsage + sizeof(Frame) > m_Budget) {
+    Drop();
+  }
+
+  Frame frame = std::move(m_Spare);
+  frame.cpu         = m_Core->cpu.GetState();
+  frame.ppu         = m_Core->ppu.GetRegisters();
+  frame.cycle       = m_Core->scheduler.GetCycle();
+  frame.controllers = m_Core->controllers.GetState();
+  frame.apu         = m_Core->mapper ? m_Core->apu.SaveState() : std::vector<u8>();
+  frame.mapper      = m_Core->mapper ? m_Core->mapper->SaveRegisters() : std::vector<u8>();
+  frame.pages.clear();
+  frame.data.clear();
+
+  m_MemoryUsage += sizeof(Frame) + frame.apu.size() + frame.mapper.size();
+  m_Frames.push_back(std::move(frame));
+
+  Arm();
+  return true;
+}
+
+bool Rewind::Restore(u32 count) {
+  if (count == 0 || count > m_Frames.size()) {
+    return false;
+  }
+
+  // The apu and the mapper are loaded first, they are the only parts that can
+  // fail and nothing is restored if they do. The apu is loaded back if the
+  // mapper fails. The mapper is loaded before the ppu, the render thread of
+  // the ppu starts over from its banks
+  const Frame &target = m_Frames[m_Frames.size() - count];
+  if (m_Core->mapper) {
+    std::vector<u8> previous = m_Core->apu.SaveState();
+    if (!m_Core->apu.LoadState(target.apu)) {
+      return false;
+    }
+    if (!m_Core->mapper->LoadRegisters(target.mapper)) {
+      m_Core->apu.LoadState(previous);
+      return false;
+    }
+  } else if (!target.mapper.empty()) {
+    return false;
+  }
+
+  // Undo the writes from the newest frame back to the restored one
+  for (u32 i = 0; i < count; i++) {
+    Frame &frame = m_Frames[m_Frames.size() - 1 - i];
+
+    for (std::size_t page = 0; page < frame.pages.size(); page++) {
+      std::size_t size;
+      u8         *memory = GetPage(frame.pages[page], size);
+      std::memcpy(memory, frame.data.data() + page * PAGE_SIZE, size);
+    }
+
+    m_MemoryUsage -= frame.pages.size() * (PAGE_SIZE + sizeof(u16));
+    frame.pages.clear();
+    frame.data.clear();
+  }
+
+  for (u32 i = 1; i < count; i++) {
+    m_MemoryUsage -= sizeof(Frame) + m_Frames.back().apu.size() + m_Frames.back().mapper.size();
+    m_Frames.pop_back();
+  }
+
+  m_Core->cpu.SetState(m_Frames.back().cpu);
+  m_Core->ppu.SetRegisters(m_Frames.back().ppu);
+  m_Core->controllers.SetState(m_Frames.back().controllers);
+  m_Core->scheduler.Sync(m_Frames.back().cycle);
+
+  // The rams were written behind the back of the bus
+  m_Core->cpu.FlushRecompiler();
+
+  Arm();
+  return true;
+}
+
+void Rewind::Clear() {
+  m_Frames.clear();
+  m_MemoryUsage = 0;
+
+  for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+    m_Core->bus.TrapWrites(m_TrapSlot, page, false);
+  }
+}
+
+void Rewind::Arm() {
+  Mapper *mapper = m_Core->mapper.get();
+  PPU    &ppu    = m_Core->ppu;
+
+  m_Regions[0] = {m_Core->ram.Data(), m_Core->ram.GetSize()};
+  m_Regions[1] = mapper ? Region{mapper->GetPrgRam().data(), mapper->GetPrgRam().size()} : Region{};
+  m_Regions[2] = mapper ? Region{mapper->GetChrRam().data(), mapper->GetChrRam().size()} : Region{};
+  m_Regions[3] = {ppu.GetVram().data(), VRAM_SIZE};
+  m_Regions[4] = {ppu.GetOam().data(), OAM_SIZE};
+  m_Regions[5] = {ppu.GetPalette().data(), PALETTE_SIZE};
+
+  std::size_t pages = 0;
+  for (const Region &region : m_Regions) {
+    pages += PAGES_OF(region.size);
+  }
+  m_Dirty.assign(pages, false);
+
+  // Trap the pages backed by the rams, including their mirrors
+  for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+    if (Locate(m_Core->bus.GetPageMemory(page)) != NO_PAGE && m_Core->bus.IsPageWritable(page)) {
+      m_Core->bus.TrapWrites(m_TrapSlot, page);
+    }
+  }
+}
+
+void Rewind::Drop() {
+  Frame &oldest = m_Frames.front();
+
+  m_MemoryUsage -= sizeof(Frame) + oldest.apu.size() + oldest.mapper.size() +
+                   oldest.pages.size() * (PAGE_SIZE + sizeof(u16));
+  m_Spare = std::move(oldest);
+  m_Frames.pop_front();
+}
+
+std::size_t Rewind::Locate(const u8 *memory) const {
+  std::size_t first = 0;
+
+  for (const Region &region : m_Regions) {
+    if (memory >= region.memory && memory < region.memory + region.size) {
+      return first + (memory - region.memory) / PAGE_SIZE;
+    }
+    first += PAGES_OF(region.size);
+  }
+  return NO_PAGE;
+}
+
+void Rewind::SavePage(const u8 *memory) {
+  std::size_t page = Locate(memory);
+
+  if (m_Frames.empty() || page == NO_PAGE || m_Dirty[page]) {
+    return;
+  }
+
+  std::size_t size;
+  const u8   *saved = GetPage(page, size);
+  Frame      &frame = m_Frames.back();
+
+  // The last page of a region may be shorter, its copy is padded
+  frame.pages.push_back(page);
+  frame.data.insert(frame.data.end(), saved, saved + size);
+  frame.data.resize(frame.pages.size() * PAGE_SIZE);
+
+  m_Dirty[page] = true;
+  m_MemoryUsage += PAGE_SIZE + sizeof(u16);
+
+  // The newest frame is never dropped, it holds the pages to restore
+  while (m_MemoryUsage > m_Budget && m_Frames.size() > 1) {
+    Drop();
+  }
+}
+
+u8 *Rewind::GetPage(std::size_t page, std::size_t &size) {
+  for (const Region &region : m_Regions) {
+    std::size_t pages = PAGES_OF(region.size);
+
+    if (page < pages) {
+      size = std::min<std::size_t>(PAGE_SIZE, region.size - page * PAGE_SIZE);
+      return region.memory + page * PAGE_SIZE;
+    }
+    page -= pages;
+  }
+  return nullptr;
+}
+
+void Rewind::OnWrite(void *context, u16 address, u8) {
+  Rewind   *rewind = static_cast<Rewind *>(context);
+  Bus      &bus    = rewind->m_Core->bus;
+  const u8 *memory = bus.GetPageMemory(PAGE_OF(address));
+
+  rewind->SavePage(memory);
+
+  // The next writes to the page and its mirrors go through the fast path
+  for (std::size_t alias = 0; alias < PAGE_COUNT; alias++) {
+    if (bus.GetPageMemory(alias) == memory) {
+      bus.TrapWrites(rewind->m_TrapSlot, alias, false);
+    }
+  }
+}
+
+void Rewind::OnVideoWrite(void *context, const u8 *memory) { static_cast<Rewind *>(context)->SavePage(memory); }
+
+}  // namespace EasyNes
@@ -0,0 +1,93 @@
+#ifndef EASYNES_REWIND_HPP
+#define EASYNES_REWIND_HPP
+
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "CPU.hpp"
+#include "Controller.hpp"
+#include "PPU.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+constexpr std::size_t DEFAULT_REWIND_BUDGET = 16 * 1024 * 1024;
+
+// Ring of snapshots to travel back in time, taken once per frame. A snapshot
+// only keeps the pages of memory written after it, their content is saved by a
+// trap right before the first write, so an idle page costs nothing. The work
+// ram and the program ram of the cartridge are trapped through the bus, the
+// graphics ram and the memories of the ppu through the ppu. The oldest
+// snapshots are dropped to stay within the memory budget
+class Rewind {
+ public:
+  Rewind(Core *core, std::size_t budget = DEFAULT_REWIND_BUDGET);
+  ~Rewind();
+
+  // Returns false and takes nothing when the bus had no trap slot left for
+  // the rewind
+  bool Snapshot();
+  // Restore the nth latest snapshot, 1 is the last one taken, which stays the
+  // last one. Returns false and restores nothing if there are not that many
+  // snapshots, or if the apu or the mapper do not load, when the cartridge was
+  // swapped since the snapshot
+  bool Restore(u32 count);
+  void Clear();
+
+  inline u32         GetSnapshotCount() const { return m_Frames.size(); }
+  inline std::size_t GetMemoryUsage() const { return m_MemoryUsage; }
+
+ private:
+  struct Frame {
+    CPUState        cpu;
+    PPURegisters    ppu;
+    ControllerState controllers;
+    // Cpu cycle reached by the ppu
+    u64 cycle;
+    // Registers of the apu and of the mapper without its rams, empty without
+    // a cartridge
+    std::vector<u8> apu;
+    std::vector<u8> mapper;
+    // Pages written after the snapshot, with their content at the time
+    std::vector<u16> pages;
+    std::vector<u8>  data;
+  };
+
+  // Memory saved a page at a time, the pages of the regions are numbered one
+  // after the other
+  struct Region {
+    u8         *memory = nullptr;
+    std::size_t size   = 0;
+  };
+
+  // Every page is clean until its next write
+  void        Arm();
+  void        Drop();
+  // Number of the page holding the memory, NO_PAGE outside of the regions
+  std::size_t Locate(const u8 *memory) const;
+  // Memory of the page and its size, the last page of a region may be shorter
+  u8         *GetPage(std::size_t page, std::size_t &size);
+  void        SavePage(const u8 *memory);
+  static void OnWrite(void *context, u16 address, u8 value);
+  static void OnVideoWrite(void *context, const u8 *memory);
+
+  Core                 *m_Core;
+  std::size_t           m_Budget;
+  u8                    m_TrapSlot;
+  std::deque<Frame>     m_Frames;
+  std::size_t           m_MemoryUsage = 0;
+  // Work ram, program ram, graphics ram, then the vram, the sprites and the
+  // palette of the ppu
+  std::array<Region, 6> m_Regions;
+  std::vector<bool>     m_Dirty;
+  // Dropped frame recycled by the next snapshot to keep its buffers
+  Frame m_Spare;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_REWIND_HPP
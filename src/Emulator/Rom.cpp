@@ -0,0 +1,290 @@
+#include "Rom.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#if defined(__unix__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u8          INES_MAGIC[] = {'N', 'E', 'S', 0x1A};
+constexpr const char *CACHE_HEADER = "# EasyNes rom cache 1";
+
+// NES 2.0 sizes are either a count of banks or an exponent-multiplier pair
+// when the high nibble of the count is 0xF, false when the size does not fit
+// in 32 bits
+bool ROM_SIZE(u8 lo, u8 hi, u32 bank, u32 &size) {
+  if (hi != 0x0F) {
+    size = ((hi << 8) | lo) * bank;
+    return true;
+  }
+
+  u32 exponent = lo >> 2;
+  u64 bytes    = exponent < 32 ? (u64{1} << exponent) * ((lo & 0x03) * 2 + 1) : 0;
+  if (exponent >= 32 || bytes > std::numeric_limits<u32>::max()) {
+    return false;
+  }
+  size = static_cast<u32>(bytes);
+  return true;
+}
+
+// Shift count of the NES 2.0 ram sizes, 0 means no ram
+constexpr u32 SHIFTED_SIZE(u8 shift) { return shift ? 64u << shift : 0; }
+
+bool ParseHeader(const u8 *header, RomInfo &info) {
+  if (!std::equal(std::begin(INES_MAGIC), std::end(INES_MAGIC), header)) {
+    return false;
+  }
+
+  if (header[6] & 0x08) {
+    info.mirroring = Mirroring::FOUR_SCREEN;
+  } else {
+    info.mirroring = header[6] & 0x01 ? Mirroring::VERTICAL : Mirroring::HORIZONTAL;
+  }
+
+  info.battery = header[6] & 0x02;
+  info.trainer = header[6] & 0x04;
+  info.nes2    = (header[7] & 0x0C) == 0x08;
+
+  if (info.nes2) {
+    info.mapper     = (header[6] >> 4) | (header[7] & 0xF0) | ((header[8] & 0x0F) << 8);
+    info.submapper  = header[8] >> 4;
+    if (!ROM_SIZE(header[4], header[9] & 0x0F, PRG_BANK_SIZE, info.prgSize) ||
+        !ROM_SIZE(header[5], header[9] >> 4, CHR_BANK_SIZE, info.chrSize)) {
+      return false;
+    }
+    info.prgRamSize = SHIFTED_SIZE(header[10] & 0x0F) + SHIFTED_SIZE(header[10] >> 4);
+    info.chrRamSize = SHIFTED_SIZE(header[11] & 0x0F) + SHIFTED_SIZE(header[11] >> 4);
+    return true;
+  }
+
+  // Old dumping tools wrote their name at the end of the header, the high
+  // nibble of the mapper is garbage when those bytes are not zero
+  bool dirty  = std::any_of(header + 12, header + 16, [](u8 byte) { return byte != 0; });
+  info.mapper = (header[6] >> 4) | (dirty ? 0 : header[7] & 0xF0);
+
+  info.submapper  = 0;
+  info.prgSize    = header[4] * PRG_BANK_SIZE;
+  info.chrSize    = header[5] * CHR_BANK_SIZE;
+  info.prgRamSize = std::max<u32>(header[8], 1) * 8 * 1024;
+  info.chrRamSize = info.chrSize ? 0 : CHR_BANK_SIZE;
+  return true;
+}
+
+struct Registry {
+  std::mutex                                                mutex;
+  std::unordered_map<std::string, std::weak_ptr<const Rom>> roms;
+};
+
+Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+}  // namespace
+
+u64 CONTENT_HASH(const u8 *data, std::size_t size) {
+  constexpr u64 MULTIPLIER = 0x9E3779B97F4A7C15;
+
+  u64  hash = 0xCBF29CE484222325 ^ size;
+  auto mix = [&](u64 word) {
+    hash = (hash ^ word) * MULTIPLIER;
+    hash ^= hash >> 32;
+  };
+
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    u64 word;
+    std::memcpy(&word, data + i, 8);
+    mix(word);
+  }
+
+  u64 tail = 0;
+  for (std::size_t shift = 0; i < size; i++, shift += 8) {
+    tail |= static_cast<u64>(data[i]) << shift;
+  }
+  mix(tail);
+
+  return hash;
+}
+
+RomCache::RomCache(std::string path) : m_Path(std::move(path)) {}
+
+std::optional<RomInfo> RomCache::Find(u64 hash) {
+  std::lock_guard lock(m_Mutex);
+  Read();
+
+  auto found = m_Entries.find(hash);
+  if (found == m_Entries.end()) {
+    return std::nullopt;
+  }
+  return found->second;
+}
+
+bool RomCache::Store(u64 hash, const RomInfo &info) {
+  std::lock_guard lock(m_Mutex);
+  Read();
+
+  bool          created = !std::filesystem::exists(m_Path);
+  std::ofstream file(m_Path, std::ios::app);
+  if (created) {
+    file << CACHE_HEADER << "\n# hash mapper submapper mirroring battery trainer nes2 prg chr prg-ram chr-ram\n";
+  }
+
+  file << std::hex << hash << std::dec << " " << info.mapper << " " << +info.submapper << " "
+       << static_cast<int>(info.mirroring) << " " << info.battery << " " << info.trainer << " " << info.nes2 << " "
+       << info.prgSize << " " << info.chrSize << " " << info.prgRamSize << " " << info.chrRamSize << "\n";
+
+  m_Entries[hash] = info;
+  return static_cast<bool>(file);
+}
+
+void RomCache::Read() {
+  if (m_Read) {
+    return;
+  }
+  m_Read = true;
+
+  std::ifstream file(m_Path);
+  std::string   line;
+
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    std::istringstream stream(line);
+    u64                hash;
+    RomInfo            info;
+    int                submapper, mirroring;
+
+    stream >> std::hex >> hash >> std::dec >> info.mapper >> submapper >> mirroring >> info.battery >> info.trainer >>
+        info.nes2 >> info.prgSize >> info.chrSize >> info.prgRamSize >> info.chrRamSize;
+
+    // A broken line is skipped, the rom is parsed again and the entry appended
+    if (stream && mirroring >= 0 && mirroring <= static_cast<int>(Mirroring::FOUR_SCREEN)) {
+      info.submapper  = submapper;
+      info.mirroring  = static_cast<Mirroring>(mirroring);
+      m_Entries[hash] = info;
+    }
+  }
+}
+
+Rom::~Rom() {
+#if defined(__unix__)
+  if (m_Mapping) {
+    munmap(m_Mapping, m_MappingSize);
+  }
+#endif
+}
+
+std::shared_ptr<const Rom> Rom::Open(const std::string &path, RomCache *cache) {
+  std::error_code error;
+  std::string     key = std::filesystem::weakly_canonical(path, error).string();
+  if (error) {
+    return nullptr;
+  }
+
+  // The lock is held while loading so the instances starting together wait
+  // for one mapping instead of each making their own
+  Registry       &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+
+  if (std::shared_ptr<const Rom> opened = registry.roms[key].lock()) {
+    return opened;
+  }
+
+  std::shared_ptr<Rom> rom(new Rom());
+
+#if defined(__unix__)
+  int file = open(key.c_str(), O_RDONLY);
+  if (file < 0) {
+    return nullptr;
+  }
+
+  struct stat status;
+  if (fstat(file, &status) == 0 && status.st_size > 0) {
+    void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    if (mapping != MAP_FAILED) {
+      rom->m_Mapping     = mapping;
+      rom->m_MappingSize = status.st_size;
+    }
+  }
+  close(file);
+
+  if (!rom->m_Mapping || !rom->Load(static_cast<const u8 *>(rom->m_Mapping), rom->m_MappingSize, cache)) {
+    return nullptr;
+  }
+#else
+  std::ifstream     file(key, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  rom->m_Copy = std::make_unique<u8[]>(data.size());
+  std::copy(data.begin(), data.end(), rom->m_Copy.get());
+
+  if (!file || !rom->Load(rom->m_Copy.get(), data.size(), cache)) {
+    return nullptr;
+  }
+#endif
+
+  registry.roms[key] = rom;
+  return rom;
+}
+
+std::shared_ptr<const Rom> Rom::Parse(const u8 *data, std::size_t size, RomCache *cache) {
+  std::shared_ptr<Rom> rom(new Rom());
+
+  rom->m_Copy = std::make_unique<u8[]>(size);
+  std::copy(data, data + size, rom->m_Copy.get());
+
+  if (!rom->Load(rom->m_Copy.get(), size, cache)) {
+    return nullptr;
+  }
+  return rom;
+}
+
+bool Rom::Load(const u8 *data, std::size_t size, RomCache *cache) {
+  if (size < INES_HEADER_SIZE) {
+    return false;
+  }
+
+  m_Hash = CONTENT_HASH(data + INES_HEADER_SIZE, size - INES_HEADER_SIZE);
+
+  std::optional<RomInfo> cached = cache ? cache->Find(m_Hash) : std::nullopt;
+  if (cached) {
+    m_Info = *cached;
+  } else if (!ParseHeader(data, m_Info)) {
+    return false;
+  }
+
+  std::size_t prg = INES_HEADER_SIZE + (m_Info.trainer ? TRAINER_SIZE : 0);
+  std::size_t chr = prg + m_Info.prgSize;
+
+  // The bus maps whole pages, and a cartridge has at least one bank of code
+  if (m_Info.prgSize == 0 || m_Info.prgSize % 256 || m_Info.chrSize % 256 || chr + m_Info.chrSize > size) {
+    return false;
+  }
+
+  m_Prg = data + prg;
+  m_Chr = m_Info.chrSize ? data + chr : nullptr;
+
+  if (cache && !cached) {
+    cache->Store(m_Hash, m_Info);
+  }
+  return true;
+}
+
+}  // namespace EasyNes
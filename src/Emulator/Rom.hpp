@@ -0,0 +1,109 @@
+#ifndef EASYNES_ROM_HPP
+#define EASYNES_ROM_HPP
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+constexpr std::size_t INES_HEADER_SIZE = 16;
+constexpr std::size_t TRAINER_SIZE     = 512;
+constexpr u32         PRG_BANK_SIZE    = 16 * 1024;
+constexpr u32         CHR_BANK_SIZE    = 8 * 1024;
+
+enum class Mirroring : u8 {
+  HORIZONTAL,
+  VERTICAL,
+  FOUR_SCREEN,
+  // Only selected by the mappers
+  SINGLE_LOWER,
+  SINGLE_UPPER,
+};
+
+// What the header says about the cartridge, once fixed by the cache
+struct RomInfo {
+  u16       mapper    = 0;
+  u8        submapper = 0;
+  Mirroring mirroring = Mirroring::HORIZONTAL;
+  bool      battery   = false;
+  bool      trainer   = false;
+  bool      nes2      = false;
+  u32       prgSize   = 0;
+  u32       chrSize   = 0;
+  // Memory on the cartridge that is not part of the image
+  u32 prgRamSize = 0;
+  u32 chrRamSize = 0;
+
+  bool operator==(const RomInfo &) const = default;
+};
+
+// Hash of the image without its header, two dumps of the same cartridge with
+// different headers share it
+u64 CONTENT_HASH(const u8 *data, std::size_t size);
+
+// Cartridge metadata keyed by content hash, stored as one line per rom in a
+// text file. The entries can be edited by hand to fix a wrong header
+class RomCache {
+ public:
+  // The file is created on the first Store()
+  explicit RomCache(std::string path);
+
+  std::optional<RomInfo> Find(u64 hash);
+  // Append the entry to the file, returns false if it cannot be written
+  bool Store(u64 hash, const RomInfo &info);
+
+ private:
+  void Read();
+
+  std::string                      m_Path;
+  std::mutex                       m_Mutex;
+  std::unordered_map<u64, RomInfo> m_Entries;
+  bool                             m_Read = false;
+};
+
+// Read only image of a .nes file mapped into the address space of the process.
+// The roms are shared, opening a file twice returns the same image as long as
+// it is alive, so every instance of a game reads the same pages
+class Rom {
+ public:
+  ~Rom();
+
+  Rom(const Rom &)            = delete;
+  Rom &operator=(const Rom &) = delete;
+
+  // Returns nullptr if the file cannot be read or is not an iNES image. The
+  // metadata of the cache take precedence over the header
+  static std::shared_ptr<const Rom> Open(const std::string &path, RomCache *cache = nullptr);
+  // Parse an image held in memory, the data is copied
+  static std::shared_ptr<const Rom> Parse(const u8 *data, std::size_t size, RomCache *cache = nullptr);
+
+  inline const RomInfo &GetInfo() const { return m_Info; }
+  inline u64            GetHash() const { return m_Hash; }
+
+  inline const u8 *GetPrg() const { return m_Prg; }
+  inline const u8 *GetChr() const { return m_Chr; }
+
+ private:
+  Rom() = default;
+
+  bool Load(const u8 *data, std::size_t size, RomCache *cache);
+
+  // Either a mapping of the file or an owned copy
+  void                 *m_Mapping     = nullptr;
+  std::size_t           m_MappingSize = 0;
+  std::unique_ptr<u8[]> m_Copy;
+
+  RomInfo   m_Info;
+  u64       m_Hash = 0;
+  const u8 *m_Prg  = nullptr;
+  const u8 *m_Chr  = nullptr;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_ROM_HPP
@@ -0,0 +1,186 @@
+#include "Runner.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace EasyNes {
+
+namespace {
+
+RunResult Execute(RunJob &job) {
+  RunResult result;
+  result.core = std::move(job.core);
+
+  if ((job.cycles == UNLIMITED_CYCLES && !job.script) || job.sliceCycles == 0) {
+    result.status = RunStatus::UNBOUNDED;
+    return result;
+  }
+
+  // An exception leaving the worker thread would end the process
+  if (!result.core && job.factory) {
+    try {
+      result.core = job.factory();
+    } catch (...) {
+      result.error = std::current_exception();
+    }
+  }
+  if (!result.core) {
+    result.status = RunStatus::FAILED;
+    return result;
+  }
+
+  Core &core  = *result.core;
+  u64   start = core.cpu.GetElapsedInstructions();
+
+  for (u64 slice = 0; result.cycles < job.cycles; slice++) {
+    if (job.script && !job.script(core, slice)) {
+      break;
+    }
+
+    u64 cycles = core.RunCycles(std::min(job.sliceCycles, job.cycles - result.cycles));
+    if (cycles == 0) {
+      result.status = RunStatus::STALLED;
+      break;
+    }
+    result.cycles += cycles;
+  }
+
+  result.instructions = core.cpu.GetElapsedInstructions() - start;
+  return result;
+}
+
+}  // namespace
+
+Runner::Runner(u32 threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (u32 i = 0; i < threads; i++) {
+    m_Workers.push_back(std::make_unique<Worker>());
+  }
+
+  // The workers are started once they can all be stolen from
+  for (u32 i = 0; i < threads; i++) {
+    m_Workers[i]->thread = std::thread(&Runner::Work, this, i);
+  }
+}
+
+Runner::~Runner() {
+  {
+    std::lock_guard lock(m_Mutex);
+    m_Stopping = true;
+  }
+  m_Wake.notify_all();
+
+  for (std::unique_ptr<Worker> &worker : m_Workers) {
+    worker->thread.join();
+  }
+}
+
+std::vector<RunResult> Runner::Run(std::vector<RunJob> jobs) {
+  std::vector<RunResult> results(jobs.size());
+
+  if (jobs.empty()) {
+    return results;
+  }
+
+  // Deal the jobs like cards, the workers are asleep until the batch starts
+  for (std::size_t job = 0; job < jobs.size(); job++) {
+    m_Workers[job % m_Workers.size()]->queue.push_back(job);
+  }
+
+  {
+    std::lock_guard lock(m_Mutex);
+    m_Jobs = &jobs;
+    m_Busy = m_Workers.size();
+    m_Batch++;
+  }
+  m_Wake.notify_all();
+
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Done.wait(lock, [this] { return m_Busy == 0; });
+    m_Jobs = nullptr;
+  }
+
+  for (std::unique_ptr<Worker> &worker : m_Workers) {
+    for (auto &[job, result] : worker->results) {
+      results[job] = std::move(result);
+    }
+    worker->results.clear();
+  }
+
+  return results;
+}
+
+std::vector<RunResult> Runner::Run(std::vector<std::unique_ptr<Core>> cores, u64 cycles) {
+  std::vector<RunJob> jobs(cores.size());
+
+  for (std::size_t i = 0; i < cores.size(); i++) {
+    jobs[i].core   = std::move(cores[i]);
+    jobs[i].cycles = cycles;
+  }
+
+  return Run(std::move(jobs));
+}
+
+void Runner::Work(u32 index) {
+  Worker &worker = *m_Workers[index];
+  u64     batch  = 0;
+
+  while (true) {
+    {
+      std::unique_lock lock(m_Mutex);
+      m_Wake.wait(lock, [&] { return m_Stopping || m_Batch != batch; });
+
+      if (m_Stopping) {
+        return;
+      }
+      batch = m_Batch;
+    }
+
+    // Once every queue is empty the remaining jobs are running on other
+    // workers, this one is done with the batch
+    std::size_t job;
+    while (Pop(index, job) || Steal(index, job)) {
+      worker.results.emplace_back(job, Execute((*m_Jobs)[job]));
+    }
+
+    std::lock_guard lock(m_Mutex);
+    if (--m_Busy == 0) {
+      m_Done.notify_one();
+    }
+  }
+}
+
+bool Runner::Pop(u32 index, std::size_t &job) {
+  Worker         &worker = *m_Workers[index];
+  std::lock_guard lock(worker.mutex);
+
+  if (worker.queue.empty()) {
+    return false;
+  }
+
+  job = worker.queue.back();
+  worker.queue.pop_back();
+  return true;
+}
+
+bool Runner::Steal(u32 thief, std::size_t &job) {
+  // The victims are visited from the next worker on, the thieves spread out
+  for (u32 i = 1; i < m_Workers.size(); i++) {
+    Worker         &victim = *m_Workers[(thief + i) % m_Workers.size()];
+    std::lock_guard lock(victim.mutex);
+
+    if (!victim.queue.empty()) {
+      job = victim.queue.front();
+      victim.queue.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace EasyNes
@@ -0,0 +1,98 @@
+#ifndef EASYNES_RUNNER_HPP
+#define EASYNES_RUNNER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Core.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+using CoreFactory = std::function<std::unique_ptr<Core>()>;
+// Called before every slice of the job with the index of the slice, feeds the
+// inputs and returns false once the job is done
+using CoreScript = std::function<bool(Core &core, u64 slice)>;
+
+// The job runs its core if it has one, otherwise the one built by the factory.
+// A job ends on its budget of cycles or on its script, it needs one of them
+struct RunJob {
+  std::unique_ptr<Core> core;
+  CoreFactory           factory;
+  CoreScript            script;
+  u64                   cycles      = UNLIMITED_CYCLES;
+  u64                   sliceCycles = CYCLES_PER_FRAME;
+};
+
+enum class RunStatus : u8 {
+  DONE,
+  // A slice ran no cycle, the cpu was stopped by a trap
+  STALLED,
+  // Without a budget, a script or cycles in its slices the job would never
+  // end, it is not run
+  UNBOUNDED,
+  // The factory threw, its exception is in the result, or made no core
+  FAILED,
+};
+
+struct RunResult {
+  std::unique_ptr<Core> core;
+  RunStatus             status       = RunStatus::DONE;
+  std::exception_ptr    error;
+  u64                   cycles       = 0;
+  u64                   instructions = 0;
+};
+
+// Pool of threads running independent cores headlessly. Each core is owned by
+// a single thread at a time and the cores share no state, the workers only
+// synchronize to steal jobs from each other when their own queue is empty
+class Runner {
+ public:
+  // Use every hardware thread by default
+  explicit Runner(u32 threads = 0);
+  ~Runner();
+
+  Runner(const Runner &)            = delete;
+  Runner &operator=(const Runner &) = delete;
+
+  // Run the jobs to completion, the results are in the order of the jobs
+  std::vector<RunResult> Run(std::vector<RunJob> jobs);
+  // Run every core for the cycles
+  std::vector<RunResult> Run(std::vector<std::unique_ptr<Core>> cores, u64 cycles);
+
+  inline u32 GetThreadCount() const { return m_Workers.size(); }
+
+ private:
+  struct Worker {
+    std::thread             thread;
+    std::mutex              mutex;
+    std::deque<std::size_t> queue;
+    // Filled by the worker alone, merged once the batch is complete
+    std::vector<std::pair<std::size_t, RunResult>> results;
+  };
+
+  void Work(u32 index);
+  bool Pop(u32 index, std::size_t &job);
+  bool Steal(u32 thief, std::size_t &job);
+
+  std::vector<std::unique_ptr<Worker>> m_Workers;
+  std::vector<RunJob>                 *m_Jobs = nullptr;
+
+  std::mutex              m_Mutex;
+  std::condition_variable m_Wake;
+  std::condition_variable m_Done;
+  u64                     m_Batch    = 0;
+  u32                     m_Busy     = 0;
+  bool                    m_Stopping = false;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_RUNNER_HPP
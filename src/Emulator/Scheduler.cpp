@@ -0,0 +1,138 @@
+#include "Scheduler.hpp"
+
+#include <algorithm>
+
+#include "Core.hpp"
+
+namespace EasyNes {
+
+Scheduler::Scheduler(Core *core) : m_Core(core), m_Cpu(&core->cpu) {}
+
+u64 Scheduler::Run(u64 cycles, u64 instructions) { return Run(cycles, instructions, false); }
+
+u64 Scheduler::RunFrame() { return Run(UNLIMITED_CYCLES, UNLIMITED_CYCLES, true); }
+
+void Scheduler::CatchUp() {
+  u64 now = m_Core->cpu.GetElapsedCycles();
+
+  // Nothing to run in the lockstep mode, the ppu is always at the cpu, unless
+  // an access of the cycle policy is past the first cycle of its instruction
+  if (now > m_Cycle) {
+    Advance(now - m_Cycle);
+    m_Cycle = now;
+  }
+  // The timing of the events is fixed, they only move once they are raised
+  if (now >= m_NextEvent) {
+    Schedule();
+  }
+}
+
+void Scheduler::Sync(u64 cycle) {
+  m_Cycle = cycle;
+  Schedule();
+  m_Core->ppu.SyncPipeline();
+}
+
+u64 Scheduler::Run(u64 cycles, u64 instructions, bool frame) {
+  m_Core->cpu.Resume();
+  if (m_Mode == SchedulerMode::LOCKSTEP) {
+    return RunLockstep(cycles, instructions, frame);
+  }
+
+  CPU &cpu     = m_Core->cpu;
+  u64  elapsed = 0;
+  u64  start   = cpu.GetElapsedInstructions();
+  u64  picture = m_Core->ppu.GetFrame();
+
+  // The cpu may have run on its own since the last run
+  if (cpu.GetElapsedCycles() >= m_NextEvent) {
+    CatchUp();
+  }
+
+  while (elapsed < cycles && cpu.GetElapsedInstructions() - start < instructions) {
+    u64 budget = std::min(cycles - elapsed, m_NextEvent - cpu.GetElapsedCycles());
+
+    // The event comes due while the cpu is still held by an interrupt or a
+    // dma, before the next instruction
+    if (budget <= cpu.GetWaitingCycles()) {
+      for (u64 i = 0; i < budget; i++) {
+        cpu.Step();
+      }
+      elapsed += budget;
+    } else {
+      elapsed += cpu.Run(budget, instructions - (cpu.GetElapsedInstructions() - start));
+    }
+
+    if (cpu.GetElapsedCycles() >= m_NextEvent) {
+      CatchUp();
+    }
+    // An access of the cycle policy may have raised the event on its own
+    if ((frame && m_Core->ppu.GetFrame() != picture) || cpu.IsStopped()) {
+      break;
+    }
+  }
+
+  return elapsed;
+}
+
+u64 Scheduler::RunLockstep(u64 cycles, u64 instructions, bool frame) {
+  CPU &cpu     = m_Core->cpu;
+  PPU &ppu     = m_Core->ppu;
+  u64  start   = m_Cycle;
+  u64  first   = cpu.GetElapsedInstructions();
+  u64  picture = ppu.GetFrame();
+  // End of the instruction in progress, the run stops on its boundary
+  u64 end = m_Cycle;
+
+  auto spent = [&] {
+    return m_Cycle - start >= cycles || cpu.GetElapsedInstructions() - first >= instructions ||
+           (frame && ppu.GetFrame() != picture) || cpu.IsStopped();
+  };
+
+  while (!spent() || cpu.GetElapsedCycles() < end) {
+    if (cpu.Step()) {
+      end = cpu.GetElapsedCycles() + cpu.GetWaitingCycles();
+    }
+
+    // The accesses of the cycle policy may have caught the ppu up with them
+    if (m_Cycle < cpu.GetElapsedCycles()) {
+      m_Cycle++;
+      Advance(1);
+    }
+  }
+
+  Schedule();
+  return m_Cycle - start;
+}
+
+void Scheduler::Advance(u64 cycles) {
+  PPU &ppu     = m_Core->ppu;
+  u64  picture = ppu.GetFrame();
+
+  ppu.Run(cycles);
+  if (m_Core->mapper) {
+    m_Core->apu.Run(cycles);
+    if (ppu.GetFrame() != picture) {
+      m_Core->apu.EndFrame();
+    }
+  }
+}
+
+u64 Scheduler::GetNextChange(bool ppu) const {
+  if (!ppu) {
+    return m_NextEvent;
+  }
+  return std::min(m_NextEvent, m_Cycle + m_Core->ppu.GetCyclesToStatusChange());
+}
+
+void Scheduler::Schedule() {
+  // A bare cpu has no apu, only a cartridge brings the rest of the console
+  const Mapper *mapper = m_Core->mapper.get();
+  u64           cycles = m_Core->ppu.GetCyclesToEvent(mapper && mapper->CountsScanlines());
+  if (mapper) {
+    cycles = std::min(cycles, m_Core->apu.GetCyclesToEvent());
+  }
+  m_NextEvent = m_Cycle + cycles;
+}
+
+}  // namespace EasyNes
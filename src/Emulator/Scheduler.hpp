@@ -0,0 +1,86 @@
+#ifndef EASYNES_SCHEDULER_HPP
+#define EASYNES_SCHEDULER_HPP
+
+#include "CPU.hpp"
+#include "Types.hpp"
+
+namespace EasyNes {
+
+struct Core;
+
+enum class SchedulerMode : u8 {
+  // The cpu runs ahead up to the next event of the components
+  CATCH_UP,
+  // The components are ticked after every cpu cycle, the reference timing
+  LOCKSTEP,
+};
+
+// Runs the cpu along with the other components of a core. In the catch up
+// mode the cpu runs freely until the next event that can reach it, the
+// vertical blank, the scanline counter of the mapper or an interrupt or sample
+// read of the apu. The ppu and the apu are brought up to the time of the cpu
+// only when the event comes due or when the cpu touches them, through their
+// registers, the sprite dma or a bank switch of the mapper.
+// Both modes give the same timing, the lockstep mode exists to prove it
+class Scheduler {
+ public:
+  explicit Scheduler(Core *core);
+
+  Scheduler(const Scheduler &)            = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  inline void          SetMode(SchedulerMode mode) { m_Mode = mode; }
+  inline SchedulerMode GetMode() const { return m_Mode; }
+
+  // Execute whole instructions until one of the budgets is spent, or until the
+  // picture of the frame is complete. Returns the elapsed cycles
+  u64 Run(u64 cycles, u64 instructions);
+  u64 RunFrame();
+  // Same as Run(cycles, 1), inline for the callers checking a condition after
+  // every instruction
+  inline u64 RunInstruction(u64 cycles) {
+    u32 waiting = m_Cpu->GetWaitingCycles();
+
+    if (m_Mode == SchedulerMode::LOCKSTEP || waiting >= cycles ||
+        m_Cpu->GetElapsedCycles() + waiting >= m_NextEvent) {
+      return Run(cycles, 1);
+    }
+
+    u64 elapsed = m_Cpu->Execute();
+    if (m_Cpu->GetElapsedCycles() >= m_NextEvent) {
+      CatchUp();
+    }
+    return elapsed;
+  }
+
+  // Run the ppu up to the cpu and raise the events that came due, called
+  // before the cpu reaches the state of the ppu
+  void CatchUp();
+  // The ppu is at the given cpu cycle, after a reset or a loaded state. The
+  // mapper is loaded first, a pipelined ppu starts over from both
+  void Sync(u64 cycle);
+  // Find the next event again, after a register write moved it
+  void Schedule();
+
+  // Cpu cycle the ppu has reached, behind the cpu in the catch up mode
+  inline u64 GetCycle() const { return m_Cycle; }
+  // Cpu cycle of the next event, or of the end of the next scanline which may
+  // change the ppu status
+  u64 GetNextChange(bool ppu) const;
+
+ private:
+  u64 Run(u64 cycles, u64 instructions, bool frame);
+  u64 RunLockstep(u64 cycles, u64 instructions, bool frame);
+  // Run the ppu and the apu, the audio of a complete frame is handed out
+  void Advance(u64 cycles);
+
+  Core         *m_Core;
+  CPU          *m_Cpu;
+  SchedulerMode m_Mode      = SchedulerMode::CATCH_UP;
+  u64           m_Cycle     = 0;
+  u64           m_NextEvent = 0;
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_SCHEDULER_HPP
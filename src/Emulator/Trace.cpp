@@ -0,0 +1,275 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include "Instructions.hpp"
+#include "PPU.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr char TRACE_MAGIC[4] = {'E', 'N', 'T', 'R'};
+
+// The records follow in the byte order of the host
+struct TraceHeader {
+  char magic[4];
+  u16  version;
+  u16  recordSize;
+  u32  unused;
+  u64  cycle;
+};
+
+// Time the writer sleeps when every ring is empty
+constexpr auto IDLE_DELAY = std::chrono::microseconds(500);
+
+// Operand in the syntax of the nestest log
+void Disassemble(const TraceRecord &record, char *text, std::size_t size) {
+  const Instruction &instruction = INSTRUCTION_SET[record.bytes[0]];
+
+  auto mode = instruction.addressing;
+  u8   lo   = record.bytes[1];
+  u16  word = record.bytes[1] | record.bytes[2] << 8;
+
+  if (mode == &CPU::ACC) {
+    std::snprintf(text, size, "A");
+  } else if (mode == &CPU::IMM) {
+    std::snprintf(text, size, "#$%02X", lo);
+  } else if (mode == &CPU::ZER) {
+    std::snprintf(text, size, "$%02X", lo);
+  } else if (mode == &CPU::ZPX) {
+    std::snprintf(text, size, "$%02X,X", lo);
+  } else if (mode == &CPU::ZPY) {
+    std::snprintf(text, size, "$%02X,Y", lo);
+  } else if (mode == &CPU::ABS) {
+    std::snprintf(text, size, "$%04X", word);
+  } else if (mode == &CPU::ABX) {
+    std::snprintf(text, size, "$%04X,X", word);
+  } else if (mode == &CPU::ABY) {
+    std::snprintf(text, size, "$%04X,Y", word);
+  } else if (mode == &CPU::IND) {
+    std::snprintf(text, size, "($%04X)", word);
+  } else if (mode == &CPU::IDX) {
+    std::snprintf(text, size, "($%02X,X)", lo);
+  } else if (mode == &CPU::IDY) {
+    std::snprintf(text, size, "($%02X),Y", lo);
+  } else if (mode == &CPU::REL) {
+    // Relative to the next instruction
+    std::snprintf(text, size, "$%04X", u16(record.pc + 2 + static_cast<s8>(lo)));
+  } else {
+    text[0] = '\0';
+  }
+}
+
+}  // namespace
+
+// Shared by every trace of the process, the thread runs while there is one
+class TraceWriter {
+ public:
+  static TraceWriter &Get() {
+    static TraceWriter writer;
+    return writer;
+  }
+
+  ~TraceWriter() { Stop(); }
+
+  void Add(Trace *trace) {
+    std::lock_guard lifetime(m_Lifetime);
+    std::lock_guard lock(m_Mutex);
+    m_Traces.push_back(trace);
+
+    if (!m_Thread.joinable()) {
+      m_Stopping = false;
+      m_Thread   = std::thread(&TraceWriter::Work, this);
+    }
+  }
+
+  // The trace is not drained anymore once this returns
+  void Remove(Trace *trace) {
+    std::lock_guard lifetime(m_Lifetime);
+    bool            last;
+    {
+      std::lock_guard lock(m_Mutex);
+      m_Traces.erase(std::find(m_Traces.begin(), m_Traces.end(), trace));
+      last = m_Traces.empty();
+    }
+
+    if (last) {
+      Stop();
+    }
+  }
+
+  void Wake() { m_Wake.notify_one(); }
+
+ private:
+  TraceWriter() = default;
+
+  void Stop() {
+    {
+      std::lock_guard lock(m_Mutex);
+      m_Stopping = true;
+    }
+    m_Wake.notify_one();
+
+    if (m_Thread.joinable()) {
+      m_Thread.join();
+    }
+  }
+
+  void Work() {
+    std::unique_lock lock(m_Mutex);
+
+    while (!m_Stopping) {
+      u32 written = 0;
+      for (Trace *trace : m_Traces) {
+        written += trace->Drain();
+      }
+
+      if (written == 0) {
+        m_Wake.wait_for(lock, IDLE_DELAY);
+      }
+    }
+  }
+
+  // Held while the thread starts or stops
+  std::mutex m_Lifetime;
+
+  std::mutex              m_Mutex;
+  std::condition_variable m_Wake;
+  std::thread             m_Thread;
+  std::vector<Trace *>    m_Traces;
+  bool                    m_Stopping = false;
+};
+
+const TraceRecord *TraceRing::Peek(u32 &count) {
+  u64 tail = m_Tail.load(std::memory_order_relaxed);
+
+  if (tail == m_CachedHead) {
+    m_CachedHead = m_Head.load(std::memory_order_acquire);
+    if (tail == m_CachedHead) {
+      return nullptr;
+    }
+  }
+
+  u32 index = tail % TRACE_RING_SIZE;
+  count     = std::min<u64>(m_CachedHead - tail, TRACE_RING_SIZE - index);
+  return &m_Records[index];
+}
+
+void TraceRing::Pop(u32 count) { m_Tail.store(m_Tail.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+std::unique_ptr<Trace> Trace::Open(const std::string &path, u64 cycle) {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    return nullptr;
+  }
+
+  TraceHeader header = {};
+  std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version    = TRACE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.cycle      = cycle;
+
+  if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+    std::fclose(file);
+    return nullptr;
+  }
+
+  std::unique_ptr<Trace> trace(new Trace(file));
+  TraceWriter::Get().Add(trace.get());
+  return trace;
+}
+
+Trace::~Trace() {
+  TraceWriter::Get().Remove(this);
+
+  // Nothing else reads the ring now
+  while (Drain() > 0) {
+  }
+  std::fclose(m_File);
+}
+
+void Trace::Wait(const TraceRecord &record) {
+  m_Stalls++;
+  TraceWriter::Get().Wake();
+
+  while (!m_Ring.Push(record)) {
+    std::this_thread::yield();
+  }
+}
+
+u32 Trace::Drain() {
+  u32 written = 0, count;
+
+  // At most twice when the records wrap around the ring
+  for (int i = 0; i < 2; i++) {
+    const TraceRecord *records = m_Ring.Peek(count);
+    if (!records) {
+      break;
+    }
+
+    std::fwrite(records, sizeof(TraceRecord), count, m_File);
+    m_Ring.Pop(count);
+    written += count;
+  }
+
+  return written;
+}
+
+TraceReader::TraceReader(std::istream &input) : m_Input(input) {
+  TraceHeader header;
+  m_Valid = input.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+            !std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) && header.version == TRACE_VERSION &&
+            header.recordSize == sizeof(TraceRecord);
+  m_Cycle = header.cycle;
+}
+
+bool TraceReader::Next(TraceRecord &record, u64 &cycle) {
+  if (!m_Valid || !m_Input.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    return false;
+  }
+
+  // An instruction, its interrupt and its dma take far less than 2^16 cycles
+  m_Cycle += u16(record.cycle - u16(m_Cycle));
+  cycle = m_Cycle;
+  return true;
+}
+
+bool WriteNestestLog(std::istream &trace, std::ostream &log) {
+  TraceReader reader(trace);
+  if (!reader.IsValid()) {
+    return false;
+  }
+
+  TraceRecord record;
+  u64         cycle;
+
+  while (reader.Next(record, cycle)) {
+    char bytes[16] = {}, operand[16], line[128];
+    u8   size      = 1 + OPERAND_SIZES[record.bytes[0]];
+
+    for (u8 i = 0; i < size; i++) {
+      std::snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", record.bytes[i]);
+    }
+    Disassemble(record, operand, sizeof(operand));
+
+    u64 dot = cycle * DOTS_PER_CYCLE;
+
+    std::snprintf(line, sizeof(line), "%04X  %-9s %s %-27s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu\n",
+                  record.pc, bytes, MNEMONIC(record.bytes[0]), operand, record.a, record.x, record.y, record.status,
+                  record.sp, unsigned(dot / DOTS_PER_SCANLINE % SCANLINES_PER_FRAME), unsigned(dot % DOTS_PER_SCANLINE),
+                  static_cast<unsigned long long>(cycle));
+    log << line;
+  }
+
+  return true;
+}
+
+}  // namespace EasyNes
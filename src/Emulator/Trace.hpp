@@ -0,0 +1,134 @@
+#ifndef EASYNES_TRACE_HPP
+#define EASYNES_TRACE_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace EasyNes {
+
+// Bumped whenever the layout of the records changes
+constexpr u16 TRACE_VERSION = 1;
+// Records buffered between the cpu and the writer thread, 768 KiB per trace
+constexpr u32 TRACE_RING_SIZE = 1 << 16;
+
+// One instruction, with the registers before it executes
+struct TraceRecord {
+  // Low bits of the elapsed cycles, the readers rebuild the rest
+  u16 cycle;
+  u16 pc;
+  // The opcode and its operand, the bytes read from handlers are left at 0
+  u8 bytes[3];
+  u8 a;
+  u8 x;
+  u8 y;
+  u8 sp;
+  u8 status;
+};
+
+static_assert(sizeof(TraceRecord) == 12);
+
+// Ring of records with a single producer, the cpu, and a single consumer, the
+// writer thread. Each index is only written by its side, the other side keeps
+// a stale copy and only reloads it when the ring looks full or empty
+class TraceRing {
+ public:
+  TraceRing() : m_Records(TRACE_RING_SIZE) {}
+
+  // Returns false when the ring is full
+  inline bool Push(const TraceRecord &record) {
+    u64 head = m_Head.load(std::memory_order_relaxed);
+
+    if (head - m_CachedTail == TRACE_RING_SIZE) {
+      m_CachedTail = m_Tail.load(std::memory_order_acquire);
+      if (head - m_CachedTail == TRACE_RING_SIZE) {
+        return false;
+      }
+    }
+
+    m_Records[head % TRACE_RING_SIZE] = record;
+    m_Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Records ready to be read, contiguous up to the end of the ring
+  const TraceRecord *Peek(u32 &count);
+  void               Pop(u32 count);
+
+ private:
+  std::vector<TraceRecord> m_Records;
+
+  // On their own cache lines, the two threads write them all the time
+  alignas(64) std::atomic<u64> m_Head = 0;
+  u64 m_CachedTail                     = 0;
+  alignas(64) std::atomic<u64> m_Tail = 0;
+  u64 m_CachedHead                     = 0;
+};
+
+// The records of a cpu written to a file. A background thread shared by every
+// trace of the process drains the rings with large sequential writes, the cpu
+// only waits for it when its ring is full
+class Trace {
+ public:
+  // Returns nullptr if the file cannot be created, cycle is the elapsed cycles
+  // of the cpu when the trace starts
+  static std::unique_ptr<Trace> Open(const std::string &path, u64 cycle);
+  // Writes the records left and closes the file
+  ~Trace();
+
+  Trace(const Trace &)            = delete;
+  Trace &operator=(const Trace &) = delete;
+
+  inline void Record(const TraceRecord &record) {
+    if (!m_Ring.Push(record)) {
+      Wait(record);
+    }
+  }
+
+  // Times the cpu waited for the writer
+  inline u64 GetStalls() const { return m_Stalls; }
+
+ private:
+  Trace(std::FILE *file) : m_File(file) {}
+
+  void Wait(const TraceRecord &record);
+  // Write the ready records, returns their count
+  u32 Drain();
+
+  friend class TraceWriter;
+
+  TraceRing  m_Ring;
+  std::FILE *m_File;
+  u64        m_Stalls = 0;
+};
+
+// Reads the records of a trace in order
+class TraceReader {
+ public:
+  explicit TraceReader(std::istream &input);
+
+  // False if the input does not start with a trace header
+  inline bool IsValid() const { return m_Valid; }
+  // Returns false at the end of the trace
+  bool Next(TraceRecord &record, u64 &cycle);
+
+ private:
+  std::istream &m_Input;
+  bool          m_Valid;
+  u64           m_Cycle = 0;
+};
+
+// Convert a trace to the text log of nestest. The memory operands are not
+// recorded, the disassembly has no "= value" and the ppu position is computed
+// from the cycles, without the skipped dot of the odd frames. Returns false
+// if the input is not a trace
+bool WriteNestestLog(std::istream &trace, std::ostream &log);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_TRACE_HPP
@@ -0,0 +1,404 @@
+#include "Fuzzer.hpp"
+
+#include <Core.hpp>
+#include <Instructions.hpp>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "Reference.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u8 NOP_OPCODE = 0xEA;
+// Cases run between two looks at the clock
+constexpr u64 CASES_PER_CHECK = 256;
+
+// SplitMix64, a case draws about a hundred numbers and a larger generator
+// would spend more time seeding than running
+class Random {
+ public:
+  explicit Random(u64 seed) : m_State(seed) {}
+
+  u64 Next() {
+    u64 z = (m_State += 0x9E3779B97F4A7C15);
+    z     = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z     = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+  }
+
+  u8 Byte() { return Next(); }
+
+  void Fill(u8 *data, std::size_t size) {
+    for (std::size_t i = 0; i < size; i += 8) {
+      u64 bits = Next();
+      std::memcpy(data + i, &bits, std::min<std::size_t>(8, size - i));
+    }
+  }
+
+ private:
+  u64 m_State;
+};
+
+std::vector<u8> MakeOfficialOpcodes() {
+  std::vector<u8> opcodes;
+  for (int opcode = 0; opcode <= 0xFF; opcode++) {
+    if (ReferenceCPU::IsOfficial(opcode)) {
+      opcodes.push_back(opcode);
+    }
+  }
+  return opcodes;
+}
+
+const std::vector<u8> OFFICIAL_OPCODES = MakeOfficialOpcodes();
+
+// Registers and program of a case, the rest of its memory is only in the
+// memories it was written to
+struct FuzzProgram {
+  ReferenceRegisters registers;
+  u16                start = 0;
+  // Offset of each generated instruction from the start
+  std::vector<u8> offsets;
+  std::vector<u8> bytes;
+};
+
+// A core and a reference running the same cases, the memories only differ
+// from zero on the pages a case initialized or wrote
+class FuzzMachine {
+ public:
+  FuzzMachine() : m_Core(std::make_unique<Core>()), m_Reference(std::make_unique<ReferenceCPU>()) {
+    // Every write of the cpu is recorded, the trap is called before the write
+    // reaches the ram
+    u8 slot = m_Core->bus.AddWriteTrap(this, &FuzzMachine::OnWrite);
+    for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+      m_Core->bus.TrapWrites(slot, page);
+    }
+    m_Writes.reserve(16);
+  }
+
+  bool Run(const FuzzCase &fuzzCase, FuzzFailure &failure) {
+    FuzzProgram program = Generate(fuzzCase);
+    CPU        &cpu     = m_Core->cpu;
+    ReferenceCPU &reference = *m_Reference;
+
+    const ReferenceRegisters &r = program.registers;
+    reference.registers         = r;
+    cpu.SetState({r.pc, r.sp, r.a, r.x, r.y, r.p, 0, 0, 0});
+
+    bool passed = true;
+    u32  step   = 0;
+
+    for (; step < fuzzCase.steps; step++) {
+      ReferenceRegisters before = reference.registers;
+      u8                 opcode = reference.memory[before.pc];
+
+      // The program can run into data, the case ends at an opcode the
+      // reference does not know
+      u32 expected = reference.Step();
+      if (expected == 0) {
+        break;
+      }
+
+      // The reference only makes the writes of the operations, without the
+      // dummy writes of the cycle policy
+      m_Writes.clear();
+      u32 cycles = cpu.Execute<InstructionAccuracy>();
+
+      for (const MemoryWrite &write : reference.GetWrites()) {
+        m_Dirty.set(PAGE_OF(write.address));
+      }
+      for (const MemoryWrite &write : m_Writes) {
+        m_Dirty.set(PAGE_OF(write.address));
+      }
+
+      const ReferenceRegisters &after  = reference.registers;
+      ReferenceRegisters        actual = {cpu.GetRegisterPC(), cpu.GetRegisterSP(), cpu.GetRegisterA(),
+                                          cpu.GetRegisterX(),  cpu.GetRegisterY(),  cpu.GetRegisterStatus()};
+
+      if (actual != after || cycles != expected || m_Writes != reference.GetWrites()) {
+        failure = {fuzzCase, step, Describe(before, opcode, actual, cycles, after, expected, reference.GetWrites())};
+        passed  = false;
+        break;
+      }
+    }
+
+    m_Instructions += step;
+    Clear();
+    return passed;
+  }
+
+  // Instructions compared since the machine was built
+  inline u64 GetInstructions() const { return m_Instructions; }
+
+  // The case is generated again for the listing, the memories are left clear
+  FuzzProgram List(const FuzzCase &fuzzCase) {
+    FuzzProgram program = Generate(fuzzCase);
+    Clear();
+    return program;
+  }
+
+ private:
+  static void OnWrite(void *context, u16 address, u8 value) {
+    static_cast<FuzzMachine *>(context)->m_Writes.push_back({address, value});
+  }
+
+  // Write the same page to both memories
+  void Fill(u8 page, Random &random) {
+    u8 *data = &m_Core->ram[page << 8];
+    random.Fill(data, PAGE_SIZE);
+    std::memcpy(&m_Reference->memory[page << 8], data, PAGE_SIZE);
+    m_Dirty.set(page);
+  }
+
+  void Poke(u16 address, u8 value) {
+    m_Core->ram[address]          = value;
+    m_Reference->memory[address] = value;
+    m_Dirty.set(PAGE_OF(address));
+  }
+
+  // The registers and the memory are drawn first, a shorter program keeps them
+  FuzzProgram Generate(const FuzzCase &fuzzCase) {
+    Random      random(fuzzCase.seed);
+    FuzzProgram program;
+
+    // The zero page holds the pointers, the stack is pulled by RTS, RTI and
+    // PLP, the data pages are read and written by the absolute operands
+    u8 code    = 0x02 + random.Next() % 0xFD;
+    u8 data[2] = {u8(0x02 + random.Next() % 0xFD), u8(0x02 + random.Next() % 0xFD)};
+
+    Fill(0x00, random);
+    Fill(0x01, random);
+    Fill(data[0], random);
+    Fill(data[1], random);
+
+    // The pointers of the zero page mostly reach the data pages
+    for (u16 pointer = 1; pointer < PAGE_SIZE; pointer += 2) {
+      if (random.Next() % 4) {
+        Poke(pointer, data[random.Next() % 2]);
+      }
+    }
+
+    u8 status          = (random.Byte() & ~BREAK_BIT) | UNUSED_BIT;
+    program.start      = code << 8;
+    program.registers  = {program.start, random.Byte(), random.Byte(), random.Byte(), random.Byte(), status};
+
+    // BRK and the zeroed memory lead back to the program
+    Poke(IRQ_VECTOR, program.start & 0xFF);
+    Poke(IRQ_VECTOR + 1, program.start >> 8);
+
+    const u8 pages[] = {0x00, 0x01, code, data[0], data[1]};
+
+    for (u32 i = 0; i < std::min(fuzzCase.length, FUZZ_MAX_LENGTH); i++) {
+      u8 opcode = OFFICIAL_OPCODES[random.Next() % OFFICIAL_OPCODES.size()];
+      u8 size   = ReferenceCPU::GetSize(opcode);
+      u8 lo     = random.Byte();
+      // The high bytes mostly point to the initialized pages
+      u8 hi = random.Next() % 8 ? pages[random.Next() % std::size(pages)] : random.Byte();
+
+      program.offsets.push_back(program.bytes.size());
+
+      if (fuzzCase.mask >> i & 1) {
+        program.bytes.push_back(NOP_OPCODE);
+        continue;
+      }
+
+      program.bytes.push_back(opcode);
+      if (size >= 2) {
+        program.bytes.push_back(lo);
+      }
+      if (size == 3) {
+        // Jumps stay in the program
+        program.bytes.push_back(opcode == 0x4C || opcode == 0x20 ? code : hi);
+      }
+    }
+
+    for (std::size_t i = 0; i < program.bytes.size(); i++) {
+      Poke(program.start + i, program.bytes[i]);
+    }
+
+    return program;
+  }
+
+  void Clear() {
+    for (std::size_t page = 0; page < PAGE_COUNT; page++) {
+      if (m_Dirty.test(page)) {
+        std::memset(&m_Core->ram[page << 8], 0, PAGE_SIZE);
+        std::memset(&m_Reference->memory[page << 8], 0, PAGE_SIZE);
+      }
+    }
+    m_Dirty.reset();
+  }
+
+  std::string Describe(const ReferenceRegisters &before, u8 opcode, const ReferenceRegisters &actual, u32 cycles,
+                       const ReferenceRegisters &expected, u32 expectedCycles,
+                       const std::vector<MemoryWrite> &expectedWrites) const {
+    auto print = [](const ReferenceRegisters &r, u32 cycles, const std::vector<MemoryWrite> &writes) {
+      char line[128];
+      std::snprintf(line, sizeof(line), "PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%u", r.pc, r.a, r.x, r.y,
+                    r.p, r.sp, cycles);
+
+      std::string text = line;
+      for (const MemoryWrite &write : writes) {
+        std::snprintf(line, sizeof(line), " [%04X]=%02X", write.address, write.value);
+        text += line;
+      }
+      return text;
+    };
+
+    char header[64];
+    std::snprintf(header, sizeof(header), "%s %s ($%02X) at $%04X\n", MNEMONIC(opcode), ADDRESSING_NAME(opcode),
+                  opcode, before.pc);
+
+    return header + ("  before     " + print(before, 0, {})) + "\n  cpu        " + print(actual, cycles, m_Writes) +
+           "\n  reference  " + print(expected, expectedCycles, expectedWrites);
+  }
+
+  std::unique_ptr<Core>         m_Core;
+  std::unique_ptr<ReferenceCPU> m_Reference;
+  std::vector<MemoryWrite>      m_Writes;
+  std::bitset<PAGE_COUNT>       m_Dirty;
+  u64                           m_Instructions = 0;
+};
+
+}  // namespace
+
+bool RunFuzzCase(const FuzzCase &fuzzCase, FuzzFailure &failure) { return FuzzMachine().Run(fuzzCase, failure); }
+
+FuzzFailure MinimizeFuzzCase(const FuzzFailure &failure) {
+  FuzzMachine machine;
+  FuzzFailure best = failure, attempt;
+
+  auto fails = [&](FuzzCase fuzzCase) {
+    if (machine.Run(fuzzCase, attempt)) {
+      return false;
+    }
+    // Nothing runs after the step that differs
+    attempt.fuzzCase.steps = attempt.step + 1;
+    best                   = attempt;
+    return true;
+  };
+
+  FuzzCase shrunk = best.fuzzCase;
+  shrunk.steps    = best.step + 1;
+  if (!fails(shrunk)) {
+    return failure;
+  }
+
+  // The first program length still failing
+  for (u32 length = 1; length < best.fuzzCase.length; length++) {
+    shrunk        = best.fuzzCase;
+    shrunk.length = length;
+    if (fails(shrunk)) {
+      break;
+    }
+  }
+
+  // Then the instructions one at a time
+  for (u32 i = 0; i < best.fuzzCase.length; i++) {
+    shrunk = best.fuzzCase;
+    shrunk.mask |= u64(1) << i;
+    if (shrunk.mask != best.fuzzCase.mask) {
+      fails(shrunk);
+    }
+  }
+
+  return best;
+}
+
+FuzzReport Fuzz(const FuzzOptions &options) {
+  u32 threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+  std::atomic<bool> stop = false;
+  std::atomic<u64>  cases = 0, instructions = 0;
+  std::mutex        mutex;
+  FuzzReport        report;
+
+  auto start    = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(options.seconds);
+
+  auto work = [&](u32 index) {
+    FuzzMachine machine;
+    FuzzFailure failure;
+    u64         count = 0;
+
+    for (u64 n = index; !stop.load(std::memory_order_relaxed); n += threads) {
+      if (!machine.Run({options.seed + n, options.length, options.steps, 0}, failure)) {
+        std::lock_guard lock(mutex);
+        // The first one found wins, the others are likely the same bug
+        if (!report.failed) {
+          report.failed  = true;
+          report.failure = failure;
+        }
+        stop = true;
+      }
+
+      if (++count % CASES_PER_CHECK == 0 && std::chrono::steady_clock::now() >= deadline) {
+        stop = true;
+      }
+    }
+
+    cases += count;
+    instructions += machine.GetInstructions();
+  };
+
+  std::vector<std::thread> workers;
+  for (u32 i = 0; i < threads; i++) {
+    workers.emplace_back(work, i);
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  report.cases        = cases;
+  report.instructions = instructions;
+  report.seconds      = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (report.failed) {
+    report.failure = MinimizeFuzzCase(report.failure);
+  }
+  return report;
+}
+
+void PrintFuzzFailure(std::ostream &output, const FuzzFailure &failure) {
+  const FuzzCase &fuzzCase = failure.fuzzCase;
+  FuzzProgram     program  = FuzzMachine().List(fuzzCase);
+
+  char start[32];
+  std::snprintf(start, sizeof(start), "\nProgram at $%04X:\n", program.start);
+  output << "Step " << failure.step << ", " << failure.message << start;
+
+  for (std::size_t i = 0; i < program.offsets.size(); i++) {
+    if (fuzzCase.mask >> i & 1) {
+      continue;
+    }
+
+    u8   offset = program.offsets[i];
+    u8   opcode = program.bytes[offset];
+    char bytes[16] = {}, line[64];
+
+    for (u8 j = 0; j < ReferenceCPU::GetSize(opcode); j++) {
+      std::snprintf(bytes + j * 3, sizeof(bytes) - j * 3, "%02X ", program.bytes[offset + j]);
+    }
+    std::snprintf(line, sizeof(line), "  %04X  %-9s %s %s\n", program.start + offset, bytes, MNEMONIC(opcode),
+                  ADDRESSING_NAME(opcode));
+    output << line;
+  }
+
+  char reproduce[128];
+  std::snprintf(reproduce, sizeof(reproduce), "Reproduce with --replay --seed %llu --length %u --steps %u --mask %llx\n",
+                static_cast<unsigned long long>(fuzzCase.seed), fuzzCase.length, fuzzCase.steps,
+                static_cast<unsigned long long>(fuzzCase.mask));
+  output << reproduce;
+}
+
+}  // namespace EasyNes
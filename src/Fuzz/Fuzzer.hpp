@@ -0,0 +1,68 @@
+#ifndef EASYNES_FUZZER_HPP
+#define EASYNES_FUZZER_HPP
+
+#include <iosfwd>
+#include <string>
+
+#include <Types.hpp>
+
+namespace EasyNes {
+
+// Most instructions generated in a case, one bit of the nop mask each
+constexpr u32 FUZZ_MAX_LENGTH = 64;
+
+// Everything a case is generated from. The registers, the memory and the
+// program come from the seed alone, the generated instructions whose bit is
+// set in the mask are replaced by NOPs
+struct FuzzCase {
+  u64 seed   = 0;
+  u32 length = 32;
+  // Instructions executed at most, the program can loop or jump away
+  u32 steps = 64;
+  u64 mask  = 0;
+};
+
+// What differed first between the cpu and the reference
+struct FuzzFailure {
+  FuzzCase    fuzzCase;
+  // Instructions executed before the one that differed
+  u32         step = 0;
+  std::string message;
+};
+
+struct FuzzOptions {
+  // Use every hardware thread by default
+  u32    threads = 0;
+  double seconds = 1.0;
+  // The cases are numbered from the seed, each thread takes every nth one
+  u64 seed   = 0;
+  u32 length = 32;
+  u32 steps  = 64;
+};
+
+struct FuzzReport {
+  u64    cases        = 0;
+  u64    instructions = 0;
+  double seconds      = 0;
+  // Minimized, the first failure found by the threads
+  bool        failed = false;
+  FuzzFailure failure;
+};
+
+// Run a single case, returns false and fills the failure if the cpu differs
+// from the reference
+bool RunFuzzCase(const FuzzCase &fuzzCase, FuzzFailure &failure);
+
+// Shrink a failing case: stop right after the step that differs, then drop
+// the instructions not needed to reproduce it
+FuzzFailure MinimizeFuzzCase(const FuzzFailure &failure);
+
+// Run cases on the threads until a case fails or the time is spent
+FuzzReport Fuzz(const FuzzOptions &options);
+
+// The case with its program and the difference, the way to reproduce it
+void PrintFuzzFailure(std::ostream &output, const FuzzFailure &failure);
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_FUZZER_HPP
@@ -0,0 +1,80 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "Fuzzer.hpp"
+
+namespace {
+
+void PrintUsage() {
+  std::cout << "Usage: EasyFuzz [options]\n"
+               "  --seconds <s>    Fuzz for the time, 10 by default\n"
+               "  --threads <n>    Use every hardware thread by default\n"
+               "  --seed <n>       Seed of the first case\n"
+               "  --length <n>     Instructions generated per case, at most 64\n"
+               "  --steps <n>      Instructions executed per case\n"
+               "  --replay         Only run the case of the seed\n"
+               "  --mask <hex>     Instructions of the replayed case replaced by NOPs\n"
+               "The exit code is 1 when the cpu differs from the reference"
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  EasyNes::FuzzOptions options;
+  EasyNes::u64         mask   = 0;
+  bool                 replay = false;
+
+  options.seconds = 10.0;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+
+    if (!std::strcmp(argv[i], "--seconds") && hasValue) {
+      options.seconds = std::atof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+      options.threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--seed") && hasValue) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--length") && hasValue) {
+      options.length = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--steps") && hasValue) {
+      options.steps = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--mask") && hasValue) {
+      mask = std::strtoull(argv[++i], nullptr, 16);
+    } else if (!std::strcmp(argv[i], "--replay")) {
+      replay = true;
+    } else {
+      PrintUsage();
+      return 2;
+    }
+  }
+
+  if (options.length == 0 || options.length > EasyNes::FUZZ_MAX_LENGTH) {
+    std::cerr << "The length is between 1 and " << EasyNes::FUZZ_MAX_LENGTH << std::endl;
+    return 2;
+  }
+
+  if (replay) {
+    EasyNes::FuzzFailure failure;
+
+    if (EasyNes::RunFuzzCase({options.seed, options.length, options.steps, mask}, failure)) {
+      std::cout << "The case passed" << std::endl;
+      return 0;
+    }
+    EasyNes::PrintFuzzFailure(std::cout, failure);
+    return 1;
+  }
+
+  EasyNes::FuzzReport report = EasyNes::Fuzz(options);
+
+  std::cout << report.cases << " cases, " << report.instructions << " instructions in " << report.seconds << " s, "
+            << report.instructions / report.seconds / 1e6 << " M instructions/s" << std::endl;
+
+  if (report.failed) {
+    EasyNes::PrintFuzzFailure(std::cout, report.failure);
+    return 1;
+  }
+  return 0;
+}
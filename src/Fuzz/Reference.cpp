@@ -0,0 +1,368 @@
+#include "Reference.hpp"
+
+namespace EasyNes {
+
+namespace {
+
+constexpr u8 FLAG_C = 0x01;
+constexpr u8 FLAG_Z = 0x02;
+constexpr u8 FLAG_I = 0x04;
+constexpr u8 FLAG_D = 0x08;
+constexpr u8 FLAG_B = 0x10;
+constexpr u8 FLAG_U = 0x20;
+constexpr u8 FLAG_V = 0x40;
+constexpr u8 FLAG_N = 0x80;
+
+}  // namespace
+
+bool ReferenceCPU::IsOfficial(u8 opcode) {
+  u8 aaa = opcode >> 5, bbb = (opcode >> 2) & 7;
+
+  switch (opcode & 3) {
+    case 0:
+      switch (bbb) {
+        case 0: return aaa != 4;                // BRK JSR RTI RTS, LDY CPY CPX immediate
+        case 1: return aaa == 1 || aaa >= 4;    // BIT STY LDY CPY CPX
+        case 3: return aaa >= 1;                // BIT JMP STY LDY CPY CPX
+        case 5: return aaa == 4 || aaa == 5;    // STY LDY
+        case 7: return aaa == 5;                // LDY
+        default: return true;                   // Branches, stack, flags and transfers
+      }
+    case 1:
+      return opcode != 0x89;                    // No STA immediate
+    case 2:
+      switch (bbb) {
+        case 0: return aaa == 5;                // LDX immediate
+        case 2: return true;                    // Accumulator shifts, TXA TAX DEX NOP
+        case 4: return false;
+        case 6: return aaa == 4 || aaa == 5;    // TXS TSX
+        case 7: return aaa != 4;                // No STX absolute,Y
+        default: return true;
+      }
+    default:
+      return false;
+  }
+}
+
+ReferenceCPU::Mode ReferenceCPU::Decode(u8 opcode) {
+  constexpr Mode GROUP_0[8] = {Mode::IMMEDIATE,  Mode::ZERO_PAGE, Mode::NONE,     Mode::ABSOLUTE,
+                               Mode::NONE,       Mode::ZERO_PAGE_X, Mode::NONE,   Mode::ABSOLUTE_X};
+  constexpr Mode GROUP_1[8] = {Mode::INDIRECT_X, Mode::ZERO_PAGE, Mode::IMMEDIATE, Mode::ABSOLUTE,
+                               Mode::INDIRECT_Y, Mode::ZERO_PAGE_X, Mode::ABSOLUTE_Y, Mode::ABSOLUTE_X};
+  constexpr Mode GROUP_2[8] = {Mode::IMMEDIATE,  Mode::ZERO_PAGE, Mode::ACCUMULATOR, Mode::ABSOLUTE,
+                               Mode::NONE,       Mode::ZERO_PAGE_X, Mode::NONE,     Mode::ABSOLUTE_X};
+
+  u8 aaa = opcode >> 5, bbb = (opcode >> 2) & 7;
+
+  switch (opcode & 3) {
+    case 0:
+      // Branches and the single byte opcodes
+      return bbb == 4 || bbb == 6 || bbb == 2 || (bbb == 0 && aaa < 4) ? Mode::NONE : GROUP_0[bbb];
+    case 1:
+      return GROUP_1[bbb];
+    default: {
+      if (bbb == 2 && aaa >= 4) {
+        return Mode::NONE;  // TXA TAX DEX NOP
+      }
+      Mode mode = GROUP_2[bbb];
+      // STX and LDX index with Y
+      if (aaa == 4 || aaa == 5) {
+        mode = mode == Mode::ZERO_PAGE_X ? Mode::ZERO_PAGE_Y : mode == Mode::ABSOLUTE_X ? Mode::ABSOLUTE_Y : mode;
+      }
+      return bbb == 6 ? Mode::NONE : mode;
+    }
+  }
+}
+
+u8 ReferenceCPU::GetSize(u8 opcode) {
+  if (opcode == 0x20 || opcode == 0x4C || opcode == 0x6C) {
+    return 3;
+  }
+  if ((opcode & 0x1F) == 0x10) {
+    return 2;
+  }
+
+  switch (Decode(opcode)) {
+    case Mode::NONE:
+    case Mode::ACCUMULATOR:
+      return 1;
+    case Mode::ABSOLUTE:
+    case Mode::ABSOLUTE_X:
+    case Mode::ABSOLUTE_Y:
+      return 3;
+    default:
+      return 2;
+  }
+}
+
+u8 ReferenceCPU::Fetch() { return memory[registers.pc++]; }
+
+u16 ReferenceCPU::FetchWord() {
+  u8 lo = Fetch();
+  return lo | Fetch() << 8;
+}
+
+void ReferenceCPU::Store(u16 address, u8 value) {
+  memory[address] = value;
+  m_Writes.push_back({address, value});
+}
+
+void ReferenceCPU::Push(u8 value) { Store(0x100 | registers.sp--, value); }
+
+u8 ReferenceCPU::Pull() { return memory[0x100 | ++registers.sp]; }
+
+void ReferenceCPU::SetFlag(u8 flag, bool set) { registers.p = set ? registers.p | flag : registers.p & ~flag; }
+
+void ReferenceCPU::SetNZ(u8 value) {
+  SetFlag(FLAG_Z, value == 0);
+  SetFlag(FLAG_N, value & 0x80);
+}
+
+void ReferenceCPU::Compare(u8 reg, u8 value) {
+  SetFlag(FLAG_C, reg >= value);
+  SetNZ(reg - value);
+}
+
+void ReferenceCPU::Add(u8 value) {
+  u16 sum = registers.a + value + (registers.p & FLAG_C);
+
+  SetFlag(FLAG_C, sum > 0xFF);
+  SetFlag(FLAG_V, ~(registers.a ^ value) & (registers.a ^ sum) & 0x80);
+  registers.a = sum;
+  SetNZ(registers.a);
+}
+
+u16 ReferenceCPU::Address(Mode mode, bool &crossed) {
+  ReferenceRegisters &r = registers;
+  u16                 base, address;
+
+  switch (mode) {
+    case Mode::IMMEDIATE:
+      return r.pc++;
+    case Mode::ZERO_PAGE:
+      return Fetch();
+    case Mode::ZERO_PAGE_X:
+      return u8(Fetch() + r.x);
+    case Mode::ZERO_PAGE_Y:
+      return u8(Fetch() + r.y);
+    case Mode::ABSOLUTE:
+      return FetchWord();
+    case Mode::ABSOLUTE_X:
+      base    = FetchWord();
+      address = base + r.x;
+      break;
+    case Mode::ABSOLUTE_Y:
+      base    = FetchWord();
+      address = base + r.y;
+      break;
+    case Mode::INDIRECT_X: {
+      u8 pointer = Fetch() + r.x;
+      return memory[pointer] | memory[u8(pointer + 1)] << 8;
+    }
+    case Mode::INDIRECT_Y: {
+      u8 pointer = Fetch();
+      base       = memory[pointer] | memory[u8(pointer + 1)] << 8;
+      address    = base + r.y;
+      break;
+    }
+    default:
+      return 0;
+  }
+
+  crossed = (base ^ address) & 0xFF00;
+  return address;
+}
+
+u32 ReferenceCPU::Step() {
+  ReferenceRegisters &r      = registers;
+  u8                  opcode = memory[r.pc];
+
+  if (!IsOfficial(opcode)) {
+    return 0;
+  }
+
+  m_Writes.clear();
+  r.pc++;
+
+  // The control flow, stack and single byte opcodes
+  switch (opcode) {
+    case 0x00: {
+      // The byte following BRK is skipped
+      u16 next = r.pc + 1;
+      Push(next >> 8);
+      Push(next);
+      Push(r.p | FLAG_B | FLAG_U);
+      r.p |= FLAG_I;
+      r.pc = memory[0xFFFE] | memory[0xFFFF] << 8;
+      return 7;
+    }
+    case 0x20: {
+      u16 target = FetchWord();
+      u16 last   = r.pc - 1;
+      Push(last >> 8);
+      Push(last);
+      r.pc = target;
+      return 6;
+    }
+    case 0x40: {
+      r.p    = (Pull() & ~FLAG_B) | FLAG_U;
+      u8 lo  = Pull();
+      r.pc   = lo | Pull() << 8;
+      return 6;
+    }
+    case 0x60: {
+      u8 lo = Pull();
+      r.pc  = (lo | Pull() << 8) + 1;
+      return 6;
+    }
+    case 0x4C:
+      r.pc = FetchWord();
+      return 3;
+    case 0x6C: {
+      // The pointer does not carry into its high byte
+      u16 pointer = FetchWord();
+      r.pc        = memory[pointer] | memory[(pointer & 0xFF00) | u8(pointer + 1)] << 8;
+      return 5;
+    }
+    case 0x08: Push(r.p | FLAG_B | FLAG_U); return 3;
+    case 0x28: r.p = (Pull() & ~FLAG_B) | FLAG_U; return 4;
+    case 0x48: Push(r.a); return 3;
+    case 0x68: r.a = Pull(); SetNZ(r.a); return 4;
+    case 0x18: SetFlag(FLAG_C, false); return 2;
+    case 0x38: SetFlag(FLAG_C, true); return 2;
+    case 0x58: SetFlag(FLAG_I, false); return 2;
+    case 0x78: SetFlag(FLAG_I, true); return 2;
+    case 0xB8: SetFlag(FLAG_V, false); return 2;
+    case 0xD8: SetFlag(FLAG_D, false); return 2;
+    case 0xF8: SetFlag(FLAG_D, true); return 2;
+    case 0x88: SetNZ(--r.y); return 2;
+    case 0xC8: SetNZ(++r.y); return 2;
+    case 0xCA: SetNZ(--r.x); return 2;
+    case 0xE8: SetNZ(++r.x); return 2;
+    case 0xA8: SetNZ(r.y = r.a); return 2;
+    case 0x98: SetNZ(r.a = r.y); return 2;
+    case 0xAA: SetNZ(r.x = r.a); return 2;
+    case 0x8A: SetNZ(r.a = r.x); return 2;
+    case 0xBA: SetNZ(r.x = r.sp); return 2;
+    case 0x9A: r.sp = r.x; return 2;
+    case 0xEA: return 2;
+  }
+
+  // Branches, bits 7-6 pick the flag and bit 5 the value taking the branch
+  if ((opcode & 0x1F) == 0x10) {
+    constexpr u8 FLAGS[4] = {FLAG_N, FLAG_V, FLAG_C, FLAG_Z};
+
+    s8 offset = Fetch();
+    if (bool(r.p & FLAGS[opcode >> 6]) != bool(opcode & 0x20)) {
+      return 2;
+    }
+
+    u16 target = r.pc + offset;
+    u32 cycles = (target ^ r.pc) & 0xFF00 ? 4 : 3;
+    r.pc       = target;
+    return cycles;
+  }
+
+  Mode mode    = Decode(opcode);
+  bool crossed = false;
+  u16  address = Address(mode, crossed);
+  u8   aaa     = opcode >> 5;
+
+  // Cycles of a read, the indexed reads take one more cycle to cross a page
+  u32 cycles;
+  switch (mode) {
+    case Mode::ACCUMULATOR:
+    case Mode::IMMEDIATE: cycles = 2; break;
+    case Mode::ZERO_PAGE: cycles = 3; break;
+    case Mode::INDIRECT_X: cycles = 6; break;
+    case Mode::INDIRECT_Y: cycles = 5; break;
+    default: cycles = 4; break;
+  }
+  bool indexed = mode == Mode::ABSOLUTE_X || mode == Mode::ABSOLUTE_Y || mode == Mode::INDIRECT_Y;
+
+  switch (opcode & 3) {
+    case 1: {
+      if (aaa == 4) {
+        // STA always spends the cycle of the page cross
+        Store(address, r.a);
+        return cycles + indexed;
+      }
+
+      u8 value = memory[address];
+      switch (aaa) {
+        case 0: SetNZ(r.a |= value); break;
+        case 1: SetNZ(r.a &= value); break;
+        case 2: SetNZ(r.a ^= value); break;
+        case 3: Add(value); break;
+        case 5: SetNZ(r.a = value); break;
+        case 6: Compare(r.a, value); break;
+        case 7: Add(~value); break;
+      }
+      return cycles + crossed;
+    }
+
+    case 2: {
+      if (aaa == 4) {
+        Store(address, r.x);
+        return cycles;
+      }
+      if (aaa == 5) {
+        SetNZ(r.x = memory[address]);
+        return cycles + crossed;
+      }
+
+      // Read-modify-write, on the accumulator or on memory
+      u8 value = mode == Mode::ACCUMULATOR ? r.a : memory[address];
+      switch (aaa) {
+        case 0:
+          SetFlag(FLAG_C, value & 0x80);
+          value <<= 1;
+          break;
+        case 1: {
+          bool carry = r.p & FLAG_C;
+          SetFlag(FLAG_C, value & 0x80);
+          value = value << 1 | carry;
+          break;
+        }
+        case 2:
+          SetFlag(FLAG_C, value & 0x01);
+          value >>= 1;
+          break;
+        case 3: {
+          bool carry = r.p & FLAG_C;
+          SetFlag(FLAG_C, value & 0x01);
+          value = value >> 1 | carry << 7;
+          break;
+        }
+        case 6: value--; break;
+        case 7: value++; break;
+      }
+      SetNZ(value);
+
+      if (mode == Mode::ACCUMULATOR) {
+        r.a = value;
+        return 2;
+      }
+      Store(address, value);
+      return cycles + 2 + indexed;
+    }
+
+    default: {
+      switch (aaa) {
+        case 1: {
+          u8 value = memory[address];
+          SetFlag(FLAG_Z, (r.a & value) == 0);
+          SetFlag(FLAG_V, value & 0x40);
+          SetFlag(FLAG_N, value & 0x80);
+          return cycles;
+        }
+        case 4: Store(address, r.y); return cycles;
+        case 5: SetNZ(r.y = memory[address]); return cycles + crossed;
+        case 6: Compare(r.y, memory[address]); return cycles;
+        default: Compare(r.x, memory[address]); return cycles;
+      }
+    }
+  }
+}
+
+}  // namespace EasyNes
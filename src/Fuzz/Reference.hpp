@@ -0,0 +1,89 @@
+#ifndef EASYNES_REFERENCE_HPP
+#define EASYNES_REFERENCE_HPP
+
+#include <array>
+#include <vector>
+
+#include <Types.hpp>
+
+namespace EasyNes {
+
+// Memory written by an instruction
+struct MemoryWrite {
+  u16 address;
+  u8  value;
+
+  bool operator==(const MemoryWrite &) const = default;
+};
+
+// Registers of the reference, the status always has the unused bit and never
+// the break bit
+struct ReferenceRegisters {
+  u16 pc = 0;
+  u8  sp = 0;
+  u8  a  = 0;
+  u8  x  = 0;
+  u8  y  = 0;
+  u8  p  = 0;
+
+  bool operator==(const ReferenceRegisters &) const = default;
+};
+
+// A 6502 written from the datasheet, apart from the CPU class: the opcodes are
+// decoded from their aaabbbcc bit groups instead of a table and the memory is
+// a plain array. Only the official opcodes are known, the decimal mode is
+// ignored like on the console
+class ReferenceCPU {
+ public:
+  ReferenceRegisters      registers;
+  std::array<u8, 0x10000> memory = {};
+
+  // Execute one instruction, returns its cycles or 0 when the opcode is not
+  // official, nothing is executed then
+  u32 Step();
+
+  // The writes of the last instruction, in order
+  inline const std::vector<MemoryWrite> &GetWrites() const { return m_Writes; }
+
+  static bool IsOfficial(u8 opcode);
+  // Bytes of the instruction, opcode included
+  static u8 GetSize(u8 opcode);
+
+ private:
+  std::vector<MemoryWrite> m_Writes;
+
+  u8   Fetch();
+  u16  FetchWord();
+  void Store(u16 address, u8 value);
+  void Push(u8 value);
+  u8   Pull();
+  void SetFlag(u8 flag, bool set);
+  void SetNZ(u8 value);
+  void Compare(u8 reg, u8 value);
+  // ADC, SBC adds the complement of its operand
+  void Add(u8 value);
+
+  enum class Mode : u8 {
+    NONE,
+    ACCUMULATOR,
+    IMMEDIATE,
+    ZERO_PAGE,
+    ZERO_PAGE_X,
+    ZERO_PAGE_Y,
+    ABSOLUTE,
+    ABSOLUTE_X,
+    ABSOLUTE_Y,
+    INDIRECT_X,
+    INDIRECT_Y,
+  };
+
+  // Mode of the opcodes decoded from their groups
+  static Mode Decode(u8 opcode);
+  // Fetch the operand and return the effective address, crossed is set when
+  // an indexed address reaches the next page
+  u16 Address(Mode mode, bool &crossed);
+};
+
+}  // namespace EasyNes
+
+#endif  // EASYNES_REFERENCE_HPP
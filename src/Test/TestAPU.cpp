@@ -0,0 +1,253 @@
+#include <Core.hpp>
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// NROM-128 image waiting in a loop with the interrupts on. The irq counts the
+// interrupts at $10 and stores the status of the apu, which acknowledges the
+// frame interrupt, at $11
+std::shared_ptr<const EasyNes::Rom> MakeApuRom() {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE + EasyNes::CHR_BANK_SIZE);
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+  image[5] = 1;
+
+  std::vector<EasyNes::u8> program = {
+      0x58,              // $8000 clear the interrupt disable
+      0x4C, 0x01, 0x80,  // $8001 goto 0x8001
+      0xE6, 0x10,        // $8004 irq: [0x10]++
+      0xAD, 0x15, 0x40,  // $8006 a = [0x4015]
+      0x85, 0x11,        // $8009 [0x11] = a
+      0x40,              // $800B return from the interrupt
+  };
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  std::copy(program.begin(), program.end(), prg);
+  prg[0x3FFA] = 0x0B, prg[0x3FFB] = 0x80;
+  prg[0x3FFC] = 0x00, prg[0x3FFD] = 0x80;
+  prg[0x3FFE] = 0x04, prg[0x3FFF] = 0x80;
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+// Cycles of a sequence of four steps
+constexpr EasyNes::u64 FRAME_SEQUENCE = 29830;
+
+}  // namespace
+
+TEST_CASE("APU registers", "[APU]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeApuRom()));
+  core.cpu.RST();
+  core.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+
+  SECTION("Length counters") {
+    core.bus.Write(EasyNes::APU_STATUS, 0x01);
+    core.bus.Write(0x4003, 0x18);
+    // The second pulse is disabled, its length is not loaded
+    core.bus.Write(0x4007, 0x18);
+    CHECK((core.bus.Read(EasyNes::APU_STATUS) & 0x1F) == 0x01);
+
+    // A length of 2 runs out after the two half frames of a sequence
+    core.RunCycles(FRAME_SEQUENCE);
+    CHECK((core.bus.Read(EasyNes::APU_STATUS) & 0x1F) == 0x00);
+
+    // Unless it is halted
+    core.bus.Write(0x4000, 0x20);
+    core.bus.Write(0x4003, 0x18);
+    core.RunCycles(FRAME_SEQUENCE);
+    CHECK((core.bus.Read(EasyNes::APU_STATUS) & 0x1F) == 0x01);
+  }
+
+  SECTION("Disable") {
+    core.bus.Write(EasyNes::APU_STATUS, 0x0F);
+    core.bus.Write(0x400B, 0xF8);
+    core.bus.Write(0x400F, 0xF8);
+    CHECK((core.bus.Read(EasyNes::APU_STATUS) & 0x1F) == 0x0C);
+
+    core.bus.Write(EasyNes::APU_STATUS, 0x00);
+    CHECK((core.bus.Read(EasyNes::APU_STATUS) & 0x1F) == 0x00);
+  }
+}
+
+TEST_CASE("APU interrupts", "[APU][Scheduler]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeApuRom()));
+  core.cpu.RST();
+
+  SECTION("Frame counter") {
+    core.RunCycles(10 * FRAME_SEQUENCE + 100);
+    CHECK(core.ram[0x10] == 10);
+    CHECK(core.ram[0x11] & 0x40);
+    // Acknowledged by the read of the irq
+    CHECK_FALSE(core.bus.Read(EasyNes::APU_STATUS) & 0x40);
+  }
+
+  SECTION("Masked by the reset") {
+    CHECK(core.cpu.GetRegisterStatus() & EasyNes::INTERRUPT_BIT);
+
+    // The loop without the clear never takes the interrupt
+    EasyNes::CPUState state = core.cpu.GetState();
+    state.pc                = 0x8001;
+    core.cpu.SetState(state);
+    core.RunCycles(3 * FRAME_SEQUENCE);
+    CHECK(core.ram[0x10] == 0);
+    CHECK(core.cpu.GetRegisterPC() == 0x8001);
+
+    // The line is still asserted when the mask is cleared
+    state    = core.cpu.GetState();
+    state.pc = 0x8000;
+    core.cpu.SetState(state);
+    core.RunInstructions(5);
+    CHECK(core.ram[0x10] == 1);
+    CHECK(core.ram[0x11] & 0x40);
+  }
+
+  SECTION("Inhibited") {
+    core.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+    core.RunCycles(10 * FRAME_SEQUENCE);
+    CHECK(core.ram[0x10] == 0);
+
+    // The sequence of five steps never interrupts
+    core.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x80);
+    core.RunCycles(10 * FRAME_SEQUENCE);
+    CHECK(core.ram[0x10] == 0);
+  }
+
+  SECTION("Samples") {
+    core.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+    // 17 bytes from $C000 at the fastest rate, 54 cycles per bit
+    core.bus.Write(0x4010, 0x8F);
+    core.bus.Write(0x4012, 0x00);
+    core.bus.Write(0x4013, 0x01);
+    core.bus.Write(EasyNes::APU_STATUS, 0x10);
+    CHECK(core.bus.Read(EasyNes::APU_STATUS) & 0x10);
+
+    core.RunCycles(17 * 8 * 54 + 100);
+    CHECK(core.ram[0x10] >= 1);
+    CHECK(core.ram[0x11] & 0x80);
+    CHECK_FALSE(core.bus.Read(EasyNes::APU_STATUS) & 0x10);
+
+    // The read of the handler does not acknowledge the sample channel, the
+    // line stays asserted and the handler runs again until the write
+    core.RunCycles(1000);
+    CHECK(core.ram[0x10] > 1);
+    core.RunUntil(0x8004);
+    core.bus.Write(EasyNes::APU_STATUS, 0x00);
+    EasyNes::u8 count = core.ram[0x10];
+    // Only the handler in progress completes
+    core.RunCycles(1000);
+    CHECK(core.ram[0x10] == count + 1);
+    CHECK_FALSE(core.bus.Read(EasyNes::APU_STATUS) & 0x80);
+  }
+
+  SECTION("Stalls") {
+    EasyNes::Core reference;
+    REQUIRE(reference.Insert(MakeApuRom()));
+    reference.cpu.RST();
+
+    for (EasyNes::Core *instance : {&core, &reference}) {
+      instance->bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+      instance->bus.Write(0x4010, 0x0F);
+      instance->bus.Write(0x4013, 0x01);
+    }
+    core.bus.Write(EasyNes::APU_STATUS, 0x10);
+
+    core.RunCycles(17 * 8 * 54 + 100);
+    reference.RunCycles(17 * 8 * 54 + 100);
+
+    // Each of the 17 reads took 4 cycles from the loop of 3 cycles
+    EasyNes::u64 lost = reference.cpu.GetElapsedInstructions() - core.cpu.GetElapsedInstructions();
+    CHECK(lost >= 17 * EasyNes::DMC_FETCH_CYCLES / 3 - 1);
+    CHECK(lost <= 17 * EasyNes::DMC_FETCH_CYCLES / 3 + 1);
+  }
+}
+
+TEST_CASE("APU output", "[APU]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeApuRom()));
+  core.cpu.RST();
+  core.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+  CHECK(core.apu.GetSamples() == nullptr);
+
+  // 440 Hz on the first pulse at half duty and full volume
+  auto play = [](EasyNes::Core &instance) {
+    instance.bus.Write(EasyNes::APU_STATUS, 0x01);
+    instance.bus.Write(0x4000, 0xBF);
+    instance.bus.Write(0x4002, 0xFD);
+    instance.bus.Write(0x4003, 0x00);
+  };
+
+  SECTION("Samples") {
+    core.apu.EnableOutput(true);
+    REQUIRE(core.apu.GetSamples() != nullptr);
+    play(core);
+
+    // The samples are handed out at the end of the frames
+    EasyNes::u64 start = core.cpu.GetElapsedCycles();
+    for (int frame = 0; frame < 8; frame++) {
+      core.RunFrame();
+    }
+    EasyNes::u64 cycles = core.cpu.GetElapsedCycles() - start;
+
+    std::vector<EasyNes::s16> samples(EasyNes::AUDIO_RING_SIZE);
+    EasyNes::u32              count = core.apu.GetSamples()->Read(samples.data(), samples.size());
+    EasyNes::u64              rate  = EasyNes::DEFAULT_SAMPLE_RATE;
+    CHECK(std::abs(static_cast<long>(count) - static_cast<long>(cycles * rate / EasyNes::CPU_CLOCK_RATE)) <= 1);
+    CHECK(core.apu.GetDroppedSamples() == 0);
+
+    // The square wave crosses zero twice per period once its offset is gone
+    EasyNes::u32 crossings = 0;
+    int          peak      = 0;
+    for (EasyNes::u32 i = count / 2; i + 1 < count; i++) {
+      crossings += (samples[i] < 0) != (samples[i + 1] < 0);
+      peak = std::max(peak, std::abs(static_cast<int>(samples[i])));
+    }
+    CHECK(crossings >= 50);
+    CHECK(crossings <= 60);
+    CHECK(peak > 1000);
+  }
+
+  SECTION("Same emulation") {
+    EasyNes::Core silent;
+    REQUIRE(silent.Insert(MakeApuRom()));
+    silent.cpu.RST();
+    silent.bus.Write(EasyNes::APU_FRAME_COUNTER, 0x40);
+
+    core.apu.EnableOutput(true);
+    play(core);
+    play(silent);
+
+    for (int frame = 0; frame < 30; frame++) {
+      core.RunFrame();
+      silent.RunFrame();
+      core.apu.GetSamples()->Read(std::vector<EasyNes::s16>(EasyNes::AUDIO_RING_SIZE).data(), EasyNes::AUDIO_RING_SIZE);
+    }
+    CHECK(core.SaveState() == silent.SaveState());
+  }
+}
+
+TEST_CASE("APU state", "[APU][State]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeApuRom()));
+  core.cpu.RST();
+  core.bus.Write(EasyNes::APU_STATUS, 0x1F);
+  core.bus.Write(0x4000, 0x9A);
+  core.bus.Write(0x4003, 0xF8);
+  core.bus.Write(0x400B, 0x08);
+  core.RunCycles(20000);
+
+  std::vector<EasyNes::u8> saved = core.SaveState();
+  core.RunCycles(50000);
+  REQUIRE(core.LoadState(saved));
+  CHECK(core.SaveState() == saved);
+
+  // The duty of the first pulse follows its envelope
+  std::vector<EasyNes::u8> apu = core.apu.SaveState();
+  std::vector<EasyNes::u8> bad = apu;
+  bad[6]                       = 4;
+  CHECK_FALSE(core.apu.LoadState(bad));
+  CHECK(core.apu.SaveState() == apu);
+}
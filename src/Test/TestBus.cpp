@@ -0,0 +1,141 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+
+TEST_CASE("Page table", "[Bus]") {
+  EasyNes::Bus bus;
+
+  SECTION("Mirroring") {
+    std::array<EasyNes::u8, 0x800> internal{};
+    // 2 KiB mirrored four times across 0x0000-0x1FFF
+    bus.MapMemory(0x00, 0x1F, internal.data(), internal.size());
+
+    bus.Write(0x0001, 0x42);
+    CHECK(bus.Read(0x0801) == 0x42);
+    CHECK(bus.Read(0x1801) == 0x42);
+
+    bus.Write(0x17FF, 0x24);
+    CHECK(internal[0x7FF] == 0x24);
+  }
+
+  SECTION("Read only memory") {
+    std::array<EasyNes::u8, 0x100> rom{};
+    rom[0x10] = 0x60;
+    bus.MapMemory(0x80, 0x80, rom.data(), rom.size(), false);
+
+    bus.Write(0x8010, 0xFF);
+    CHECK(bus.Read(0x8010) == 0x60);
+  }
+
+  SECTION("Handlers") {
+    struct Register {
+      EasyNes::u8 value  = 0;
+      int         reads  = 0;
+      int         writes = 0;
+    } reg;
+
+    auto read = [](void *context, EasyNes::u16 address) -> EasyNes::u8 {
+      auto *reg = static_cast<Register *>(context);
+      reg->reads++;
+      return reg->value + (address & 0x07);
+    };
+    auto write = [](void *context, EasyNes::u16, EasyNes::u8 value) {
+      auto *reg = static_cast<Register *>(context);
+      reg->writes++;
+      reg->value = value;
+    };
+    bus.MapHandlers(0x20, 0x3F, &reg, read, write);
+
+    bus.Write(0x2000, 0x10);
+    CHECK(bus.Read(0x2002) == 0x12);
+    CHECK(bus.Read(0x3FFA) == 0x12);
+    CHECK(reg.reads == 2);
+    CHECK(reg.writes == 1);
+
+    bus.Unmap(0x20, 0x3F);
+    bus.Write(0x2000, 0x00);
+    CHECK(reg.writes == 1);
+  }
+
+  SECTION("Handler slots") {
+    std::array<EasyNes::u8, EasyNes::HANDLER_SLOTS> contexts{};
+    auto write = [](void *context, EasyNes::u16, EasyNes::u8 value) { *static_cast<EasyNes::u8 *>(context) = value; };
+
+    // The slot 0 is kept for the pages without handlers
+    for (std::size_t i = 0; i < EasyNes::HANDLER_SLOTS - 1; i++) {
+      REQUIRE(bus.MapHandlers(0x40 + i, 0x40 + i, &contexts[i], nullptr, write));
+    }
+    // The same handlers share their slot
+    CHECK(bus.MapHandlers(0x60, 0x6F, &contexts[0], nullptr, write));
+
+    // The pages keep their handlers when there is no slot left
+    CHECK_FALSE(bus.MapHandlers(0x40, 0x40, &contexts.back(), nullptr, write));
+    bus.Write(0x4000, 0x11);
+    CHECK(contexts[0] == 0x11);
+    CHECK(contexts.back() == 0);
+
+    // Unmapped pages free their slot
+    bus.Unmap(0x41, 0x41);
+    CHECK(bus.MapHandlers(0x40, 0x40, &contexts.back(), nullptr, write));
+    bus.Write(0x4000, 0x22);
+    CHECK(contexts.back() == 0x22);
+  }
+
+  SECTION("Trap slots") {
+    std::array<EasyNes::u8, 0x100> memory{};
+    std::array<int, EasyNes::TRAP_SLOTS> writes{};
+    auto trap = [](void *context, EasyNes::u16, EasyNes::u8) { (*static_cast<int *>(context))++; };
+    bus.MapMemory(0x00, 0x00, memory.data(), memory.size());
+
+    for (std::size_t i = 0; i < EasyNes::TRAP_SLOTS; i++) {
+      EasyNes::u8 slot = bus.AddWriteTrap(&writes[i], trap);
+      REQUIRE(slot == i);
+      bus.TrapWrites(slot, 0x00);
+    }
+
+    // The slot past the last one traps nothing
+    int ignored = 0;
+    CHECK(bus.AddWriteTrap(&ignored, trap) == EasyNes::NO_TRAP_SLOT);
+    bus.TrapWrites(EasyNes::NO_TRAP_SLOT, 0x00);
+    bus.RemoveTrap(EasyNes::NO_TRAP_SLOT);
+    bus.Write(0x0010, 0x42);
+    CHECK(memory[0x10] == 0x42);
+    CHECK(writes.back() == 1);
+    CHECK(ignored == 0);
+
+    // Removed traps free their slot
+    bus.RemoveTrap(3);
+    CHECK(bus.AddWriteTrap(&ignored, trap) == 3);
+  }
+}
+
+TEST_CASE("Memory mapped register", "[Bus][CPU]") {
+  EasyNes::Core core;
+
+  constexpr std::array<EasyNes::u8, 8> program{
+      0xAD, 0x02, 0x20,  // A = ram[0x2002]
+      0x8D, 0x00, 0x20,  // ram[0x2000] = A
+      0xE8,              // X++
+      0x00,              // END
+  };
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.ram[0x8000 + i] = program[i];
+  }
+
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  EasyNes::u8 written = 0;
+  core.bus.MapHandlers(
+      0x20, 0x20, &written, [](void *, EasyNes::u16) -> EasyNes::u8 { return 0x80; },
+      [](void *context, EasyNes::u16, EasyNes::u8 value) { *static_cast<EasyNes::u8 *>(context) = value; });
+
+  core.cpu.RST();
+  core.RunInstructions(2);
+
+  CHECK(core.cpu.GetRegisterA() == 0x80);
+  CHECK(core.cpu.GetRegisterStatus() & EasyNes::NEGATIVE_BIT);
+  CHECK(written == 0x80);
+  // The register is not backed by the ram
+  CHECK(core.ram[0x2000] == 0x00);
+}
@@ -1,5 +1,8 @@
 #include <Core.hpp>
+#include <Instructions.hpp>
 #include <catch2/catch.hpp>
+#include <random>
+#include <vector>
 
 TEST_CASE("Tiny program", "[CPU]") {
   EasyNes::Core core;
@@ -44,3 +47,307 @@ TEST_CASE("Tiny program", "[CPU]") {
   EXECUTE_INS();
   CHECK(core.cpu.GetRegisterY() == 0x13);
 }
+
+TEST_CASE("Subroutine and loop", "[CPU]") {
+  EasyNes::Core core;
+
+  constexpr std::array<EasyNes::u8, 11> program{
+      0xA2, 0x05,        // X = 0x05
+      0x20, 0x09, 0x80,  // call 0x8009
+      0xCA,              // X--
+      0xD0, 0xFA,        // if X != 0 goto 0x8002
+      0x00,              // END
+      0xC8,              // 0x8009: Y++
+      0x60,              // return
+  };
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.ram[0x8000 + i] = program[i];
+  }
+
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  core.cpu.RST();
+  core.RunUntil(0x8008, 1000);
+
+  CHECK(core.cpu.GetRegisterPC() == 0x8008);
+  CHECK(core.cpu.GetRegisterX() == 0x00);
+  CHECK(core.cpu.GetRegisterY() == 0x05);
+  CHECK(core.cpu.GetRegisterSP() == 0xFD);
+}
+
+namespace {
+
+// Zero and negative flags as the operations set them, from the registers
+// before the instruction, all equal to value
+struct FlagCase {
+  EasyNes::u8 opcode;
+  bool (*zero)(EasyNes::u8 value, EasyNes::u8 operand, bool carry, bool zero);
+  EasyNes::u8 (*negative)(EasyNes::u8 value, EasyNes::u8 operand, bool carry);
+};
+
+// clang-format off
+const std::vector<FlagCase> FLAG_CASES = {
+    {0x69, [](auto v, auto o, bool c, bool) { return EasyNes::u8(v + o + c) == 0; }, [](auto v, auto o, bool c) -> EasyNes::u8 { return v + o + c; }},
+    {0xE9, [](auto v, auto o, bool c, bool) { return EasyNes::u8(v - o - !c) == 0; }, [](auto v, auto o, bool c) -> EasyNes::u8 { return v - o - !c; }},
+    {0x2A, [](auto v, auto, bool c, bool) { return EasyNes::u8(v << 1 | c) == 0; }, [](auto v, auto, bool c) -> EasyNes::u8 { return v << 1 | c; }},
+    {0x29, [](auto v, auto o, bool, bool) { return (v & o) == 0; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v & o; }},
+    {0x09, [](auto v, auto o, bool, bool) { return (v | o) == 0; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v | o; }},
+    {0x49, [](auto v, auto o, bool, bool) { return (v ^ o) == 0; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v ^ o; }},
+    {0xC9, [](auto v, auto o, bool, bool) { return v == o; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v - o; }},
+    {0xE0, [](auto v, auto o, bool, bool) { return v == o; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v - o; }},
+    {0xC0, [](auto v, auto o, bool, bool) { return v == o; }, [](auto v, auto o, bool) -> EasyNes::u8 { return v - o; }},
+    {0xA9, [](auto, auto o, bool, bool) { return o == 0; }, [](auto, auto o, bool) { return o; }},
+    {0xA2, [](auto, auto o, bool, bool) { return o == 0; }, [](auto, auto o, bool) { return o; }},
+    {0xA0, [](auto, auto o, bool, bool) { return o == 0; }, [](auto, auto o, bool) { return o; }},
+    {0x0A, [](auto v, auto, bool, bool) { return EasyNes::u8(v << 1) == 0; }, [](auto v, auto, bool) -> EasyNes::u8 { return v << 1; }},
+    {0x6A, [](auto v, auto, bool c, bool) { return (v >> 1 | c << 7) == 0; }, [](auto v, auto, bool c) -> EasyNes::u8 { return v >> 1 | c << 7; }},
+    {0x4A, [](auto v, auto, bool, bool) { return v >> 1 == 0; }, [](auto v, auto, bool) -> EasyNes::u8 { return v >> 1; }},
+    // The negative flag of BIT is bit 7 of the operand
+    {0x24, [](auto v, auto o, bool, bool) { return (v & o) == 0; }, [](auto, auto o, bool) { return o; }},
+    {0xE8, [](auto v, auto, bool, bool) { return v == 0xFF; }, [](auto v, auto, bool) -> EasyNes::u8 { return v + 1; }},
+    {0xC8, [](auto v, auto, bool, bool) { return v == 0xFF; }, [](auto v, auto, bool) -> EasyNes::u8 { return v + 1; }},
+    {0xCA, [](auto v, auto, bool, bool) { return v == 0x01; }, [](auto v, auto, bool) -> EasyNes::u8 { return v - 1; }},
+    {0x88, [](auto v, auto, bool, bool) { return v == 0x01; }, [](auto v, auto, bool) -> EasyNes::u8 { return v - 1; }},
+    {0xAA, [](auto v, auto, bool, bool) { return v == 0; }, [](auto v, auto, bool) { return v; }},
+    {0xA8, [](auto v, auto, bool, bool) { return v == 0; }, [](auto v, auto, bool) { return v; }},
+    {0x8A, [](auto v, auto, bool, bool) { return v == 0; }, [](auto v, auto, bool) { return v; }},
+    {0x98, [](auto v, auto, bool, bool) { return v == 0; }, [](auto v, auto, bool) { return v; }},
+    {0xBA, [](auto v, auto, bool, bool) { return v == 0; }, [](auto v, auto, bool) { return v; }},
+};
+// clang-format on
+
+}  // namespace
+
+TEST_CASE("Lazy flags match the eager status", "[CPU]") {
+  EasyNes::Core core;
+
+  // The instruction is followed by a PHP and by branches to the next
+  // instruction, a taken branch takes one more cycle
+  constexpr std::array<EasyNes::u8, 9> readers{0x08, 0xF0, 0x00, 0xD0, 0x00, 0x10, 0x00, 0x30, 0x00};
+
+  // Every place reading the status sees the same flags
+  auto check = [&](EasyNes::u8 status) {
+    EasyNes::CPUState state = core.cpu.GetState();
+    REQUIRE(core.cpu.GetRegisterStatus() == status);
+    REQUIRE(state.status == status);
+
+    core.cpu.Execute();
+    REQUIRE(core.ram[EasyNes::STACK_BASE + state.sp] == (status | EasyNes::BREAK_BITS));
+
+    bool zero     = status & EasyNes::ZERO_BIT;
+    bool negative = status & EasyNes::NEGATIVE_BIT;
+    REQUIRE((core.cpu.Execute() == 3) == zero);
+    REQUIRE((core.cpu.Execute() == 3) == !zero);
+    REQUIRE((core.cpu.Execute() == 3) == !negative);
+    REQUIRE((core.cpu.Execute() == 3) == negative);
+  };
+
+  SECTION("Operations") {
+    for (const FlagCase &flagCase : FLAG_CASES) {
+      EasyNes::u8 size = 1 + EasyNes::OPERAND_SIZES[flagCase.opcode];
+
+      core.ram[0x8000] = flagCase.opcode;
+      std::copy(readers.begin(), readers.end(), &core.ram[0x8000 + size]);
+
+      for (int value = 0; value <= 0xFF; value++) {
+        for (int operand = 0; operand <= 0xFF; operand++) {
+          for (EasyNes::u8 before : {0x20, 0xE3}) {
+            // The operand of BIT is read from the zero page
+            if (size == 2) {
+              core.ram[0x8001] = flagCase.opcode == 0x24 ? 0x10 : operand;
+            }
+            core.ram[0x10] = operand;
+
+            core.cpu.SetState({0x8000, EasyNes::u8(value), EasyNes::u8(value), EasyNes::u8(value), EasyNes::u8(value),
+                               before, 0, 0, 0});
+            core.cpu.Execute();
+
+            bool        carry    = before & EasyNes::CARRY_BIT;
+            bool        zero     = flagCase.zero(value, operand, carry, before & EasyNes::ZERO_BIT);
+            EasyNes::u8 negative = flagCase.negative(value, operand, carry) & EasyNes::NEGATIVE_BIT;
+
+            // The other flags are still built eagerly
+            EasyNes::u8 status = core.cpu.GetRegisterStatus();
+            REQUIRE((status & EasyNes::ZERO_BIT) == (zero ? EasyNes::ZERO_BIT : 0));
+            REQUIRE((status & EasyNes::NEGATIVE_BIT) == negative);
+            check(status);
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Pulled status") {
+    // PLP then the readers
+    core.ram[0x8000] = 0x28;
+    std::copy(readers.begin(), readers.end(), &core.ram[0x8001]);
+
+    for (int status = 0; status <= 0xFF; status++) {
+      core.ram[EasyNes::STACK_BASE + 0xFE] = status;
+      core.cpu.SetState({0x8000, 0xFD, 0, 0, 0, EasyNes::u8(~status), 0, 0, 0});
+      core.cpu.Execute();
+      // The break bit only exists on the stack
+      check((status & ~EasyNes::BREAK_BIT) | EasyNes::UNUSED_BIT);
+    }
+  }
+}
+
+namespace {
+
+// An access of the cpu to the recorded pages, the cycle is counted from the
+// start of the instruction
+struct BusAccess {
+  EasyNes::u16 address;
+  EasyNes::u8  value;
+  EasyNes::u64 cycle;
+  bool         write;
+
+  bool operator==(const BusAccess &) const = default;
+};
+
+struct BusRecorder {
+  EasyNes::Core         *core  = nullptr;
+  EasyNes::u64           start = 0;
+  std::vector<BusAccess> accesses{};
+
+  static EasyNes::u8 OnRead(void *context, EasyNes::u16 address) {
+    auto *recorder = static_cast<BusRecorder *>(context);
+    // The registers read the low byte of their address
+    EasyNes::u8 value = address;
+    recorder->accesses.push_back({address, value, recorder->core->cpu.GetElapsedCycles() - recorder->start, false});
+    return value;
+  }
+
+  static void OnWrite(void *context, EasyNes::u16 address, EasyNes::u8 value) {
+    auto *recorder = static_cast<BusRecorder *>(context);
+    recorder->accesses.push_back({address, value, recorder->core->cpu.GetElapsedCycles() - recorder->start, true});
+  }
+};
+
+struct CycleCase {
+  std::vector<EasyNes::u8> program;
+  std::vector<BusAccess>   cycles;
+  std::vector<BusAccess>   instructions;
+  EasyNes::u16             pc = 0x8000;
+};
+
+// X and Y are 0x20, the pages $20 and $21 are recorded along with the stack,
+// the pointer at $10 reaches $20F0 and the one at $30 reaches $2003
+const std::vector<CycleCase> CYCLE_CASES = {
+    // A = [0x2002]
+    {{0xAD, 0x02, 0x20}, {{0x2002, 0x02, 3, false}}, {{0x2002, 0x02, 0, false}}},
+    // A = [0x2000 + X], on the same page
+    {{0xBD, 0x00, 0x20}, {{0x2020, 0x20, 3, false}}, {{0x2020, 0x20, 0, false}}},
+    // A = [0x20F0 + X], the address before the carry is read first
+    {{0xBD, 0xF0, 0x20}, {{0x2010, 0x10, 3, false}, {0x2110, 0x10, 4, false}}, {{0x2110, 0x10, 0, false}}},
+    // [0x2000 + X] = A, the stores always read before the carry
+    {{0x9D, 0x00, 0x20}, {{0x2020, 0x20, 3, false}, {0x2020, 0x00, 4, true}}, {{0x2020, 0x00, 0, true}}},
+    // [0x2005]++, the unmodified value is written first
+    {{0xEE, 0x05, 0x20},
+     {{0x2005, 0x05, 3, false}, {0x2005, 0x05, 4, true}, {0x2005, 0x06, 5, true}},
+     {{0x2005, 0x05, 0, false}, {0x2005, 0x06, 0, true}}},
+    // [0x20F0 + X] <<= 1
+    {{0x1E, 0xF0, 0x20},
+     {{0x2010, 0x10, 3, false}, {0x2110, 0x10, 4, false}, {0x2110, 0x10, 5, true}, {0x2110, 0x20, 6, true}},
+     {{0x2110, 0x10, 0, false}, {0x2110, 0x20, 0, true}}},
+    // A = [[0x10] + Y]
+    {{0xB1, 0x10}, {{0x2010, 0x10, 4, false}, {0x2110, 0x10, 5, false}}, {{0x2110, 0x10, 0, false}}},
+    // [[0x10 + X]] = A
+    {{0x81, 0x10}, {{0x2003, 0x00, 5, true}}, {{0x2003, 0x00, 0, true}}},
+    // goto [0x20F0]
+    {{0x6C, 0xF0, 0x20}, {{0x20F0, 0xF0, 3, false}, {0x20F1, 0xF1, 4, false}},
+     {{0x20F0, 0xF0, 0, false}, {0x20F1, 0xF1, 0, false}}},
+    // goto [0x20FF], the high byte wraps around the page of the pointer
+    {{0x6C, 0xFF, 0x20}, {{0x20FF, 0xFF, 3, false}, {0x2000, 0x00, 4, false}},
+     {{0x20FF, 0xFF, 0, false}, {0x2000, 0x00, 0, false}}},
+    // call 0x2221, run from the recorded page which reads back its own low
+    // bytes. The return address is pushed before the high byte is read
+    {{},
+     {{0x2020, 0x20, 0, false},
+      {0x2021, 0x21, 1, false},
+      {0x01FD, 0xFD, 2, false},
+      {0x01FD, 0x20, 3, true},
+      {0x01FC, 0x22, 4, true},
+      {0x2022, 0x22, 5, false}},
+     {{0x2020, 0x20, 0, false}, {0x2021, 0x21, 0, false}, {0x2022, 0x22, 0, false}, {0x01FD, 0x20, 0, true},
+      {0x01FC, 0x22, 0, true}},
+     0x2020},
+};
+
+// Programs of random bytes, the opcodes missing from the instruction set do
+// nothing on both policies
+void FillRandom(EasyNes::Core &core, std::mt19937 &random) {
+  for (std::size_t address = 0; address < core.ram.GetSize(); address++) {
+    core.ram[address] = random();
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Cycle accuracy", "[CPU]") {
+  EasyNes::Core core;
+  BusRecorder   recorder = {&core};
+  core.bus.MapHandlers(0x20, 0x21, &recorder, &BusRecorder::OnRead, &BusRecorder::OnWrite);
+  core.bus.MapHandlers(0x01, 0x01, &recorder, &BusRecorder::OnRead, &BusRecorder::OnWrite);
+
+  core.ram[0x10] = 0xF0, core.ram[0x11] = 0x20;
+  core.ram[0x30] = 0x03, core.ram[0x31] = 0x20;
+
+  for (const CycleCase &cycleCase : CYCLE_CASES) {
+    std::copy(cycleCase.program.begin(), cycleCase.program.end(), &core.ram[0x8000]);
+
+    auto execute = [&](auto accuracy) {
+      core.cpu.SetState({cycleCase.pc, 0xFD, 0x00, 0x20, 0x20, 0x20, 0, 0, 0});
+      recorder.start = core.cpu.GetElapsedCycles();
+      recorder.accesses.clear();
+
+      EasyNes::u32 cycles = core.cpu.Execute<decltype(accuracy)>();
+      CHECK(core.cpu.GetElapsedCycles() == cycles);
+      return cycles;
+    };
+
+    EasyNes::u32 cycles = execute(EasyNes::CycleAccuracy{});
+    CHECK(recorder.accesses == cycleCase.cycles);
+    // Each access is on its own cycle, the last one on the last cycle
+    CHECK(recorder.accesses.back().cycle == cycles - 1);
+
+    CHECK(execute(EasyNes::InstructionAccuracy{}) == cycles);
+    CHECK(recorder.accesses == cycleCase.instructions);
+  }
+}
+
+TEST_CASE("Both accuracies execute the same", "[CPU]") {
+  EasyNes::Core instruction;
+  EasyNes::Core cycle;
+
+  for (unsigned seed = 0; seed < 200; seed++) {
+    std::mt19937 random(seed);
+    FillRandom(instruction, random);
+    std::copy(instruction.ram.Data(), instruction.ram.Data() + instruction.ram.GetSize(), cycle.ram.Data());
+
+    EasyNes::CPUState start = {EasyNes::u16(random()), EasyNes::u8(random()), EasyNes::u8(random()),
+                               EasyNes::u8(random()), EasyNes::u8(random()), EasyNes::u8(random() | 0x20),
+                               0, 0, 0};
+    instruction.cpu.SetState(start);
+    cycle.cpu.SetState(start);
+
+    for (int i = 0; i < 256; i++) {
+      REQUIRE(instruction.cpu.Execute<EasyNes::InstructionAccuracy>() ==
+              cycle.cpu.Execute<EasyNes::CycleAccuracy>());
+
+      EasyNes::CPUState expected = instruction.cpu.GetState();
+      EasyNes::CPUState state    = cycle.cpu.GetState();
+      REQUIRE(state.pc == expected.pc);
+      REQUIRE(state.a == expected.a);
+      REQUIRE(state.x == expected.x);
+      REQUIRE(state.y == expected.y);
+      REQUIRE(state.sp == expected.sp);
+      REQUIRE(state.status == expected.status);
+      REQUIRE(state.elapsedCycles == expected.elapsedCycles);
+    }
+
+    REQUIRE(std::equal(instruction.ram.Data(), instruction.ram.Data() + instruction.ram.GetSize(), cycle.ram.Data()));
+  }
+}
@@ -0,0 +1,84 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+
+TEST_CASE("Batched execution", "[Core]") {
+  EasyNes::Core core;
+
+  constexpr std::array<EasyNes::u8, 16> program{
+      0xA9, 0x10,  // A = 0x10                 2 cycles
+      0x85, 0x20,  // ram[0x20] = A            3 cycles
+      0xA9, 0x01,  // A = 0x1                  2 cycles
+      0x65, 0x20,  // A += ram[0x20]           3 cycles
+      0x85, 0x21,  // ram[0x21] = A            3 cycles
+      0xE6, 0x21,  // ram[0x21]++              5 cycles
+      0xA4, 0x21,  // Y = ram[0x21]            3 cycles
+      0xC8,        // Y++                      2 cycles
+      0x00,        // END
+  };
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.ram[0x8000 + i] = program[i];
+  }
+
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  core.cpu.RST();
+
+  SECTION("Instructions") {
+    // The 8 reset cycles are paid with the first instruction
+    CHECK(core.RunInstructions(1) == 8 + 2);
+    CHECK(core.cpu.GetRegisterA() == 0x10);
+
+    CHECK(core.RunInstructions(5) == 3 + 2 + 3 + 3 + 5);
+    CHECK(core.ram[0x21] == 0x12);
+    CHECK(core.cpu.GetElapsedInstructions() == 6);
+    CHECK(core.cpu.GetElapsedCycles() == 8 + 18);
+  }
+
+  SECTION("Until") {
+    CHECK(core.RunUntil(0x800C) == 8 + 2 + 3 + 2 + 3 + 3 + 5);
+    CHECK(core.cpu.GetRegisterPC() == 0x800C);
+
+    // The budget stops the run before the address is reached
+    CHECK(core.RunUntil(0x800F, 1) == 3);
+    CHECK(core.cpu.GetRegisterY() == 0x12);
+
+    auto yIsOdd = [](const EasyNes::CPU &cpu) { return cpu.GetRegisterY() & 1; };
+    CHECK(core.RunUntil(yIsOdd) == 2);
+    CHECK(core.cpu.GetRegisterY() == 0x13);
+  }
+
+  SECTION("Cycles") {
+    // Whole instructions are executed, the last one overshoots the budget
+    CHECK(core.RunCycles(11) == 8 + 2 + 3);
+    CHECK(core.ram[0x20] == 0x10);
+
+    CHECK(core.RunCycles(0) == 0);
+    CHECK(core.cpu.GetElapsedInstructions() == 2);
+  }
+
+  SECTION("Same timing as stepping") {
+    EasyNes::Core stepped;
+    for (std::size_t i = 0; i < program.size(); i++) {
+      stepped.ram[0x8000 + i] = program[i];
+    }
+    stepped.ram[0xFFFC] = 0x00;
+    stepped.ram[0xFFFD] = 0x80;
+    stepped.cpu.RST();
+
+    EasyNes::u64 steps = 0;
+    while (stepped.cpu.GetElapsedInstructions() < 8) {
+      stepped.cpu.Step();
+      steps++;
+    }
+    // Run the last clocks of the final instruction
+    while (!stepped.cpu.IsCompleted()) {
+      stepped.cpu.Step();
+      steps++;
+    }
+
+    CHECK(core.RunInstructions(8) == steps);
+    CHECK(core.cpu.GetRegisterY() == stepped.cpu.GetRegisterY());
+  }
+}
@@ -0,0 +1,213 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <vector>
+
+namespace {
+
+// Counts in x around a subroutine calling another one, which reads the count
+// back from memory
+const std::vector<EasyNes::u8> PROGRAM = {
+    0xA2, 0x00,        // $C000 x = 0
+    0x20, 0x10, 0xC0,  // $C002 call 0xC010
+    0xE8,              // $C005 x++
+    0x8E, 0x00, 0x03,  // $C006 [0x0300] = x
+    0x4C, 0x02, 0xC0,  // $C009 goto 0xC002
+};
+
+const std::vector<EasyNes::u8> SUBROUTINES = {
+    0xA9, 0x05,        // $C010 a = 5
+    0x20, 0x20, 0xC0,  // $C012 call 0xC020
+    0x60,              // $C015 return
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xAD, 0x00, 0x03,  // $C020 a = [0x0300]
+    0x60,              // $C023 return
+};
+
+void Load(EasyNes::Core &core) {
+  std::copy(PROGRAM.begin(), PROGRAM.end(), &core.ram[0xC000]);
+  std::copy(SUBROUTINES.begin(), SUBROUTINES.end(), &core.ram[0xC010]);
+  core.ram[EasyNes::RST_VECTOR]     = 0x00;
+  core.ram[EasyNes::RST_VECTOR + 1] = 0xC0;
+  core.cpu.RST();
+  core.EnableDebugger(true);
+}
+
+}  // namespace
+
+TEST_CASE("Breakpoints stop in front of their instruction", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  core.RunInstructions(10);
+
+  EasyNes::Debugger &debugger = *core.debugger;
+  EasyNes::u32       id       = debugger.AddBreakpoint(0xC005);
+  REQUIRE(id != 0);
+
+  for (EasyNes::u8 count = 1; count <= 3; count++) {
+    EasyNes::DebugEvent event = debugger.Run(EasyNes::UNLIMITED_CYCLES);
+    REQUIRE(event.reason == EasyNes::DebugReason::BREAKPOINT);
+    REQUIRE(event.id == id);
+    REQUIRE(event.address == 0xC005);
+    REQUIRE(core.cpu.GetRegisterPC() == 0xC005);
+    // The instruction at the breakpoint is not executed yet
+    REQUIRE(core.cpu.GetRegisterX() == count);
+    REQUIRE(core.ram[0x0300] == count);
+  }
+
+  // The budget ends the run once the breakpoint is gone
+  debugger.Remove(id);
+  REQUIRE(debugger.Run(1000).reason == EasyNes::DebugReason::NONE);
+}
+
+TEST_CASE("Breakpoints only stop when their condition holds", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+
+  EasyNes::Debugger &debugger = *core.debugger;
+  debugger.AddBreakpoint(0xC005, [](const EasyNes::Core &core) { return core.cpu.GetRegisterX() == 7; });
+
+  REQUIRE(debugger.Run(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::BREAKPOINT);
+  REQUIRE(core.cpu.GetRegisterX() == 7);
+  REQUIRE(core.ram[0x0300] == 7);
+
+  // The other runs of the core go through the breakpoints
+  EasyNes::u64 instructions = core.cpu.GetElapsedInstructions();
+  core.RunCycles(10000);
+  REQUIRE(core.cpu.GetElapsedInstructions() - instructions > 1000);
+}
+
+TEST_CASE("Watchpoints stop after the access", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  EasyNes::Debugger &debugger = *core.debugger;
+
+  EasyNes::u32        write = debugger.AddWatchpoint(0x0300, 0x0300, false, true);
+  EasyNes::DebugEvent event = debugger.Run(EasyNes::UNLIMITED_CYCLES);
+  REQUIRE(event.reason == EasyNes::DebugReason::WRITE);
+  REQUIRE(event.id == write);
+  REQUIRE(event.address == 0x0300);
+  REQUIRE(event.value == 1);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC009);
+  debugger.Remove(write);
+
+  EasyNes::u32 read = debugger.AddWatchpoint(0x02F0, 0x0310, true, false);
+  event             = debugger.Run(EasyNes::UNLIMITED_CYCLES);
+  REQUIRE(event.reason == EasyNes::DebugReason::READ);
+  REQUIRE(event.id == read);
+  REQUIRE(event.address == 0x0300);
+  REQUIRE(event.value == 1);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC023);
+  REQUIRE(core.cpu.GetRegisterA() == 1);
+}
+
+TEST_CASE("Callbacks see the hits and may keep the run going", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  EasyNes::Debugger &debugger = *core.debugger;
+
+  std::vector<EasyNes::u8> written;
+  debugger.AddWatchpoint(0x0300, 0x0300, false, true);
+  debugger.SetCallback([&](const EasyNes::DebugEvent &event) {
+    written.push_back(event.value);
+    return written.size() == 5;
+  });
+
+  REQUIRE(debugger.Run(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::WRITE);
+  REQUIRE(written == std::vector<EasyNes::u8>{1, 2, 3, 4, 5});
+}
+
+TEST_CASE("Steps follow the subroutines", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  EasyNes::Debugger &debugger = *core.debugger;
+  core.RunUntil(0xC002);
+
+  // Over the call and its nested call
+  EasyNes::DebugEvent event = debugger.StepOver(EasyNes::UNLIMITED_CYCLES);
+  REQUIRE(event.reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC005);
+  REQUIRE(debugger.StepOver(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC006);
+
+  // Into the call, then out of the nested one and of the first one
+  core.RunUntil(0xC002);
+  REQUIRE(debugger.Step().reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC010);
+  core.RunUntil(0xC020);
+  REQUIRE(debugger.StepOut(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC015);
+  REQUIRE(debugger.StepOut(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC005);
+
+  // A breakpoint in the subroutine ends the step first
+  core.RunUntil(0xC002);
+  EasyNes::u32 id = debugger.AddBreakpoint(0xC020);
+  event           = debugger.StepOver(EasyNes::UNLIMITED_CYCLES);
+  REQUIRE(event.reason == EasyNes::DebugReason::BREAKPOINT);
+  REQUIRE(event.id == id);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC020);
+}
+
+TEST_CASE("Steps out past the values pushed by the subroutine", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  EasyNes::Debugger &debugger = *core.debugger;
+
+  const std::vector<EasyNes::u8> program = {
+      0x20, 0x40, 0xC0,  // $C030 call 0xC040
+      0xE8,              // $C033 x++
+      0x4C, 0x30, 0xC0,  // $C034 goto 0xC030
+  };
+  const std::vector<EasyNes::u8> subroutine = {
+      0x48,  // $C040 push a
+      0x08,  // $C041 push the status
+      0xEA,  // $C042 nop
+      0x28,  // $C043 pull the status
+      0x68,  // $C044 pull a
+      0x60,  // $C045 return
+  };
+  std::copy(program.begin(), program.end(), &core.ram[0xC030]);
+  std::copy(subroutine.begin(), subroutine.end(), &core.ram[0xC040]);
+  core.ram[EasyNes::RST_VECTOR] = 0x30;
+  core.cpu.RST();
+
+  // The top of the stack holds the pushed values, not the return address
+  core.RunUntil(0xC042);
+  REQUIRE(debugger.StepOut(EasyNes::UNLIMITED_CYCLES).reason == EasyNes::DebugReason::STEP);
+  REQUIRE(core.cpu.GetRegisterPC() == 0xC033);
+  REQUIRE(core.cpu.GetRegisterSP() == 0xFD);
+}
+
+TEST_CASE("Only the pages of the debugger leave the fast path", "[Debugger]") {
+  EasyNes::Core core;
+  Load(core);
+  EasyNes::Debugger &debugger = *core.debugger;
+  const EasyNes::Bus &bus     = core.bus;
+
+  // A breakpoint only traps the fetches, they share the table of the reads
+  EasyNes::u32 breakpoint = debugger.AddBreakpoint(0xC005);
+  REQUIRE(bus.IsFetchTrapped(0xC0));
+  REQUIRE_FALSE(bus.IsFetchTrapped(0xC1));
+  REQUIRE(bus.GetReadTable()[0xC0] == nullptr);
+  REQUIRE(bus.GetReadTable()[0xC1] != nullptr);
+  REQUIRE(bus.GetWriteTable()[0xC0] != nullptr);
+
+  EasyNes::u32 watchpoint = debugger.AddWatchpoint(0x0300, 0x04FF, true, false);
+  for (EasyNes::u16 page = 0; page < EasyNes::PAGE_COUNT; page++) {
+    bool trapped = page == 0x03 || page == 0x04 || page == 0xC0;
+    REQUIRE((bus.GetReadTable()[page] == nullptr) == trapped);
+    REQUIRE(bus.GetWriteTable()[page] != nullptr);
+    // The host memory is still there to peek
+    REQUIRE(bus.GetPageMemory(page) != nullptr);
+  }
+
+  debugger.Remove(breakpoint);
+  debugger.Remove(watchpoint);
+  REQUIRE_FALSE(bus.IsFetchTrapped(0xC0));
+  REQUIRE(bus.GetReadTable()[0xC0] != nullptr);
+  REQUIRE(bus.GetReadTable()[0x03] != nullptr);
+
+  // The bus is left as it was
+  core.EnableDebugger(false);
+  REQUIRE(core.debugger == nullptr);
+}
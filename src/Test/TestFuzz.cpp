@@ -0,0 +1,33 @@
+#include <Fuzzer.hpp>
+#include <catch2/catch.hpp>
+#include <sstream>
+
+TEST_CASE("Random programs match the reference", "[Fuzz]") {
+  EasyNes::FuzzFailure failure;
+
+  for (EasyNes::u64 seed = 0; seed < 20000; seed++) {
+    if (!EasyNes::RunFuzzCase({seed, 32, 64, 0}, failure)) {
+      std::ostringstream text;
+      EasyNes::PrintFuzzFailure(text, EasyNes::MinimizeFuzzCase(failure));
+      FAIL(text.str());
+    }
+  }
+}
+
+TEST_CASE("Fuzzing runs on every thread", "[Fuzz]") {
+  EasyNes::FuzzOptions options;
+  options.threads = 2;
+  options.seconds = 0.2;
+  options.seed    = 1000000;
+
+  EasyNes::FuzzReport report = EasyNes::Fuzz(options);
+
+  std::ostringstream text;
+  if (report.failed) {
+    EasyNes::PrintFuzzFailure(text, report.failure);
+  }
+  INFO(text.str());
+  CHECK_FALSE(report.failed);
+  CHECK(report.cases > 0);
+  CHECK(report.instructions > report.cases);
+}
@@ -0,0 +1,120 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <vector>
+
+namespace {
+
+// Waits for the vertical blank, then waits in turn for the nmi counting the
+// frames and for the sprite zero hit, which comes from the sprite zero left at
+// the top of the screen on power on
+const std::vector<EasyNes::u8> PROGRAM = {
+    0x2C, 0x02, 0x20,  // $C000 bit [0x2002]
+    0x10, 0xFB,        // $C003 goto 0xC000 if positive
+    0xA9, 0x80,        // $C005 a = 0x80
+    0x8D, 0x00, 0x20,  // $C007 [0x2000] = a, nmi on
+    0xA9, 0x1E,        // $C00A a = 0x1E
+    0x8D, 0x01, 0x20,  // $C00C [0x2001] = a, rendering on
+    0xA5, 0x10,        // $C00F a = [0x10]
+    0xC5, 0x11,        // $C011 compare a with [0x11]
+    0xF0, 0xFA,        // $C013 goto 0xC00F if equal
+    0x85, 0x11,        // $C015 [0x11] = a
+    0x2C, 0x02, 0x20,  // $C017 bit [0x2002]
+    0x50, 0xFB,        // $C01A goto 0xC017 if no overflow
+    0xE8,              // $C01C x++
+    0x8E, 0x05, 0x20,  // $C01D [0x2005] = x
+    0x4C, 0x0F, 0xC0,  // $C020 goto 0xC00F
+    0xE6, 0x10,        // $C023 nmi: [0x10]++
+    0x40,              // $C025 return from the interrupt
+};
+
+std::shared_ptr<const EasyNes::Rom> MakeRom(const std::vector<EasyNes::u8> &program) {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + 2 * EasyNes::PRG_BANK_SIZE + EasyNes::CHR_BANK_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 2;
+  image[5] = 1;
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  std::copy(program.begin(), program.end(), prg + 0x4000);
+
+  const EasyNes::u16 vectors[] = {0xC023, 0xC000, 0xC000};
+  for (int i = 0; i < 3; i++) {
+    prg[0x7FFA + i * 2]     = vectors[i] & 0xFF;
+    prg[0x7FFA + i * 2 + 1] = vectors[i] >> 8;
+  }
+
+  // Every tile is opaque
+  std::fill(prg + 2 * EasyNes::PRG_BANK_SIZE, image.data() + image.size(), 0xFF);
+
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+}  // namespace
+
+TEST_CASE("Idle loops", "[IdleLoop][Scheduler]") {
+  // The reference core runs every loop in lockstep
+  EasyNes::Core             skipping, reference;
+  std::vector<EasyNes::u32> first(EasyNes::FRAMEBUFFER_SIZE), second(EasyNes::FRAMEBUFFER_SIZE);
+
+  SECTION("Polling") {
+    std::shared_ptr<const EasyNes::Rom> rom = MakeRom(PROGRAM);
+    REQUIRE(skipping.Insert(rom));
+    REQUIRE(reference.Insert(rom));
+  }
+
+  SECTION("Jump to itself") {
+    std::shared_ptr<const EasyNes::Rom> rom = MakeRom({0x4C, 0x00, 0xC0});
+    REQUIRE(skipping.Insert(rom));
+    REQUIRE(reference.Insert(rom));
+  }
+
+  skipping.cpu.EnableIdleLoopSkip(true);
+  reference.scheduler.SetMode(EasyNes::SchedulerMode::LOCKSTEP);
+  skipping.ppu.SetFramebuffer(first.data());
+  reference.ppu.SetFramebuffer(second.data());
+  skipping.cpu.RST();
+  reference.cpu.RST();
+
+  for (int i = 0; i < 10; i++) {
+    REQUIRE(skipping.RunFrame() == reference.RunFrame());
+    REQUIRE(first == second);
+
+    skipping.scheduler.CatchUp();
+    REQUIRE(skipping.SaveState() == reference.SaveState());
+  }
+
+  // Budgets ending in the middle of the skipped loops
+  for (int i = 0; i < 100; i++) {
+    REQUIRE(skipping.RunCycles(1000 + i) == reference.RunCycles(1000 + i));
+    REQUIRE(skipping.RunInstructions(100 + i) == reference.RunInstructions(100 + i));
+
+    skipping.scheduler.CatchUp();
+    REQUIRE(skipping.SaveState() == reference.SaveState());
+  }
+
+  // Most of the time is spent waiting
+  const EasyNes::IdleLoopStats &stats = skipping.cpu.GetIdleLoopDetector()->GetStats();
+  CHECK(stats.skips > 0);
+  CHECK(stats.skippedCycles > skipping.cpu.GetElapsedCycles() / 2);
+  CHECK(stats.skippedInstructions > 0);
+}
+
+TEST_CASE("Loops with side effects are not skipped", "[IdleLoop]") {
+  EasyNes::Core core;
+  // Writing the scroll, reading the data port of the ppu and pulling from the stack
+  const std::vector<std::vector<EasyNes::u8>> programs = {
+      {0x8D, 0x05, 0x20, 0x4C, 0x00, 0xC0},
+      {0xAD, 0x07, 0x20, 0xA9, 0x00, 0xF0, 0xF9},
+      {0x68, 0x4C, 0x00, 0xC0},
+  };
+
+  for (const std::vector<EasyNes::u8> &program : programs) {
+    REQUIRE(core.Insert(MakeRom(program)));
+    core.cpu.EnableIdleLoopSkip(false);
+    core.cpu.EnableIdleLoopSkip(true);
+    core.cpu.RST();
+    core.RunFrame();
+
+    CHECK(core.cpu.GetIdleLoopDetector()->GetStats().skips == 0);
+  }
+}
@@ -0,0 +1,58 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <type_traits>
+
+TEST_CASE("Instrumentation", "[CPU][Instrumentation]") {
+#ifndef EASYNES_INSTRUMENTATION
+  // Compiled out, the cpu does not even hold the counters
+  STATIC_REQUIRE(std::is_empty_v<EasyNes::Instrumentation>);
+  CHECK_FALSE(EasyNes::DumpInstrumentationAtExit("instrumentation.txt"));
+#else
+  EasyNes::Core core;
+
+  constexpr std::array<EasyNes::u8, 12> program{
+      0xA0, 0x01,        // Y = 0x01
+      0xB9, 0xFF, 0x02,  // A = ram[0x02FF + Y]   crosses a page when Y = 1
+      0x88,              // Y--
+      0xF0, 0xFA,        // if Y == 0 goto 0x8002
+      0x4C, 0x08, 0x80,  // goto 0x8008
+      0xEA,              // NOP
+  };
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.ram[0x8000 + i] = program[i];
+  }
+
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  core.cpu.RST();
+  core.RunInstructions(10);
+
+  const auto &data = core.cpu.GetInstrumentation().GetData();
+
+  // LDY, then twice LDA DEY BEQ, the loop is left on the second BEQ
+  CHECK(data.opcodeCounts[0xA0] == 1);
+  CHECK(data.opcodeCounts[0xB9] == 2);
+  CHECK(data.opcodeCounts[0x88] == 2);
+  CHECK(data.opcodeCounts[0xF0] == 2);
+  CHECK(data.opcodeCounts[0x4C] == 3);
+  // The reset cycles are not counted with the first instruction
+  CHECK(data.opcodeCycles[0xA0] == 2);
+  CHECK(data.opcodeCycles[0xB9] == 5 + 4);
+
+  CHECK(data.penalties[static_cast<int>(EasyNes::Penalty::PAGE_CROSS)] == 1);
+  CHECK(data.penalties[static_cast<int>(EasyNes::Penalty::BRANCH_TAKEN)] == 1);
+  CHECK(data.penalties[static_cast<int>(EasyNes::Penalty::BRANCH_PAGE_CROSS)] == 0);
+
+  CHECK(data.heatmap[0x8002] == 2);
+  CHECK(data.heatmap[0x8008] == 3);
+  CHECK(data.heatmap[0x800B] == 0);
+
+  std::ostringstream report;
+  data.Write(report);
+  CHECK(report.str().find("B9 LDA ABY 2 9\n") != std::string::npos);
+  CHECK(report.str().find("page_cross 1\n") != std::string::npos);
+#endif
+}
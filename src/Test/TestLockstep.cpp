@@ -0,0 +1,130 @@
+#include <Lockstep.hpp>
+#include <catch2/catch.hpp>
+#include <random>
+
+namespace {
+
+void CheckSameInstance(EasyNes::LockstepCPU &lockstep, EasyNes::u32 instance, EasyNes::Core &core) {
+  EasyNes::CPUState expected = core.cpu.GetState();
+  EasyNes::CPUState state    = lockstep.GetState(instance);
+
+  CHECK(state.pc == expected.pc);
+  CHECK(state.a == expected.a);
+  CHECK(state.x == expected.x);
+  CHECK(state.y == expected.y);
+  CHECK(state.sp == expected.sp);
+  CHECK(state.status == expected.status);
+  CHECK(state.elapsedCycles == expected.elapsedCycles);
+  CHECK(state.elapsedInstructions == expected.elapsedInstructions);
+
+  for (int address = 0x0000; address <= 0xFFFF; address++) {
+    REQUIRE(lockstep.Read(instance, address) == core.bus.Read(address));
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Lockstep instances match the interpreter", "[Lockstep]") {
+  // Not a whole number of vectors
+  constexpr int INSTANCES = 40;
+
+  // Opcodes with a vector kernel, the others are picked as well to run on the
+  // scalar cpu and to make the instances diverge
+  constexpr std::array<EasyNes::u8, 36> vectorized{
+      0xA9, 0xA5, 0xAD, 0xA2, 0xA6, 0xAE, 0xA0, 0xA4, 0xAC, 0x85, 0x8D, 0x86,
+      0x8E, 0x84, 0x8C, 0x29, 0x25, 0x09, 0x4D, 0xE8, 0xC8, 0xCA, 0x88, 0xAA,
+      0xA8, 0x8A, 0x98, 0x18, 0x38, 0xB8, 0xEA, 0xD0, 0xF0, 0x10, 0x30, 0x90,
+  };
+
+  // Run both for the budget and compare every instance
+  auto check = [&](unsigned seed, auto run) {
+    std::mt19937 random(seed);
+
+    // The same program for every instance with different data
+    std::array<EasyNes::u8, 0x10000> program;
+    for (EasyNes::u8 &byte : program) {
+      byte = random() % 4 ? vectorized[random() % vectorized.size()] : random();
+    }
+
+    EasyNes::LockstepCPU                        lockstep(INSTANCES);
+    std::vector<std::unique_ptr<EasyNes::Core>> cores;
+
+    for (int instance = 0; instance < INSTANCES; instance++) {
+      auto core = std::make_unique<EasyNes::Core>();
+
+      for (std::size_t address = 0; address < program.size(); address++) {
+        EasyNes::u8 byte = address < 0x0800 ? random() : program[address];
+        core->ram[address]  = byte;
+        lockstep.Write(instance, address, byte);
+      }
+
+      core->ram[EasyNes::RST_VECTOR]     = 0x00;
+      core->ram[EasyNes::RST_VECTOR + 1] = 0x80;
+      lockstep.Write(instance, EasyNes::RST_VECTOR, 0x00);
+      lockstep.Write(instance, EasyNes::RST_VECTOR + 1, 0x80);
+
+      core->cpu.RST();
+      cores.push_back(std::move(core));
+    }
+
+    lockstep.RST();
+    run(lockstep, cores);
+
+    for (int instance = 0; instance < INSTANCES; instance++) {
+      CheckSameInstance(lockstep, instance, *cores[instance]);
+    }
+  };
+
+  SECTION("Instructions") {
+    for (unsigned seed = 0; seed < 4; seed++) {
+      check(seed, [](EasyNes::LockstepCPU &lockstep, auto &cores) {
+        lockstep.RunInstructions(2000);
+        for (auto &core : cores) {
+          core->RunInstructions(2000);
+        }
+      });
+    }
+  }
+
+  SECTION("Cycles") {
+    for (unsigned seed = 0; seed < 4; seed++) {
+      check(seed, [](EasyNes::LockstepCPU &lockstep, auto &cores) {
+        lockstep.RunCycles(5000);
+        for (auto &core : cores) {
+          core->RunCycles(5000);
+        }
+      });
+    }
+  }
+}
+
+TEST_CASE("Lockstep groups", "[Lockstep]") {
+  EasyNes::LockstepCPU lockstep(64);
+
+  // Branch on the input at 0x0010, half of the instances take the branch
+  constexpr std::array<EasyNes::u8, 9> program{
+      0xA5, 0x10,        // A = ram[0x10]
+      0xD0, 0x02,        // if A != 0 goto 0x8006
+      0xA2, 0x01,        // X = 0x01
+      0x4C, 0x00, 0x80,  // goto 0x8000
+  };
+
+  for (int instance = 0; instance < 64; instance++) {
+    for (std::size_t i = 0; i < program.size(); i++) {
+      lockstep.Write(instance, 0x8000 + i, program[i]);
+    }
+
+    lockstep.Write(instance, 0x10, instance % 2);
+    lockstep.Write(instance, EasyNes::RST_VECTOR, 0x00);
+    lockstep.Write(instance, EasyNes::RST_VECTOR + 1, 0x80);
+  }
+
+  lockstep.RST();
+
+  CHECK(lockstep.Step() == 1);
+  CHECK(lockstep.Step() == 1);
+  // The branch split the instances
+  CHECK(lockstep.Step() == 2);
+  CHECK(lockstep.GetState(0).x == 0x01);
+  CHECK(lockstep.GetState(1).x == 0x00);
+}
@@ -0,0 +1,245 @@
+#include <Core.hpp>
+#include <Rewind.hpp>
+#include <catch2/catch.hpp>
+#include <vector>
+
+namespace {
+
+// Every byte of a program bank of 8 KiB holds the number of the bank, and
+// every byte of a graphics bank of 1 KiB holds 0x80 plus its number
+std::shared_ptr<const EasyNes::Rom> MakeRom(EasyNes::u8 mapper, EasyNes::u8 prgBanks, EasyNes::u8 chrBanks) {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = prgBanks;
+  image[5] = chrBanks;
+  image[6] = mapper << 4;
+
+  for (EasyNes::u32 i = 0; i < prgBanks * EasyNes::PRG_BANK_SIZE; i++) {
+    image.push_back(i / EasyNes::PRG_SLOT_SIZE);
+  }
+  for (EasyNes::u32 i = 0; i < chrBanks * EasyNes::CHR_BANK_SIZE; i++) {
+    image.push_back(0x80 + i / EasyNes::CHR_SLOT_SIZE);
+  }
+
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+}  // namespace
+
+TEST_CASE("Mappers", "[Mapper]") {
+  EasyNes::Core core;
+
+  SECTION("NROM") {
+    REQUIRE(core.Insert(MakeRom(0, 1, 1)));
+
+    // The bank is read in place and mirrored, the writes are lost
+    CHECK(core.bus.GetPageMemory(0x80) == core.rom->GetPrg());
+    CHECK(core.bus.GetPageMemory(0xC0) == core.rom->GetPrg());
+    core.bus.Write(0x8000, 0x12);
+    CHECK(core.bus.Read(0x8000) == 0);
+    CHECK(core.bus.Read(0xFFFF) == 1);
+    CHECK(core.mapper->GetChrBank(7)[0] == 0x87);
+  }
+
+  SECTION("MMC1") {
+    REQUIRE(core.Insert(MakeRom(1, 8, 2)));
+
+    // The last bank is fixed at $C000 on power on
+    CHECK(core.bus.Read(0xC000) == 14);
+    CHECK(core.bus.Read(0xFFFF) == 15);
+
+    auto serial = [&](EasyNes::u16 address, EasyNes::u8 value) {
+      for (int i = 0; i < 5; i++) {
+        core.bus.Write(address, value >> i);
+      }
+    };
+
+    serial(0xE000, 0x03);
+    CHECK(core.bus.Read(0x8000) == 6);
+    CHECK(core.bus.Read(0xA000) == 7);
+    CHECK(core.bus.GetPageMemory(0x80) == core.rom->GetPrg() + 3 * EasyNes::PRG_BANK_SIZE);
+
+    // Vertical mirroring, two 4 KiB graphics banks
+    serial(0x8000, 0x1E);
+    serial(0xA000, 0x03);
+    serial(0xC000, 0x01);
+    CHECK(core.mapper->GetMirroring() == EasyNes::Mirroring::VERTICAL);
+    CHECK(core.mapper->GetChrBank(0)[0] == 0x8C);
+    CHECK(core.mapper->GetChrBank(4)[0] == 0x84);
+
+    // A write with the high bit set resets the shift register
+    core.bus.Write(0xE000, 0x01);
+    core.bus.Write(0xE000, 0x80);
+    serial(0xE000, 0x00);
+    CHECK(core.bus.Read(0x8000) == 0);
+  }
+
+  SECTION("UxROM") {
+    REQUIRE(core.Insert(MakeRom(2, 8, 0)));
+
+    core.bus.Write(0x8000, 3);
+    CHECK(core.bus.Read(0x8000) == 6);
+    CHECK(core.bus.Read(0xBFFF) == 7);
+    CHECK(core.bus.Read(0xC000) == 14);
+
+    // Graphics ram on the board
+    REQUIRE(core.mapper->GetWritableChrBank(0));
+    core.mapper->GetWritableChrBank(0)[0] = 0x55;
+    CHECK(core.mapper->GetChrBank(0)[0] == 0x55);
+  }
+
+  SECTION("CNROM") {
+    REQUIRE(core.Insert(MakeRom(3, 2, 4)));
+
+    core.bus.Write(0x8000, 2);
+    CHECK(core.mapper->GetChrBank(0)[0] == 0x90);
+    CHECK(core.mapper->GetChrBank(7)[0] == 0x97);
+    CHECK_FALSE(core.mapper->GetWritableChrBank(0));
+  }
+
+  SECTION("MMC3") {
+    REQUIRE(core.Insert(MakeRom(4, 16, 8)));
+
+    core.bus.Write(0x8000, 6);
+    core.bus.Write(0x8001, 5);
+    core.bus.Write(0x8000, 7);
+    core.bus.Write(0x8001, 9);
+    CHECK(core.bus.Read(0x8000) == 5);
+    CHECK(core.bus.Read(0xA000) == 9);
+    CHECK(core.bus.Read(0xC000) == 30);
+    CHECK(core.bus.Read(0xE000) == 31);
+
+    // The fixed bank moves to $8000
+    core.bus.Write(0x8000, 0x46);
+    CHECK(core.bus.Read(0x8000) == 30);
+    CHECK(core.bus.Read(0xC000) == 5);
+
+    // Graphics inversion
+    core.bus.Write(0x8000, 0x80);
+    core.bus.Write(0x8001, 4);
+    core.bus.Write(0x8000, 0x82);
+    core.bus.Write(0x8001, 11);
+    CHECK(core.mapper->GetChrBank(4)[0] == 0x84);
+    CHECK(core.mapper->GetChrBank(5)[0] == 0x85);
+    CHECK(core.mapper->GetChrBank(0)[0] == 0x8B);
+
+    core.bus.Write(0xA000, 1);
+    CHECK(core.mapper->GetMirroring() == EasyNes::Mirroring::HORIZONTAL);
+  }
+}
+
+TEST_CASE("MMC3 interrupt", "[Mapper]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom(4, 2, 1)));
+
+  core.cpu.RST();
+  EasyNes::CPUState state = core.cpu.GetState();
+  state.status &= ~EasyNes::INTERRUPT_BIT;
+  core.cpu.SetState(state);
+
+  core.bus.Write(0xC000, 2);  // Latch
+  core.bus.Write(0xC001, 0);  // Reload
+  core.bus.Write(0xE001, 0);  // Enable
+
+  // The counter is reloaded, then counts down to zero
+  core.mapper->OnScanline();
+  core.mapper->OnScanline();
+  CHECK_FALSE(core.mapper->IsIrqPending());
+  CHECK(core.cpu.GetRegisterSP() == state.sp);
+
+  core.mapper->OnScanline();
+  CHECK(core.mapper->IsIrqPending());
+  // The program counter and the status are pushed
+  CHECK(core.cpu.GetRegisterSP() == state.sp - 3);
+  CHECK(core.cpu.GetRegisterStatus() & EasyNes::INTERRUPT_BIT);
+
+  // Acknowledged by disabling
+  core.bus.Write(0xE000, 0);
+  CHECK_FALSE(core.mapper->IsIrqPending());
+}
+
+TEST_CASE("MMC3 interrupt raised while masked", "[Mapper]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom(4, 2, 1)));
+  core.cpu.RST();
+
+  // Clear the mask from the work ram
+  core.ram[0x0000]        = 0x58;
+  EasyNes::CPUState state = core.cpu.GetState();
+  state.pc                = 0x0000;
+  state.waitingCycles     = 0;
+  core.cpu.SetState(state);
+
+  core.bus.Write(0xC000, 0);  // Latch
+  core.bus.Write(0xE001, 0);  // Enable
+  core.mapper->OnScanline();
+  REQUIRE(core.mapper->IsIrqPending());
+  // Masked by the reset, the line stays asserted
+  CHECK(core.cpu.GetRegisterSP() == state.sp);
+
+  core.RunInstructions(1);
+  CHECK(core.cpu.GetRegisterSP() == state.sp - 3);
+  CHECK(core.cpu.GetRegisterPC() == (core.bus.Read(EasyNes::IRQ_VECTOR) | core.bus.Read(EasyNes::IRQ_VECTOR + 1) << 8));
+  CHECK(core.cpu.GetRegisterStatus() & EasyNes::INTERRUPT_BIT);
+  // The status pushed by the interrupt has the mask cleared
+  CHECK_FALSE(core.ram[EasyNes::STACK_BASE + state.sp - 2] & EasyNes::INTERRUPT_BIT);
+}
+
+TEST_CASE("Mapper save states", "[Mapper][State]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom(2, 8, 0)));
+
+  core.bus.Write(0x8000, 2);
+  std::vector<EasyNes::u8> state = core.SaveState();
+
+  core.bus.Write(0x8000, 5);
+  CHECK(core.bus.Read(0x8000) == 10);
+
+  REQUIRE(core.LoadState(state));
+  CHECK(core.bus.Read(0x8000) == 4);
+
+  // A state without the mapper does not load
+  EasyNes::Core empty;
+  CHECK_FALSE(empty.LoadState(state));
+}
+
+TEST_CASE("Rewind of the cartridge rams", "[Mapper][State]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom(2, 8, 0)));
+  EasyNes::Rewind rewind(&core);
+
+  core.bus.Write(0x6010, 1);
+  core.ppu.WriteMemory(0x0123, 2);
+  rewind.Snapshot();
+  std::vector<EasyNes::u8> state = core.SaveState();
+
+  core.bus.Write(0x6010, 3);
+  core.bus.Write(0x7F00, 4);
+  core.ppu.WriteMemory(0x0123, 5);
+  core.ppu.WriteMemory(0x1FFF, 6);
+  core.bus.Write(0x8000, 5);
+
+  // Only the four written pages are kept, not the 16 KiB of rams
+  CHECK(rewind.GetMemoryUsage() < 8 * 1024);
+
+  REQUIRE(rewind.Restore(1));
+  CHECK(core.bus.Read(0x6010) == 1);
+  CHECK(core.ppu.ReadMemory(0x0123) == 2);
+  CHECK(core.SaveState() == state);
+}
+
+TEST_CASE("Rewind across cartridges", "[Mapper][State]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom(2, 8, 0)));
+  EasyNes::Rewind rewind(&core);
+  rewind.Snapshot();
+
+  // The registers of the other mapper do not load, the apu is left as it was
+  REQUIRE(core.Insert(MakeRom(4, 2, 1)));
+  core.RunCycles(1000);
+  std::vector<EasyNes::u8> state = core.SaveState();
+
+  CHECK_FALSE(rewind.Restore(1));
+  CHECK(core.SaveState() == state);
+}
@@ -0,0 +1,145 @@
+#include <Core.hpp>
+#include <Movie.hpp>
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// NROM-128 image reading the first controller in a loop, the buttons of the
+// last whole read are stored at $0301
+std::shared_ptr<const EasyNes::Rom> MakeControllerRom() {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE + EasyNes::CHR_BANK_SIZE);
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+  image[5] = 1;
+
+  std::vector<EasyNes::u8> program = {
+      0xA9, 0x01,        // A = 1
+      0x8D, 0x16, 0x40,  // Strobe
+      0xA9, 0x00,        // A = 0
+      0x8D, 0x16, 0x40,  // Latch the buttons
+      0xA2, 0x08,        // X = 8
+      0xAD, 0x16, 0x40,  // A = next button
+      0x4A,              // C = A & 1
+      0x6E, 0x00, 0x03,  // ram[0x0300] = C << 7 | ram[0x0300] >> 1
+      0xCA,              // X--
+      0xD0, 0xF6,        // if X != 0 goto 0x800C
+      0xAD, 0x00, 0x03,  // A = ram[0x0300]
+      0x8D, 0x01, 0x03,  // ram[0x0301] = A
+      0x4C, 0x00, 0x80,  // goto 0x8000
+  };
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  std::copy(program.begin(), program.end(), prg);
+  prg[0x3FFC] = 0x00;
+  prg[0x3FFD] = 0x80;
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+}  // namespace
+
+TEST_CASE("Movie files", "[Movie]") {
+  EasyNes::Movie movie;
+
+  SECTION("Frames") {
+    std::istringstream input(
+        "version 3\n"
+        "romFilename test\n"
+        "port0 1\n"
+        "port1 1\n"
+        "port2 0\n"
+        "|0|R.......|........||\r\n"
+        "|0|.......A|...U....||\n"
+        "|1|........|        ||\n"
+        "|0|RLDUTSBA|||\n");
+
+    REQUIRE(EasyNes::ReadMovie(input, movie));
+    REQUIRE(movie.frames.size() == 4);
+
+    CHECK(movie.frames[0].buttons[0] == EasyNes::BUTTON_RIGHT);
+    CHECK(movie.frames[0].buttons[1] == 0x00);
+    CHECK_FALSE(movie.frames[0].reset);
+    CHECK(movie.frames[1].buttons[0] == EasyNes::BUTTON_A);
+    CHECK(movie.frames[1].buttons[1] == EasyNes::BUTTON_UP);
+    CHECK(movie.frames[2].buttons[0] == 0x00);
+    CHECK(movie.frames[2].buttons[1] == 0x00);
+    CHECK(movie.frames[2].reset);
+    // The second port is not plugged
+    CHECK(movie.frames[3].buttons[0] == 0xFF);
+    CHECK(movie.frames[3].buttons[1] == 0x00);
+  }
+
+  SECTION("Invalid") {
+    std::istringstream commands("|x|........|........||\n");
+    CHECK_FALSE(EasyNes::ReadMovie(commands, movie));
+
+    std::istringstream buttons("|0|.....|........||\n");
+    CHECK_FALSE(EasyNes::ReadMovie(buttons, movie));
+
+    std::istringstream binary("version 3\nbinary 1\n");
+    CHECK_FALSE(EasyNes::ReadMovie(binary, movie));
+  }
+}
+
+TEST_CASE("Movie hashes", "[Movie]") {
+  auto hash = [](const std::string &text) { return EasyNes::XXHASH64(text.data(), text.size()); };
+
+  // Values of the reference implementation
+  CHECK(hash("") == 0xEF46DB3751D8E999);
+  CHECK(hash("abc") == 0x44BC2CF5AD770999);
+  CHECK(hash("Nobody inspects the spammish repetition") == 0xFBCEA83C8A378BF1);
+}
+
+TEST_CASE("Movie replay", "[Movie][Core]") {
+  auto rom = MakeControllerRom();
+  REQUIRE(rom);
+
+  EasyNes::Movie movie;
+  movie.frames.resize(4);
+  movie.frames[1].buttons[0] = EasyNes::BUTTON_A | EasyNes::BUTTON_START;
+  movie.frames[2].buttons[0] = EasyNes::BUTTON_RIGHT;
+  movie.frames[3].buttons[0] = EasyNes::BUTTON_RIGHT;
+
+  std::vector<EasyNes::u32> framebuffer(EasyNes::FRAMEBUFFER_SIZE);
+
+  SECTION("Controllers") {
+    EasyNes::Core core;
+    REQUIRE(core.Insert(rom));
+    core.cpu.RST();
+
+    for (const EasyNes::MovieFrame &frame : movie.frames) {
+      EasyNes::ReplayMovie(core, EasyNes::Movie{{frame}}, framebuffer.data());
+      CHECK(core.ram[0x0301] == frame.buttons[0]);
+    }
+
+    // Reads past the eighth return ones
+    core.bus.Write(EasyNes::CONTROLLER_PORT_1, 1);
+    core.bus.Write(EasyNes::CONTROLLER_PORT_1, 0);
+    for (int i = 0; i < 8; i++) {
+      CHECK(core.bus.Read(EasyNes::CONTROLLER_PORT_1) == (0x40 | ((EasyNes::BUTTON_RIGHT >> i) & 1)));
+    }
+    CHECK(core.bus.Read(EasyNes::CONTROLLER_PORT_1) == 0x41);
+    CHECK(core.bus.Read(EasyNes::CONTROLLER_PORT_2) == 0x40);
+  }
+
+  SECTION("Hashes") {
+    auto replay = [&](bool fast) {
+      EasyNes::Core core;
+      REQUIRE(core.Insert(rom));
+      core.cpu.EnableRecompiler(fast);
+      core.cpu.EnableIdleLoopSkip(fast);
+      core.cpu.RST();
+      return EasyNes::ReplayMovie(core, movie, framebuffer.data());
+    };
+
+    std::vector<EasyNes::u64> hashes = replay(false);
+    REQUIRE(hashes.size() == movie.frames.size());
+    CHECK(replay(true) == hashes);
+
+    // The input shows in the ram, the same input gives the same state
+    CHECK(hashes[0] != hashes[1]);
+    CHECK(hashes[1] != hashes[2]);
+  }
+}
@@ -0,0 +1,352 @@
+#include <Core.hpp>
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <vector>
+
+namespace {
+
+// NROM-128 image with graphics ram, the program loops on itself and every
+// vector points to it
+std::shared_ptr<const EasyNes::Rom> MakeRom() {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  prg[0]           = 0x4C;  // goto 0x8000
+  prg[1]           = 0x00;
+  prg[2]           = 0x80;
+
+  for (EasyNes::u16 vector = 0x3FFA; vector < 0x4000; vector += 2) {
+    prg[vector]     = 0x00;
+    prg[vector + 1] = 0x80;
+  }
+
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+// CNROM image with four graphics banks, the first tile of the bank n is
+// filled with the color n
+std::shared_ptr<const EasyNes::Rom> MakeBankedRom() {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE + 4 * EasyNes::CHR_BANK_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;
+  image[5] = 4;
+  image[6] = 0x30;
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  prg[0]           = 0x4C;  // goto 0x8000
+  prg[1]           = 0x00;
+  prg[2]           = 0x80;
+  prg[0x3FFD]      = 0x80;
+
+  for (EasyNes::u32 bank = 0; bank < 4; bank++) {
+    EasyNes::u8 *tile = prg + EasyNes::PRG_BANK_SIZE + bank * EasyNes::CHR_BANK_SIZE;
+    std::fill_n(tile, 8, bank & 1 ? 0xFF : 0x00);
+    std::fill_n(tile + 8, 8, bank & 2 ? 0xFF : 0x00);
+  }
+
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+void WriteMemory(EasyNes::Core &core, EasyNes::u16 address, const std::vector<EasyNes::u8> &data) {
+  core.bus.Read(0x2002);
+  core.bus.Write(0x2006, address >> 8);
+  core.bus.Write(0x2006, address & 0xFF);
+  for (EasyNes::u8 value : data) {
+    core.bus.Write(0x2007, value);
+  }
+}
+
+void Scroll(EasyNes::Core &core, EasyNes::u8 x, EasyNes::u8 y) {
+  core.bus.Write(0x2000, 0x00);
+  core.bus.Write(0x2005, x);
+  core.bus.Write(0x2005, y);
+}
+
+}  // namespace
+
+TEST_CASE("PPU registers", "[PPU]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom()));
+
+  SECTION("Buffered reads") {
+    WriteMemory(core, 0x2108, {0x55, 0x66});
+
+    core.bus.Write(0x2006, 0x21);
+    core.bus.Write(0x2006, 0x08);
+    CHECK(core.bus.Read(0x2007) == 0x00);
+    CHECK(core.bus.Read(0x2007) == 0x55);
+    // Mirrored every 8 bytes
+    CHECK(core.bus.Read(0x3FFF) == 0x66);
+  }
+
+  SECTION("Palette") {
+    WriteMemory(core, 0x3F10, {0x2A});
+
+    // The palette is read at once, the backdrop entries are shared
+    core.bus.Write(0x2006, 0x3F);
+    core.bus.Write(0x2006, 0x00);
+    CHECK(core.bus.Read(0x2007) == 0x2A);
+  }
+
+  SECTION("Nametable mirroring") {
+    // Horizontal mirroring, the two upper nametables are the same
+    WriteMemory(core, 0x2000, {0x12});
+    core.bus.Write(0x2006, 0x24);
+    core.bus.Write(0x2006, 0x00);
+    core.bus.Read(0x2007);
+    CHECK(core.bus.Read(0x2007) == 0x12);
+  }
+
+  SECTION("Sprite dma") {
+    for (int i = 0; i < 256; i++) {
+      core.ram[0x0200 + i] = i;
+    }
+
+    core.cpu.RST();
+    core.RunInstructions(1);
+    core.bus.Write(EasyNes::OAM_DMA, 0x02);
+    CHECK(core.cpu.GetState().waitingCycles == EasyNes::OAM_DMA_CYCLES);
+
+    core.bus.Write(0x2003, 0x05);
+    CHECK(core.bus.Read(0x2004) == 0x05);
+  }
+}
+
+TEST_CASE("PPU rendering", "[PPU]") {
+  EasyNes::Core             core;
+  std::vector<EasyNes::u32> frame(EasyNes::FRAMEBUFFER_SIZE);
+  REQUIRE(core.Insert(MakeRom()));
+  core.ppu.SetFramebuffer(frame.data());
+
+  // Tile 1 uses the first color, tile 2 the second one
+  WriteMemory(core, 0x0010, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
+  WriteMemory(core, 0x0028, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
+  WriteMemory(core, 0x2000, {0x01});
+  WriteMemory(core, 0x3F00, {0x0F, 0x16});
+  WriteMemory(core, 0x3F12, {0x2A});
+
+  // Sprite zero from the line 10 to 17 at the column 16
+  core.bus.Write(0x2003, 0x00);
+  for (EasyNes::u8 value : {9, 2, 0, 16}) {
+    core.bus.Write(0x2004, value);
+  }
+
+  core.bus.Write(0x2001, 0x1E);
+  core.cpu.RST();
+
+  auto pixel = [&](EasyNes::u32 x, EasyNes::u32 y) { return frame[y * EasyNes::SCREEN_WIDTH + x]; };
+
+  SECTION("Layers") {
+    Scroll(core, 0, 0);
+    core.RunFrame();
+    core.RunFrame();
+
+    CHECK(pixel(0, 0) == EasyNes::SYSTEM_PALETTE[0x16]);
+    CHECK(pixel(7, 7) == EasyNes::SYSTEM_PALETTE[0x16]);
+    CHECK(pixel(8, 0) == EasyNes::SYSTEM_PALETTE[0x0F]);
+    CHECK(pixel(0, 8) == EasyNes::SYSTEM_PALETTE[0x0F]);
+    CHECK(pixel(16, 10) == EasyNes::SYSTEM_PALETTE[0x2A]);
+    CHECK(pixel(23, 17) == EasyNes::SYSTEM_PALETTE[0x2A]);
+    CHECK(pixel(16, 9) == EasyNes::SYSTEM_PALETTE[0x0F]);
+    CHECK(pixel(24, 10) == EasyNes::SYSTEM_PALETTE[0x0F]);
+
+    // The sprite only covers the backdrop
+    CHECK_FALSE(core.bus.Read(0x2002) & EasyNes::STATUS_SPRITE_ZERO_BIT);
+  }
+
+  SECTION("Fine scroll") {
+    Scroll(core, 4, 0);
+    core.RunFrame();
+    core.RunFrame();
+
+    CHECK(pixel(3, 0) == EasyNes::SYSTEM_PALETTE[0x16]);
+    CHECK(pixel(4, 0) == EasyNes::SYSTEM_PALETTE[0x0F]);
+  }
+
+  SECTION("Sprite zero hit") {
+    // Over the opaque tile, behind the background
+    core.bus.Write(0x2003, 0x00);
+    for (EasyNes::u8 value : {0, 2, 0x20, 4}) {
+      core.bus.Write(0x2004, value);
+    }
+
+    Scroll(core, 0, 0);
+    core.RunFrame();
+    core.RunFrame();
+
+    CHECK(pixel(4, 1) == EasyNes::SYSTEM_PALETTE[0x16]);
+    CHECK(pixel(8, 1) == EasyNes::SYSTEM_PALETTE[0x2A]);
+    CHECK(core.bus.Read(0x2002) & EasyNes::STATUS_SPRITE_ZERO_BIT);
+  }
+
+  SECTION("Left column") {
+    core.bus.Write(0x2001, 0x18);
+    Scroll(core, 0, 0);
+    core.RunFrame();
+    core.RunFrame();
+
+    CHECK(pixel(0, 0) == EasyNes::SYSTEM_PALETTE[0x0F]);
+  }
+}
+
+TEST_CASE("PPU vertical blank", "[PPU]") {
+  EasyNes::Core core;
+  REQUIRE(core.Insert(MakeRom()));
+  core.cpu.RST();
+
+  core.bus.Write(0x2000, EasyNes::CONTROL_NMI_BIT);
+  EasyNes::u8 sp = core.cpu.GetRegisterSP();
+
+  // About a frame of cycles up to the vertical blank
+  EasyNes::u64 cycles = core.RunFrame();
+  CHECK(cycles >= 241 * EasyNes::DOTS_PER_SCANLINE / EasyNes::DOTS_PER_CYCLE);
+  CHECK(cycles < 242 * EasyNes::DOTS_PER_SCANLINE / EasyNes::DOTS_PER_CYCLE);
+  CHECK(core.ppu.GetScanline() == 241);
+
+  // The nmi pushed the program counter and the status
+  CHECK(core.cpu.GetRegisterSP() == EasyNes::u8(sp - 3));
+  CHECK(core.bus.Read(0x2002) & EasyNes::STATUS_VBLANK_BIT);
+  CHECK_FALSE(core.bus.Read(0x2002) & EasyNes::STATUS_VBLANK_BIT);
+
+  // A whole frame from now on
+  cycles = core.RunFrame();
+  CHECK(cycles >= EasyNes::CYCLES_PER_FRAME - 1);
+  CHECK(cycles <= EasyNes::CYCLES_PER_FRAME + 8);
+}
+
+TEST_CASE("PPU save states", "[PPU][State]") {
+  EasyNes::Core             core;
+  std::vector<EasyNes::u32> first(EasyNes::FRAMEBUFFER_SIZE), second(EasyNes::FRAMEBUFFER_SIZE);
+  REQUIRE(core.Insert(MakeRom()));
+
+  WriteMemory(core, 0x0010, {0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA});
+  WriteMemory(core, 0x2000, {0x01, 0x01, 0x01});
+  WriteMemory(core, 0x3F00, {0x0F, 0x16});
+  core.bus.Write(0x2001, 0x0A);
+  Scroll(core, 3, 5);
+  core.cpu.RST();
+  core.RunCycles(1000);
+
+  std::vector<EasyNes::u8> state = core.SaveState();
+  core.ppu.SetFramebuffer(first.data());
+  core.RunFrame();
+
+  REQUIRE(core.LoadState(state));
+  core.ppu.SetFramebuffer(second.data());
+  core.RunFrame();
+
+  CHECK(first == second);
+  CHECK(std::count(first.begin(), first.end(), EasyNes::SYSTEM_PALETTE[0x16]) > 0);
+}
+
+TEST_CASE("PPU pipeline", "[PPU][Pipeline]") {
+  EasyNes::Core             reference, pipelined;
+  std::vector<EasyNes::u32> expected(EasyNes::FRAMEBUFFER_SIZE), frame(EasyNes::FRAMEBUFFER_SIZE);
+
+  auto setup = [](EasyNes::Core &core) {
+    REQUIRE(core.Insert(MakeRom()));
+    WriteMemory(core, 0x0010, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
+    WriteMemory(core, 0x2000, {0x01, 0x00, 0x01});
+    WriteMemory(core, 0x3F00, {0x0F, 0x16});
+    WriteMemory(core, 0x3F12, {0x2A});
+
+    // Sprite zero over the opaque tile
+    core.bus.Write(0x2003, 0x00);
+    for (EasyNes::u8 value : {0, 1, 0, 4}) {
+      core.bus.Write(0x2004, value);
+    }
+    core.bus.Write(0x2001, 0x1E);
+    core.cpu.RST();
+  };
+
+  setup(reference);
+  setup(pipelined);
+  reference.ppu.SetFramebuffer(expected.data());
+  pipelined.ppu.EnablePipeline(true);
+  pipelined.ppu.SetFramebuffer(frame.data());
+  REQUIRE(pipelined.ppu.IsPipelined());
+
+  // Every frame scrolls and writes the graphics ram, the picture of a frame is
+  // delivered at the end of the next one
+  std::vector<EasyNes::u32> previous;
+  std::vector<EasyNes::u8>  state;
+  int                       hits = 0;
+  for (EasyNes::u8 i = 0; i < 12; i++) {
+    for (EasyNes::Core *core : {&reference, &pipelined}) {
+      WriteMemory(*core, 0x0011 + i % 8, {static_cast<EasyNes::u8>(i * 37)});
+      WriteMemory(*core, 0x3F01, {static_cast<EasyNes::u8>(0x10 + i)});
+      Scroll(*core, i * 3, i);
+      core->RunFrame();
+    }
+
+    if (i == 6) {
+      state = reference.SaveState();
+    }
+    if (!previous.empty()) {
+      CHECK(frame == previous);
+    }
+    // The ppu of the core only keeps the flags, the same as with the picture
+    CHECK(pipelined.SaveState() == reference.SaveState());
+    previous = expected;
+    hits += (pipelined.ppu.GetState().status & EasyNes::STATUS_SPRITE_ZERO_BIT) != 0;
+  }
+  // Until the graphics ram makes the rows of sprite zero transparent
+  CHECK(hits > 0);
+
+  SECTION("Loaded states") {
+    REQUIRE(reference.LoadState(state));
+    REQUIRE(pipelined.LoadState(state));
+
+    for (int i = 0; i < 3; i++) {
+      previous = expected;
+      reference.RunFrame();
+      pipelined.RunFrame();
+    }
+    CHECK(frame == previous);
+  }
+
+  SECTION("Disabled") {
+    pipelined.ppu.EnablePipeline(false);
+    reference.RunFrame();
+    pipelined.RunFrame();
+    CHECK(frame == expected);
+  }
+}
+
+TEST_CASE("PPU pipeline banks", "[PPU][Pipeline][Mapper]") {
+  EasyNes::Core             reference, pipelined;
+  std::vector<EasyNes::u32> expected(EasyNes::FRAMEBUFFER_SIZE), frame(EasyNes::FRAMEBUFFER_SIZE);
+
+  for (EasyNes::Core *core : {&reference, &pipelined}) {
+    REQUIRE(core->Insert(MakeBankedRom()));
+    WriteMemory(*core, 0x3F00, {0x0F, 0x16, 0x2A, 0x12});
+    Scroll(*core, 0, 0);
+    core->bus.Write(0x2001, 0x0A);
+    core->cpu.RST();
+  }
+  reference.ppu.SetFramebuffer(expected.data());
+  pipelined.ppu.EnablePipeline(true);
+  pipelined.ppu.SetFramebuffer(frame.data());
+
+  // A bank switch in the middle of every frame, the top of the picture keeps
+  // the previous bank
+  std::vector<EasyNes::u32> previous;
+  for (EasyNes::u8 i = 0; i < 8; i++) {
+    for (EasyNes::Core *core : {&reference, &pipelined}) {
+      core->RunCycles(EasyNes::CYCLES_PER_FRAME / 2);
+      core->bus.Write(0x8000, i % 4);
+      core->RunFrame();
+    }
+
+    if (!previous.empty()) {
+      CHECK(frame == previous);
+    }
+    previous = expected;
+  }
+
+  CHECK(previous.front() != previous.back());
+}
@@ -0,0 +1,119 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <sstream>
+
+namespace {
+
+std::map<std::string, EasyNes::u64> ReadFolded(const EasyNes::Profiler &profiler) {
+  std::stringstream                   folded;
+  std::map<std::string, EasyNes::u64> stacks;
+  std::string                         stack;
+  EasyNes::u64                        count;
+
+  profiler.WriteFoldedStacks(folded);
+  while (folded >> stack >> count) {
+    stacks[stack] = count;
+  }
+  return stacks;
+}
+
+void Load(EasyNes::Core &core, EasyNes::u16 address, std::initializer_list<EasyNes::u8> program) {
+  std::copy(program.begin(), program.end(), &core.ram[address]);
+}
+
+}  // namespace
+
+TEST_CASE("Profiles follow the calls", "[Profiler]") {
+  EasyNes::Core core;
+
+  Load(core, 0x8000,
+       {
+           0x20, 0x10, 0x80,  // call 0x8010
+           0x20, 0x20, 0x80,  // call 0x8020
+           0x4C, 0x00, 0x80,  // goto 0x8000
+       });
+  Load(core, 0x8010,
+       {
+           0x20, 0x20, 0x80,  // 0x8010: call 0x8020
+           0x60,              // return
+       });
+  Load(core, 0x8020,
+       {
+           0xA2, 0x10,  // 0x8020: X = 0x10
+           0xCA,        // 0x8022: X--
+           0xD0, 0xFD,  // if X != 0 goto 0x8022
+           0x60,        // return
+       });
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  core.cpu.EnableProfiler(true, 7);
+  core.cpu.RST();
+  core.RunCycles(100000);
+
+  EasyNes::Profiler &profiler = *core.cpu.GetProfiler();
+
+  SECTION("Addresses") {
+    auto stacks = ReadFolded(profiler);
+
+    CHECK(stacks.size() == 4);
+    CHECK(stacks.count("$8000"));
+    CHECK(stacks.count("$8000;$8010"));
+    CHECK(stacks.count("$8000;$8010;$8020"));
+    CHECK(stacks.count("$8000;$8020"));
+
+    // Every cycle is sampled once, the inner routine is called twice
+    EasyNes::u64 total = 0;
+    for (const auto &[stack, count] : stacks) {
+      total += count;
+    }
+    CHECK(total == profiler.GetSamples());
+    CHECK(total == Approx(100000 / 7).margin(2));
+    CHECK(stacks["$8000;$8010;$8020"] == Approx(stacks["$8000;$8020"]).epsilon(0.05));
+    CHECK(stacks["$8000;$8020"] > 5 * stacks["$8000"]);
+  }
+
+  SECTION("Symbols") {
+    std::istringstream symbols("# labels\n"
+                               "8000 reset\n"
+                               "$8010 outer\n"
+                               "al 008020 .inner\n"
+                               "al 008022 .inner_loop\n");
+    REQUIRE(profiler.LoadSymbols(symbols));
+
+    // The sampled address is in another label than the routine entry
+    auto stacks = ReadFolded(profiler);
+    CHECK(stacks.count("reset;outer;inner;inner_loop"));
+    CHECK(stacks.count("reset;outer;inner"));
+    CHECK(stacks.count("reset;inner;inner_loop"));
+
+    std::istringstream invalid("zzzz name\n");
+    CHECK_FALSE(profiler.LoadSymbols(invalid));
+  }
+}
+
+TEST_CASE("Profiles drop the lost return addresses", "[Profiler]") {
+  EasyNes::Core core;
+
+  Load(core, 0x8000,
+       {
+           0x20, 0x10, 0x80,  // call 0x8010
+       });
+  Load(core, 0x8010,
+       {
+           0x68,              // 0x8010: pull the return address
+           0x68,              //
+           0x4C, 0x00, 0x80,  // goto 0x8000
+       });
+  core.ram[0xFFFC] = 0x00;
+  core.ram[0xFFFD] = 0x80;
+
+  core.cpu.EnableProfiler(true, 1);
+  core.cpu.RST();
+  core.RunCycles(10000);
+
+  // The frame is replaced by the next call instead of piling up
+  auto stacks = ReadFolded(*core.cpu.GetProfiler());
+  CHECK(stacks.size() == 1);
+  CHECK(stacks.count("$8000;$8010"));
+}
@@ -0,0 +1,152 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <random>
+
+namespace {
+
+template <std::size_t SIZE>
+void LoadProgram(EasyNes::Core &core, const std::array<EasyNes::u8, SIZE> &program, EasyNes::u16 origin) {
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.bus.Write(origin + i, program[i]);
+  }
+
+  core.bus.Write(EasyNes::RST_VECTOR, origin & 0xFF);
+  core.bus.Write(EasyNes::RST_VECTOR + 1, origin >> 8);
+}
+
+void CheckSameState(EasyNes::Core &interpreted, EasyNes::Core &compiled) {
+  CHECK(interpreted.cpu.GetRegisterPC() == compiled.cpu.GetRegisterPC());
+  CHECK(interpreted.cpu.GetRegisterA() == compiled.cpu.GetRegisterA());
+  CHECK(interpreted.cpu.GetRegisterX() == compiled.cpu.GetRegisterX());
+  CHECK(interpreted.cpu.GetRegisterY() == compiled.cpu.GetRegisterY());
+  CHECK(interpreted.cpu.GetRegisterSP() == compiled.cpu.GetRegisterSP());
+  CHECK(interpreted.cpu.GetRegisterStatus() == compiled.cpu.GetRegisterStatus());
+  CHECK(interpreted.cpu.GetElapsedCycles() == compiled.cpu.GetElapsedCycles());
+  CHECK(interpreted.cpu.GetElapsedInstructions() == compiled.cpu.GetElapsedInstructions());
+
+  for (int address = 0x0000; address <= 0xFFFF; address++) {
+    REQUIRE(interpreted.bus.Read(address) == compiled.bus.Read(address));
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Recompiled blocks match the interpreter", "[Recompiler]") {
+  if (!EasyNes::Recompiler::IsSupported()) {
+    return;
+  }
+
+  constexpr std::array<EasyNes::u8, 19> program{
+      0xA2, 0x00,        // X = 0x00
+      0xBD, 0x00, 0x03,  // A = ram[0x0300 + X]
+      0x49, 0x5A,        // A ^= 0x5A
+      0x9D, 0x00, 0x03,  // ram[0x0300 + X] = A
+      0xE6, 0x20,        // ram[0x20]++
+      0xE8,              // X++
+      0xD0, 0xF3,        // if X != 0 goto 0x8002
+      0x4C, 0x00, 0x80,  // goto 0x8000
+      0xEA,              // NOP
+  };
+
+  EasyNes::Core interpreted;
+  EasyNes::Core compiled;
+  compiled.cpu.EnableRecompiler(true, 2);
+
+  for (EasyNes::Core *core : {&interpreted, &compiled}) {
+    LoadProgram(*core, program, 0x8000);
+    core->cpu.RST();
+  }
+
+  SECTION("Instructions") { CHECK(interpreted.RunInstructions(10000) == compiled.RunInstructions(10000)); }
+  SECTION("Cycles") { CHECK(interpreted.RunCycles(20000) == compiled.RunCycles(20000)); }
+
+  CHECK(compiled.cpu.GetRecompiler()->GetBlockCount() > 0);
+  CheckSameState(interpreted, compiled);
+}
+
+TEST_CASE("Recompiled random programs", "[Recompiler]") {
+  if (!EasyNes::Recompiler::IsSupported()) {
+    return;
+  }
+
+  // Opcodes translated by the recompiler, the others are picked as well to end
+  // the blocks and jump around
+  constexpr std::array<EasyNes::u8, 48> supported{
+      0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA2, 0xA6, 0xB6, 0xAE, 0xBE, 0xA0, 0xA4, 0xB4, 0xAC, 0xBC,
+      0x85, 0x95, 0x8D, 0x9D, 0x99, 0x86, 0x96, 0x8E, 0x84, 0x94, 0x8C, 0x29, 0x0D, 0x5D, 0xE6, 0xCE,
+      0xE8, 0xC8, 0xCA, 0x88, 0xAA, 0xA8, 0x8A, 0x98, 0x18, 0x38, 0xB8, 0xEA, 0xD0, 0xF0, 0x10, 0x90,
+  };
+
+  struct Register {
+    int reads  = 0;
+    int writes = 0;
+  };
+
+  auto read = [](void *context, EasyNes::u16 address) -> EasyNes::u8 {
+    static_cast<Register *>(context)->reads++;
+    return address * 7;
+  };
+  auto write = [](void *context, EasyNes::u16, EasyNes::u8) { static_cast<Register *>(context)->writes++; };
+
+  for (unsigned seed = 0; seed < 16; seed++) {
+    std::mt19937 random(seed);
+
+    Register      registers[2];
+    EasyNes::Core interpreted;
+    EasyNes::Core compiled;
+    compiled.cpu.EnableRecompiler(true, 1);
+
+    std::array<EasyNes::u8, 0x10000> memory;
+    for (std::size_t address = 0; address < memory.size(); address++) {
+      memory[address] = random() % 4 ? supported[random() % supported.size()] : random();
+    }
+
+    int i = 0;
+    for (EasyNes::Core *core : {&interpreted, &compiled}) {
+      for (std::size_t address = 0; address < memory.size(); address++) {
+        core->bus.Write(address, memory[address]);
+      }
+
+      core->bus.MapHandlers(0x40, 0x40, &registers[i++], read, write);
+      core->bus.Write(EasyNes::RST_VECTOR, 0x00);
+      core->bus.Write(EasyNes::RST_VECTOR + 1, 0x80);
+      core->cpu.RST();
+    }
+
+    // Irregular budgets stop the blocks anywhere
+    for (int chunk = 0; chunk < 200; chunk++) {
+      EasyNes::u64 count = 1 + random() % 100;
+      REQUIRE(interpreted.RunInstructions(count) == compiled.RunInstructions(count));
+    }
+
+    CheckSameState(interpreted, compiled);
+    CHECK(registers[0].reads == registers[1].reads);
+    CHECK(registers[0].writes == registers[1].writes);
+  }
+}
+
+TEST_CASE("Recompiled self-modifying code", "[Recompiler]") {
+  if (!EasyNes::Recompiler::IsSupported()) {
+    return;
+  }
+
+  constexpr std::array<EasyNes::u8, 10> program{
+      0xA2, 0x01,        // X = 0x01
+      0x8A,              // A = X
+      0x0A,              // A <<= 1
+      0x8D, 0x01, 0x02,  // ram[0x0201] = A, overwrite the loaded value
+      0x4C, 0x00, 0x02,  // goto 0x0200
+  };
+
+  EasyNes::Core core;
+  core.cpu.EnableRecompiler(true, 1);
+  LoadProgram(core, program, 0x0200);
+  core.cpu.RST();
+
+  for (int i = 0; i <= 6; i++) {
+    core.RunInstructions(5);
+    CHECK(core.cpu.GetRegisterX() == (1 << i));
+  }
+
+  CHECK(core.cpu.GetRecompiler()->GetBlockCount() > 0);
+}
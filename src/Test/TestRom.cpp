@@ -0,0 +1,220 @@
+#include <Core.hpp>
+#include <Rom.hpp>
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// NROM-128 image, one bank of code starting with the program and the reset
+// vector pointing to it
+std::vector<EasyNes::u8> MakeImage(const std::vector<EasyNes::u8> &program) {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE + EasyNes::CHR_BANK_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 1;     // 16 KiB of code
+  image[5] = 1;     // 8 KiB of graphics
+  image[6] = 0x01;  // Vertical mirroring
+
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  std::copy(program.begin(), program.end(), prg);
+  prg[0x3FFC] = 0x00;
+  prg[0x3FFD] = 0x80;
+
+  // Marks the graphics to tell the banks apart
+  image[EasyNes::INES_HEADER_SIZE + EasyNes::PRG_BANK_SIZE] = 0xC3;
+  return image;
+}
+
+std::filesystem::path WriteImage(const std::vector<EasyNes::u8> &image, const char *name) {
+  std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+  std::ofstream         file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(image.data()), image.size());
+  return path;
+}
+
+}  // namespace
+
+TEST_CASE("Rom header", "[Rom]") {
+  std::vector<EasyNes::u8> image = MakeImage({});
+
+  SECTION("iNES") {
+    image[6] |= 0x42;  // Battery, mapper 4
+    image[7] = 0x10;   // Mapper 16 + 4
+
+    auto rom = EasyNes::Rom::Parse(image.data(), image.size());
+    REQUIRE(rom);
+
+    const EasyNes::RomInfo &info = rom->GetInfo();
+    CHECK(info.mapper == 0x14);
+    CHECK(info.mirroring == EasyNes::Mirroring::VERTICAL);
+    CHECK(info.battery);
+    CHECK_FALSE(info.nes2);
+    CHECK(info.prgSize == EasyNes::PRG_BANK_SIZE);
+    CHECK(info.chrSize == EasyNes::CHR_BANK_SIZE);
+    CHECK(info.chrRamSize == 0);
+    CHECK(rom->GetPrg()[0x3FFD] == 0x80);
+    CHECK(rom->GetChr()[0] == 0xC3);
+  }
+
+  SECTION("Dirty header") {
+    image[7] = 0x40;
+    std::copy_n("Dude", 4, image.begin() + 12);
+
+    auto rom = EasyNes::Rom::Parse(image.data(), image.size());
+    REQUIRE(rom);
+    CHECK(rom->GetInfo().mapper == 0);
+  }
+
+  SECTION("NES 2.0") {
+    image[7]  = 0x08;
+    image[8]  = 0x31;  // Submapper 3, mapper 256
+    image[10] = 0x07;  // 8 KiB of program ram
+
+    auto rom = EasyNes::Rom::Parse(image.data(), image.size());
+    REQUIRE(rom);
+    CHECK(rom->GetInfo().nes2);
+    CHECK(rom->GetInfo().mapper == 0x100);
+    CHECK(rom->GetInfo().submapper == 3);
+    CHECK(rom->GetInfo().prgRamSize == 8 * 1024);
+  }
+
+  SECTION("NES 2.0 exponent") {
+    image[7] = 0x08;
+    image[9] = 0x0F;
+    image[4] = 14 << 2;  // 2^14 * 1, the 16 KiB bank
+    auto rom = EasyNes::Rom::Parse(image.data(), image.size());
+    REQUIRE(rom);
+    CHECK(rom->GetInfo().prgSize == EasyNes::PRG_BANK_SIZE);
+
+    // Sizes past 32 bits
+    image[4] = 32 << 2;
+    CHECK_FALSE(EasyNes::Rom::Parse(image.data(), image.size()));
+    image[4] = (63 << 2) | 0x03;
+    CHECK_FALSE(EasyNes::Rom::Parse(image.data(), image.size()));
+    image[4] = (31 << 2) | 0x01;
+    CHECK_FALSE(EasyNes::Rom::Parse(image.data(), image.size()));
+  }
+
+  SECTION("Invalid") {
+    CHECK_FALSE(EasyNes::Rom::Parse(image.data(), image.size() - 1));
+
+    image[0] = 'M';
+    CHECK_FALSE(EasyNes::Rom::Parse(image.data(), image.size()));
+  }
+}
+
+TEST_CASE("Rom mapping", "[Rom][Core]") {
+  std::vector<EasyNes::u8> image = MakeImage({
+      0xA9, 0x2A,        // A = 0x2A
+      0x8D, 0x00, 0x03,  // ram[0x0300] = A
+      0x8D, 0x00, 0x80,  // rom[0x8000] = A
+      0x4C, 0x08, 0x80,  // goto 0x8008
+  });
+  std::filesystem::path path = WriteImage(image, "EasyNesTestRom.nes");
+
+  auto rom = EasyNes::Rom::Open(path.string());
+  REQUIRE(rom);
+  CHECK(EasyNes::Rom::Open(path.string()) == rom);
+
+  EasyNes::Core first, second;
+  REQUIRE(first.Insert(rom));
+  REQUIRE(second.Insert(rom));
+
+  // The cores read the image in place, the 16 KiB bank is mirrored
+  CHECK(first.bus.GetPageMemory(0x80) == rom->GetPrg());
+  CHECK(second.bus.GetPageMemory(0xC0) == rom->GetPrg());
+
+  first.cpu.RST();
+  first.RunInstructions(4);
+  CHECK(first.cpu.GetRegisterPC() == 0x8008);
+  CHECK(first.ram[0x0300] == 0x2A);
+  // Writes to the rom are lost
+  CHECK(first.bus.Read(0x8000) == 0xA9);
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Rom cache", "[Rom]") {
+  std::filesystem::path cachePath = std::filesystem::temp_directory_path() / "EasyNesTestRomCache.txt";
+  std::filesystem::remove(cachePath);
+
+  std::vector<EasyNes::u8> image = MakeImage({0xEA});
+  EasyNes::u64             hash;
+
+  {
+    EasyNes::RomCache cache(cachePath.string());
+    auto              rom = EasyNes::Rom::Parse(image.data(), image.size(), &cache);
+    REQUIRE(rom);
+
+    hash = rom->GetHash();
+    REQUIRE(cache.Find(hash));
+    CHECK(*cache.Find(hash) == rom->GetInfo());
+  }
+
+  // A fixed entry wins over the header
+  {
+    EasyNes::RomCache cache(cachePath.string());
+    EasyNes::RomInfo  info = *cache.Find(hash);
+    info.mirroring         = EasyNes::Mirroring::HORIZONTAL;
+    CHECK(cache.Store(hash, info));
+  }
+
+  {
+    EasyNes::RomCache cache(cachePath.string());
+    auto              rom = EasyNes::Rom::Parse(image.data(), image.size(), &cache);
+    REQUIRE(rom);
+    CHECK(rom->GetInfo().mirroring == EasyNes::Mirroring::HORIZONTAL);
+  }
+
+  // The hash ignores the header
+  image[6] = 0x00;
+  CHECK(EasyNes::Rom::Parse(image.data(), image.size())->GetHash() == hash);
+
+  std::filesystem::remove(cachePath);
+}
+
+TEST_CASE("Console memory", "[Rom][Core]") {
+  std::vector<EasyNes::u8> image = MakeImage({
+      0xA9, 0x2A,        // A = 0x2A
+      0x8D, 0x00, 0x08,  // ram[0x0800] = A, mirror of ram[0x0000]
+      0x8D, 0x00, 0x60,  // ram[0x6000] = A, on the cartridge
+      0x4C, 0x08, 0x80,  // goto 0x8008
+  });
+  auto rom = EasyNes::Rom::Parse(image.data(), image.size());
+  REQUIRE(rom);
+
+  // Only the work ram is owned by the core, the rom is shared. The tables of
+  // the bus take about half of it
+  STATIC_REQUIRE(sizeof(EasyNes::Core) <= 16 * 1024);
+  STATIC_REQUIRE(sizeof(EasyNes::Bus) <= 9 * 1024);
+
+  EasyNes::Core flat, console(EasyNes::CoreMemory::CONSOLE);
+  CHECK(flat.ram.GetSize() == EasyNes::RAM_SIZE);
+  CHECK(console.ram.GetSize() == EasyNes::WORK_RAM_SIZE);
+  CHECK(console.bus.Read(0x2000) == 0x20);
+
+  for (EasyNes::Core *core : {&flat, &console}) {
+    REQUIRE(core->Insert(rom));
+    core->cpu.RST();
+    core->RunInstructions(4);
+
+    CHECK(core->ram.GetSize() == EasyNes::WORK_RAM_SIZE);
+    CHECK(core->ram[0x0000] == 0x2A);
+    CHECK(core->bus.Read(0x1800) == 0x2A);
+    CHECK(core->bus.Read(0x6000) == 0x2A);
+    // Nothing answers between the registers and the cartridge ram
+    CHECK(core->bus.Read(0x5000) == 0x50);
+  }
+
+  // The states hold the ram of the cartridge
+  std::vector<EasyNes::u8> state = console.SaveState();
+  console.bus.Write(0x6000, 0x00);
+  REQUIRE(console.LoadState(state));
+  CHECK(console.bus.Read(0x6000) == 0x2A);
+
+  // But do not load into a core with another memory
+  EasyNes::Core bare;
+  CHECK_FALSE(bare.LoadState(state));
+}
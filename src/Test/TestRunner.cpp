@@ -0,0 +1,128 @@
+#include <Runner.hpp>
+#include <catch2/catch.hpp>
+#include <stdexcept>
+
+namespace {
+
+// Sum the input byte at 0x0010 into 0x0020 forever
+constexpr std::array<EasyNes::u8, 11> program{
+    0x18,              // C = 0
+    0xA5, 0x10,        // A = ram[0x10]
+    0x65, 0x20,        // A += ram[0x20]
+    0x85, 0x20,        // ram[0x20] = A
+    0x4C, 0x00, 0x80,  // goto 0x8000
+    0xEA,              // NOP
+};
+
+std::unique_ptr<EasyNes::Core> MakeCore(EasyNes::u8 input) {
+  auto core = std::make_unique<EasyNes::Core>();
+
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core->ram[0x8000 + i] = program[i];
+  }
+
+  core->ram[0x10]                    = input;
+  core->ram[EasyNes::RST_VECTOR]     = 0x00;
+  core->ram[EasyNes::RST_VECTOR + 1] = 0x80;
+  core->cpu.RST();
+  return core;
+}
+
+}  // namespace
+
+TEST_CASE("Same results as a sequential run", "[Runner]") {
+  EasyNes::Runner runner(4);
+  REQUIRE(runner.GetThreadCount() == 4);
+
+  std::vector<std::unique_ptr<EasyNes::Core>> cores;
+  for (int i = 0; i < 64; i++) {
+    cores.push_back(MakeCore(i));
+  }
+
+  // Uneven budgets keep the workers stealing
+  std::vector<EasyNes::RunJob> jobs(cores.size());
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    jobs[i].core   = std::move(cores[i]);
+    jobs[i].cycles = 1000 + 5000 * (i % 7);
+  }
+
+  std::vector<EasyNes::RunResult> results = runner.Run(std::move(jobs));
+  REQUIRE(results.size() == 64);
+
+  for (std::size_t i = 0; i < results.size(); i++) {
+    auto        expected = MakeCore(i);
+    EasyNes::u64 cycles   = expected->RunCycles(1000 + 5000 * (i % 7));
+
+    REQUIRE(results[i].core);
+    CHECK(results[i].cycles == cycles);
+    CHECK(results[i].instructions == expected->cpu.GetElapsedInstructions());
+    CHECK(results[i].core->ram[0x20] == expected->ram[0x20]);
+  }
+}
+
+TEST_CASE("Scripted jobs", "[Runner]") {
+  EasyNes::Runner runner;
+
+  std::vector<EasyNes::RunJob> jobs(100);
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    jobs[i].factory = [] { return MakeCore(0); };
+    // Press the input on the first slices then stop after i slices
+    jobs[i].script = [i](EasyNes::Core &core, EasyNes::u64 slice) {
+      core.ram[0x10] = slice < 2 ? 1 : 0;
+      return slice < i;
+    };
+    jobs[i].sliceCycles = 100;
+  }
+
+  std::vector<EasyNes::RunResult> results = runner.Run(std::move(jobs));
+
+  for (std::size_t i = 0; i < results.size(); i++) {
+    CHECK(results[i].cycles >= 100 * i);
+    CHECK(results[i].cycles <= 107 * i);
+    // Nothing was added before the first slice
+    if (i > 0) {
+      CHECK(results[i].core->ram[0x20] > 0);
+    }
+  }
+
+  // The pool runs several batches
+  CHECK(runner.Run(std::vector<EasyNes::RunJob>{}).empty());
+  CHECK(runner.Run({}, 1000).empty());
+}
+
+TEST_CASE("Jobs that cannot end", "[Runner]") {
+  EasyNes::Runner runner(2);
+
+  std::vector<EasyNes::RunJob> jobs(5);
+  jobs[0].core        = MakeCore(0);
+  jobs[1].core        = MakeCore(0);
+  jobs[1].cycles      = 1000;
+  jobs[1].sliceCycles = 0;
+  jobs[2].factory     = []() -> std::unique_ptr<EasyNes::Core> { throw std::runtime_error("no rom"); };
+  jobs[2].cycles      = 1000;
+  jobs[3].factory     = [] { return std::unique_ptr<EasyNes::Core>(); };
+  jobs[3].cycles      = 1000;
+
+  // A fetch trap stopping every instruction, the slices run no cycle
+  jobs[4].core   = MakeCore(0);
+  jobs[4].cycles = 1000;
+  EasyNes::u8 slot = jobs[4].core->bus.AddTrap(nullptr, nullptr, nullptr, [](void *, EasyNes::u16) { return true; });
+  jobs[4].core->bus.TrapFetches(slot, 0x80);
+
+  std::vector<EasyNes::RunResult> results = runner.Run(std::move(jobs));
+
+  // The cores of the jobs are given back
+  CHECK(results[0].status == EasyNes::RunStatus::UNBOUNDED);
+  CHECK(results[0].core);
+  CHECK(results[1].status == EasyNes::RunStatus::UNBOUNDED);
+  CHECK(results[1].cycles == 0);
+
+  CHECK(results[2].status == EasyNes::RunStatus::FAILED);
+  REQUIRE(results[2].error);
+  CHECK_THROWS_AS(std::rethrow_exception(results[2].error), std::runtime_error);
+  CHECK(results[3].status == EasyNes::RunStatus::FAILED);
+  CHECK_FALSE(results[3].error);
+
+  CHECK(results[4].status == EasyNes::RunStatus::STALLED);
+  CHECK(results[4].cycles == 0);
+}
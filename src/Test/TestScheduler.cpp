@@ -0,0 +1,155 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <vector>
+
+namespace {
+
+// Program with rendering on, summing the status reads, writing the sprites and
+// the scroll all the time. The nmi copies the sprites with the dma and
+// switches a graphics bank, the scanline counter of the MMC3 interrupts every
+// 8 scanlines to write the scroll again. The writes to the mapper are lost on
+// NROM, the ppu then only has the vertical blank as an event
+const std::vector<EasyNes::u8> PROGRAM = {
+    0xA9, 0x3F,        // $C000 a = 0x3F
+    0x8D, 0x06, 0x20,  // $C002 [0x2006] = a
+    0xA9, 0x00,        // $C005 a = 0x00
+    0x8D, 0x06, 0x20,  // $C007 [0x2006] = a
+    0xA2, 0x00,        // $C00A x = 0
+    0x8E, 0x07, 0x20,  // $C00C [0x2007] = x, the palette
+    0xE8,              // $C00F x++
+    0xE0, 0x20,        // $C010 compare x with 0x20
+    0xD0, 0xF8,        // $C012 goto 0xC00C if not equal
+    0xA9, 0x80,        // $C014 a = 0x80
+    0x8D, 0x00, 0x20,  // $C016 [0x2000] = a, nmi on
+    0xA9, 0x1E,        // $C019 a = 0x1E
+    0x8D, 0x01, 0x20,  // $C01B [0x2001] = a, rendering on
+    0xA9, 0x07,        // $C01E a = 0x07
+    0x8D, 0x00, 0xC0,  // $C020 [0xC000] = a, counter latch
+    0x8D, 0x01, 0xC0,  // $C023 [0xC001] = a, counter reload
+    0x8D, 0x01, 0xE0,  // $C026 [0xE001] = a, interrupt on
+    0x58,              // $C029 clear the interrupt disable
+    0xAD, 0x02, 0x20,  // $C02A a = [0x2002]
+    0x65, 0x11,        // $C02D a += [0x11]
+    0x85, 0x11,        // $C02F [0x11] = a, the sum of the status reads
+    0xE8,              // $C031 x++
+    0x8E, 0x04, 0x20,  // $C032 [0x2004] = x
+    0x8E, 0x05, 0x20,  // $C035 [0x2005] = x
+    0x4C, 0x2A, 0xC0,  // $C038 goto 0xC02A
+    0xE6, 0x10,        // $C03B nmi: [0x10]++
+    0xA9, 0x02,        // $C03D a = 0x02
+    0x8D, 0x14, 0x40,  // $C03F [0x4014] = a, sprite dma
+    0xA9, 0x00,        // $C042 a = 0x00
+    0x8D, 0x00, 0x80,  // $C044 [0x8000] = a, select the first graphics bank
+    0xA5, 0x10,        // $C047 a = [0x10]
+    0x8D, 0x01, 0x80,  // $C049 [0x8001] = a
+    0x40,              // $C04C return from the interrupt
+    0x8D, 0x00, 0xE0,  // $C04D irq: [0xE000] = a, acknowledge
+    0x8D, 0x01, 0xE0,  // $C050 [0xE001] = a, interrupt on
+    0xC8,              // $C053 y++
+    0x8C, 0x05, 0x20,  // $C054 [0x2005] = y
+    0x40,              // $C057 return from the interrupt
+};
+
+std::shared_ptr<const EasyNes::Rom> MakeRom(EasyNes::u8 mapper) {
+  std::vector<EasyNes::u8> image(EasyNes::INES_HEADER_SIZE + 2 * EasyNes::PRG_BANK_SIZE + EasyNes::CHR_BANK_SIZE);
+
+  image[0] = 'N', image[1] = 'E', image[2] = 'S', image[3] = 0x1A;
+  image[4] = 2;
+  image[5] = 1;
+  image[6] = mapper << 4;
+
+  // The last 16 KiB are fixed at $C000
+  EasyNes::u8 *prg = image.data() + EasyNes::INES_HEADER_SIZE;
+  std::copy(PROGRAM.begin(), PROGRAM.end(), prg + 0x4000);
+
+  const EasyNes::u16 vectors[] = {0xC03B, 0xC000, 0xC04D};
+  for (int i = 0; i < 3; i++) {
+    prg[0x7FFA + i * 2]     = vectors[i] & 0xFF;
+    prg[0x7FFA + i * 2 + 1] = vectors[i] >> 8;
+  }
+
+  EasyNes::u8 *chr = prg + 2 * EasyNes::PRG_BANK_SIZE;
+  for (EasyNes::u32 i = 0; i < EasyNes::CHR_BANK_SIZE; i++) {
+    chr[i] = i * 7 ^ i >> 3;
+  }
+
+  return EasyNes::Rom::Parse(image.data(), image.size());
+}
+
+// The reference core runs every component after every cycle
+struct Instances {
+  EasyNes::Core             catchUp, lockstep;
+  std::vector<EasyNes::u32> first, second;
+
+  Instances(EasyNes::u8 mapper, bool recompiler)
+      : first(EasyNes::FRAMEBUFFER_SIZE), second(EasyNes::FRAMEBUFFER_SIZE) {
+    std::shared_ptr<const EasyNes::Rom> rom = MakeRom(mapper);
+    REQUIRE(catchUp.Insert(rom));
+    REQUIRE(lockstep.Insert(rom));
+
+    catchUp.ppu.SetFramebuffer(first.data());
+    lockstep.ppu.SetFramebuffer(second.data());
+    lockstep.scheduler.SetMode(EasyNes::SchedulerMode::LOCKSTEP);
+    catchUp.cpu.EnableRecompiler(recompiler, 2);
+
+    catchUp.cpu.RST();
+    lockstep.cpu.RST();
+  }
+
+  void Compare() {
+    // The ppu of the catch up core is brought to the cpu to compare the states
+    catchUp.scheduler.CatchUp();
+    REQUIRE(catchUp.scheduler.GetCycle() == lockstep.scheduler.GetCycle());
+    REQUIRE(catchUp.SaveState() == lockstep.SaveState());
+  }
+};
+
+void CompareFrames(Instances &instances) {
+  for (int i = 0; i < 20; i++) {
+    REQUIRE(instances.catchUp.RunFrame() == instances.lockstep.RunFrame());
+    REQUIRE(instances.first == instances.second);
+    instances.Compare();
+  }
+
+  // The last nmi is still pending
+  CHECK(instances.catchUp.ram[0x10] == 19);
+}
+
+void CompareBudgets(Instances &instances) {
+  // Budgets ending anywhere, in the middle of the interrupts and the dma
+  EasyNes::u64 budget = 1;
+  for (int i = 0; i < 2000; i++) {
+    budget = (budget * 37 + 11) % 301;
+    REQUIRE(instances.catchUp.RunCycles(budget) == instances.lockstep.RunCycles(budget));
+    REQUIRE(instances.catchUp.RunInstructions(i % 5) == instances.lockstep.RunInstructions(i % 5));
+    // Up to the nmi handler
+    REQUIRE(instances.catchUp.RunUntil(0xC03B, budget) == instances.lockstep.RunUntil(0xC03B, budget));
+    instances.Compare();
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Catch up timing matches the lockstep", "[Scheduler]") {
+  SECTION("NROM") {
+    Instances instances(0, false);
+    CompareFrames(instances);
+    CompareBudgets(instances);
+  }
+
+  SECTION("MMC3") {
+    Instances instances(4, false);
+    CompareFrames(instances);
+    CompareBudgets(instances);
+    CHECK(instances.catchUp.cpu.GetRegisterY() > 20);
+  }
+}
+
+TEST_CASE("Recompiled catch up timing matches the lockstep", "[Scheduler][Recompiler]") {
+  if (!EasyNes::Recompiler::IsSupported()) {
+    return;
+  }
+
+  Instances instances(4, true);
+  CompareFrames(instances);
+}
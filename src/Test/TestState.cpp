@@ -0,0 +1,155 @@
+#include <Core.hpp>
+#include <Rewind.hpp>
+#include <catch2/catch.hpp>
+
+namespace {
+
+// Increment every byte of a page, then move on to the next page
+constexpr std::array<EasyNes::u8, 15> program{
+    0xA2, 0x00,        // X = 0x00
+    0xFE, 0x00, 0x03,  // ram[0x0300 + X]++
+    0xE8,              // X++
+    0xD0, 0xFA,        // if X != 0 goto 0x8002
+    0xEE, 0x04, 0x80,  // ram[0x8004]++, move to the next page
+    0x4C, 0x00, 0x80,  // goto 0x8000
+};
+
+void LoadProgram(EasyNes::Core &core) {
+  for (std::size_t i = 0; i < program.size(); i++) {
+    core.ram[0x8000 + i] = program[i];
+  }
+
+  core.ram[EasyNes::RST_VECTOR]     = 0x00;
+  core.ram[EasyNes::RST_VECTOR + 1] = 0x80;
+  core.cpu.RST();
+}
+
+}  // namespace
+
+TEST_CASE("Save states", "[State]") {
+  EasyNes::Core core;
+  LoadProgram(core);
+  core.RunInstructions(1000);
+
+  std::vector<EasyNes::u8> state = core.SaveState();
+  EasyNes::u64             cycles = core.RunInstructions(1000);
+  std::vector<EasyNes::u8> after  = core.SaveState();
+
+  SECTION("Load") {
+    EasyNes::Core loaded;
+    REQUIRE(loaded.LoadState(state));
+    CHECK(loaded.SaveState() == state);
+
+    CHECK(loaded.RunInstructions(1000) == cycles);
+    CHECK(loaded.SaveState() == after);
+  }
+
+  SECTION("Invalid state") {
+    std::vector<EasyNes::u8> truncated(state.begin(), state.end() - 1);
+    CHECK_FALSE(core.LoadState(truncated));
+
+    // The version follows the magic
+    std::vector<EasyNes::u8> newer = state;
+    newer[4]++;
+    CHECK_FALSE(core.LoadState(newer));
+
+    CHECK(core.SaveState() == after);
+  }
+
+  SECTION("Controllers") {
+    // Halfway through the buttons of the first port
+    core.controllers.SetButtons(0, EasyNes::BUTTON_A | EasyNes::BUTTON_START | EasyNes::BUTTON_RIGHT);
+    core.controllers.Write(1);
+    core.controllers.Write(0);
+    for (int i = 0; i < 3; i++) {
+      core.controllers.Read(0);
+    }
+    std::vector<EasyNes::u8> pressed = core.SaveState();
+
+    EasyNes::Core loaded;
+    REQUIRE(loaded.LoadState(pressed));
+    std::vector<EasyNes::u8> buttons;
+    for (int i = 0; i < 5; i++) {
+      buttons.push_back(loaded.controllers.Read(0) & 1);
+    }
+    CHECK(buttons == std::vector<EasyNes::u8>{1, 0, 0, 0, 1});
+  }
+}
+
+TEST_CASE("Rewind", "[State]") {
+  EasyNes::Core   core;
+  EasyNes::Rewind rewind(&core);
+  LoadProgram(core);
+
+  std::vector<std::vector<EasyNes::u8>> frames;
+
+  for (int frame = 0; frame < 10; frame++) {
+    rewind.Snapshot();
+    frames.push_back(core.SaveState());
+    core.RunInstructions(500);
+  }
+
+  SECTION("Last snapshot") {
+    REQUIRE(rewind.Restore(1));
+    CHECK(core.SaveState() == frames[9]);
+    CHECK(rewind.GetSnapshotCount() == 10);
+  }
+
+  SECTION("Several snapshots back") {
+    REQUIRE(rewind.Restore(4));
+    CHECK(core.SaveState() == frames[6]);
+    CHECK(rewind.GetSnapshotCount() == 7);
+
+    // Resume and rewind again
+    core.RunInstructions(700);
+    REQUIRE(rewind.Restore(2));
+    CHECK(core.SaveState() == frames[5]);
+  }
+
+  SECTION("Too far") {
+    CHECK_FALSE(rewind.Restore(11));
+    CHECK_FALSE(rewind.Restore(0));
+  }
+
+  SECTION("Recompiled writes") {
+    core.cpu.EnableRecompiler(true, 1);
+    rewind.Snapshot();
+    std::vector<EasyNes::u8> state = core.SaveState();
+
+    core.RunInstructions(5000);
+    REQUIRE(rewind.Restore(1));
+    CHECK(core.SaveState() == state);
+  }
+
+  SECTION("Memories of the ppu") {
+    rewind.Snapshot();
+    std::vector<EasyNes::u8> state = core.SaveState();
+    std::size_t              usage = rewind.GetMemoryUsage();
+
+    core.ppu.WriteMemory(0x2400, 1);
+    core.ppu.WriteMemory(0x3F01, 2);
+    core.ppu.WriteRegister(0x2004, 3);
+    // A page each for the vram, the sprites and the palette
+    CHECK(rewind.GetMemoryUsage() - usage < 4 * EasyNes::PAGE_SIZE);
+
+    REQUIRE(rewind.Restore(1));
+    CHECK(core.SaveState() == state);
+  }
+}
+
+TEST_CASE("Rewind memory budget", "[State]") {
+  EasyNes::Core core;
+  // Room for a few frames of 2 pages
+  EasyNes::Rewind rewind(&core, 4096);
+  LoadProgram(core);
+
+  for (int frame = 0; frame < 100; frame++) {
+    rewind.Snapshot();
+    core.RunInstructions(200);
+    CHECK(rewind.GetMemoryUsage() <= 4096);
+  }
+
+  CHECK(rewind.GetSnapshotCount() > 1);
+  CHECK(rewind.GetSnapshotCount() < 100);
+  CHECK(rewind.Restore(rewind.GetSnapshotCount()));
+}
@@ -0,0 +1,112 @@
+#include <Core.hpp>
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// Starts like nestest with a jump to 0xC5F5, then copies a table through a
+// pointer with a subroutine counting the bytes
+const std::vector<EasyNes::u8> ENTRY = {
+    0x4C, 0xF5, 0xC5,  // $C000 goto 0xC5F5
+};
+
+const std::vector<EasyNes::u8> PROGRAM = {
+    0xA9, 0x10,        // $C5F5 a = 0x10
+    0x85, 0x20,        // $C5F7 [0x20] = a
+    0x4A,              // $C5F9 a >>= 1
+    0xA0, 0x00,        // $C5FA y = 0
+    0xB1, 0x20,        // $C5FC a = [[0x20] + y]
+    0x9D, 0x00, 0x03,  // $C5FE [0x0300 + x] = a
+    0xE8,              // $C601 x++
+    0x20, 0x0A, 0xC6,  // $C602 call 0xC60A
+    0xD0, 0xF5,        // $C605 goto 0xC5FC if not zero
+    0x4C, 0xF5, 0xC5,  // $C607 goto 0xC5F5
+    0xC8,              // $C60A y++
+    0x60,              // $C60B return
+};
+
+void Load(EasyNes::Core &core) {
+  std::copy(ENTRY.begin(), ENTRY.end(), &core.ram[0xC000]);
+  std::copy(PROGRAM.begin(), PROGRAM.end(), &core.ram[0xC5F5]);
+  core.ram[EasyNes::RST_VECTOR]     = 0x00;
+  core.ram[EasyNes::RST_VECTOR + 1] = 0xC0;
+  core.cpu.RST();
+}
+
+std::string TracePath() { return (std::filesystem::temp_directory_path() / "easynes_test.trace").string(); }
+
+}  // namespace
+
+TEST_CASE("Traces record every instruction", "[Trace]") {
+  EasyNes::Core traced, reference;
+  Load(traced);
+  Load(reference);
+
+  // Both are bypassed while tracing
+  traced.cpu.EnableRecompiler(true, 2);
+  traced.cpu.EnableIdleLoopSkip(true);
+
+  // Enough instructions to go around the ring many times
+  REQUIRE(traced.cpu.StartTrace(TracePath()));
+  REQUIRE(traced.cpu.IsTracing());
+  traced.RunCycles(2000000);
+  traced.cpu.StopTrace();
+
+  std::ifstream        file(TracePath(), std::ios::binary);
+  EasyNes::TraceReader reader(file);
+  REQUIRE(reader.IsValid());
+
+  EasyNes::TraceRecord record;
+  EasyNes::u64         cycle;
+
+  while (reader.Next(record, cycle)) {
+    EasyNes::CPUState state = reference.cpu.GetState();
+
+    REQUIRE(record.pc == state.pc);
+    REQUIRE(record.a == state.a);
+    REQUIRE(record.x == state.x);
+    REQUIRE(record.y == state.y);
+    REQUIRE(record.sp == state.sp);
+    REQUIRE(record.status == state.status);
+    REQUIRE(record.bytes[0] == reference.ram[state.pc]);
+    // The cycles waited after the reset come first
+    REQUIRE(cycle == state.elapsedCycles + state.waitingCycles);
+
+    reference.cpu.Execute();
+  }
+
+  CHECK(reference.cpu.GetElapsedInstructions() == traced.cpu.GetElapsedInstructions());
+  CHECK(reference.cpu.GetElapsedInstructions() > 4 * EasyNes::TRACE_RING_SIZE);
+}
+
+TEST_CASE("Traces convert to the nestest log", "[Trace]") {
+  EasyNes::Core core;
+  Load(core);
+
+  REQUIRE(core.cpu.StartTrace(TracePath()));
+  core.RunInstructions(9);
+  core.cpu.StopTrace();
+
+  std::ifstream      file(TracePath(), std::ios::binary);
+  std::ostringstream log;
+  REQUIRE(EasyNes::WriteNestestLog(file, log));
+
+  // clang-format off
+  CHECK(log.str() ==
+      "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 24 CYC:8\n"
+      "C5F5  A9 10     LDA #$10                        A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 33 CYC:11\n"
+      "C5F7  85 20     STA $20                         A:10 X:00 Y:00 P:24 SP:FD PPU:  0, 39 CYC:13\n"
+      "C5F9  4A        LSR A                           A:10 X:00 Y:00 P:24 SP:FD PPU:  0, 48 CYC:16\n"
+      "C5FA  A0 00     LDY #$00                        A:08 X:00 Y:00 P:24 SP:FD PPU:  0, 54 CYC:18\n"
+      "C5FC  B1 20     LDA ($20),Y                     A:08 X:00 Y:00 P:26 SP:FD PPU:  0, 60 CYC:20\n"
+      "C5FE  9D 00 03  STA $0300,X                     A:00 X:00 Y:00 P:26 SP:FD PPU:  0, 75 CYC:25\n"
+      "C601  E8        INX                             A:00 X:00 Y:00 P:26 SP:FD PPU:  0, 90 CYC:30\n"
+      "C602  20 0A C6  JSR $C60A                       A:00 X:01 Y:00 P:24 SP:FD PPU:  0, 96 CYC:32\n");
+  // clang-format on
+
+  std::istringstream text("C000  4C F5 C5  JMP $C5F5");
+  CHECK(!EasyNes::WriteNestestLog(text, log));
+}